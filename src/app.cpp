@@ -1,7 +1,10 @@
 #include "app.hpp"
 #include "util/time.hpp"
 #include "header.hpp"
+#include "net/transport.hpp"
+#include "util/task_pool.hpp"
 #include <vector>
+#include <algorithm>
 
 using namespace std;
 
@@ -21,31 +24,71 @@ namespace linkchat
         return cfg;
     }
 
-    LinkchatApp::LinkchatApp(SenderConfig cfg) noexcept
+    LinkchatApp::LinkchatApp(SenderConfig cfg, McastConfig mcfg, DeliveryConfig dcfg)
         : cfg_(move(correctness_check(cfg))),
-          sender_([this](const vector<uint8_t> &pdu)
-                  { if(emit_pdu_) emit_pdu_(pdu); }, cfg_),
+          mcfg_(mcfg),
+          sender_([this](const FrameRef &pdu, FrameNote note)
+                  { capture_tx(unicast_peer_, pdu, note); if(emit_pdu_) emit_pdu_(pdu); }, cfg_),
+          mcast_tx_([this](const FrameRef &pdu, FrameNote note)
+                    { capture_tx(mcfg_.group, pdu, note); if(emit_group_) emit_group_(pdu); }, cfg_, mcfg_),
           rx_([this](const AckFields &ack)
               {
-            auto pdu = create_ack(ack);
-            if(!pdu.empty() && emit_pdu_) emit_pdu_(pdu); }),
+            if(is_mcast_id(ack.msg_id)) return; // multicast receivers NAK instead
+            AckFields out = ack;
+            if(ack_rwnd_)
+            {
+                out.rwnd = static_cast<uint32_t>(min<size_t>(delivery_.room(), kNoRwnd - 1));
+                window_low_ = out.rwnd < delivery_.capacity() / 2;
+                window_update_ = out;
+            }
+            auto pdu = create_ack(out);
+            if(pdu.empty()) return;
+            capture_tx(unicast_peer_, pdu);
+            acks_sent_.fetch_add(1, memory_order_relaxed);
+            if(emit_pdu_) emit_pdu_(pdu); }),
+          naks_(mcfg_, cfg_.now),
           emit_pdu_{},
-          on_deliver_{}
+          emit_group_{},
+          on_deliver_{},
+          delivery_(dcfg, on_deliver_, &latency_, &stream_delivery_)
     {
+        sender_.set_on_latency([this](LatencyMetric m, Type type, uint64_t us)
+                               { latency_.record(m, type, unicast_peer_, us); });
+        // a multicast group has no one sender to tell, and an older peer would not read it
+        rx_.set_on_reject([this](const RejectFields &reject)
+                          {
+            if (is_mcast_id(reject.msg_id) || !peers_ || (peers_->caps_of(rx_src_) & kCapReject) == 0)
+                return false;
+            auto pdu = create_reject(reject);
+            if (pdu.empty())
+                return false;
+            capture_tx(unicast_peer_, pdu);
+            emit_pdu_(pdu);
+            return true; });
         if (!emit_pdu_)
-            emit_pdu_ = [](const vector<uint8_t> &) {};
+            emit_pdu_ = [](const FrameRef &) {};
+        if (!emit_group_)
+            emit_group_ = [](const FrameRef &) {};
         if (!on_deliver_)
             on_deliver_ = [](uint32_t, Type, const vector<uint8_t> &, const Mac &) {};
     }
 
-    void LinkchatApp::set_emit_pdu(function<void(const vector<uint8_t> &)> fn) noexcept
+    void LinkchatApp::set_emit_pdu(EmitTxFn fn) noexcept
     {
         if (fn == nullptr)
-            emit_pdu_ = [](const vector<uint8_t> &) {};
+            emit_pdu_ = [](const FrameRef &) {};
         else
             emit_pdu_ = move(fn);
     }
 
+    void LinkchatApp::set_emit_group_pdu(EmitTxFn fn) noexcept
+    {
+        if (fn == nullptr)
+            emit_group_ = [](const FrameRef &) {};
+        else
+            emit_group_ = move(fn);
+    }
+
     void LinkchatApp::set_on_deliver(DeliverMsgFn fn) noexcept
     {
         if (fn == nullptr)
@@ -54,37 +97,362 @@ namespace linkchat
             on_deliver_ = move(fn);
     }
 
+    // rx_'s callbacks only note what happened; hand_over_stream queues it outside the lock
+    void LinkchatApp::set_stream(StreamPickFn pick, DeliverDataFn on_data, DeliverDoneFn on_complete) noexcept
+    {
+        StreamCallbacks cb;
+        if (pick && on_data)
+        {
+            cb.want = [this, pick = move(pick)](uint32_t msg_id, Type type, uint32_t total, uint64_t)
+            {
+                if (type == Type::HELLO || !pick(msg_id, type, total, rx_src_))
+                    return false;
+                streams_[msg_id] = rx_src_;
+                return true;
+            };
+            cb.on_data = [this](uint32_t msg_id, uint64_t offset, const FrameRef &frame, span<const uint8_t> data)
+            { stream_out_.push_back(StreamEvent{msg_id, offset, frame, data, false, true, streams_[msg_id]}); };
+            cb.on_complete = [this](uint32_t msg_id, uint64_t bytes, bool ok)
+            {
+                stream_out_.push_back(StreamEvent{msg_id, bytes, {}, {}, true, ok, streams_[msg_id]});
+                streams_.erase(msg_id);
+            };
+        }
+        rx_.set_stream(move(cb));
+        stream_delivery_.on_data = move(on_data);
+        stream_delivery_.on_complete = move(on_complete);
+    }
+
+    void LinkchatApp::hand_over_stream(unique_lock<mutex> &rx_lock) noexcept
+    {
+        if (stream_out_.empty())
+        {
+            rx_lock.unlock();
+            return;
+        }
+        lock_guard<mutex> order(stream_mu_);
+        swap(stream_out_, stream_spare_);
+        rx_lock.unlock();
+        for (StreamEvent &e : stream_spare_)
+        {
+            if (e.done)
+                delivery_.push_done(e.msg_id, e.offset, e.ok, e.src);
+            else
+                delivery_.push_data(e.msg_id, e.offset, move(e.frame), e.piece, e.src);
+        }
+        stream_spare_.clear();
+    }
+
+    void LinkchatApp::flush_deliveries()
+    {
+        delivery_.flush();
+    }
+
     void LinkchatApp::on_rx_pdu(const Mac &src_mac, const uint8_t *pdu, size_t pdu_size) noexcept
     {
-        if (pdu == nullptr || pdu_size < kHeaderSize + kCrcSize)
+        rx_pdu(src_mac, PduView::parse(pdu, pdu_size), FrameStamp{});
+    }
+
+    static constexpr size_t kParallelCrcMin = 8; // smaller batches cost more to hand out than to check
+
+    void LinkchatApp::on_rx_batch(const RxFrame *frames, size_t n) noexcept
+    {
+        TaskPool &pool = shared_pool();
+        if (frames == nullptr || n < kParallelCrcMin || pool.workers() == 0)
+        {
+            for (size_t i = 0; i < n; i++)
+                rx_pdu(frames[i].src, PduView::parse(frames[i].pdu, frames[i].len), frames[i].stamp);
             return;
+        }
+
+        // frames still go through rx_pdu one by one and in order; only parsing and checksums run
+        // ahead, and their views carry the result along. A longer batch goes kRxBatchMax at a time
+        PduView views[kRxBatchMax];
+        for (size_t from = 0; from < n; from += kRxBatchMax)
+        {
+            const RxFrame *slice = frames + from;
+            const size_t m = min(n - from, kRxBatchMax);
+            pool.parallel_for(m, (m + pool.workers()) / (pool.workers() + 1), [&](size_t begin, size_t end)
+                              {
+                                  for (size_t i = begin; i < end; i++)
+                                  {
+                                      views[i] = PduView::parse(slice[i].pdu, slice[i].len);
+                                      if (views[i] && !crc_trusted(views[i]))
+                                          views[i].crc_ok();
+                                  } });
+            for (size_t i = 0; i < m; i++)
+                rx_pdu(slice[i].src, views[i], slice[i].stamp);
+        }
+    }
 
-        Header h{};
-        if (!parse_header(pdu, pdu_size, h))
+    // digest frames to an FCS-trusting end: the link already checked them and the digest covers
+    // the rest, so their CRC field may be zero. ACKs and REJECTs echo the id but always carry a CRC
+    bool LinkchatApp::crc_trusted(const PduView &pdu) const noexcept
+    {
+        return trust_fcs_ && has_digest(pdu.msg_id()) && pdu.type() != Type::ACK && pdu.type() != Type::REJECT;
+    }
+
+    enum RxStage : size_t
+    {
+        kStageParse,
+        kStageCrc,
+        kStageReassembly,
+        kStageDelivery,
+    };
+
+    // charges the time since the last stage change to the stage being left; the frame's
+    // remaining time goes to whatever stage it returned from
+    class StageClock
+    {
+    public:
+        StageClock(bool on, atomic<uint64_t> *ns, atomic<uint64_t> &frames) noexcept
+            : ns_(on ? ns : nullptr), frames_(frames), mark_(on ? steady_nanos() : 0) {}
+        ~StageClock()
+        {
+            if (!ns_)
+                return;
+            ns_[stage_].fetch_add(steady_nanos() - mark_, memory_order_relaxed);
+            frames_.fetch_add(1, memory_order_relaxed);
+        }
+        bool on() const noexcept { return ns_ != nullptr; }
+        void enter(RxStage stage) noexcept
+        {
+            if (!ns_)
+                return;
+            const uint64_t now = steady_nanos();
+            ns_[stage_].fetch_add(now - mark_, memory_order_relaxed);
+            mark_ = now;
+            stage_ = stage;
+        }
+
+    private:
+        atomic<uint64_t> *ns_;
+        atomic<uint64_t> &frames_;
+        uint64_t mark_;
+        RxStage stage_{kStageParse};
+    };
+
+    void LinkchatApp::rx_pdu(const Mac &src_mac, PduView pdu, const FrameStamp &stamp) noexcept
+    {
+        StageClock clock(profile_rx_, rx_stage_ns_, rx_stage_frames_);
+        if (!pdu)
+            return;
+
+        if (pdu.truncated())
+        {
+            capture_rx(src_mac, pdu.data(), pdu.frame_len(), FrameNote::Rejected);
+            return;
+        }
+
+        const Type type = pdu.type();
+        if (type == Type::HELLO && pdu.msg_id() == kHelloMsgId)
+        {
+            capture_rx(src_mac, pdu.data(), pdu.size());
+            if (peers_ && pdu.crc_ok())
+                peers_->on_hello(src_mac, pdu.payload(), pdu.payload_len());
             return;
+        }
 
-        const size_t want = kHeaderSize + static_cast<size_t>(h.payload_len) + kCrcSize;
-        if (pdu_size < want)
+        if (type == Type::ECHO)
+        {
+            EchoFields echo{};
+            const bool ok = try_parse_echo(pdu, echo);
+            capture_rx(src_mac, pdu.data(), pdu.size(), ok ? FrameNote::None : FrameNote::Rejected);
+            if (ok)
+                on_echo(src_mac, echo, stamp);
             return;
+        }
 
         AckFields ack{};
-        if (try_parse_ack(const_cast<uint8_t *>(pdu), want, ack))
+        if (type == Type::ACK && try_parse_ack(pdu, ack))
+        {
+            capture_rx(src_mac, pdu.data(), pdu.size());
+            sender_.on_ack(ack, mac_to_u64(src_mac));
+            return;
+        }
+
+        if (type == Type::REJECT)
+        {
+            RejectFields reject{};
+            const bool ok = try_parse_reject(pdu, reject);
+            capture_rx(src_mac, pdu.data(), pdu.size(), ok ? FrameNote::None : FrameNote::Rejected);
+            if (ok)
+                sender_.on_reject(reject);
+            return;
+        }
+
+        if (type == Type::NAK)
         {
-            sender_.on_ack(ack);
+            uint32_t msg_id = 0, total = 0;
+            vector<NakRange> ranges;
+            const bool ok = try_parse_nak(pdu, msg_id, total, ranges);
+            capture_rx(src_mac, pdu.data(), pdu.size(), ok ? FrameNote::None : FrameNote::Rejected);
+            if (ok)
+                on_nak(msg_id, ranges);
             return;
         }
 
-        RxChunkEvent event = rx_.feed_pdu(pdu, want);
+        if (crc_trusted(pdu))
+            pdu.assume_crc(true);
+        else if (clock.on())
+        {
+            // profiling pulls the CRC out of feed_pdu to time it; a mismatch is left for feed_pdu to report
+            clock.enter(kStageCrc);
+            pdu.crc_ok();
+        }
+        clock.enter(kStageReassembly);
+
+        vector<uint8_t> out_msg;
+        RxChunkEvent event{};
+        bool delivered = false;
+        uint64_t first_us = 0;
+        {
+            unique_lock<mutex> lk(rx_mu_);
+            ack_rwnd_ = peers_ && (peers_->caps_of(src_mac) & kCapRwnd) != 0;
+            rx_src_ = src_mac;
+            event = rx_.feed_pdu(pdu, mac_to_u64(src_mac));
+            if (event.duplicate)
+                rx_duplicates_++;
+            if (event.accepted && !event.streamed && (event.completed || rx_.is_complete(event.msg_id)))
+                delivered = rx_.extract_message(event.msg_id, out_msg, &first_us);
+            hand_over_stream(lk);
+        }
+
+        if (capture_)
+        {
+            // parity held back for a later loss is not accepted yet, but nothing is wrong with it
+            FrameNote note = FrameNote::None;
+            if (event.bad_crc)
+                note = FrameNote::BadCrc;
+            else if (event.duplicate)
+                note = FrameNote::Duplicate;
+            else if (!event.accepted && type != Type::REPAIR)
+                note = FrameNote::Rejected;
+            else if (event.digest_failed)
+                note = FrameNote::DigestMismatch;
+            else if (event.completed && !delivered && !event.streamed)
+                note = has_digest(event.msg_id) ? FrameNote::DigestMismatch : FrameNote::Rejected;
+            capture_rx(src_mac, pdu.data(), pdu.size(), note);
+        }
         if (!event.accepted)
             return;
-        if (event.completed || rx_.is_complete(event.msg_id))
+
+        clock.enter(kStageDelivery);
+        if (is_mcast_id(event.msg_id))
         {
-            vector<uint8_t> out_msg;
-            if (rx_.extract_message(event.msg_id, out_msg))
-                on_deliver_(event.msg_id, event.type, out_msg, src_mac);
+            if (delivered || (event.streamed && event.completed))
+                naks_.forget(event.msg_id);
+            else
+                naks_.on_data(event.msg_id, event.total, true);
         }
-        else
+
+        if (!delivered)
+            return;
+        // reliable HELLO from an older peer
+        if (event.type == Type::HELLO && peers_)
+            peers_->on_hello(src_mac, out_msg.data(), out_msg.size());
+        delivery_.push(event.msg_id, event.type, move(out_msg), src_mac, first_us);
+    }
+
+    bool LinkchatApp::send_echo(const Mac &dst, uint16_t ident, uint32_t seq) noexcept
+    {
+        FrameRef pdu = create_echo(EchoFields{kEchoRequest, ident, seq, 0});
+        if (pdu.empty() || !emit_echo_)
+            return false;
+
+        FrameStamp tx{};
+        echo_.on_sent(seq, steady_nanos());
+        capture_tx(dst, pdu);
+        if (!emit_echo_(dst, pdu, &tx))
+            return false;
+        echo_sampled(dst, echo_.on_tx_stamp(seq, tx));
+        return true;
+    }
+
+    // requests are answered at once with how long they sat here, measured from the kernel's
+    // arrival stamp when there is one, so the asker can take it out of its RTT
+    void LinkchatApp::on_echo(const Mac &src_mac, const EchoFields &echo, const FrameStamp &stamp) noexcept
+    {
+        if (echo.kind == kEchoReply)
+        {
+            echo_sampled(src_mac, echo_.on_reply(echo.ident, echo.seq, stamp, steady_nanos(), echo.turnaround_ns));
+            return;
+        }
+
+        EchoFields reply = echo;
+        reply.kind = kEchoReply;
+        reply.turnaround_ns = 0;
+        if (stamp.sw_ns != 0)
+        {
+            const uint64_t now = realtime_nanos();
+            reply.turnaround_ns = now > stamp.sw_ns ? now - stamp.sw_ns : 0;
+        }
+        FrameRef pdu = create_echo(reply);
+        if (pdu.empty() || !emit_echo_)
+            return;
+        capture_tx(src_mac, pdu);
+        emit_echo_(src_mac, pdu, nullptr);
+    }
+
+    void LinkchatApp::echo_sampled(const Mac &peer, const optional<EchoRtt> &rtt) noexcept
+    {
+        if (rtt && peer == unicast_peer_)
+            sender_.seed_rtt_us(rtt->rtt_ns / 1000);
+    }
+
+    void LinkchatApp::on_nak(uint32_t msg_id, const vector<NakRange> &ranges) noexcept
+    {
+        if (mcast_tx_.owns(msg_id))
+        {
+            mcast_tx_.on_nak(msg_id, ranges);
             return;
+        }
+
+        // another receiver's NAK: hold ours back if it already asks for every gap we have
+        vector<NakRange> mine;
+        {
+            lock_guard<mutex> lk(rx_mu_);
+            rx_.missing_ranges(msg_id, mine, kNakMaxRanges);
+        }
+        for (const NakRange &m : mine)
+        {
+            bool covered = false;
+            for (const NakRange &r : ranges)
+            {
+                if (r.from <= m.from && m.to <= r.to)
+                {
+                    covered = true;
+                    break;
+                }
+            }
+            if (!covered)
+                return;
+        }
+        naks_.suppress(msg_id);
+    }
+
+    void LinkchatApp::send_naks() noexcept
+    {
+        for (const auto &d : naks_.due())
+        {
+            vector<NakRange> ranges;
+            {
+                lock_guard<mutex> lk(rx_mu_);
+                rx_.missing_ranges(d.msg_id, ranges, kNakMaxRanges);
+            }
+            if (ranges.empty())
+            {
+                naks_.reschedule(d.msg_id, false);
+                continue;
+            }
+            auto pdu = create_nak(d.msg_id, d.total, ranges);
+            if (!pdu.empty())
+            {
+                capture_tx(mcfg_.group, pdu);
+                emit_group_(pdu);
+            }
+            naks_.reschedule(d.msg_id, true);
+        }
     }
 
     uint32_t LinkchatApp::send_hello(const string &nick)
@@ -103,25 +471,102 @@ namespace linkchat
     {
         if (data.empty())
             return 0;
-        return sender_.send(data, type);
+        SendOptions opt;
+        const uint32_t caps = peers_ ? peers_->caps_of(unicast_peer_) : 0;
+        opt.digest = (caps & kCapDigest) != 0;
+        opt.frame_crc = !(opt.digest && (caps & kCapFcsTrust) != 0);
+        opt.dst = mac_to_u64(unicast_peer_);
+        return sender_.send(data, type, opt);
+    }
+
+    uint32_t LinkchatApp::send_group(const vector<uint8_t> &data, Type type) noexcept
+    {
+        if (data.empty())
+            return 0;
+        return mcast_tx_.send(data, type);
+    }
+
+    uint64_t LinkchatApp::mcast_repair_frames() const noexcept
+    {
+        return mcast_tx_.repair_frames();
     }
 
     void LinkchatApp::tick() noexcept
     {
         sender_.on_tick();
+        mcast_tx_.on_tick();
+        FrameRef update;
+        {
+            unique_lock<mutex> lk(rx_mu_);
+            rx_.on_tick();
+            // the sender only learns the window from ACKs: once the queue has drained, repeat
+            // the last one so a sender waiting on a closed window need not wait for its probe
+            if(window_low_ && delivery_.room() >= delivery_.capacity() / 2)
+            {
+                window_update_.rwnd = static_cast<uint32_t>(min<size_t>(delivery_.room(), kNoRwnd - 1));
+                update = create_ack(window_update_);
+                window_low_ = false;
+            }
+            hand_over_stream(lk);
+        }
+        if(!update.empty())
+        {
+            capture_tx(unicast_peer_, update);
+            acks_sent_.fetch_add(1, memory_order_relaxed);
+            emit_pdu_(update);
+        }
+        send_naks();
+        if (peers_)
+            peers_->tick();
+    }
+
+    uint64_t LinkchatApp::tick_wait_us(uint64_t max_us) const noexcept
+    {
+        return min(max_us, sender_.pace_wait_us());
     }
 
     bool LinkchatApp::is_done(uint32_t msg_id) const noexcept
     {
+        if (is_mcast_id(msg_id))
+            return mcast_tx_.is_done(msg_id);
         return sender_.is_done(msg_id);
     }
 
+    AppStats LinkchatApp::stats() const noexcept
+    {
+        AppStats st{};
+        {
+            lock_guard<mutex> lk(rx_mu_);
+            st.rx = rx_.stats();
+            st.rx_duplicates = rx_duplicates_;
+        }
+        st.tx_loss = sender_.loss_estimate();
+        st.tx_srtt_us = sender_.srtt_us();
+        st.tx = sender_.stats();
+        st.acks_sent = acks_sent_.load(memory_order_relaxed);
+        st.mcast_repairs = mcast_tx_.repair_frames();
+        st.frames = frame_pool_stats();
+        st.delivery = delivery_.stats();
+        return st;
+    }
+
+    RxStageStats LinkchatApp::rx_stage_stats() const noexcept
+    {
+        RxStageStats st{};
+        st.frames = rx_stage_frames_.load(memory_order_relaxed);
+        st.parse_ns = rx_stage_ns_[kStageParse].load(memory_order_relaxed);
+        st.crc_ns = rx_stage_ns_[kStageCrc].load(memory_order_relaxed);
+        st.reassembly_ns = rx_stage_ns_[kStageReassembly].load(memory_order_relaxed);
+        st.delivery_ns = rx_stage_ns_[kStageDelivery].load(memory_order_relaxed);
+        return st;
+    }
+
     size_t LinkchatApp::in_flight(uint32_t msg_id) const noexcept
     {
         return sender_.in_flight(msg_id);
     }
 
-    auto LinkchatApp::get_emit_pdu() const noexcept -> function<void(const vector<uint8_t> &)>
+    auto LinkchatApp::get_emit_pdu() const noexcept -> EmitTxFn
     {
         return emit_pdu_;
     }
@@ -2,48 +2,203 @@
 #include <cstdint>
 #include <vector>
 #include <functional>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
 #include "sender.hpp"
 #include "reassembly.hpp"
+#include "mcast.hpp"
+#include "peers.hpp"
+#include "delivery.hpp"
+#include "capture.hpp"
+#include "latency.hpp"
+#include "echo.hpp"
 #include "util/structs.hpp" // Type
 #include "util/mac.hpp"     // Mac
 
 namespace linkchat {
     
     constexpr size_t HELLO_NICK_MAX = 255;
-    using DeliverMsgFn = std::function<void(std::uint32_t msg_id,
-                                            Type type,
-                                            const std::vector<std::uint8_t>& data,
-                                            const Mac& src_mac)>;
+
+    // sends one ECHO frame to dst; with tx set the link also reports when it left (send_stamped)
+    using EmitEchoFn = std::function<bool(const Mac& dst, const FrameRef& pdu, FrameStamp* tx)>;
+
+    // which messages are streamed (LinkchatApp::set_stream); frames = the message's frame count
+    using StreamPickFn = std::function<bool(std::uint32_t msg_id, Type type, std::uint32_t frames, const Mac& src)>;
+
+    struct AppStats {
+        ReassemblyStats rx;           // receive memory and evictions
+        double tx_loss;               // sender's retransmit ratio estimate
+        std::uint64_t tx_srtt_us;     // smoothed RTT that paces the sender
+        SenderStats tx;               // frames sent and resent, ACKs taken
+        std::uint64_t rx_duplicates;  // frames that arrived again (the peer resent them)
+        std::uint64_t acks_sent;
+        std::uint64_t mcast_repairs;  // frames sent in answer to multicast NAKs
+        FramePoolStats frames;        // heap allocs stay flat once a transfer reaches steady state
+        DeliveryStats delivery;       // completed messages waiting for on_deliver
+    };
+
+    // where on_rx_pdu spends its time, summed over frames; only counted with set_rx_profiling(true)
+    struct RxStageStats {
+        std::uint64_t frames;
+        std::uint64_t parse_ns;       // header, and all of a control frame (HELLO, ECHO, ACK, NAK)
+        std::uint64_t crc_ns;         // payload CRC32
+        std::uint64_t reassembly_ns;  // Reassembly::feed_pdu and extraction of completed messages
+        std::uint64_t delivery_ns;    // handing the message over (with no delivery workers, on_deliver itself)
+    };
 
     class LinkchatApp {
     public:
-        explicit LinkchatApp(SenderConfig cfg) noexcept;
+        explicit LinkchatApp(SenderConfig cfg, McastConfig mcfg = {}, DeliveryConfig dcfg = {});
+
+        void set_emit_pdu(EmitTxFn fn) noexcept;
 
-        void set_emit_pdu(std::function<void(const std::vector<std::uint8_t>&)> fn) noexcept;
+        // multicast data, NAKs and repairs go through this one (to the group address)
+        void set_emit_group_pdu(EmitTxFn fn) noexcept;
 
+        // ECHO requests and replies go through this one; without it requests are left unanswered
+        void set_emit_echo(EmitEchoFn fn) noexcept { emit_echo_ = std::move(fn); }
+
+        // runs on a delivery worker (DeliveryConfig::workers = 0: on the RX thread);
+        // set it before binding the app to a link
         void set_on_deliver(DeliverMsgFn fn) noexcept;
 
+        // progressive delivery (Reassembly::set_stream): messages pick accepts go to on_data in
+        // order as their frames arrive, then to on_complete, and never reach on_deliver. HELLO is
+        // never streamed. pick runs on the RX thread under the receive lock, so it only decides;
+        // on_data and on_complete run where on_deliver does, in order with the peer's other
+        // messages, and their bytes count against the receive window. Set before binding
+        void set_stream(StreamPickFn pick, DeliverDataFn on_data, DeliverDoneFn on_complete) noexcept;
+
+        // messages the unicast peer refused (REJECT) and the sender gave up on; called with the
+        // sender's lock held, on the RX thread. Set before binding
+        void set_on_refused(RefusedFn fn) noexcept { sender_.set_on_refused(std::move(fn)); }
+
+        // waits until every completed message has gone through on_deliver
+        void flush_deliveries();
+
+        // directory fed with every HELLO and driven by tick(); not owned, nullptr detaches
+        void set_peer_directory(PeerDirectory* dir) noexcept { peers_ = dir; }
+        PeerDirectory* peer_directory() const noexcept { return peers_; }
+
+        // peer send_bytes() goes to: its HELLO caps decide whether messages carry a digest and
+        // frame CRCs; set before binding
+        void set_unicast_peer(const Mac& mac) noexcept { unicast_peer_ = mac; }
+
+        // skip the CRC32 of digest frames (this end advertises kCapFcsTrust); only for links
+        // whose NIC drops frames with a bad FCS; set before binding
+        void set_trust_fcs(bool on) noexcept { trust_fcs_ = on; }
+
+        // every frame in and out, with what the engine made of it, is offered to the capture;
+        // not owned, set before binding
+        void set_capture(PacketCapture* cap) noexcept { capture_ = cap; }
+        PacketCapture* capture() const noexcept { return capture_; }
+
+        // times every received frame by stage (one clock read per stage change); set before binding
+        void set_rx_profiling(bool on) noexcept { profile_rx_ = on; }
+        RxStageStats rx_stage_stats() const noexcept;
+
         void on_rx_pdu(const Mac& src_mac, const std::uint8_t* pdu, std::size_t pdu_size) noexcept;
 
+        // one ping probe to dst, part of the run echo().begin(ident) started; false when it could not go out.
+        // Replies (and a probe toward the unicast peer seeds the sender's RTT before its first ACK)
+        // land in echo()
+        bool send_echo(const Mac& dst, std::uint16_t ident, std::uint32_t seq) noexcept;
+        EchoTracker& echo() noexcept { return echo_; }
+
+        // frames from one read of the link; with cores to spare their CRCs are checked in parallel first
+        void on_rx_batch(const RxFrame* frames, std::size_t n) noexcept;
+
         std::uint32_t send_bytes(const std::vector<std::uint8_t>& data, Type type) noexcept;
         
         std::uint32_t send_hello(const std::string& nick);
+
+        // reliable one-to-many send: no ACKs, receivers NAK what they miss
+        std::uint32_t send_group(const std::vector<std::uint8_t>& data, Type type) noexcept;
+
+        const McastConfig& mcast_config() const noexcept { return mcfg_; }
+        std::uint64_t mcast_repair_frames() const noexcept;
         
         void tick() noexcept;
+
+        // how long the tick loop may sleep before paced frames are due (capped at max_us)
+        std::uint64_t tick_wait_us(std::uint64_t max_us) const noexcept;
         
         bool is_done(std::uint32_t msg_id) const noexcept;
         
         std::size_t in_flight(std::uint32_t msg_id) const noexcept;
 
-        std::function<void(const std::vector<std::uint8_t>&)> get_emit_pdu() const noexcept;
+        AppStats stats() const noexcept;
+
+        // per-message latencies by Type and peer: send -> first frame out, send -> fully ACKed and
+        // frame ACK RTT (toward the unicast peer), first frame in -> on_deliver
+        LatencyBook& latency() noexcept { return latency_; }
+        const LatencyBook& latency() const noexcept { return latency_; }
+
+        EmitTxFn get_emit_pdu() const noexcept;
 
         
     private:
+        // every received frame, parsed once into pdu by on_rx_pdu / on_rx_batch
+        void rx_pdu(const Mac& src_mac, PduView pdu, const FrameStamp& stamp) noexcept;
+        void on_echo(const Mac& src_mac, const EchoFields& echo, const FrameStamp& stamp) noexcept;
+        void echo_sampled(const Mac& peer, const std::optional<EchoRtt>& rtt) noexcept;
+        bool crc_trusted(const PduView& pdu) const noexcept;
+        void capture_tx(const Mac& dst, const FrameRef& pdu, FrameNote note = FrameNote::None) noexcept
+        {
+            if (capture_) capture_->record(CaptureDir::Tx, dst, pdu.data(), pdu.size(), note);
+        }
+        void capture_rx(const Mac& src, const std::uint8_t* pdu, std::size_t len, FrameNote note = FrameNote::None) noexcept
+        {
+            if (capture_) capture_->record(CaptureDir::Rx, src, pdu, len, note);
+        }
+        void on_nak(std::uint32_t msg_id, const std::vector<NakRange>& ranges) noexcept;
+        void send_naks() noexcept;
+        void hand_over_stream(std::unique_lock<std::mutex>& rx_lock) noexcept;
+
+        // what rx_'s stream callbacks produced, queued once the receive lock is let go
+        struct StreamEvent {
+            std::uint32_t msg_id;
+            std::uint64_t offset;               // piece: where it goes; end: bytes in all
+            FrameRef frame;
+            std::span<const std::uint8_t> piece;
+            bool done;
+            bool ok;
+            Mac src;
+        };
+
         SenderConfig cfg_;
+        McastConfig mcfg_;
         Sender     sender_;
+        McastSender mcast_tx_;
         Reassembly rx_;
-        std::function<void(const std::vector<std::uint8_t>&)> emit_pdu_;
+        NakScheduler naks_;
+        mutable std::mutex rx_mu_;  // rx_ is fed by the RX thread, tick() asks it for NAK gaps and expiry
+        EmitTxFn emit_pdu_;
+        EmitTxFn emit_group_;
+        EmitEchoFn emit_echo_;
+        EchoTracker echo_;
         DeliverMsgFn on_deliver_;
+        PeerDirectory* peers_{nullptr};
+        Mac unicast_peer_{};
+        bool trust_fcs_{false};
+        PacketCapture* capture_{nullptr};
+        bool profile_rx_{false};
+        std::atomic<std::uint64_t> rx_stage_frames_{0};
+        std::atomic<std::uint64_t> rx_stage_ns_[4]{};  // parse, CRC, reassembly, delivery
+        bool ack_rwnd_{false};      // the peer being ACKed reads windows; guarded by rx_mu_
+        AckFields window_update_{}; // last ACK that advertised a nearly closed window, resent by tick()
+        bool window_low_{false};    // once the queue has drained; both guarded by rx_mu_
+        std::uint64_t rx_duplicates_{0}; // guarded by rx_mu_
+        Mac rx_src_{};              // sender of the frame rx_ is being fed, for StreamPickFn; guarded by rx_mu_
+        std::unordered_map<std::uint32_t, Mac> streams_; // streamed messages in progress -> sender; guarded by rx_mu_
+        std::vector<StreamEvent> stream_out_;            // guarded by rx_mu_
+        std::vector<StreamEvent> stream_spare_;          // guarded by stream_mu_
+        std::mutex stream_mu_;      // taken before rx_mu_ is let go: events reach delivery_ in the order rx_ made them
+        StreamDelivery stream_delivery_;
+        std::atomic<std::uint64_t> acks_sent_{0};
+        LatencyBook latency_;
+        DeliveryQueue delivery_;    // last: its workers stop before the rest goes away
     };
 
 } 
@@ -0,0 +1,318 @@
+#include "capture.hpp"
+
+#include <time.h>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <chrono>
+#include <new>
+
+using namespace std;
+
+namespace linkchat
+{
+    // pcapng blocks are written in host byte order; the section header's magic tells readers which
+    static constexpr uint32_t kShbType = 0x0A0D0D0Au;
+    static constexpr uint32_t kIdbType = 1;
+    static constexpr uint32_t kEpbType = 6;
+    static constexpr uint32_t kByteOrderMagic = 0x1A2B3C4Du;
+    static constexpr uint16_t kLinkEthernet = 1;
+    static constexpr uint16_t kOptEnd = 0;
+    static constexpr uint16_t kOptComment = 1;
+    static constexpr uint16_t kOptIfName = 2;
+    static constexpr uint16_t kOptEpbFlags = 2;
+    static constexpr uint16_t kOptIfTsresol = 9;
+    static constexpr size_t kEthHdrLen = 14;
+
+    static const char *note_text(FrameNote note) noexcept
+    {
+        switch (note)
+        {
+        case FrameNote::Resend:
+            return "retransmit";
+        case FrameNote::Duplicate:
+            return "duplicate";
+        case FrameNote::BadCrc:
+            return "crc fail";
+        case FrameNote::Rejected:
+            return "rejected";
+        case FrameNote::DigestMismatch:
+            return "digest mismatch";
+        default:
+            return nullptr;
+        }
+    }
+
+    static void put16(vector<uint8_t> &b, uint16_t v)
+    {
+        const size_t at = b.size();
+        b.resize(at + 2);
+        memcpy(b.data() + at, &v, 2);
+    }
+
+    static void put32(vector<uint8_t> &b, uint32_t v)
+    {
+        const size_t at = b.size();
+        b.resize(at + 4);
+        memcpy(b.data() + at, &v, 4);
+    }
+
+    static void put_option(vector<uint8_t> &b, uint16_t code, const void *val, size_t len)
+    {
+        put16(b, code);
+        put16(b, static_cast<uint16_t>(len));
+        const uint8_t *p = static_cast<const uint8_t *>(val);
+        b.insert(b.end(), p, p + len);
+        b.resize((b.size() + 3) & ~size_t(3));
+    }
+
+    // block type and length around body; the length is written at both ends
+    static void seal_block(vector<uint8_t> &b, uint32_t type)
+    {
+        const uint32_t total = static_cast<uint32_t>(b.size() + 12);
+        vector<uint8_t> head;
+        put32(head, type);
+        put32(head, total);
+        b.insert(b.begin(), head.begin(), head.end());
+        put32(b, total);
+    }
+
+    PacketCapture::PacketCapture(CaptureConfig cfg) : cfg_(cfg)
+    {
+        size_t n = 1;
+        while (n < max<size_t>(cfg_.slots, 2))
+            n <<= 1;
+        cfg_.slots = n;
+        cfg_.snaplen = min<size_t>(max<size_t>(cfg_.snaplen, 16), 0xFFFF);
+        mask_ = n - 1;
+        slots_ = make_unique<Slot[]>(n);
+        for (size_t i = 0; i < n; i++)
+            slots_[i].seq.store(i, memory_order_relaxed);
+    }
+
+    PacketCapture::~PacketCapture()
+    {
+        stop();
+    }
+
+    void PacketCapture::push(CaptureDir dir, const Mac &peer, const uint8_t *pdu, size_t len, FrameNote note) noexcept
+    {
+        if (pdu == nullptr)
+            return;
+        // counted before on_ is read again: stop() either sees us or we see it stopping
+        pushing_.fetch_add(1);
+        if (!on_.load())
+        {
+            pushing_.fetch_sub(1);
+            return;
+        }
+        timespec ts{};
+        ::clock_gettime(CLOCK_REALTIME, &ts);
+
+        // bounded MPMC ring: a slot whose seq equals the claimed position is free
+        size_t pos = tail_.load(memory_order_relaxed);
+        Slot *s;
+        for (;;)
+        {
+            s = &slots_[pos & mask_];
+            const size_t seq = s->seq.load(memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (tail_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                // the writer is behind: losing a frame beats stalling the data path
+                dropped_.fetch_add(1, memory_order_relaxed);
+                pushing_.fetch_sub(1);
+                return;
+            }
+            else
+                pos = tail_.load(memory_order_relaxed);
+        }
+
+        s->ts_ns = static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+        s->orig_len = static_cast<uint32_t>(min<size_t>(len, UINT32_MAX - kEthHdrLen));
+        s->cap_len = static_cast<uint16_t>(min(len, snaplen_));
+        s->dir = dir;
+        s->note = note;
+        s->peer = peer;
+        memcpy(data_.get() + (pos & mask_) * snaplen_, pdu, s->cap_len);
+        s->seq.store(pos + 1, memory_order_release);
+        pushing_.fetch_sub(1);
+    }
+
+    // hands published slots back to producers, writing them first when write is set; stops at
+    // the first slot a producer has claimed but not filled yet
+    size_t PacketCapture::drain(bool write) noexcept
+    {
+        size_t n = 0;
+        for (;;)
+        {
+            Slot &s = slots_[head_ & mask_];
+            if (s.seq.load(memory_order_acquire) != head_ + 1)
+                break;
+            if (write)
+                write_packet(s, data_.get() + (head_ & mask_) * snaplen_);
+            s.seq.store(head_ + mask_ + 1, memory_order_release);
+            head_++;
+            n++;
+        }
+        return n;
+    }
+
+    void PacketCapture::write_packet(const Slot &s, const uint8_t *data) noexcept
+    {
+        // enhanced packet block: the Ethernet header is rebuilt, the PDU follows as captured
+        uint8_t eth[kEthHdrLen];
+        const Mac &dst = s.dir == CaptureDir::Tx ? s.peer : local_;
+        const Mac &src = s.dir == CaptureDir::Tx ? local_ : s.peer;
+        memcpy(eth, dst.bytes, kMacSize);
+        memcpy(eth + kMacSize, src.bytes, kMacSize);
+        eth[12] = static_cast<uint8_t>(ethertype_ >> 8);
+        eth[13] = static_cast<uint8_t>(ethertype_ & 0xFF);
+
+        vector<uint8_t> b;
+        b.reserve(64 + kEthHdrLen + s.cap_len);
+        put32(b, 0); // interface id
+        put32(b, static_cast<uint32_t>(s.ts_ns >> 32));
+        put32(b, static_cast<uint32_t>(s.ts_ns & 0xFFFFFFFFu));
+        put32(b, static_cast<uint32_t>(kEthHdrLen + s.cap_len));
+        put32(b, static_cast<uint32_t>(kEthHdrLen + s.orig_len));
+        b.insert(b.end(), eth, eth + kEthHdrLen);
+        b.insert(b.end(), data, data + s.cap_len);
+        b.resize((b.size() + 3) & ~size_t(3));
+
+        const uint32_t flags = s.dir == CaptureDir::Rx ? 1u : 2u; // inbound / outbound
+        put_option(b, kOptEpbFlags, &flags, sizeof(flags));
+        if (const char *text = note_text(s.note))
+            put_option(b, kOptComment, text, strlen(text));
+        put_option(b, kOptEnd, nullptr, 0);
+        seal_block(b, kEpbType);
+
+        if (fwrite(b.data(), 1, b.size(), file_) == b.size())
+        {
+            captured_.fetch_add(1, memory_order_relaxed);
+            bytes_.fetch_add(b.size(), memory_order_relaxed);
+        }
+    }
+
+    bool PacketCapture::start(const string &path, size_t snaplen)
+    {
+        lock_guard<mutex> lk(mu_);
+        if (file_ != nullptr)
+            return false;
+
+        // off, and stop() waited out every push: the ring's bytes are ours to resize
+        snaplen = min<size_t>(max<size_t>(snaplen == 0 ? cfg_.snaplen : snaplen, 16), 0xFFFF);
+        if (!data_ || snaplen != snaplen_)
+        {
+            data_.reset();
+            data_.reset(new (nothrow) uint8_t[cfg_.slots * snaplen]);
+            snaplen_ = data_ ? snaplen : 0;
+            if (!data_)
+                return false;
+        }
+
+        FILE *f = fopen(path.c_str(), "wb");
+        if (f == nullptr)
+            return false;
+
+        vector<uint8_t> shb;
+        put32(shb, kByteOrderMagic);
+        put16(shb, 1); // version 1.0
+        put16(shb, 0);
+        put32(shb, 0xFFFFFFFFu); // section length unknown
+        put32(shb, 0xFFFFFFFFu);
+        put_option(shb, kOptEnd, nullptr, 0);
+        seal_block(shb, kShbType);
+
+        vector<uint8_t> idb;
+        put16(idb, kLinkEthernet);
+        put16(idb, 0);
+        put32(idb, static_cast<uint32_t>(kEthHdrLen + snaplen_));
+        const char name[] = "linkchat";
+        put_option(idb, kOptIfName, name, sizeof(name) - 1);
+        const uint8_t tsresol = 9; // nanoseconds
+        put_option(idb, kOptIfTsresol, &tsresol, 1);
+        put_option(idb, kOptEnd, nullptr, 0);
+        seal_block(idb, kIdbType);
+
+        if (fwrite(shb.data(), 1, shb.size(), f) != shb.size() || fwrite(idb.data(), 1, idb.size(), f) != idb.size())
+        {
+            fclose(f);
+            return false;
+        }
+
+        drain(false); // leftovers of an earlier session
+        file_ = f;
+        path_ = path;
+        stopping_ = false;
+        captured_ = 0;
+        dropped_ = 0;
+        bytes_ = shb.size() + idb.size();
+        on_.store(true); // publishes the ring to push()
+        writer_ = thread([this]
+                         { run(); });
+        return true;
+    }
+
+    void PacketCapture::stop()
+    {
+        {
+            lock_guard<mutex> lk(mu_);
+            if (file_ == nullptr)
+                return;
+            on_.store(false);
+        }
+        // a record() that saw on_ still set finishes its slot before the last drain
+        while (pushing_.load() != 0)
+            this_thread::yield();
+        {
+            lock_guard<mutex> lk(mu_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        if (writer_.joinable())
+            writer_.join();
+
+        lock_guard<mutex> lk(mu_);
+        fclose(file_);
+        file_ = nullptr;
+    }
+
+    void PacketCapture::run() noexcept
+    {
+        unique_lock<mutex> lk(mu_);
+        for (;;)
+        {
+            cv_.wait_for(lk, chrono::milliseconds(cfg_.flush_ms), [this]
+                         { return stopping_; });
+            const bool last = stopping_;
+            lk.unlock();
+            if (drain(true) > 0)
+                fflush(file_);
+            lk.lock();
+            if (last)
+                return;
+        }
+    }
+
+    string PacketCapture::path() const
+    {
+        lock_guard<mutex> lk(mu_);
+        return path_;
+    }
+
+    CaptureStats PacketCapture::stats() const noexcept
+    {
+        CaptureStats st{};
+        st.on = on();
+        st.captured = captured_.load(memory_order_relaxed);
+        st.dropped = dropped_.load(memory_order_relaxed);
+        st.bytes_written = bytes_.load(memory_order_relaxed);
+        return st;
+    }
+}
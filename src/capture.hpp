@@ -0,0 +1,120 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "util/mac.hpp"
+
+namespace linkchat
+{
+    // what the engine made of a frame; written as a pcapng packet comment
+    enum class FrameNote : std::uint8_t
+    {
+        None = 0,
+        Resend,         // TX: the frame went out before and was not ACKed in time
+        Duplicate,      // RX: already had it
+        BadCrc,         // RX: payload CRC mismatch, dropped
+        Rejected,       // RX: malformed, or no room for its message
+        DigestMismatch, // RX: completed the message, whose digest did not match
+    };
+
+    enum class CaptureDir : std::uint8_t
+    {
+        Rx = 1,
+        Tx = 2,
+    };
+
+    struct CaptureConfig
+    {
+        std::size_t slots = 8192;   // ring entries, rounded up to a power of two
+        std::size_t snaplen = 1500; // PDU bytes kept per frame when start() is not given any: whole frames at the usual MTU
+        std::uint32_t flush_ms = 50;
+    };
+
+    struct CaptureStats
+    {
+        bool on;
+        std::uint64_t captured;     // frames written to the file
+        std::uint64_t dropped;      // frames lost because the ring was full
+        std::uint64_t bytes_written;
+    };
+
+    // Records PDUs with their direction and FrameNote into a fixed ring: any thread may record,
+    // a slot is claimed with one CAS and nothing blocks or allocates. A writer thread drains the
+    // ring into a pcapng file (Ethernet link type, nanosecond timestamps), rebuilding the
+    // Ethernet header from the MACs. When capture is off, record() is a single relaxed load.
+    class PacketCapture
+    {
+    public:
+        explicit PacketCapture(CaptureConfig cfg = {});
+        ~PacketCapture(); // stops
+        PacketCapture(const PacketCapture &) = delete;
+        PacketCapture &operator=(const PacketCapture &) = delete;
+
+        // opens (truncates) path and starts recording snaplen bytes of every PDU (0 = the config's);
+        // false if already on or the file cannot be opened. Cut frames cannot be replayed
+        bool start(const std::string &path, std::size_t snaplen = 0);
+        // stops recording, writes out what the ring still holds and closes the file
+        void stop();
+
+        bool on() const noexcept { return on_.load(std::memory_order_relaxed); }
+        std::string path() const;
+
+        // our end of the link, for the rebuilt Ethernet headers
+        void set_local_mac(const Mac &mac) noexcept { local_ = mac; }
+        void set_ethertype(std::uint16_t ethertype) noexcept { ethertype_ = ethertype; }
+
+        // peer: destination of a TX frame, source of an RX frame
+        void record(CaptureDir dir, const Mac &peer, const std::uint8_t *pdu, std::size_t len, FrameNote note = FrameNote::None) noexcept
+        {
+            if (on_.load(std::memory_order_relaxed))
+                push(dir, peer, pdu, len, note);
+        }
+
+        CaptureStats stats() const noexcept;
+
+    private:
+        struct Slot
+        {
+            std::atomic<std::size_t> seq;
+            std::uint64_t ts_ns;
+            std::uint32_t orig_len;
+            std::uint16_t cap_len;
+            CaptureDir dir;
+            FrameNote note;
+            Mac peer;
+        };
+
+        void push(CaptureDir dir, const Mac &peer, const std::uint8_t *pdu, std::size_t len, FrameNote note) noexcept;
+        std::size_t drain(bool write) noexcept;
+        void write_packet(const Slot &s, const std::uint8_t *data) noexcept;
+        void run() noexcept;
+
+        CaptureConfig cfg_;
+        std::size_t mask_;
+        std::unique_ptr<Slot[]> slots_;
+        std::unique_ptr<std::uint8_t[]> data_;     // snaplen_ bytes per slot, allocated by start()
+        std::size_t snaplen_{0};                   // of the current (or last) capture
+        alignas(64) std::atomic<std::size_t> tail_{0}; // next slot producers claim
+        alignas(64) std::size_t head_{0};              // next slot the writer reads
+        std::atomic<bool> on_{false};
+        std::atomic<std::uint32_t> pushing_{0};    // record() calls inside push(): stop() waits them out
+        std::atomic<std::uint64_t> dropped_{0};
+        std::atomic<std::uint64_t> captured_{0};
+        std::atomic<std::uint64_t> bytes_{0};
+        Mac local_{};
+        std::uint16_t ethertype_{0x88B5};
+
+        mutable std::mutex mu_; // start/stop and the writer's wakeups
+        std::condition_variable cv_;
+        bool stopping_{false};
+        std::FILE *file_{nullptr};
+        std::string path_;
+        std::thread writer_;
+    };
+}
@@ -3,18 +3,34 @@
 #include "app.hpp"          // LinkchatApp, SenderConfig
 #include "app_eth_bind.hpp" // AppEthHandle, bind_app_to_eth, unbind_app_from_eth
 #include "eth_adapter.hpp"  // EthConfig
+#include "xdp_socket.hpp"   // xdp_supported
 #include "mac.hpp"          // parse_mac(Mac)
-
+#include "transfer.hpp"     // XferOffer, TransferStore
+#include "file_sink.hpp"    // FileSink
+#include "capture.hpp"      // PacketCapture
+#include "latency.hpp"      // LatencyBook
+#include "echo.hpp"         // EchoTracker
+#include "peers.hpp"        // PeerDirectory
+#include "time.hpp"         // steady_millis
+
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <csignal>
 #include <cstdint>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <span>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 using namespace std;
@@ -47,31 +63,34 @@ namespace
         return f.good();
     }
 
-    static bool write_file(const string &path, const vector<uint8_t> &data)
-    {
-        ofstream f(path, ios::binary);
-        if (!f)
-            return false;
-        f.write(reinterpret_cast<const char *>(data.data()), data.size());
-        return f.good();
-    }
-
     static void print_help()
     {
         cout <<
             R"(Commands:
             config                Configure interface, destination MAC and protocol params
             chat                  Start interactive chat (text + /sendfile <path> + /all <text> + /allfile <path>)
-            send <path>           Send a file directly and return to prompt
-            discover              Send HELLO packet to discover peers
+            send <path>           Send a file (delta + resumable: only chunks the peer lacks go on the wire)
+            discover              Probe the segment and list the peers that answer (about 1s)
+            ping [count] [peer]   Measure L2 round-trip time (kernel/NIC timestamps when available)
+            perf server [idle_s]  Receive and discard a perf run, reporting every second (ends after idle_s quiet, default 5)
+            perf client [sz] [n]  Send n synthetic messages of sz bytes (default 100 x 1 MiB) to a perf server, report goodput
+            peers                 List known peers right away (background directory)
+            capture <path> [snap]|off  Record every frame in and out (pcapng, with retransmit/duplicate/crc notes);
+                                  snap = PDU bytes kept per frame, default the whole frame (MTU)
             info                  Show current configuration
             exit                  Quit
 
             While in chat:
             Type messages and press Enter to send
             Use /sendfile <path> to send files
-            Use /all <text> to send to all peers
-            Use /allfile <path> to send a file to all peers
+            Use /all <text> to send to all peers (Ethernet multicast, NAK-based repair)
+            Use /allfile <path> to send a file to all peers at once
+            Use /links to show per-interface frame counters and transport
+            Use /peers to list known peers
+            Use /capture <path> [snap] or /capture off to switch packet capture on the fly
+            Use /stats to show receive memory, evictions, digest mismatches, loss, frames sent, frame pool, delivery queue, file sink, capture and latency counters
+            Use /latency to show message latency percentiles by type and peer (/latency reset clears them)
+            Use /ping [count] to measure the round-trip time to the peer
             Use /quit to leave chat
             )";
     }
@@ -104,22 +123,81 @@ namespace
         return out;
     }
 
-    static bool unwrap_file_with_name(const vector<uint8_t> &data,
-                                      string &out_name,
-                                      vector<uint8_t> &out_bytes)
+    // FILE messages written to disk as they arrive (LinkchatApp::set_stream): the name header
+    // of wrap_file_with_name is cut from the front of the stream, everything after it goes
+    // straight to a StreamFile. Runs on the delivery workers; a message stays on one of them
+    class FileReceiver
     {
-        if (data.size() < 2)
-            return false;
-        uint16_t nlen = (static_cast<uint16_t>(data[0]) << 8) | data[1];
-        if (static_cast<uint16_t>(data.size()) < 2 + nlen)
-            return false;
+    public:
+        FileReceiver(FileSink &sink, string outdir) : sink_(sink), outdir_(move(outdir)) {}
 
-        out_name.assign(reinterpret_cast<const char *>(&data[2]), nlen);
-        out_bytes.assign(data.begin() + 2 + nlen, data.end());
+        void on_data(uint32_t msg_id, span<const uint8_t> data)
+        {
+            Rx &rx = get(msg_id);
+            if (rx.out)
+            {
+                rx.out->append(data);
+                return;
+            }
+            rx.head.insert(rx.head.end(), data.begin(), data.end());
+            if (rx.head.size() < 2)
+                return;
+            const size_t nlen = (static_cast<size_t>(rx.head[0]) << 8) | rx.head[1];
+            if (rx.head.size() < 2 + nlen)
+                return;
+            string name(reinterpret_cast<const char *>(rx.head.data() + 2), nlen);
+            name = fs::path(name).filename().string();
+            if (name.empty())
+                open(rx, "file-" + to_string(msg_id) + ".bin", 0); // compat: no usable name, keep it all
+            else
+                open(rx, name, 2 + nlen);
+        }
 
-        out_name = fs::path(out_name).filename().string();
-        return !out_name.empty();
-    }
+        void on_complete(uint32_t msg_id, bool ok)
+        {
+            Rx rx;
+            {
+                lock_guard<mutex> lk(mu_);
+                auto it = files_.find(msg_id);
+                if (it == files_.end())
+                    return;
+                rx = move(it->second);
+                files_.erase(it);
+            }
+            // compat: a message too short for its name header was an unnamed file
+            if (!rx.out && ok)
+                open(rx, "file-" + to_string(msg_id) + ".bin", 0);
+            if (rx.out)
+                rx.out->finish(ok);
+        }
+
+    private:
+        struct Rx
+        {
+            vector<uint8_t> head;        // bytes before the name header is complete
+            unique_ptr<StreamFile> out;
+        };
+
+        Rx &get(uint32_t msg_id)
+        {
+            lock_guard<mutex> lk(mu_);
+            return files_[msg_id];
+        }
+
+        void open(Rx &rx, const string &name, size_t skip)
+        {
+            if (!ensure_dir(outdir_))
+                cerr << "\n[WARN] cannot access outdir '" << outdir_ << "', using current dir\n> ";
+            rx.out = make_unique<StreamFile>(sink_, (fs::path(outdir_) / fs::path(name)).string());
+            rx.out->append(span<const uint8_t>(rx.head).subspan(min(skip, rx.head.size())));
+            rx.head = vector<uint8_t>{};
+        }
+
+        FileSink &sink_;
+        string outdir_;
+        mutex mu_;
+        unordered_map<uint32_t, Rx> files_; // node-based: an entry stays put while its lane uses it
+    };
 
     static string get_local_mac_ascii(const string &ifname)
     {
@@ -137,32 +215,307 @@ namespace
         return mac;
     }
 
-    //  HELLO payload: [1B nick_len][nick][mac_ascii(17B "aa:bb:cc:dd:ee:ff")]
-    static vector<uint8_t> build_hello_payload(const string &nick, const string &mac_ascii)
+    static void use_peer_directory(LinkchatApp &app, PeerDirectory &peers, const RuntimeConfig &rcfg)
     {
-        string nn = nick;
-        if (nn.size() > 255)
-            nn.resize(255);
-        vector<uint8_t> out;
-        out.reserve(1 + nn.size() + 17);
-        out.push_back(static_cast<uint8_t>(nn.size()));
-        out.insert(out.end(), nn.begin(), nn.end());
-        string mac = mac_ascii;
-        if (mac.size() != 17)
-            mac = "??:??:??:??:??:??";
-        out.insert(out.end(), mac.begin(), mac.end());
+        peers.set_identity(rcfg.alias, get_local_mac_ascii(rcfg.ifname), kLocalCaps | (rcfg.trust_fcs ? kCapFcsTrust : 0u));
+        app.set_peer_directory(&peers);
+        app.set_trust_fcs(rcfg.trust_fcs);
+        Mac peer{};
+        if (parse_mac(rcfg.dst_mac, peer))
+            app.set_unicast_peer(peer);
+    }
+
+    // "" shows the state, "off" stops, anything else is the file to capture to, optionally
+    // followed by the PDU bytes kept per frame (whole frames at the configured MTU by default,
+    // which is what linkchat_replay needs)
+    static void capture_command(PacketCapture &cap, string arg, const RuntimeConfig &rcfg)
+    {
+        if (arg == "off")
+        {
+            if (!cap.on())
+            {
+                cout << "[capture] already off\n";
+                return;
+            }
+            cap.stop();
+            CaptureStats st = cap.stats();
+            cout << "[capture] off, " << st.captured << " frames written to " << cap.path()
+                 << " (" << st.dropped << " dropped)\n";
+            return;
+        }
+        if (arg.empty())
+        {
+            CaptureStats st = cap.stats();
+            cout << "[capture] " << (st.on ? "on, writing to " + cap.path() : string("off"))
+                 << " (" << st.captured << " frames, " << st.dropped << " dropped)\n";
+            return;
+        }
+        if (cap.on())
+        {
+            cerr << "[ERR] capture already on (" << cap.path() << "), use 'off' first\n";
+            return;
+        }
+        size_t snaplen = static_cast<size_t>(max(rcfg.mtu, 60));
+        const size_t sp = arg.find_last_of(' ');
+        if (sp != string::npos && sp + 1 < arg.size() &&
+            all_of(arg.begin() + static_cast<ptrdiff_t>(sp + 1), arg.end(), ::isdigit))
+        {
+            snaplen = arg.size() - sp - 1 > 5 ? 0xFFFF : static_cast<size_t>(stoul(arg.substr(sp + 1)));
+            arg.erase(arg.find_last_not_of(' ', sp) + 1);
+        }
+        cap.set_ethertype(rcfg.ethertype);
+        if (!cap.start(arg, snaplen))
+        {
+            cerr << "[ERR] cannot open capture file: " << arg << "\n";
+            return;
+        }
+        cout << "[capture] writing to " << arg << " (" << snaplen << " bytes per frame)\n";
+    }
+
+    static string caps_to_string(uint32_t caps)
+    {
+        string out;
+        if (caps & kCapFec)
+            out += "fec,";
+        if (caps & kCapXfer)
+            out += "xfer,";
+        if (caps & kCapDelta)
+            out += "delta,";
+        if (caps & kCapMcast)
+            out += "mcast,";
+        if (caps & kCapRwnd)
+            out += "rwnd,";
+        if (caps & kCapDigest)
+            out += "digest,";
+        if (caps & kCapEcho)
+            out += "echo,";
+        if (caps & kCapFcsTrust)
+            out += "fcs-trust,";
+        if (caps & kCapReject)
+            out += "reject,";
+        if (caps & kCapFileStream)
+            out += "file-stream,";
+        if (out.empty())
+            return "-";
+        out.pop_back();
         return out;
     }
 
-    static bool parse_hello_payload(const vector<uint8_t> &data, string &out_nick, string &out_mac)
+    static void print_peers(const PeerDirectory &peers)
     {
-        if (data.size() < 1 + 17)
-            return false;
-        uint8_t nlen = data[0];
-        if (static_cast<uint8_t>(data.size()) < 1 + nlen + 17)
-            return false;
-        out_nick.assign(reinterpret_cast<const char *>(&data[1]), nlen);
-        out_mac.assign(reinterpret_cast<const char *>(&data[1 + nlen]), 17);
+        auto list = peers.snapshot();
+        if (list.empty())
+        {
+            cout << "[peers] none known yet (run 'discover' or stay in 'chat')\n";
+            return;
+        }
+        uint64_t now = steady_millis();
+        for (const auto &p : list)
+            cout << "[peer] " << (p.alias.empty() ? "LinkChat User" : p.alias)
+                 << "  mac=" << mac_to_string(p.mac)
+                 << "  caps=" << caps_to_string(p.caps)
+                 << "  seen " << (now - p.last_seen_ms) / 1000 << "s ago\n";
+    }
+
+    static const char *type_name(Type type)
+    {
+        switch (type)
+        {
+        case Type::MSG:
+            return "MSG";
+        case Type::FILE:
+            return "FILE";
+        case Type::HELLO:
+            return "HELLO";
+        case Type::XFER:
+            return "XFER";
+        default:
+            return "other";
+        }
+    }
+
+    // A peer that does not stream files to disk holds a FILE message whole in its receive memory
+    // and refuses one that cannot fit; 'send' splits a file into segments instead. A peer not
+    // heard from yet (caps 0) is let through: if it cannot take the file it says so
+    static bool file_fits(uint32_t caps, size_t bytes)
+    {
+        // each frame's slot costs about 1% on top of its payload
+        return caps == 0 || (caps & kCapFileStream) != 0 || bytes + bytes / 32 <= ReassemblyConfig{}.peer_cap_bytes;
+    }
+
+    static void print_refused(uint32_t msg_id, Type type, RejectReason reason)
+    {
+        cerr << "\n[ERR] peer refused message " << msg_id << " (" << type_name(type) << "): ";
+        if (reason == RejectReason::TooLarge)
+            cerr << "too large for its receive memory";
+        else
+            cerr << "it kept arriving corrupted (digest mismatch)";
+        cerr << "\n> ";
+    }
+
+    static void print_percentiles(const LatencyPercentiles &p)
+    {
+        cout << "p50=" << p.p50 << " p90=" << p.p90 << " p99=" << p.p99 << " p99.9=" << p.p999
+             << " max=" << p.max << " us (" << p.count << ")";
+    }
+
+    // detail adds the per-Type and per-peer rows under each metric
+    static void print_latency(const LatencyBook &book, bool detail)
+    {
+        bool any = false;
+        for (size_t i = 0; i < kLatencyMetrics; i++)
+        {
+            const LatencyMetric m = static_cast<LatencyMetric>(i);
+            if (!detail)
+            {
+                const LatencyPercentiles p = book.summary(m);
+                if (p.count == 0)
+                    continue;
+                cout << "[latency] " << latency_metric_name(m) << ": ";
+                print_percentiles(p);
+                cout << "\n";
+                any = true;
+                continue;
+            }
+            const LatencyBreakdown b = book.breakdown(m);
+            if (b.all.count == 0)
+                continue;
+            any = true;
+            cout << "[latency] " << latency_metric_name(m) << ": ";
+            print_percentiles(b.all);
+            cout << "\n";
+            for (const auto &[type, p] : b.by_type)
+            {
+                cout << "            type " << type_name(type) << ": ";
+                print_percentiles(p);
+                cout << "\n";
+            }
+            for (const auto &[mac, p] : b.by_peer)
+            {
+                cout << "            peer " << mac_to_string(mac) << ": ";
+                print_percentiles(p);
+                cout << "\n";
+            }
+            if (b.other_peers > 0)
+                cout << "            " << b.other_peers << " samples from peers past the first " << LatencyBook::kLatencyPeers << "\n";
+        }
+        if (!any)
+            cout << "[latency] no samples yet\n";
+    }
+
+    static const char *echo_clock_name(EchoClock clock)
+    {
+        switch (clock)
+        {
+        case EchoClock::Hardware:
+            return "hardware";
+        case EchoClock::Kernel:
+            return "kernel";
+        default:
+            return "app";
+        }
+    }
+
+    // one probe every 200ms, then up to 1s for the stragglers; RTTs come from the best clock both
+    // ends of a probe were stamped with, minus the time the request sat in the peer
+    static void run_ping(LinkchatApp &app, const PeerDirectory &peers, const Mac &dst, int count)
+    {
+        const uint32_t caps = peers.caps_of(dst);
+        if (caps != 0 && (caps & kCapEcho) == 0)
+            cerr << "[WARN] " << mac_to_string(dst) << " does not advertise echo; expect no replies\n";
+
+        EchoTracker &echo = app.echo();
+        const uint16_t ident = static_cast<uint16_t>(steady_nanos());
+        echo.begin(ident);
+
+        cout << "[ping] " << mac_to_string(dst) << ", " << count << " probes\n";
+        int sent = 0;
+        size_t shown = 0;
+        auto show = [&]
+        {
+            vector<EchoRtt> res = echo.results();
+            for (; shown < res.size(); shown++)
+                cout << "[ping] seq=" << res[shown].seq << " rtt=" << res[shown].rtt_ns / 1000.0 << " us ("
+                     << echo_clock_name(res[shown].clock) << ")\n";
+        };
+        for (int i = 0; i < count && g_running.load(); i++)
+        {
+            if (app.send_echo(dst, ident, static_cast<uint32_t>(i)))
+                sent++;
+            else
+                cerr << "[ERR] probe " << i << " could not be sent\n";
+            this_thread::sleep_for(200ms);
+            show();
+        }
+        auto end = chrono::steady_clock::now() + 1s;
+        while (shown < static_cast<size_t>(sent) && chrono::steady_clock::now() < end && g_running.load())
+        {
+            this_thread::sleep_for(10ms);
+            show();
+        }
+
+        vector<EchoRtt> res = echo.results();
+        const size_t got = res.size();
+        cout << "[ping] " << sent << " sent, " << got << " received, "
+             << (sent > 0 ? 100.0 * static_cast<double>(sent - static_cast<int>(got)) / sent : 0.0) << "% loss\n";
+        if (got == 0)
+            return;
+
+        // a run is a handful of samples: exact percentiles from the sorted RTTs
+        vector<uint64_t> rtt;
+        EchoClock worst = EchoClock::Hardware;
+        uint64_t sum = 0;
+        for (const EchoRtt &r : res)
+        {
+            rtt.push_back(r.rtt_ns);
+            sum += r.rtt_ns;
+            worst = max(worst, r.clock);
+        }
+        sort(rtt.begin(), rtt.end());
+        auto pct = [&](size_t p)
+        { return rtt[min(rtt.size() - 1, (rtt.size() * p + 99) / 100 - 1)] / 1000.0; };
+        cout << "[ping] rtt min/avg/max = " << rtt.front() / 1000.0 << "/" << sum / got / 1000.0 << "/"
+             << rtt.back() / 1000.0 << " us, p50=" << pct(50) << " p90=" << pct(90) << " p99=" << pct(99)
+             << " us (" << echo_clock_name(worst) << " clock)\n";
+    }
+
+    static SenderConfig make_sendercfg_for(const RuntimeConfig &rcfg)
+    {
+        SenderConfig scfg{};
+        scfg.mtu = rcfg.mtu;
+        scfg.window = rcfg.window;
+        scfg.rto_ms = rcfg.rto_ms;
+        scfg.fec.k = static_cast<uint8_t>(rcfg.fec_k);
+        scfg.rate_cap = static_cast<uint64_t>(rcfg.rate_mbps) * 125000; // Mbit/s -> bytes/s
+        return scfg;
+    }
+
+    static DeliveryConfig make_deliverycfg_for(const RuntimeConfig &rcfg)
+    {
+        DeliveryConfig dcfg{};
+        dcfg.workers = static_cast<unsigned>(rcfg.delivery_workers);
+        return dcfg;
+    }
+
+    // "eth1=aa:bb:cc:dd:ee:ff,eth2=..." -> one EthLink per entry
+    static bool parse_extra_links(const string &text, vector<EthLink> &out)
+    {
+        out.clear();
+        stringstream ss(text);
+        string item;
+        while (getline(ss, item, ','))
+        {
+            if (item.empty())
+                continue;
+            auto eq = item.find('=');
+            if (eq == string::npos)
+                return false;
+            EthLink link;
+            link.ifname = item.substr(0, eq);
+            if (link.ifname.empty() || !parse_mac(item.substr(eq + 1), link.dst_mac))
+                return false;
+            out.push_back(link);
+        }
         return true;
     }
 
@@ -173,96 +526,390 @@ namespace
         out.ifname = rcfg.ifname;
         out.ether_type = rcfg.ethertype;
         out.frame_mtu = static_cast<size_t>(rcfg.mtu);
+        out.low_latency = rcfg.low_latency;
+        out.rx_stamps = rcfg.low_latency; // the RX latency histogram is what that mode is tuned by
+        out.rx_cpu = rcfg.rx_cpu;
+        out.use_xdp = rcfg.xdp;
 
         if (!parse_mac(dst_mac_ascii, out.dst_mac))
             return false;
 
-        return true;
+        return parse_extra_links(rcfg.links, out.extra_links);
     }
 
-    static bool broadcast_send_msg(const RuntimeConfig &rcfg,
-                                   const vector<uint8_t> &bytes)
+    // one side of a perf run at one instant; reports are the difference of two of these
+    struct PerfSample
+    {
+        uint64_t wall_ns;
+        uint64_t cpu_ns;
+        uint64_t bytes;  // client: in fully ACKed messages; server: delivered
+        uint64_t frames; // on the links: sent by the client, received by the server
+        uint64_t resent; // client: frames sent again; server: duplicates that arrived
+        uint64_t acks;   // client: ACKs taken; server: ACKs sent
+    };
+
+    static PerfSample perf_sample(const LinkchatApp &app, const Transport &link, bool client, uint64_t bytes)
     {
-        if (rcfg.ifname.empty())
+        const AppStats st = app.stats();
+        PerfSample s{steady_nanos(), process_cpu_nanos(), bytes, 0, 0, 0};
+        for (const auto &ls : link.link_stats())
+            s.frames += client ? ls.tx_frames : ls.rx_frames;
+        s.resent = client ? st.tx.resent : st.rx_duplicates;
+        s.acks = client ? st.tx.acks : st.acks_sent;
+        return s;
+    }
+
+    // cpu is the whole process against wall time, so above 100% once several threads are busy
+    static void print_perf(const PerfSample &start, const PerfSample &a, const PerfSample &b, bool client)
+    {
+        const double secs = max<double>(1e-9, static_cast<double>(b.wall_ns - a.wall_ns) / 1e9);
+        const uint64_t frames = b.frames - a.frames;
+        cout << fixed << setprecision(2) << "[perf] " << static_cast<double>(a.wall_ns - start.wall_ns) / 1e9 << "-"
+             << static_cast<double>(b.wall_ns - start.wall_ns) / 1e9 << " s: " << b.bytes - a.bytes << " bytes, "
+             << static_cast<double>(b.bytes - a.bytes) * 8 / secs / 1e6 << " Mbit/s, "
+             << static_cast<double>(frames) / secs << " frames/s, " << (client ? "resent " : "duplicates ")
+             << b.resent - a.resent << ", acks/frame "
+             << (frames ? static_cast<double>(b.acks - a.acks) / static_cast<double>(frames) : 0.0) << ", cpu "
+             << 100.0 * static_cast<double>(b.cpu_ns - a.cpu_ns) / 1e9 / secs << "%\n"
+             << defaultfloat << setprecision(6);
+    }
+
+    static constexpr size_t kPerfInFlight = 4; // messages queued at once: enough to keep the window full
+
+    static void run_perf_client(LinkchatApp &app, const Transport &link, size_t size, int count)
+    {
+        // generated once and sent count times: nothing but the engine between the buffer and the wire
+        vector<uint8_t> payload(size);
+        uint64_t x = 0x9E3779B97F4A7C15ull;
+        for (uint8_t &b : payload)
         {
-            cerr << "[ERR] set interface in config\n";
-            return false;
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            b = static_cast<uint8_t>(x);
         }
 
-        SenderConfig scfg{};
-        scfg.mtu = rcfg.mtu;
-        scfg.window = rcfg.window;
-        scfg.rto_ms = rcfg.rto_ms;
-        EthConfig ecfg{};
-        if (!make_ethcfg_for(rcfg, "ff:ff:ff:ff:ff:ff", ecfg))
+        cout << "[perf] client: " << count << " x " << size << " bytes\n";
+        deque<uint32_t> inflight;
+        int started = 0;
+        uint64_t acked = 0;
+        const PerfSample start = perf_sample(app, link, true, 0);
+        PerfSample prev = start;
+        uint64_t progress_ns = start.wall_ns;
+        while (g_running.load() && (started < count || !inflight.empty()))
         {
-            cerr << "[ERR] cannot build broadcast eth config\n";
-            return false;
+            while (started < count && inflight.size() < kPerfInFlight)
+            {
+                uint32_t id = app.send_bytes(payload, Type::MSG);
+                if (id == 0)
+                {
+                    cerr << "[ERR] send failed after " << started << " messages\n";
+                    count = started;
+                    break;
+                }
+                inflight.push_back(id);
+                started++;
+            }
+            while (!inflight.empty() && app.is_done(inflight.front()))
+            {
+                inflight.pop_front();
+                acked += size;
+                progress_ns = steady_nanos();
+            }
+
+            const uint64_t now = steady_nanos();
+            if (now - prev.wall_ns >= 1000000000ull)
+            {
+                PerfSample cur = perf_sample(app, link, true, acked);
+                print_perf(start, prev, cur, true);
+                prev = cur;
+            }
+            if (now - progress_ns > 30000000000ull)
+            {
+                cerr << "[ERR] no message acknowledged for 30s, giving up\n";
+                break;
+            }
+            this_thread::sleep_for(1ms);
         }
+        cout << "[perf] total: " << acked / max<size_t>(size, 1) << " of " << count << " messages acknowledged\n";
+        print_perf(start, start, perf_sample(app, link, true, acked), true);
+    }
 
-        LinkchatApp app(scfg);
-        AppEthHandle h{};
-        if (!bind_app_to_eth(app, ecfg, h))
+    // reports once a second while data comes in; the total runs from the first ACK this end sent
+    // (first data frame in) to the last delivery, to within 10ms
+    static void run_perf_server(LinkchatApp &app, const Transport &link, const atomic<uint64_t> &delivered, int idle_s)
+    {
+        cout << "[perf] server: waiting for a client (Ctrl-C to stop)" << endl;
+        const uint64_t acks_before = app.stats().acks_sent;
+        while (g_running.load() && app.stats().acks_sent == acks_before)
+            this_thread::sleep_for(1ms);
+        if (!g_running.load())
+            return;
+
+        const PerfSample start = perf_sample(app, link, false, 0);
+        PerfSample prev = start, last = start;
+        while (g_running.load())
         {
-            cerr << "[ERR] bind(broadcast) failed\n";
-            return false;
+            this_thread::sleep_for(10ms);
+            PerfSample cur = perf_sample(app, link, false, delivered.load());
+            if (cur.bytes != last.bytes)
+                last = cur;
+            if (cur.wall_ns - prev.wall_ns >= 1000000000ull)
+            {
+                if (cur.bytes != prev.bytes)
+                    print_perf(start, prev, cur, false);
+                prev = cur;
+            }
+            if (cur.wall_ns - last.wall_ns >= static_cast<uint64_t>(idle_s) * 1000000000ull)
+                break;
         }
+        cout << "[perf] total:\n";
+        print_perf(start, start, last, false);
+    }
 
-        app.send_bytes(bytes, Type::MSG);
+    struct XferReplies
+    {
+        mutex mu;
+        condition_variable cv;
+        bool have = false;
+        XferState state;
+    };
 
-        // pequeña espera para salir sin dejar PDUs colgando
-        auto until = chrono::steady_clock::now() + chrono::milliseconds(800);
-        while (chrono::steady_clock::now() < until)
+    static bool wait_msg_done(LinkchatApp &app, uint32_t msg_id, chrono::milliseconds stall)
+    {
+        auto until = chrono::steady_clock::now() + stall;
+        while (!app.is_done(msg_id))
         {
-            app.tick();
-            this_thread::sleep_for(chrono::milliseconds(10));
+            if (!g_running.load() || chrono::steady_clock::now() > until)
+                return false;
+            this_thread::sleep_for(5ms);
         }
-        unbind_app_from_eth(h);
         return true;
     }
 
-    static bool broadcast_send_file(const RuntimeConfig &rcfg, const string &path)
+    // sends the OFFER or MANIFEST in `query` until the peer answers with its STATE. A STATE
+    // without segments means the peer is still looking for chunks it has: wait longer for the real one
+    static bool query_xfer_state(LinkchatApp &app, uint64_t xfer_id, const vector<uint8_t> &query,
+                                 XferReplies &replies, XferState &out)
     {
-        vector<uint8_t> raw;
-        if (!read_file(path, raw))
         {
-            cerr << "[ERR] cannot read file: " << path << "\n";
-            return false;
+            lock_guard<mutex> lk(replies.mu);
+            replies.have = false;
         }
-        auto wrapped = wrap_file_with_name(path, raw); // <-- usa el helper que ya añadimos antes
-        SenderConfig scfg{};
-        scfg.mtu = rcfg.mtu;
-        scfg.window = rcfg.window;
-        scfg.rto_ms = rcfg.rto_ms;
+        bool preparing = false;
+        bool resend = true;
+        for (int attempt = 0; attempt < 4 && g_running.load(); attempt++)
+        {
+            if (resend)
+                app.send_bytes(query, Type::XFER);
+            unique_lock<mutex> lk(replies.mu);
+            resend = !replies.cv.wait_for(lk, preparing ? 5s : 500ms, [&]
+                                          { return replies.have && replies.state.xfer_id == xfer_id; });
+            if (resend)
+                continue;
+            if (replies.state.seg_count == 0)
+            {
+                if (!preparing)
+                    cout << "[xfer] peer is looking for chunks it already has...\n";
+                preparing = true;
+                replies.have = false;
+                attempt = -1;
+                continue;
+            }
+            out = replies.state;
+            return true;
+        }
+        return false;
+    }
+
+    // 1 = complete, 0 = peer does not speak this mode, -1 = failed or interrupted (resumable)
+    // delta: content-defined chunks, the peer skips the ones it already has; else fixed 1 MiB segments
+    static int send_file_resumable(LinkchatApp &app, const string &path, XferReplies &replies, bool delta)
+    {
+        const string name = fs::path(path).filename().string();
+        uint64_t xfer_id = 0;
+        uint64_t file_size = 0;
+        vector<CdcChunk> segs;
+        vector<uint8_t> query;
 
-        EthConfig ecfg{};
-        if (!make_ethcfg_for(rcfg, "ff:ff:ff:ff:ff:ff", ecfg))
+        if (delta)
         {
-            cerr << "[ERR] cannot build broadcast eth config\n";
-            return false;
+            if (!cdc_chunk_file(path, segs) || segs.empty())
+            {
+                cerr << "[ERR] cannot read file: " << path << "\n";
+                return -1;
+            }
+            XferManifest m;
+            m.xfer_id = xfer_id = manifest_xfer_id(segs, name);
+            m.file_size = file_size = segs.back().offset + segs.back().len;
+            m.name = name;
+            m.chunks = segs;
+            query = encode_manifest(m);
         }
-        LinkchatApp app(scfg);
-        AppEthHandle h{};
-        if (!bind_app_to_eth(app, ecfg, h))
+        else
         {
-            cerr << "[ERR] bind(broadcast) failed\n";
-            return false;
+            XferOffer offer{};
+            if (!file_xfer_id(path, offer.xfer_id, offer.file_size))
+            {
+                cerr << "[ERR] cannot read file: " << path << "\n";
+                return -1;
+            }
+            offer.seg_size = kXferSegSize;
+            offer.name = name;
+            xfer_id = offer.xfer_id;
+            file_size = offer.file_size;
+            for (uint64_t off = 0; off < file_size; off += kXferSegSize)
+                segs.push_back({off, static_cast<uint32_t>(min<uint64_t>(kXferSegSize, file_size - off)), {}});
+            query = encode_offer(offer);
         }
-        app.send_bytes(wrapped, Type::FILE);
-        auto until = chrono::steady_clock::now() + chrono::milliseconds(1000);
-        while (chrono::steady_clock::now() < until)
+        const uint32_t seg_count = static_cast<uint32_t>(segs.size());
+
+        XferState st;
+        if (!query_xfer_state(app, xfer_id, query, replies, st))
+            return 0;
+        if (st.seg_count != seg_count)
+            return -1;
+
+        uint32_t missing = 0;
+        uint64_t missing_bytes = 0;
+        for (uint32_t i = 0; i < seg_count; i++)
         {
-            app.tick();
-            this_thread::sleep_for(chrono::milliseconds(10));
+            if (bitmap_test(st.bitmap, i))
+                continue;
+            missing++;
+            missing_bytes += segs[i].len;
+        }
+        cout << "[xfer] " << name << ": peer has " << (seg_count - missing) << "/" << seg_count
+             << (delta ? " chunks" : " segments") << ", sending " << missing_bytes << " of " << file_size << " bytes\n";
+
+        ifstream f(path, ios::binary);
+        if (!f)
+            return -1;
+
+        // keep about 4 MiB of segment messages in flight
+        const size_t max_inflight = delta ? 64 : 4;
+        deque<uint32_t> inflight;
+        vector<uint8_t> buf;
+        for (uint32_t i = 0; i < seg_count; i++)
+        {
+            if (bitmap_test(st.bitmap, i))
+                continue;
+            if (!g_running.load())
+                return -1;
+
+            const CdcChunk &seg = segs[i];
+            buf.resize(seg.len);
+            f.seekg(static_cast<streamoff>(seg.offset));
+            f.read(reinterpret_cast<char *>(buf.data()), seg.len);
+            if (static_cast<size_t>(f.gcount()) != seg.len)
+                return -1;
+
+            uint32_t id = app.send_bytes(encode_seg(xfer_id, i, seg.offset, buf.data(), seg.len), Type::XFER);
+            if (id == 0)
+                return -1;
+            inflight.push_back(id);
+
+            while (inflight.size() >= max_inflight)
+            {
+                if (!wait_msg_done(app, inflight.front(), 30s))
+                    return -1;
+                inflight.pop_front();
+            }
+        }
+        while (!inflight.empty())
+        {
+            if (!wait_msg_done(app, inflight.front(), 30s))
+                return -1;
+            inflight.pop_front();
+        }
+
+        if (!query_xfer_state(app, xfer_id, query, replies, st))
+            return -1;
+        for (uint32_t i = 0; i < seg_count; i++)
+        {
+            if (!bitmap_test(st.bitmap, i))
+                return -1;
+        }
+        return 1;
+    }
+
+    static void print_xfer_ready(const string &name, const XferState &st, const string &done_path)
+    {
+        uint32_t have = 0;
+        for (uint32_t i = 0; i < st.seg_count; i++)
+            have += bitmap_test(st.bitmap, i) ? 1 : 0;
+        cout << "\n[xfer] " << name << ": " << have << "/" << st.seg_count << " chunks available locally\n> ";
+        if (!done_path.empty())
+            cout << "\n[file recv] saved " << done_path << "\n> ";
+    }
+
+    // state_mu: held while a MANIFEST is answered, so the STATE the store's thread sends once it
+    // is ready never goes out ahead of the "still looking" one
+    static void handle_xfer_msg(LinkchatApp &app, TransferStore &store, mutex &state_mu, const vector<uint8_t> &data)
+    {
+        XferOp op;
+        if (!xfer_op_of(data, op))
+            return;
+
+        if (op == XferOp::OFFER)
+        {
+            XferOffer offer;
+            XferState st;
+            if (!decode_offer(data, offer))
+                return;
+            if (!store.on_offer(offer, st))
+            {
+                cerr << "\n[xfer] refused " << offer.name << " (" << offer.file_size << " bytes): not enough disk space\n> ";
+                return;
+            }
+            app.send_bytes(encode_state(st), Type::XFER);
+            uint32_t have = 0;
+            for (uint32_t i = 0; i < st.seg_count; i++)
+                have += bitmap_test(st.bitmap, i) ? 1 : 0;
+            cout << "\n[xfer] " << offer.name << " offered (" << have << "/" << st.seg_count << " segments on disk)\n> ";
+            return;
+        }
+
+        if (op == XferOp::MANIFEST)
+        {
+            XferManifest m;
+            XferState st;
+            string done_path;
+            if (!decode_manifest(data, m))
+                return;
+            {
+                lock_guard<mutex> lk(state_mu);
+                if (!store.on_manifest(m, st, done_path))
+                {
+                    cerr << "\n[xfer] refused " << m.name << " (" << m.file_size << " bytes): not enough disk space\n> ";
+                    return;
+                }
+                app.send_bytes(encode_state(st), Type::XFER);
+            }
+            if (st.seg_count == 0)
+            {
+                cout << "\n[xfer] " << m.name << " offered (" << m.chunks.size() << " chunks, looking for the ones already here)\n> ";
+                return;
+            }
+            print_xfer_ready(m.name, st, done_path);
+            return;
+        }
+
+        if (op == XferOp::SEG)
+        {
+            XferSeg seg;
+            string done_path;
+            if (decode_seg(data, seg) && store.on_segment(seg, done_path) && !done_path.empty())
+                cout << "\n[file recv] saved " << done_path << "\n> ";
         }
-        unbind_app_from_eth(h);
-        return true;
     }
 }
 
 int run_cli()
 {
     RuntimeConfig cfg;
+    PeerDirectory peers;
+    PacketCapture capture; // outlives every app that records into it
     signal(SIGINT, on_sigint);
 
     cout << "LinkChat — Ethernet P2P Messenger (Layer 2)\n";
@@ -297,11 +944,18 @@ int run_cli()
             cout << "Interface : " << (cfg.ifname.empty() ? "(unset)" : cfg.ifname) << "\n"
                  << "Dest MAC  : " << (cfg.dst_mac.empty() ? "(unset)" : cfg.dst_mac) << "\n"
                  << "MTU       : " << cfg.mtu << "\n"
-                 << "Window    : " << cfg.window << "\n"
+                 << "Window    : " << cfg.window << (cfg.fec_k > cfg.window ? " (" + to_string(cfg.fec_k) + " with FEC)" : string()) << "\n"
                  << "RTO (ms)  : " << cfg.rto_ms << "\n"
+                 << "FEC K     : " << (cfg.fec_k == 0 ? string("off") : to_string(cfg.fec_k)) << "\n"
+                 << "Rate cap  : " << (cfg.rate_mbps == 0 ? string("none") : to_string(cfg.rate_mbps) + " Mbit/s") << "\n"
+                 << "Low lat RX: " << (!cfg.low_latency ? string("off") : cfg.rx_cpu < 0 ? string("spin") : "spin on cpu " + to_string(cfg.rx_cpu)) << "\n"
+                 << "Transport : " << (cfg.xdp ? "AF_XDP (AF_PACKET fallback)" : "AF_PACKET") << "\n"
+                 << "Delivery  : " << (cfg.delivery_workers == 0 ? string("on the RX thread") : to_string(cfg.delivery_workers) + " worker(s)") << "\n"
+                 << "Frame CRC : " << (cfg.trust_fcs ? "skipped for digest messages (link FCS trusted)" : "checked") << "\n"
                  << "Ethertype : 0x" << hex << cfg.ethertype << dec << "\n"
                  << "Outdir    : " << cfg.outdir << "\n"
-                 << "Alias     : " << cfg.alias << "\n";
+                 << "Alias     : " << cfg.alias << "\n"
+                 << "Links     : " << (cfg.links.empty() ? "(none)" : cfg.links) << "\n";
             continue;
         }
 
@@ -314,6 +968,12 @@ int run_cli()
 
             cout << "Destination MAC: ";
             getline(cin, cfg.dst_mac);
+            Mac by_alias{};
+            if (!cfg.dst_mac.empty() && !parse_mac(cfg.dst_mac, by_alias) && peers.lookup(cfg.dst_mac, by_alias))
+            {
+                cout << "(peer '" << cfg.dst_mac << "' is " << mac_to_string(by_alias) << ") ";
+                cfg.dst_mac = mac_to_string(by_alias);
+            }
 
             cout << "MTU (default 1500): ";
             getline(cin, s);
@@ -330,6 +990,36 @@ int run_cli()
             if (!s.empty())
                 cfg.rto_ms = max(1, atoi(s.c_str()));
 
+            cout << "FEC block size K (0 = off, default 0; the window grows to at least K): ";
+            getline(cin, s);
+            if (!s.empty())
+                cfg.fec_k = min(255, max(0, atoi(s.c_str())));
+
+            cout << "Rate cap per transfer (Mbit/s, 0 = none, default 0): ";
+            getline(cin, s);
+            if (!s.empty())
+                cfg.rate_mbps = max(0, atoi(s.c_str()));
+
+            cout << "Low-latency RX (cpu to pin, 'spin' = any cpu, empty = off): ";
+            getline(cin, s);
+            cfg.low_latency = !s.empty();
+            cfg.rx_cpu = (s.empty() || s == "spin") ? -1 : max(0, atoi(s.c_str()));
+
+            cout << "Transport ('xdp' = AF_XDP, empty = AF_PACKET): ";
+            getline(cin, s);
+            cfg.xdp = (s == "xdp");
+            if (cfg.xdp && !xdp_supported())
+                cerr << "[WARN] built without AF_XDP support, using AF_PACKET\n";
+
+            cout << "Delivery workers (0 = on the RX thread, default 1): ";
+            getline(cin, s);
+            if (!s.empty())
+                cfg.delivery_workers = min(16, max(0, atoi(s.c_str())));
+
+            cout << "Trust link FCS (skip per-frame CRC32 when messages carry a digest, y/N): ";
+            getline(cin, s);
+            cfg.trust_fcs = (s == "y" || s == "Y");
+
             cout << "Downloads dir (default 'inbox'): ";
             string s2;
             getline(cin, s2);
@@ -345,6 +1035,14 @@ int run_cli()
             if (!s2.empty())
                 cfg.alias = s2;
 
+            cout << "Extra links for striping (ifname=peer_mac,... empty = none): ";
+            getline(cin, s2);
+            vector<EthLink> links;
+            if (!parse_extra_links(s2, links))
+                cerr << "[WARN] invalid links list, striping disabled\n";
+            else
+                cfg.links = s2;
+
             cout << "[OK] Configuration saved.\n";
             continue;
         }
@@ -357,87 +1055,77 @@ int run_cli()
                 continue;
             }
 
-            SenderConfig scfg{};
-            scfg.mtu = cfg.mtu;
-            scfg.window = cfg.window;
-            scfg.rto_ms = cfg.rto_ms;
+            SenderConfig scfg = make_sendercfg_for(cfg);
 
             EthConfig ecfg{};
             ecfg.ifname = cfg.ifname;
             ecfg.ether_type = cfg.ethertype;
             ecfg.frame_mtu = static_cast<size_t>(cfg.mtu);
+            ecfg.low_latency = cfg.low_latency;
+            ecfg.rx_stamps = cfg.low_latency; // the RX latency histogram is what that mode is tuned by
+            ecfg.rx_cpu = cfg.rx_cpu;
+            ecfg.use_xdp = cfg.xdp;
 
             if (!parse_mac(cfg.dst_mac, ecfg.dst_mac))
             {
                 cerr << "[ERR] invalid destination MAC format.\n";
                 continue;
             }
+            if (!parse_extra_links(cfg.links, ecfg.extra_links))
+            {
+                cerr << "[ERR] invalid extra links.\n";
+                continue;
+            }
 
-            LinkchatApp app(scfg);
-
+            LinkchatApp app(scfg, McastConfig{}, make_deliverycfg_for(cfg));
+            use_peer_directory(app, peers, cfg);
+            app.set_capture(&capture);
+            mutex xfer_state_mu; // outlives the store's thread
+            TransferStore store(cfg.outdir);
+            // delta transfers are matched against local chunks on the store's thread; the STATE
+            // the MANIFEST could not answer right away is sent from there
+            store.set_on_ready([&](const string &name, const XferState &st, const string &done_path)
+                               {
+                                   {
+                                       lock_guard<mutex> lk(xfer_state_mu);
+                                       app.send_bytes(encode_state(st), Type::XFER);
+                                   }
+                                   print_xfer_ready(name, st, done_path);
+                               });
+            // FILE payloads are written off the RX thread; the result shows up here when it lands
+            FileSink sink(FileSinkConfig{}, [](const string &path, size_t bytes, bool ok)
+                          {
+                              if (ok)
+                                  cout << "\n[file recv] saved " << path << " (" << bytes << " bytes)\n> ";
+                              else
+                                  cerr << "\n[ERR] failed to save file " << path << "\n> ";
+                          });
+
+            // files are streamed to disk as their frames come in, never held whole
+            FileReceiver files(sink, cfg.outdir);
+            app.set_stream([](uint32_t, Type type, uint32_t, const Mac &)
+                           { return type == Type::FILE; },
+                           [&](uint32_t msg_id, uint64_t, span<const uint8_t> data, const Mac &)
+                           { files.on_data(msg_id, data); },
+                           [&](uint32_t msg_id, uint64_t, bool ok, const Mac &)
+                           { files.on_complete(msg_id, ok); });
+
+            app.set_on_refused(print_refused);
             app.set_on_deliver([&](uint32_t msg_id, Type type, const vector<uint8_t> &data, const Mac &src_mac)
                                {
-                                    if (type == Type::HELLO)
+                                    if (type == Type::XFER)
                                     {
-                                        string alias, peer_mac_ascii;
-                                        if (parse_hello_payload(data, alias, peer_mac_ascii))
-                                        {
-                                            cout << "\n[hello] peer=" << (alias.empty() ? "LinkChat User" : alias)
-                                                 << " mac=" << peer_mac_ascii << "\n";
-                                        }
-                                        else
-                                        {
-                                            // fallback to hardware MAC
-                                            string alias2;
-                                            if(!data.empty())
-                                            {
-                                                uint8_t alias_len = data[0];
-                                                if(data.size() >= 1 + alias_len)
-                                                    alias2.assign(reinterpret_cast<const char*>(&data[1]), alias_len);
-                                            }
-                                            cout << "\n[hello] peer=" << (alias2.empty() ? "LinkChat User" : alias2)
-                                                 << " mac=" << mac_to_string(src_mac) << "\n";
-                                        }
+                                        handle_xfer_msg(app, store, xfer_state_mu, data);
                                         return;
                                     }
-                                    if (type == Type::FILE) 
+                                    if (type == Type::HELLO)
                                     {
-                                        string fname;
-                                        vector<uint8_t> file_bytes;
-                                        if (unwrap_file_with_name(data, fname, file_bytes)) 
-                                        {
-                                            if (!ensure_dir(cfg.outdir)) 
-                                            {
-                                                cerr << "\n[WARN] cannot access outdir '" << cfg.outdir << "', using current dir\n> ";
-                                            }
-                                            auto outpath = (fs::path(cfg.outdir) / fs::path(fname)).string();
-                                            if (write_file(outpath, file_bytes)) 
-                                            {
-                                                cout<< "\n[file recv] saved " << outpath
-                                                    << " (" << file_bytes.size() << " bytes)\n> ";
-                                            } 
-                                            else 
-                                            {
-                                                cerr << "\n[ERR] failed to save file msg_id=" << msg_id << "\n> ";
-                                            }
-                                        } 
-                                        else 
-                                        {
-                                            // Compat: si el emisor no empaquetó nombre, guardar genérico
-                                            auto outpath = (fs::path(cfg.outdir) / fs::path("file-" + to_string(msg_id) + ".bin")).string();
-                                            if (write_file(outpath, data)) 
-                                            {
-                                                cout << "\n[file recv] saved " << outpath
-                                                    << " (" << data.size() << " bytes)\n> ";
-                                            } 
-                                            else 
-                                            {
-                                                cerr << "\n[ERR] failed to save file msg_id=" << msg_id << "\n> ";
-                                            }
-                                        }
+                                        HelloInfo hello;
+                                        decode_hello(data.data(), data.size(), hello);
+                                        cout << "\n[hello] peer=" << (hello.alias.empty() ? "LinkChat User" : hello.alias)
+                                             << " mac=" << mac_to_string(src_mac) << "\n";
                                         return;
                                     }
-
                                     cout << "\n[" << msg_id << "] " << string(data.begin(), data.end()) << "\n> "; });
 
             AppEthHandle handle{};
@@ -453,7 +1141,7 @@ int run_cli()
                             {
                 while (g_running.load()) {
                     app.tick();
-                    this_thread::sleep_for(10ms);
+                    this_thread::sleep_for(chrono::microseconds(app.tick_wait_us(10000)));
                 } });
 
             string msg;
@@ -472,53 +1160,145 @@ int run_cli()
                         continue;
                     }
                     auto wrapped = wrap_file_with_name(path, bytes);
+                    Mac peer{};
+                    parse_mac(cfg.dst_mac, peer);
+                    if (!file_fits(peers.caps_of(peer), wrapped.size()))
+                    {
+                        cerr << "[ERR] " << path << " is too large for the peer to take as one message;"
+                             << " /quit and run 'send " << path << "' instead\n> ";
+                        continue;
+                    }
                     app.send_bytes(wrapped, Type::FILE);
                     cout << "[file sent] " << fs::path(path).filename().string()
                          << " (" << bytes.size() << " bytes)\n> ";
                     continue;
                 }
 
-                if (msg.rfind("/all ", 0) == 0)
+                if (msg == "/stats")
                 {
-                    string text = msg.substr(5);
-                    vector<uint8_t> bytes(text.begin(), text.end());
-
-                    auto prev_emit = app.get_emit_pdu(); // si no tienes get_emit_pdu(), ver nota abajo
+                    AppStats st = app.stats();
+                    cout << "[stats] rx held=" << st.rx.bytes_held << " bytes in " << st.rx.msgs_held << " partial msgs"
+                         << ", evicted idle=" << st.rx.evicted_idle << " pressure=" << st.rx.evicted_pressure
+                         << ", rejected=" << st.rx.rejected << ", refused msgs=" << st.rx.refused
+                         << ", digest mismatches=" << st.rx.digest_failed << "\n"
+                         << "[stats] tx loss=" << st.tx_loss << ", srtt=" << st.tx_srtt_us << " us"
+                         << ", frames=" << st.tx.frames << " (resent " << st.tx.resent << ", repairs " << st.tx.repairs << ")"
+                         << ", multicast repairs=" << st.mcast_repairs << "\n"
+                         << "[stats] frame pool: " << st.frames.heap_allocs - st.frames.heap_frees << " buffers, "
+                         << st.frames.heap_allocs << " heap allocs, " << st.frames.reused << " reused\n";
+                    cout << "[stats] delivery: " << st.delivery.queued_msgs << " msgs (" << st.delivery.queued_bytes
+                         << " bytes) waiting, " << st.delivery.delivered << " delivered, " << st.delivery.over_limit
+                         << " over the queue limit\n";
+                    FileSinkStats fst = sink.stats();
+                    cout << "[stats] file sink (" << fst.backend << "): " << fst.files_written << " saved, "
+                         << fst.files_failed << " failed, " << fst.bytes_written << " bytes written, "
+                         << fst.bytes_inflight << " bytes pending, " << fst.submit_waits << " waits\n";
+                    CaptureStats cst = capture.stats();
+                    if (cst.on || cst.captured > 0)
+                        cout << "[stats] capture " << (cst.on ? "on" : "off") << ": " << cst.captured << " frames, "
+                             << cst.dropped << " dropped, " << cst.bytes_written << " bytes\n";
+                    LatencyPercentiles lat = handle.transport->rx_latency();
+                    if (lat.count > 0)
+                        cout << "[stats] rx latency (kernel -> app, " << lat.count << " frames): p50=" << lat.p50 / 1000.0
+                             << " us, p90=" << lat.p90 / 1000.0 << " us, p99=" << lat.p99 / 1000.0 << " us, p99.9="
+                             << lat.p999 / 1000.0 << " us, max=" << lat.max / 1000.0 << " us\n";
+                    print_latency(app.latency(), false);
+                    cout << "> ";
+                    continue;
+                }
 
-                    linkchat::Mac bcast{};
-                    fill(begin(bcast.bytes), end(bcast.bytes), 0xFF);
+                if (msg == "/latency" || msg == "/latency reset")
+                {
+                    if (msg == "/latency reset")
+                    {
+                        app.latency().reset();
+                        cout << "[latency] cleared\n> ";
+                        continue;
+                    }
+                    print_latency(app.latency(), true);
+                    cout << "> ";
+                    continue;
+                }
 
-                    app.set_emit_pdu([&](const vector<uint8_t> &pdu)
-                                     {
-                                         (void)eth_send_pdu_to(bcast, pdu); 
-                                     });
+                if (msg == "/ping" || msg.rfind("/ping ", 0) == 0)
+                {
+                    int count = 10;
+                    istringstream args(msg.substr(5));
+                    args >> count;
+                    Mac dst{};
+                    if (count > 0 && parse_mac(cfg.dst_mac, dst))
+                        run_ping(app, peers, dst, count);
+                    else
+                        cerr << "[ERR] usage: /ping [count]\n";
+                    cout << "> ";
+                    continue;
+                }
 
-                    app.send_bytes(bytes, linkchat::Type::MSG);
+                if (msg == "/capture" || msg.rfind("/capture ", 0) == 0)
+                {
+                    capture_command(capture, msg.size() > 9 ? msg.substr(9) : string(), cfg);
+                    cout << "> ";
+                    continue;
+                }
 
-                    auto until = chrono::steady_clock::now() + chrono::milliseconds(600);
-                    while (chrono::steady_clock::now() < until)
-                    {
-                        app.tick();
-                        this_thread::sleep_for(chrono::milliseconds(10));
-                    }
+                if (msg == "/peers")
+                {
+                    print_peers(peers);
+                    cout << "> ";
+                    continue;
+                }
 
-                    app.set_emit_pdu(prev_emit);
+                if (msg == "/links")
+                {
+                    for (const auto &st : handle.transport->link_stats())
+                        cout << "[link] " << st.name << " (" << st.backend << ") tx=" << st.tx_frames << " rx=" << st.rx_frames << "\n";
+                    cout << "> ";
+                    continue;
+                }
 
-                    cout << "[broadcast] sent (" << bytes.size() << " bytes)\n> ";
+                if (msg.rfind("/all ", 0) == 0)
+                {
+                    string text = msg.substr(5);
+                    vector<uint8_t> bytes(text.begin(), text.end());
+                    if (app.send_group(bytes, Type::MSG) == 0)
+                        cerr << "[ERR] multicast send failed\n> ";
+                    else
+                        cout << "[multicast] sent (" << bytes.size() << " bytes)\n> ";
                     continue;
                 }
 
                 if (msg.rfind("/allfile ", 0) == 0)
                 {
                     string path = msg.substr(string("/allfile ").size());
-                    if (broadcast_send_file(cfg, path))
+                    vector<uint8_t> bytes;
+                    if (!read_file(path, bytes))
                     {
-                        cout << "[broadcast file] sent " << fs::path(path).filename().string() << "\n> ";
+                        cerr << "[ERR] cannot read file: " << path << "\n> ";
+                        continue;
                     }
-                    else
+                    auto wrapped = wrap_file_with_name(path, bytes);
+                    string too_small;
+                    for (const PeerInfo &p : peers.snapshot())
+                        if (!file_fits(p.caps, wrapped.size()))
+                            too_small += (too_small.empty() ? "" : ", ") + (p.alias.empty() ? mac_to_string(p.mac) : p.alias);
+                    if (!too_small.empty())
+                    {
+                        cerr << "[ERR] " << path << " is too large for " << too_small << " to take as one message\n> ";
+                        continue;
+                    }
+                    uint64_t repairs_before = app.mcast_repair_frames();
+                    uint32_t id = app.send_group(wrapped, Type::FILE);
+                    if (id == 0)
                     {
-                        cerr << "[ERR] broadcast file failed\n> ";
+                        cerr << "[ERR] multicast send failed\n> ";
+                        continue;
                     }
+                    // done once no receiver has NAKed for a linger period
+                    while (!app.is_done(id) && g_running.load())
+                        this_thread::sleep_for(20ms);
+                    cout << "[multicast file] sent " << fs::path(path).filename().string()
+                         << " (" << bytes.size() << " bytes, "
+                         << (app.mcast_repair_frames() - repairs_before) << " repair frames)\n> ";
                     continue;
                 }
 
@@ -550,22 +1330,47 @@ int run_cli()
                 continue;
             }
 
-            SenderConfig scfg{};
-            scfg.mtu = cfg.mtu;
-            scfg.window = cfg.window;
-            scfg.rto_ms = cfg.rto_ms;
+            SenderConfig scfg = make_sendercfg_for(cfg);
 
             EthConfig ecfg{};
             ecfg.ifname = cfg.ifname;
             ecfg.ether_type = cfg.ethertype;
             ecfg.frame_mtu = static_cast<size_t>(cfg.mtu);
+            ecfg.low_latency = cfg.low_latency;
+            ecfg.rx_cpu = cfg.rx_cpu;
+            ecfg.use_xdp = cfg.xdp;
             if (!parse_mac(cfg.dst_mac, ecfg.dst_mac))
             {
                 cerr << "[ERR] invalid destination MAC format.\n";
                 continue;
             }
+            if (!parse_extra_links(cfg.links, ecfg.extra_links))
+            {
+                cerr << "[ERR] invalid extra links.\n";
+                continue;
+            }
+
+            LinkchatApp app(scfg, McastConfig{}, make_deliverycfg_for(cfg));
+            use_peer_directory(app, peers, cfg);
+            app.set_capture(&capture);
+            XferReplies replies;
+            atomic<bool> refused{false};
+            app.set_on_refused([&](uint32_t msg_id, Type type, RejectReason reason)
+                               {
+                                   refused.store(true);
+                                   print_refused(msg_id, type, reason); });
+            app.set_on_deliver([&](uint32_t, Type type, const vector<uint8_t> &data, const Mac &)
+                               {
+                                    XferState st;
+                                    if (type != Type::XFER || !decode_state(data, st))
+                                        return;
+                                    {
+                                        lock_guard<mutex> lk(replies.mu);
+                                        replies.state = move(st);
+                                        replies.have = true;
+                                    }
+                                    replies.cv.notify_all(); });
 
-            LinkchatApp app(scfg);
             AppEthHandle handle{};
             if (!bind_app_to_eth(app, ecfg, handle))
             {
@@ -573,27 +1378,72 @@ int run_cli()
                 continue;
             }
 
-            vector<uint8_t> bytes;
-            if (!read_file(path, bytes))
+            atomic<bool> ticking{true};
+            thread tick_thr([&]()
+                            {
+                while (ticking.load()) {
+                    app.tick();
+                    this_thread::sleep_for(chrono::microseconds(app.tick_wait_us(10000)));
+                } });
+
+            int rc = send_file_resumable(app, path, replies, true);
+            if (rc == 0)
+                rc = send_file_resumable(app, path, replies, false);
+            if (rc == 1)
             {
-                cerr << "[ERR] cannot read file: " << path << "\n";
-                unbind_app_from_eth(handle);
-                continue;
+                cout << "[file sent] " << fs::path(path).filename().string() << "\n";
             }
-            auto wrapped = wrap_file_with_name(path, bytes);
-            app.send_bytes(wrapped, Type::FILE);
-            cout << "[file sent] " << fs::path(path).filename().string() << " (" << bytes.size() << " bytes)\n";
-
-            auto until = chrono::steady_clock::now() + 1500ms;
-            while (chrono::steady_clock::now() < until)
+            else if (rc < 0)
             {
-                app.tick();
-                this_thread::sleep_for(10ms);
+                cerr << "[ERR] transfer interrupted, run 'send " << path << "' again to resume\n";
             }
+            else
+            {
+                // peer without resumable transfers: one FILE message
+                vector<uint8_t> bytes;
+                if (!read_file(path, bytes))
+                {
+                    cerr << "[ERR] cannot read file: " << path << "\n";
+                }
+                else
+                {
+                    auto wrapped = wrap_file_with_name(path, bytes);
+                    if (!file_fits(peers.caps_of(ecfg.dst_mac), wrapped.size()))
+                    {
+                        cerr << "[ERR] " << path << " is too large for the peer to take as one message\n";
+                    }
+                    else
+                    {
+                        uint32_t id = app.send_bytes(wrapped, Type::FILE);
+                        if (id != 0 && wait_msg_done(app, id, 30s) && !refused.load())
+                            cout << "[file sent] " << fs::path(path).filename().string() << " (" << bytes.size() << " bytes)\n";
+                        else if (!refused.load())
+                            cerr << "[ERR] file not acknowledged by peer\n";
+                    }
+                }
+            }
+
+            ticking.store(false);
+            if (tick_thr.joinable())
+                tick_thr.join();
             unbind_app_from_eth(handle);
             continue;
         }
 
+        if (cmd == "capture")
+        {
+            string arg;
+            getline(ss >> ws, arg);
+            capture_command(capture, arg, cfg);
+            continue;
+        }
+
+        if (cmd == "peers")
+        {
+            print_peers(peers);
+            continue;
+        }
+
         if (cmd == "discover")
         {
             if (cfg.ifname.empty())
@@ -602,59 +1452,160 @@ int run_cli()
                 continue;
             }
 
-            linkchat::SenderConfig scfg{};
-            scfg.mtu = cfg.mtu;
-            scfg.window = cfg.window;
-            scfg.rto_ms = cfg.rto_ms;
-            linkchat::EthConfig ecfg{};
+            SenderConfig scfg = make_sendercfg_for(cfg);
+            EthConfig ecfg{};
             ecfg.ifname = cfg.ifname;
             ecfg.ether_type = cfg.ethertype;
-            ecfg.frame_mtu = (size_t)cfg.mtu;
+            ecfg.frame_mtu = static_cast<size_t>(cfg.mtu);
+            ecfg.dst_mac = kMcastGroup; // only HELLOs go out, addressed per frame
 
-            if (!linkchat::parse_mac("ff:ff:ff:ff:ff:ff", ecfg.dst_mac))
+            LinkchatApp app(scfg);
+            use_peer_directory(app, peers, cfg);
+            app.set_capture(&capture);
+
+            AppEthHandle h{};
+            if (!bind_app_to_eth(app, ecfg, h))
             {
-                cerr << "[ERR] cannot parse broadcast MAC\n";
+                cerr << "[ERR] bind failed\n";
                 continue;
             }
 
-            linkchat::LinkchatApp app(scfg);
-            // Reutiliza el mismo set_on_deliver de arriba si está en scope; si no, registra uno local simplificado
-            app.set_on_deliver([&](uint32_t, linkchat::Type type, const vector<uint8_t> &data, const linkchat::Mac &src)
-                               {
-                                    if (type != linkchat::Type::HELLO) return;
-                                    string nick; if (!data.empty()) {
-                                    auto nlen = data[0];
-                                    if (data.size() >= 1 + nlen) nick.assign((const char*)&data[1], nlen);
-                                }
-            cout<< "[discover] " << (nick.empty() ? "(anon)" : nick)
-                << "  mac=" << linkchat::mac_to_string(src) << "\n"; });
+            // binding probes the segment; peers answer within their reply jitter
+            auto end = chrono::steady_clock::now() + 1s;
+            while (chrono::steady_clock::now() < end && g_running.load())
+            {
+                app.tick();
+                this_thread::sleep_for(10ms);
+            }
+            unbind_app_from_eth(h);
+            print_peers(peers);
+            cout << "[discover] done. Use a peer alias or MAC as destination in 'config'.\n";
+            continue;
+        }
 
-            linkchat::AppEthHandle h{};
-            if (!linkchat::bind_app_to_eth(app, ecfg, h))
+        if (cmd == "perf")
+        {
+            string mode;
+            ss >> mode;
+            const bool client = mode == "client";
+            if (!client && mode != "server")
             {
-                cerr << "[ERR] bind failed\n";
+                cerr << "[ERR] usage: perf server [idle_s] | perf client [size] [count]\n";
+                continue;
+            }
+            if (cfg.ifname.empty() || cfg.dst_mac.empty())
+            {
+                cerr << "[ERR] please run 'config' first.\n";
                 continue;
             }
 
-            // build HELLO with alias and real local MAC in ascii
-            string my_mac_ascii = get_local_mac_ascii(cfg.ifname);
-            auto payload = build_hello_payload(cfg.alias, my_mac_ascii);
-            app.send_bytes(payload, Type::HELLO);
+            long long size = 1048576, count = 100, idle_s = 5;
+            if (client)
+                ss >> size >> count;
+            else
+                ss >> idle_s;
+            if (size <= 0 || count <= 0 || idle_s <= 0)
+            {
+                cerr << "[ERR] size, count and idle_s must be positive\n";
+                continue;
+            }
 
-            cout << "[discover] HELLO broadcast sent (nick=" << cfg.alias
-                 << ", mac=" << (my_mac_ascii.empty() ? "unknown" : my_mac_ascii) << "). Listening 10s...\n";
-            auto end = chrono::steady_clock::now() + chrono::seconds(10);
-            while (chrono::steady_clock::now() < end)
+            EthConfig ecfg{};
+            if (!make_ethcfg_for(cfg, cfg.dst_mac, ecfg))
             {
-                app.send_hello(cfg.alias);
-                for (int i = 0; i < 100; i++)
-                {
+                cerr << "[ERR] invalid destination MAC or extra links.\n";
+                continue;
+            }
+
+            LinkchatApp app(make_sendercfg_for(cfg), McastConfig{}, make_deliverycfg_for(cfg));
+            use_peer_directory(app, peers, cfg);
+            app.set_capture(&capture);
+            // the server throws the data away as it arrives in order: messages are streamed,
+            // never held whole, and goodput counts bytes rather than finished messages
+            atomic<uint64_t> delivered{0};
+            app.set_stream([](uint32_t, Type, uint32_t, const Mac &)
+                           { return true; },
+                           [&](uint32_t, uint64_t, span<const uint8_t> data, const Mac &)
+                           { delivered.fetch_add(data.size()); },
+                           nullptr);
+
+            AppEthHandle handle{};
+            if (!bind_app_to_eth(app, ecfg, handle))
+            {
+                cerr << "[ERR] bind failed\n";
+                continue;
+            }
+
+            atomic<bool> ticking{true};
+            thread tick_thr([&]()
+                            {
+                while (ticking.load()) {
                     app.tick();
-                    this_thread::sleep_for(chrono::milliseconds(10));
-                }
+                    this_thread::sleep_for(chrono::microseconds(app.tick_wait_us(10000)));
+                } });
+
+            if (client)
+                run_perf_client(app, *handle.transport, static_cast<size_t>(size), static_cast<int>(count));
+            else
+                run_perf_server(app, *handle.transport, delivered, static_cast<int>(idle_s));
+
+            ticking.store(false);
+            if (tick_thr.joinable())
+                tick_thr.join();
+            unbind_app_from_eth(handle);
+            continue;
+        }
+
+        if (cmd == "ping")
+        {
+            if (cfg.ifname.empty())
+            {
+                cerr << "[ERR] please run 'config' first.\n";
+                continue;
+            }
+
+            // "ping", "ping 5", "ping <peer>" or "ping 5 <peer>"; the peer defaults to the configured one
+            int count = 10;
+            string target = cfg.dst_mac, arg;
+            while (ss >> arg)
+            {
+                if (!arg.empty() && all_of(arg.begin(), arg.end(), ::isdigit))
+                    count = stoi(arg);
+                else
+                    target = arg;
+            }
+            Mac dst{};
+            if (!parse_mac(target, dst) && !peers.lookup(target, dst))
+            {
+                cerr << "[ERR] unknown peer '" << target << "' (MAC or alias from 'peers')\n";
+                continue;
+            }
+            if (count <= 0)
+            {
+                cerr << "[ERR] count must be positive\n";
+                continue;
+            }
+
+            SenderConfig scfg = make_sendercfg_for(cfg);
+            EthConfig ecfg{};
+            ecfg.ifname = cfg.ifname;
+            ecfg.ether_type = cfg.ethertype;
+            ecfg.frame_mtu = static_cast<size_t>(cfg.mtu);
+            ecfg.dst_mac = dst;
+            ecfg.hw_stamps = true; // put back as it was when the link closes
+
+            LinkchatApp app(scfg);
+            use_peer_directory(app, peers, cfg);
+            app.set_capture(&capture);
+
+            AppEthHandle h{};
+            if (!bind_app_to_eth(app, ecfg, h))
+            {
+                cerr << "[ERR] bind failed\n";
+                continue;
             }
-            linkchat::unbind_app_from_eth(h);
-            cout << "[discover] done. Set peer MAC in 'config' and use 'chat'.\n";
+            run_ping(app, peers, dst, count);
+            unbind_app_from_eth(h);
             continue;
         }
 
@@ -16,9 +16,17 @@ struct RuntimeConfig {
     std::string dst_mac;     // MAC dst
     std::string outdir   = "inbox"; //  downloads here 
     std::string alias = "LinkChat User"; //user alias 
+    std::string links;       // extra striping links "eth1=aa:bb:..,eth2=..."
     int         mtu      = 1500;
     int         window   = 1;
     int         rto_ms   = 300;
+    int         fec_k    = 0;    // data frames per FEC block, 0 = off
+    int         rate_mbps = 0;   // pacing cap per transfer in Mbit/s, 0 = none
+    bool        low_latency = false; // busy-polling RX thread
+    int         rx_cpu   = -1;   // core the low-latency RX thread is pinned to, -1 = any
+    bool        xdp      = false; // AF_XDP sockets instead of AF_PACKET
+    int         delivery_workers = 1; // threads running on_deliver, 0 = the RX thread
+    bool        trust_fcs = false; // peers with digests may skip per-frame CRC32 (NIC checks the FCS)
     uint16_t    ethertype = 0x88B5;
 };
 
@@ -0,0 +1,208 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+namespace linkchat
+{
+    // Wire layouts described at compile time. A PDU (or payload) layout is a Codec over a struct
+    // and an ordered list of its members; widths come from the member types, offsets from the
+    // fields before them, so encode/decode are a fixed sequence of inlined loads and stores with
+    // no offsets written by hand:
+    //
+    //     using AckCodec = Codec<AckFields, Field<&AckFields::msg_id>, Field<&AckFields::highest_seq_ok>>;
+    //     static_assert(AckCodec::size == 8);
+    //
+    // Fields are unsigned integers (big-endian on the wire) or enums over them; an enum decodes
+    // only if WireEnum<E>::valid accepts the byte.
+
+    // unaligned big-endian loads and stores: one memcpy and a byte swap
+    template <typename T>
+    inline T load_be(const std::uint8_t *p) noexcept
+    {
+        static_assert(std::is_unsigned_v<T>, "wire integers are unsigned");
+        T v;
+        std::memcpy(&v, p, sizeof(v));
+        if constexpr (sizeof(T) == 2 && std::endian::native == std::endian::little)
+            v = __builtin_bswap16(v);
+        else if constexpr (sizeof(T) == 4 && std::endian::native == std::endian::little)
+            v = __builtin_bswap32(v);
+        else if constexpr (sizeof(T) == 8 && std::endian::native == std::endian::little)
+            v = __builtin_bswap64(v);
+        return v;
+    }
+
+    template <typename T>
+    inline void store_be(std::uint8_t *p, T v) noexcept
+    {
+        static_assert(std::is_unsigned_v<T>, "wire integers are unsigned");
+        if constexpr (sizeof(T) == 2 && std::endian::native == std::endian::little)
+            v = __builtin_bswap16(v);
+        else if constexpr (sizeof(T) == 4 && std::endian::native == std::endian::little)
+            v = __builtin_bswap32(v);
+        else if constexpr (sizeof(T) == 8 && std::endian::native == std::endian::little)
+            v = __builtin_bswap64(v);
+        std::memcpy(p, &v, sizeof(v));
+    }
+
+    inline std::uint16_t load_be16(const std::uint8_t *p) noexcept { return load_be<std::uint16_t>(p); }
+    inline std::uint32_t load_be32(const std::uint8_t *p) noexcept { return load_be<std::uint32_t>(p); }
+    inline std::uint64_t load_be64(const std::uint8_t *p) noexcept { return load_be<std::uint64_t>(p); }
+
+    // which values of an enum field are on the protocol; specialized next to the enum
+    template <typename E>
+    struct WireEnum
+    {
+        static constexpr bool valid(std::underlying_type_t<E>) noexcept { return true; }
+    };
+
+    namespace codec_detail
+    {
+        template <typename M>
+        struct member_of;
+        template <typename S, typename V>
+        struct member_of<V S::*>
+        {
+            using owner = S;
+            using value = V;
+        };
+
+        template <typename V, bool = std::is_enum_v<V>>
+        struct wire_of
+        {
+            using type = V;
+        };
+        template <typename V>
+        struct wire_of<V, true>
+        {
+            using type = std::underlying_type_t<V>;
+        };
+    }
+
+    // one member of the layout, in wire order
+    template <auto Member>
+    struct Field
+    {
+        using Owner = typename codec_detail::member_of<decltype(Member)>::owner;
+        using Value = typename codec_detail::member_of<decltype(Member)>::value;
+        using Wire = typename codec_detail::wire_of<Value>::type;
+        static_assert(std::is_unsigned_v<Wire>, "fields are unsigned integers or enums over them");
+
+        static constexpr auto member = Member;
+        static constexpr std::size_t width = sizeof(Wire);
+
+        static Value read(const std::uint8_t *p) noexcept { return static_cast<Value>(load_be<Wire>(p)); }
+        static void write(std::uint8_t *p, Value v) noexcept { store_be<Wire>(p, static_cast<Wire>(v)); }
+        static bool valid(Value v) noexcept
+        {
+            if constexpr (std::is_enum_v<Value>)
+                return WireEnum<Value>::valid(static_cast<Wire>(v));
+            else
+                return true;
+        }
+        static bool valid_at(const std::uint8_t *p) noexcept
+        {
+            if constexpr (std::is_enum_v<Value>)
+                return WireEnum<Value>::valid(load_be<Wire>(p));
+            else
+                return true;
+        }
+    };
+
+    template <typename S, typename... Fields>
+    struct Codec
+    {
+        static_assert(sizeof...(Fields) > 0, "a layout needs fields");
+        static_assert((std::is_same_v<typename Fields::Owner, S> && ...), "every field must be a member of S");
+
+        using Struct = S;
+        static constexpr std::size_t size = (Fields::width + ...);
+        static constexpr std::array<std::size_t, sizeof...(Fields)> offsets = []
+        {
+            std::array<std::size_t, sizeof...(Fields)> o{};
+            std::size_t at = 0, i = 0;
+            ((o[i++] = at, at += Fields::width), ...);
+            return o;
+        }();
+
+        // where Member sits; naming a member that is not in the layout fails to compile
+        template <auto Member>
+        static constexpr std::size_t offset_of() noexcept
+        {
+            constexpr std::size_t i = index_of<Member>();
+            static_assert(i < sizeof...(Fields), "member is not part of this layout");
+            return offsets[i];
+        }
+
+        // a single field straight from the wire (PduView's accessors)
+        template <auto Member>
+        static auto read(const std::uint8_t *in) noexcept
+        {
+            return Field<Member>::read(in + offset_of<Member>());
+        }
+
+        static void encode(const S &s, std::uint8_t *out) noexcept
+        {
+            encode_at(s, out, std::index_sequence_for<Fields...>{});
+        }
+
+        // false, with out partly filled, when an enum field holds a value off the protocol
+        static bool decode(const std::uint8_t *in, S &out) noexcept
+        {
+            return decode_at(in, out, std::index_sequence_for<Fields...>{});
+        }
+
+        // the enum fields hold values on the protocol; always true for plain integer layouts
+        static bool valid(const S &s) noexcept
+        {
+            return (Fields::valid(s.*Fields::member) & ...);
+        }
+
+        // the same, checked on the wire bytes before decoding
+        static bool valid_at(const std::uint8_t *in) noexcept
+        {
+            return valid_at(in, std::index_sequence_for<Fields...>{});
+        }
+
+    private:
+        template <auto Member>
+        static constexpr std::size_t index_of() noexcept
+        {
+            std::size_t i = 0, found = sizeof...(Fields);
+            ((same_member<Fields, Member>() ? (found = i, i++) : i++), ...);
+            return found;
+        }
+
+        template <typename F, auto Member>
+        static constexpr bool same_member() noexcept
+        {
+            if constexpr (std::is_same_v<std::remove_cv_t<decltype(F::member)>, decltype(Member)>)
+                return F::member == Member;
+            else
+                return false;
+        }
+
+        template <std::size_t... I>
+        static void encode_at(const S &s, std::uint8_t *out, std::index_sequence<I...>) noexcept
+        {
+            (Fields::write(out + offsets[I], s.*Fields::member), ...);
+        }
+
+        template <std::size_t... I>
+        static bool decode_at(const std::uint8_t *in, S &out, std::index_sequence<I...>) noexcept
+        {
+            ((out.*Fields::member = Fields::read(in + offsets[I])), ...);
+            return valid_at(in, std::index_sequence<I...>{});
+        }
+
+        template <std::size_t... I>
+        static bool valid_at(const std::uint8_t *in, std::index_sequence<I...>) noexcept
+        {
+            return (Fields::valid_at(in + offsets[I]) & ...);
+        }
+    };
+}
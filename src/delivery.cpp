@@ -0,0 +1,151 @@
+#include "delivery.hpp"
+#include "util/time.hpp"
+#include <algorithm>
+
+using namespace std;
+
+namespace linkchat
+{
+    DeliveryQueue::DeliveryQueue(DeliveryConfig cfg, const DeliverMsgFn &deliver, LatencyBook *latency,
+                                 const StreamDelivery *stream)
+        : cfg_(cfg), deliver_(deliver), latency_(latency), stream_(stream)
+    {
+        for (unsigned i = 0; i < cfg_.workers; i++)
+            lanes_.push_back(make_unique<Lane>());
+        for (auto &lane : lanes_)
+        {
+            Lane *l = lane.get();
+            l->worker = thread([this, l]
+                               { run(*l); });
+        }
+    }
+
+    DeliveryQueue::~DeliveryQueue()
+    {
+        for (auto &lane : lanes_)
+        {
+            {
+                lock_guard<mutex> lk(lane->mu);
+                lane->stopping = true;
+            }
+            lane->cv_work.notify_all();
+        }
+        for (auto &lane : lanes_)
+            if (lane->worker.joinable())
+                lane->worker.join();
+    }
+
+    // the sample is taken as on_deliver starts: time spent queued counts, on_deliver itself does not
+    void DeliveryQueue::deliver(const Item &item) noexcept
+    {
+        if (item.kind != Kind::Message)
+        {
+            if (!stream_)
+                return;
+            if (item.kind == Kind::Data && stream_->on_data)
+                stream_->on_data(item.msg_id, item.offset, item.piece, item.src);
+            else if (item.kind == Kind::Done && stream_->on_complete)
+                stream_->on_complete(item.msg_id, item.offset, item.ok, item.src);
+            return;
+        }
+        if (latency_ && item.first_us != 0)
+            latency_->record(LatencyMetric::Delivery, item.type, item.src, steady_micros() - item.first_us);
+        deliver_(item.msg_id, item.type, item.data, item.src);
+    }
+
+    void DeliveryQueue::push(uint32_t msg_id, Type type, vector<uint8_t> data, const Mac &src_mac, uint64_t first_us)
+    {
+        enqueue(Item{.msg_id = msg_id, .type = type, .data = move(data), .src = src_mac, .first_us = first_us});
+    }
+
+    void DeliveryQueue::push_data(uint32_t msg_id, uint64_t offset, FrameRef frame, span<const uint8_t> data, const Mac &src_mac)
+    {
+        enqueue(Item{.msg_id = msg_id, .src = src_mac, .kind = Kind::Data, .frame = move(frame), .piece = data, .offset = offset});
+    }
+
+    void DeliveryQueue::push_done(uint32_t msg_id, uint64_t bytes, bool ok, const Mac &src_mac)
+    {
+        enqueue(Item{.msg_id = msg_id, .src = src_mac, .kind = Kind::Done, .offset = bytes, .ok = ok});
+    }
+
+    // streamed pieces count as bytes, not as messages; a streamed message counts once, at its end
+    void DeliveryQueue::enqueue(Item item)
+    {
+        const bool whole = item.kind != Kind::Data;
+        if (lanes_.empty())
+        {
+            deliver(item);
+            if (whole)
+                delivered_.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+
+        const size_t size = item.bytes();
+        if (queued_bytes_.fetch_add(size) + size > cfg_.max_queued_bytes)
+            over_limit_.fetch_add(1, memory_order_relaxed);
+        if (whole)
+            queued_msgs_.fetch_add(1);
+
+        Lane &lane = *lanes_[mac_to_u64(item.src) % lanes_.size()];
+        {
+            lock_guard<mutex> lk(lane.mu);
+            lane.items.push_back(move(item));
+        }
+        lane.cv_work.notify_one();
+    }
+
+    void DeliveryQueue::run(Lane &lane) noexcept
+    {
+        unique_lock<mutex> lk(lane.mu);
+        for (;;)
+        {
+            lane.cv_work.wait(lk, [&]
+                              { return !lane.items.empty() || lane.stopping; });
+            if (lane.items.empty())
+                return;
+            Item item = move(lane.items.front());
+            lane.items.pop_front();
+            lane.busy = true;
+            lk.unlock();
+
+            deliver(item);
+            queued_bytes_.fetch_sub(item.bytes());
+            if (item.kind != Kind::Data)
+            {
+                queued_msgs_.fetch_sub(1);
+                delivered_.fetch_add(1, memory_order_relaxed);
+            }
+
+            lk.lock();
+            lane.busy = false;
+            if (lane.items.empty())
+                lane.cv_idle.notify_all();
+        }
+    }
+
+    void DeliveryQueue::flush()
+    {
+        for (auto &lane : lanes_)
+        {
+            unique_lock<mutex> lk(lane->mu);
+            lane->cv_idle.wait(lk, [&]
+                               { return lane->items.empty() && !lane->busy; });
+        }
+    }
+
+    size_t DeliveryQueue::room() const noexcept
+    {
+        const size_t queued = queued_bytes_.load(memory_order_relaxed);
+        return queued >= cfg_.max_queued_bytes ? 0 : cfg_.max_queued_bytes - queued;
+    }
+
+    DeliveryStats DeliveryQueue::stats() const
+    {
+        DeliveryStats st{};
+        st.queued_msgs = queued_msgs_.load(memory_order_relaxed);
+        st.queued_bytes = queued_bytes_.load(memory_order_relaxed);
+        st.delivered = delivered_.load(memory_order_relaxed);
+        st.over_limit = over_limit_.load(memory_order_relaxed);
+        return st;
+    }
+}
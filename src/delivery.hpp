@@ -0,0 +1,131 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <span>
+#include "util/structs.hpp" // Type
+#include "util/frame_pool.hpp" // FrameRef
+#include "util/mac.hpp"     // Mac
+#include "latency.hpp"      // LatencyBook
+
+namespace linkchat
+{
+    using DeliverMsgFn = std::function<void(std::uint32_t msg_id,
+                                            Type type,
+                                            const std::vector<std::uint8_t> &data,
+                                            const Mac &src_mac)>;
+
+    // progressive delivery (LinkchatApp::set_stream): the pieces of a streamed message in order,
+    // then its end; ok = false means what came before must be thrown away
+    using DeliverDataFn = std::function<void(std::uint32_t msg_id, std::uint64_t offset,
+                                             std::span<const std::uint8_t> data, const Mac &src_mac)>;
+    using DeliverDoneFn = std::function<void(std::uint32_t msg_id, std::uint64_t bytes, bool ok, const Mac &src_mac)>;
+
+    struct StreamDelivery
+    {
+        DeliverDataFn on_data;
+        DeliverDoneFn on_complete;
+    };
+
+    struct DeliveryConfig
+    {
+        unsigned workers = 1;                                 // 0 = on_deliver runs on the RX thread
+        std::size_t max_queued_bytes = std::size_t(64) << 20; // the advertised receive window closes as this fills
+    };
+
+    struct DeliveryStats
+    {
+        std::size_t queued_msgs;
+        std::size_t queued_bytes;
+        std::uint64_t delivered;
+        std::uint64_t over_limit; // queued past max_queued_bytes: already ACKed, so never dropped
+    };
+
+    // Completed messages wait here for the application, so a slow on_deliver never holds up
+    // the RX thread. A peer always lands on the same worker, which keeps its messages in
+    // order; different peers are delivered side by side. Streamed messages go the same way,
+    // piece by piece, and their bytes count against the window like a whole message's.
+    class DeliveryQueue
+    {
+    public:
+        // deliver (and stream's callbacks) are called by the workers; they must outlive the queue, and
+        // so must latency, which gets a Delivery sample for every message pushed with its first frame's time
+        DeliveryQueue(DeliveryConfig cfg, const DeliverMsgFn &deliver, LatencyBook *latency = nullptr,
+                      const StreamDelivery *stream = nullptr);
+        ~DeliveryQueue(); // delivers what is queued, then stops
+        DeliveryQueue(const DeliveryQueue &) = delete;
+        DeliveryQueue &operator=(const DeliveryQueue &) = delete;
+
+        // first_us: steady_micros() of the message's first frame, 0 = no latency sample
+        void push(std::uint32_t msg_id, Type type, std::vector<std::uint8_t> data, const Mac &src_mac, std::uint64_t first_us = 0);
+
+        // a piece of a streamed message; data lies in frame, which the queue holds on to
+        void push_data(std::uint32_t msg_id, std::uint64_t offset, FrameRef frame, std::span<const std::uint8_t> data, const Mac &src_mac);
+        void push_done(std::uint32_t msg_id, std::uint64_t bytes, bool ok, const Mac &src_mac);
+
+        // returns once everything pushed before the call has been delivered
+        void flush();
+
+        // bytes that still fit before the queue is full, what ACKs advertise as the window
+        std::size_t room() const noexcept;
+        std::size_t capacity() const noexcept { return cfg_.max_queued_bytes; }
+
+        DeliveryStats stats() const;
+
+    private:
+        enum class Kind : std::uint8_t
+        {
+            Message,
+            Data,   // streamed piece
+            Done    // end of a streamed message
+        };
+
+        struct Item
+        {
+            std::uint32_t msg_id{0};
+            Type type{};
+            std::vector<std::uint8_t> data{};
+            Mac src{};
+            std::uint64_t first_us{0};
+            Kind kind{Kind::Message};
+            FrameRef frame{};                   // Data: holds piece
+            std::span<const std::uint8_t> piece{};
+            std::uint64_t offset{0};            // Data: where piece goes; Done: bytes in all
+            bool ok{true};                      // Done
+
+            std::size_t bytes() const noexcept { return kind == Kind::Data ? piece.size() : data.size(); }
+        };
+
+        struct Lane
+        {
+            std::mutex mu;
+            std::condition_variable cv_work;
+            std::condition_variable cv_idle;
+            std::deque<Item> items;
+            bool busy{false};
+            bool stopping{false};
+            std::thread worker;
+        };
+
+        void enqueue(Item item);
+        void run(Lane &lane) noexcept;
+        void deliver(const Item &item) noexcept;
+
+        DeliveryConfig cfg_;
+        const DeliverMsgFn &deliver_;
+        LatencyBook *latency_;
+        const StreamDelivery *stream_;
+        std::vector<std::unique_ptr<Lane>> lanes_;
+        std::atomic<std::size_t> queued_msgs_{0};
+        std::atomic<std::size_t> queued_bytes_{0};
+        std::atomic<std::uint64_t> delivered_{0};
+        std::atomic<std::uint64_t> over_limit_{0};
+    };
+}
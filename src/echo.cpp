@@ -0,0 +1,84 @@
+#include "echo.hpp"
+
+using namespace std;
+
+namespace linkchat
+{
+    void EchoTracker::begin(uint16_t ident)
+    {
+        lock_guard<mutex> lk(mu_);
+        ident_ = ident;
+        probes_.clear();
+        done_.clear();
+    }
+
+    uint16_t EchoTracker::ident() const
+    {
+        lock_guard<mutex> lk(mu_);
+        return ident_;
+    }
+
+    void EchoTracker::on_sent(uint32_t seq, uint64_t app_ns)
+    {
+        lock_guard<mutex> lk(mu_);
+        Probe &p = probes_[seq];
+        p = Probe{};
+        p.sent_app_ns = app_ns;
+    }
+
+    optional<EchoRtt> EchoTracker::on_tx_stamp(uint32_t seq, const FrameStamp &tx)
+    {
+        lock_guard<mutex> lk(mu_);
+        auto it = probes_.find(seq);
+        if (it == probes_.end())
+            return nullopt;
+        it->second.tx = tx;
+        it->second.tx_known = true;
+        return complete(seq, it->second);
+    }
+
+    optional<EchoRtt> EchoTracker::on_reply(uint16_t ident, uint32_t seq, const FrameStamp &rx,
+                                            uint64_t app_ns, uint64_t turnaround_ns)
+    {
+        lock_guard<mutex> lk(mu_);
+        auto it = probes_.find(seq);
+        if (ident != ident_ || it == probes_.end() || it->second.replied)
+            return nullopt;
+        Probe &p = it->second;
+        p.replied = true;
+        p.rx = rx;
+        p.rx_app_ns = app_ns;
+        p.turnaround_ns = turnaround_ns;
+        return complete(seq, p);
+    }
+
+    // stamps are only compared with stamps of the same clock; the app clock is the fallback
+    optional<EchoRtt> EchoTracker::complete(uint32_t seq, Probe &p)
+    {
+        if (!p.tx_known || !p.replied)
+            return nullopt;
+
+        EchoRtt r{seq, 0, EchoClock::App};
+        uint64_t span = p.rx_app_ns > p.sent_app_ns ? p.rx_app_ns - p.sent_app_ns : 0;
+        if (p.tx.hw_ns != 0 && p.rx.hw_ns > p.tx.hw_ns)
+        {
+            span = p.rx.hw_ns - p.tx.hw_ns;
+            r.clock = EchoClock::Hardware;
+        }
+        else if (p.tx.sw_ns != 0 && p.rx.sw_ns > p.tx.sw_ns)
+        {
+            span = p.rx.sw_ns - p.tx.sw_ns;
+            r.clock = EchoClock::Kernel;
+        }
+        r.rtt_ns = span > p.turnaround_ns ? span - p.turnaround_ns : span;
+        done_.push_back(r);
+        probes_.erase(seq);
+        return r;
+    }
+
+    vector<EchoRtt> EchoTracker::results() const
+    {
+        lock_guard<mutex> lk(mu_);
+        return done_;
+    }
+}
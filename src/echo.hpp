@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "net/transport.hpp" // FrameStamp
+
+namespace linkchat
+{
+    // which clock pair an RTT was measured with, best first
+    enum class EchoClock : std::uint8_t
+    {
+        Hardware, // NIC stamps on both ends of our request/reply
+        Kernel,   // SO_TIMESTAMPING software stamps: scheduling delay on this host left out
+        App,      // the process's own clock around send and receive
+    };
+
+    struct EchoRtt
+    {
+        std::uint32_t seq;
+        std::uint64_t rtt_ns; // the responder's turnaround already taken out
+        EchoClock clock;
+    };
+
+    // Pairs the echo requests of one ping run with their replies. The TX stamp of a request may
+    // only be known after its reply came in (the reply can overtake send_stamped), so a sample
+    // is complete once both halves are in, whichever is last.
+    class EchoTracker
+    {
+    public:
+        // new run: replies carrying another ident are ignored from now on
+        void begin(std::uint16_t ident);
+        std::uint16_t ident() const;
+
+        // before the request goes out (app clock), then once the link reported its TX stamps
+        void on_sent(std::uint32_t seq, std::uint64_t app_ns);
+        std::optional<EchoRtt> on_tx_stamp(std::uint32_t seq, const FrameStamp &tx);
+
+        std::optional<EchoRtt> on_reply(std::uint16_t ident, std::uint32_t seq, const FrameStamp &rx,
+                                        std::uint64_t app_ns, std::uint64_t turnaround_ns);
+
+        std::vector<EchoRtt> results() const;
+
+    private:
+        struct Probe
+        {
+            std::uint64_t sent_app_ns{0};
+            FrameStamp tx{};
+            bool tx_known{false};
+            bool replied{false};
+            FrameStamp rx{};
+            std::uint64_t rx_app_ns{0};
+            std::uint64_t turnaround_ns{0};
+        };
+
+        std::optional<EchoRtt> complete(std::uint32_t seq, Probe &p);
+
+        mutable std::mutex mu_; // the RX thread reports replies, the pinging thread the rest
+        std::uint16_t ident_{0};
+        std::unordered_map<std::uint32_t, Probe> probes_;
+        std::vector<EchoRtt> done_;
+    };
+}
@@ -0,0 +1,98 @@
+#include "fec.hpp"
+#include "pdu.hpp"
+#include "util/helpers.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+namespace linkchat
+{
+    size_t build_repair_pdus(const vector<FrameRef> &pdus,
+                             uint32_t msg_id,
+                             Type msg_type,
+                             uint32_t block_start,
+                             uint8_t k,
+                             uint8_t groups,
+                             vector<FrameRef> &out)
+    {
+        if(k == 0 || groups == 0 || block_start >= pdus.size())
+            return 0;
+
+        uint32_t block_end = min<uint32_t>(block_start + k, static_cast<uint32_t>(pdus.size()));
+        uint8_t k_eff = static_cast<uint8_t>(block_end - block_start);
+        groups = min(groups, k_eff);
+
+        const size_t first = out.size();
+        for(uint8_t g = 0; g < groups; g++)
+        {
+            size_t parity_len = 0;
+            for(uint32_t seq = block_start + g; seq < block_end; seq += groups)
+                parity_len = max<size_t>(parity_len, HeaderCodec::read<&Header::payload_len>(pdus[seq].data()));
+
+            const size_t payload_len = kRepairHdrSize + parity_len;
+            FrameRef pdu = FrameRef::make(kHeaderSize + payload_len + kCrcSize);
+            if(pdu.empty())
+                break;
+
+            // parity is XORed straight into the frame, header and CRC go around it last
+            uint8_t *payload = pdu.data() + kHeaderSize;
+            memset(payload, 0, payload_len);
+            uint16_t len_xor = 0;
+            for(uint32_t seq = block_start + g; seq < block_end; seq += groups)
+            {
+                const uint8_t *src = pdus[seq].data() + kHeaderSize;
+                uint16_t len = HeaderCodec::read<&Header::payload_len>(pdus[seq].data());
+                len_xor ^= len;
+                for(size_t i = 0; i < len; i++)
+                    payload[kRepairHdrSize + i] ^= src[i];
+            }
+
+            RepairCodec::encode(RepairFields{msg_type, block_start, k_eff, g, groups, len_xor}, payload);
+
+            Header h;
+            h.type = Type::REPAIR;
+            h.msg_id = msg_id;
+            h.seq = block_start;
+            h.total = static_cast<uint32_t>(pdus.size());
+            h.payload_len = static_cast<uint16_t>(payload_len);
+
+            if(seal_pdu(h, pdu.data(), pdu.size()) != pdu.size())
+                break;
+            out.push_back(move(pdu));
+        }
+
+        return out.size() - first;
+    }
+
+    bool parse_repair(const uint8_t *payload, size_t payload_len,
+                      RepairFields &out,
+                      const uint8_t *&parity, size_t &parity_len) noexcept
+    {
+        if(payload == nullptr || payload_len < kRepairHdrSize)
+            return false;
+
+        if(!RepairCodec::decode(payload, out))
+            return false;
+        if(out.orig_type == Type::ACK || out.orig_type == Type::REPAIR)
+            return false;
+        if(out.k == 0 || out.groups == 0 || out.group >= out.groups || out.groups > out.k)
+            return false;
+
+        parity = payload + kRepairHdrSize;
+        parity_len = payload_len - kRepairHdrSize;
+        return true;
+    }
+
+    [[nodiscard]] uint8_t fec_groups_for_loss(double loss, const FecConfig &cfg) noexcept
+    {
+        // budget twice the expected losses per block so bursts still fit
+        double expected = max(0.0, loss) * cfg.k * 2.0;
+        int r = static_cast<int>(ceil(expected));
+        r = max<int>(r, cfg.min_r);
+        r = min<int>(r, cfg.max_r);
+        r = min<int>(r, cfg.k);
+        return static_cast<uint8_t>(max(r, 1));
+    }
+}
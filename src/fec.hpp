@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "header.hpp"
+#include "util/structs.hpp"
+#include "util/frame_pool.hpp"
+
+namespace linkchat
+{
+    struct FecConfig
+    {
+        std::uint8_t k = 0;      // data frames per block, 0 = FEC off
+        std::uint8_t min_r = 1;  // repair frames per block at zero loss
+        std::uint8_t max_r = 4;  // repair frames per block at worst loss
+    };
+
+    struct RepairFields
+    {
+        Type orig_type;           // type of the protected message
+        std::uint32_t block_start; // seq of the first data frame in the block
+        std::uint8_t k;           // data frames in the block (last block may be shorter)
+        std::uint8_t group;       // parity group, covers seqs block_start + group + n*groups
+        std::uint8_t groups;      // number of parity groups (= repair frames) in the block
+        std::uint16_t len_xor;    // XOR of the payload lengths of the group
+    };
+
+    // Repair payload: [orig_type(1)] [block_start(4, BE)] [k(1)] [group(1)] [groups(1)] [len_xor(2, BE)] [parity...]
+    using RepairCodec = Codec<RepairFields,
+                              Field<&RepairFields::orig_type>,
+                              Field<&RepairFields::block_start>,
+                              Field<&RepairFields::k>,
+                              Field<&RepairFields::group>,
+                              Field<&RepairFields::groups>,
+                              Field<&RepairFields::len_xor>>;
+    inline constexpr std::size_t kRepairHdrSize = RepairCodec::size;
+    static_assert(kRepairHdrSize == 10, "repair header is part of the wire format");
+
+    // XOR parity groups for the block [block_start, block_start + k) of an already chunkified message.
+    // Every group repairs one lost frame among the seqs it covers. Frames are appended to out
+    // (callers keep it around so a steady stream of blocks does not reallocate); returns how many.
+    std::size_t build_repair_pdus(const std::vector<FrameRef> &pdus,
+                                  std::uint32_t msg_id,
+                                  Type msg_type,
+                                  std::uint32_t block_start,
+                                  std::uint8_t k,
+                                  std::uint8_t groups,
+                                  std::vector<FrameRef> &out);
+
+    bool parse_repair(const std::uint8_t *payload, std::size_t payload_len,
+                      RepairFields &out,
+                      const std::uint8_t *&parity, std::size_t &parity_len) noexcept;
+
+    // number of repair frames per block for a measured frame loss rate (0..1)
+    [[nodiscard]] std::uint8_t fec_groups_for_loss(double loss, const FecConfig &cfg) noexcept;
+}
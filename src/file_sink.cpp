@@ -0,0 +1,512 @@
+#include "file_sink.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <tuple>
+
+#if __has_include(<linux/io_uring.h>)
+#define LINKCHAT_HAVE_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace std;
+
+namespace linkchat
+{
+    static constexpr size_t kMaxChunkBytes = size_t(8) << 20; // a write's length shares user_data with its offset
+    static constexpr int kBrokenRingWaitMs = 2000;             // a broken ring's last writes are waited for this long
+
+    static bool write_pwrite(const string &path, const vector<uint8_t> &data, size_t chunk) noexcept
+    {
+        const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return false;
+        size_t off = 0;
+        bool ok = true;
+        while (off < data.size())
+        {
+            const size_t len = min(chunk, data.size() - off);
+            const ssize_t n = ::pwrite(fd, data.data() + off, len, static_cast<off_t>(off));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                ok = false;
+                break;
+            }
+            off += static_cast<size_t>(n);
+        }
+        return ::close(fd) == 0 && ok;
+    }
+
+#ifdef LINKCHAT_HAVE_URING
+
+    // Bare io_uring (no liburing): one submission and one completion ring, used by a single thread.
+    struct FileSink::Ring
+    {
+        int fd = -1;
+        uint32_t *sq_head = nullptr;
+        uint32_t *sq_tail = nullptr;
+        uint32_t *sq_array = nullptr;
+        uint32_t sq_mask = 0;
+        io_uring_sqe *sqes = nullptr;
+        uint32_t *cq_head = nullptr;
+        uint32_t *cq_tail = nullptr;
+        uint32_t cq_mask = 0;
+        io_uring_cqe *cqes = nullptr;
+        void *sq_map = nullptr;
+        size_t sq_len = 0;
+        void *cq_map = nullptr;
+        size_t cq_len = 0;
+        void *sqe_map = nullptr;
+        size_t sqe_len = 0;
+    };
+
+    static uint32_t load_acquire(uint32_t *p) noexcept
+    {
+        return atomic_ref<uint32_t>(*p).load(memory_order_acquire);
+    }
+
+    static void store_release(uint32_t *p, uint32_t v) noexcept
+    {
+        atomic_ref<uint32_t>(*p).store(v, memory_order_release);
+    }
+
+    static void ring_close(FileSink::Ring *r) noexcept
+    {
+        if (r == nullptr)
+            return;
+        if (r->sqe_map != nullptr)
+            ::munmap(r->sqe_map, r->sqe_len);
+        if (r->cq_map != nullptr && r->cq_map != r->sq_map)
+            ::munmap(r->cq_map, r->cq_len);
+        if (r->sq_map != nullptr)
+            ::munmap(r->sq_map, r->sq_len);
+        if (r->fd >= 0)
+            ::close(r->fd);
+        delete r;
+    }
+
+    static FileSink::Ring *ring_open(unsigned entries) noexcept
+    {
+        io_uring_params p{};
+        const int fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+        if (fd < 0)
+            return nullptr;
+
+        auto *r = new (nothrow) FileSink::Ring{};
+        if (r == nullptr)
+        {
+            ::close(fd);
+            return nullptr;
+        }
+        r->fd = fd;
+        r->sq_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+            r->sq_len = r->cq_len = max(r->sq_len, r->cq_len);
+
+        void *sq = ::mmap(nullptr, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq == MAP_FAILED)
+        {
+            ring_close(r);
+            return nullptr;
+        }
+        r->sq_map = sq;
+        if (single)
+            r->cq_map = sq;
+        else
+        {
+            void *cq = ::mmap(nullptr, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cq == MAP_FAILED)
+            {
+                ring_close(r);
+                return nullptr;
+            }
+            r->cq_map = cq;
+        }
+        r->sqe_len = p.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = ::mmap(nullptr, r->sqe_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+        {
+            ring_close(r);
+            return nullptr;
+        }
+        r->sqe_map = sqes;
+
+        uint8_t *sqb = static_cast<uint8_t *>(r->sq_map);
+        uint8_t *cqb = static_cast<uint8_t *>(r->cq_map);
+        r->sq_head = reinterpret_cast<uint32_t *>(sqb + p.sq_off.head);
+        r->sq_tail = reinterpret_cast<uint32_t *>(sqb + p.sq_off.tail);
+        r->sq_mask = *reinterpret_cast<uint32_t *>(sqb + p.sq_off.ring_mask);
+        r->sq_array = reinterpret_cast<uint32_t *>(sqb + p.sq_off.array);
+        r->sqes = static_cast<io_uring_sqe *>(sqes);
+        r->cq_head = reinterpret_cast<uint32_t *>(cqb + p.cq_off.head);
+        r->cq_tail = reinterpret_cast<uint32_t *>(cqb + p.cq_off.tail);
+        r->cq_mask = *reinterpret_cast<uint32_t *>(cqb + p.cq_off.ring_mask);
+        r->cqes = reinterpret_cast<io_uring_cqe *>(cqb + p.cq_off.cqes);
+        return r;
+    }
+
+    // the writes already submitted when the ring broke still read their buffer: wait for their
+    // completions to show up in the CQ ring (no io_uring_enter needed) for a while. Whatever is
+    // left after that is the caller's to keep alive until the ring is closed
+    static void reap_broken(FileSink::Ring &r, unsigned &inflight) noexcept
+    {
+        const auto until = chrono::steady_clock::now() + chrono::milliseconds(kBrokenRingWaitMs);
+        while (inflight > 0)
+        {
+            uint32_t head = *r.cq_head;
+            const uint32_t ctail = load_acquire(r.cq_tail);
+            for (; head != ctail && inflight > 0; head++)
+                inflight--;
+            store_release(r.cq_head, head);
+            if (inflight == 0 || chrono::steady_clock::now() > until)
+                return;
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+
+    // keeps up to queue_depth chunk writes in flight; short writes are queued again for the rest
+    bool FileSink::write_uring(const Job &job) noexcept
+    {
+        const int fd = ::open(job.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return false;
+
+        Ring &r = *ring_;
+        const uint8_t *base = job.data.data();
+        const size_t total = job.data.size();
+        const size_t chunk = min(max<size_t>(cfg_.chunk_bytes, 4096), kMaxChunkBytes);
+        const unsigned depth = max(1u, min(cfg_.queue_depth, r.sq_mask + 1));
+        vector<pair<size_t, size_t>> retry;
+        size_t next = 0;
+        unsigned inflight = 0;
+        bool ok = true;
+
+        while (inflight > 0 || (ok && (next < total || !retry.empty())))
+        {
+            unsigned queued = 0;
+            uint32_t tail = *r.sq_tail;
+            while (ok && inflight + queued < depth && (next < total || !retry.empty()))
+            {
+                size_t off, len;
+                if (!retry.empty())
+                {
+                    tie(off, len) = retry.back();
+                    retry.pop_back();
+                }
+                else
+                {
+                    off = next;
+                    len = min(chunk, total - next);
+                    next += len;
+                }
+                const uint32_t idx = tail & r.sq_mask;
+                io_uring_sqe &sqe = r.sqes[idx];
+                memset(&sqe, 0, sizeof(sqe));
+                sqe.opcode = IORING_OP_WRITE;
+                sqe.fd = fd;
+                sqe.addr = reinterpret_cast<uintptr_t>(base + off);
+                sqe.len = static_cast<uint32_t>(len);
+                sqe.off = off;
+                sqe.user_data = (static_cast<uint64_t>(off) << 24) | len;
+                r.sq_array[idx] = idx;
+                tail++;
+                queued++;
+            }
+            store_release(r.sq_tail, tail);
+
+            // submit what was queued and wait for at least one completion
+            for (;;)
+            {
+                const long rc = ::syscall(__NR_io_uring_enter, r.fd, queued, 1u, IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (rc >= 0)
+                {
+                    inflight += static_cast<unsigned>(rc);
+                    queued -= min<unsigned>(queued, static_cast<unsigned>(rc));
+                    if (queued == 0)
+                        break;
+                    continue;
+                }
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                {
+                    if (inflight > 0 && queued == 0)
+                        break;
+                    continue;
+                }
+                // the ring is broken: never enter it again, or entries left in it would be
+                // submitted later against freed buffers; the worker carries on with pwrite()
+                ring_broken_ = true;
+                ok = false;
+                queued = 0;
+                break;
+            }
+            if (ring_broken_)
+            {
+                reap_broken(r, inflight);
+                break;
+            }
+
+            uint32_t head = *r.cq_head;
+            const uint32_t ctail = load_acquire(r.cq_tail);
+            for (; head != ctail; head++)
+            {
+                const io_uring_cqe &cqe = r.cqes[head & r.cq_mask];
+                const size_t off = static_cast<size_t>(cqe.user_data >> 24);
+                const size_t len = static_cast<size_t>(cqe.user_data & 0xFFFFFF);
+                inflight--;
+                if (cqe.res < 0 || (cqe.res == 0 && len > 0))
+                    ok = false;
+                else if (static_cast<size_t>(cqe.res) < len)
+                    retry.emplace_back(off + static_cast<size_t>(cqe.res), len - static_cast<size_t>(cqe.res));
+            }
+            store_release(r.cq_head, head);
+        }
+
+        ring_holds_job_ = inflight > 0;
+        return ::close(fd) == 0 && ok;
+    }
+
+#else
+
+    struct FileSink::Ring
+    {
+    };
+
+    static void ring_close(FileSink::Ring *r) noexcept
+    {
+        delete r;
+    }
+
+    static FileSink::Ring *ring_open(unsigned) noexcept
+    {
+        return nullptr;
+    }
+
+    bool FileSink::write_uring(const Job &) noexcept
+    {
+        return false;
+    }
+
+#endif
+
+    FileSink::FileSink(FileSinkConfig cfg, FileDoneFn on_done) : cfg_(cfg), on_done_(move(on_done))
+    {
+        cfg_.chunk_bytes = min(max<size_t>(cfg_.chunk_bytes, 4096), kMaxChunkBytes);
+        if (cfg_.use_uring)
+            ring_ = ring_open(max(2u, cfg_.queue_depth));
+
+        if (ring_ != nullptr)
+            workers_.emplace_back([this]
+                                  { worker_uring(); });
+        else
+            for (unsigned i = 0; i < max(1u, cfg_.fallback_threads); i++)
+                workers_.emplace_back([this]
+                                      { worker_pwrite(); });
+    }
+
+    FileSink::~FileSink()
+    {
+        drain();
+        {
+            lock_guard<mutex> lk(mu_);
+            stopping_ = true;
+        }
+        cv_jobs_.notify_all();
+        cv_room_.notify_all();
+        for (auto &t : workers_)
+            t.join();
+        ring_close(ring_);
+    }
+
+    bool FileSink::submit(string path, vector<uint8_t> data)
+    {
+        const size_t size = data.size();
+        {
+            unique_lock<mutex> lk(mu_);
+            if (stopping_)
+                return false;
+            auto has_room = [&]
+            { return stopping_ || inflight_ == 0 || inflight_ + size <= cfg_.max_inflight_bytes; };
+            if (!has_room())
+            {
+                submit_waits_.fetch_add(1, memory_order_relaxed);
+                cv_room_.wait(lk, has_room);
+                if (stopping_)
+                    return false;
+            }
+            inflight_ += size;
+            jobs_.push_back(Job{move(path), move(data)});
+        }
+        cv_jobs_.notify_one();
+        return true;
+    }
+
+    void FileSink::drain()
+    {
+        unique_lock<mutex> lk(mu_);
+        cv_room_.wait(lk, [this]
+                      { return jobs_.empty() && busy_ == 0; });
+    }
+
+    bool FileSink::pop(Job &job)
+    {
+        unique_lock<mutex> lk(mu_);
+        cv_jobs_.wait(lk, [this]
+                      { return !jobs_.empty() || stopping_; });
+        if (jobs_.empty())
+            return false;
+        job = move(jobs_.front());
+        jobs_.pop_front();
+        busy_++;
+        return true;
+    }
+
+    void FileSink::finish(const Job &job, bool ok) noexcept
+    {
+        if (ok)
+        {
+            files_written_.fetch_add(1, memory_order_relaxed);
+            bytes_written_.fetch_add(job.data.size(), memory_order_relaxed);
+        }
+        else
+            files_failed_.fetch_add(1, memory_order_relaxed);
+
+        if (on_done_)
+            on_done_(job.path, job.data.size(), ok);
+
+        {
+            lock_guard<mutex> lk(mu_);
+            inflight_ -= job.data.size();
+            busy_--;
+        }
+        cv_room_.notify_all();
+    }
+
+    void FileSink::worker_uring() noexcept
+    {
+        Job job;
+        while (pop(job))
+        {
+            finish(job, ring_broken_ ? write_pwrite(job.path, job.data, cfg_.chunk_bytes) : write_uring(job));
+            if (ring_holds_job_)
+                ring_held_.push_back(move(job.data)); // the kernel may still read it
+            ring_holds_job_ = false;
+            job = {};
+        }
+    }
+
+    void FileSink::worker_pwrite() noexcept
+    {
+        Job job;
+        while (pop(job))
+        {
+            finish(job, write_pwrite(job.path, job.data, cfg_.chunk_bytes));
+            job = {};
+        }
+    }
+
+    FileSinkStats FileSink::stats() const
+    {
+        FileSinkStats st{};
+        st.backend = ring_ != nullptr ? "io_uring" : "pwrite";
+        st.files_written = files_written_.load(memory_order_relaxed);
+        st.files_failed = files_failed_.load(memory_order_relaxed);
+        st.bytes_written = bytes_written_.load(memory_order_relaxed);
+        st.submit_waits = submit_waits_.load(memory_order_relaxed);
+        lock_guard<mutex> lk(mu_);
+        st.bytes_inflight = inflight_;
+        return st;
+    }
+
+    void FileSink::stream_done(const string &path, uint64_t bytes, bool ok) noexcept
+    {
+        if (ok)
+        {
+            files_written_.fetch_add(1, memory_order_relaxed);
+            bytes_written_.fetch_add(bytes, memory_order_relaxed);
+        }
+        else
+            files_failed_.fetch_add(1, memory_order_relaxed);
+        if (on_done_)
+            on_done_(path, static_cast<size_t>(bytes), ok);
+    }
+
+    StreamFile::StreamFile(FileSink &sink, string path)
+        : sink_(sink), path_(move(path)), part_(path_ + ".part"),
+          chunk_(min(max<size_t>(sink.cfg_.chunk_bytes, 4096), kMaxChunkBytes))
+    {
+        fd_ = ::open(part_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        failed_ = fd_ < 0;
+        if (!failed_)
+            buf_.reserve(chunk_);
+    }
+
+    StreamFile::~StreamFile()
+    {
+        finish(false);
+    }
+
+    bool StreamFile::flush() noexcept
+    {
+        size_t off = 0;
+        while (!failed_ && off < buf_.size())
+        {
+            const ssize_t n = ::pwrite(fd_, buf_.data() + off, buf_.size() - off, static_cast<off_t>(written_));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                failed_ = true;
+                break;
+            }
+            off += static_cast<size_t>(n);
+            written_ += static_cast<uint64_t>(n);
+        }
+        buf_.clear();
+        return !failed_;
+    }
+
+    bool StreamFile::append(span<const uint8_t> data) noexcept
+    {
+        while (!failed_ && !data.empty())
+        {
+            const size_t n = min(data.size(), chunk_ - buf_.size());
+            buf_.insert(buf_.end(), data.begin(), data.begin() + n);
+            data = data.subspan(n);
+            if (buf_.size() == chunk_)
+                flush();
+        }
+        return !failed_;
+    }
+
+    void StreamFile::finish(bool ok) noexcept
+    {
+        if (finished_)
+            return;
+        finished_ = true;
+        ok = ok && flush();
+        if (fd_ >= 0)
+        {
+            if (::close(fd_) != 0)
+                ok = false;
+            fd_ = -1;
+        }
+        if (ok && ::rename(part_.c_str(), path_.c_str()) != 0)
+            ok = false;
+        if (!ok)
+            ::unlink(part_.c_str());
+        sink_.stream_done(path_, written_, ok);
+        buf_ = vector<uint8_t>{};
+    }
+}
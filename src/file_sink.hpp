@@ -0,0 +1,133 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <span>
+
+namespace linkchat
+{
+    // Writes delivered files off the RX thread. With io_uring one worker keeps up to
+    // queue_depth chunk writes of a file in flight; without it (old kernel, disabled by
+    // sysctl, seccomp) a few threads pwrite() whole files in chunks. submit() only blocks
+    // when the bytes waiting for the disk would go over max_inflight_bytes.
+    struct FileSinkConfig
+    {
+        std::size_t max_inflight_bytes = std::size_t(256) << 20;
+        std::size_t chunk_bytes = std::size_t(1) << 20; // one write
+        unsigned queue_depth = 16;                      // io_uring writes in flight
+        unsigned fallback_threads = 2;
+        bool use_uring = true;
+    };
+
+    struct FileSinkStats
+    {
+        const char *backend;          // "io_uring" or "pwrite"
+        std::uint64_t files_written;
+        std::uint64_t files_failed;
+        std::uint64_t bytes_written;
+        std::size_t bytes_inflight;   // accepted, not yet on disk
+        std::uint64_t submit_waits;   // submit() calls that had to wait for room
+    };
+
+    // path, bytes, ok; runs on a sink thread
+    using FileDoneFn = std::function<void(const std::string &path, std::size_t bytes, bool ok)>;
+
+    class FileSink
+    {
+    public:
+        explicit FileSink(FileSinkConfig cfg = {}, FileDoneFn on_done = nullptr);
+        ~FileSink(); // drains
+        FileSink(const FileSink &) = delete;
+        FileSink &operator=(const FileSink &) = delete;
+
+        // queues data to replace the file at path; a file bigger than the whole budget
+        // is still taken once nothing else is in flight
+        bool submit(std::string path, std::vector<std::uint8_t> data);
+
+        // returns once every submitted file is written (or failed)
+        void drain();
+
+        FileSinkStats stats() const;
+
+        struct Ring;
+
+    private:
+        struct Job
+        {
+            std::string path;
+            std::vector<std::uint8_t> data;
+        };
+
+        friend class StreamFile;
+        void stream_done(const std::string &path, std::uint64_t bytes, bool ok) noexcept;
+
+        void worker_uring() noexcept;
+        void worker_pwrite() noexcept;
+        bool pop(Job &job);
+        void finish(const Job &job, bool ok) noexcept;
+        bool write_uring(const Job &job) noexcept;
+
+        FileSinkConfig cfg_;
+        FileDoneFn on_done_;
+        Ring *ring_{nullptr};
+        bool ring_broken_{false};          // worker thread only
+        bool ring_holds_job_{false};       // worker thread only: writes of the last job still in the kernel
+        std::vector<std::vector<std::uint8_t>> ring_held_; // their buffers, kept until the ring is closed
+
+        mutable std::mutex mu_;
+        std::condition_variable cv_jobs_;  // workers wait for jobs
+        std::condition_variable cv_room_;  // submit() and drain() wait for bytes to land
+        std::deque<Job> jobs_;
+        std::size_t inflight_{0};
+        std::size_t busy_{0};              // jobs taken by a worker, not finished
+        bool stopping_{false};
+
+        std::atomic<std::uint64_t> files_written_{0};
+        std::atomic<std::uint64_t> files_failed_{0};
+        std::atomic<std::uint64_t> bytes_written_{0};
+        std::atomic<std::uint64_t> submit_waits_{0};
+
+        std::vector<std::thread> workers_;
+    };
+
+    // A file written while its message is still arriving (LinkchatApp::set_stream), on the
+    // caller's thread (a delivery worker). Pieces are gathered into chunk_bytes pwrite()s to
+    // <path>.part, which replaces path once finish(true) has flushed it; a failed or abandoned
+    // file is removed. The outcome goes to the sink's on_done and stats like a submitted file.
+    // A message's pieces all come from one delivery lane, so one StreamFile is never shared.
+    class StreamFile
+    {
+    public:
+        StreamFile(FileSink &sink, std::string path);
+        ~StreamFile(); // never finished: removed, and reported as failed
+        StreamFile(const StreamFile &) = delete;
+        StreamFile &operator=(const StreamFile &) = delete;
+
+        // false once a write has failed; the rest is dropped until finish()
+        bool append(std::span<const std::uint8_t> data) noexcept;
+
+        void finish(bool ok) noexcept;
+
+        const std::string &path() const noexcept { return path_; }
+
+    private:
+        bool flush() noexcept;
+
+        FileSink &sink_;
+        std::string path_;
+        std::string part_;
+        int fd_{-1};
+        std::vector<std::uint8_t> buf_;
+        std::size_t chunk_;
+        std::uint64_t written_{0};
+        bool failed_{false};
+        bool finished_{false};
+    };
+}
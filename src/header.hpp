@@ -3,6 +3,7 @@
 
 #include <cstdint>
 #include <cstddef>
+#include "codec.hpp"
 #include "util/helpers.hpp"
 #include "util/structs.hpp"
 
@@ -19,6 +20,28 @@ namespace linkchat
         };
     #pragma pack(pop)
     static_assert(sizeof(Header) == 15, "Header must be exactly 15 bytes"); // Ensure no padding
+
+    // Type values on the wire: MSG .. kLastType; move the upper bound along with the enum
+    inline constexpr Type kLastType = Type::REJECT;
+    inline constexpr std::size_t kTypeSlots = static_cast<std::size_t>(kLastType) + 1; // arrays indexed by Type value
+
+    template <>
+    struct WireEnum<Type>
+    {
+        static constexpr bool valid(std::uint8_t t) noexcept
+        {
+            return t >= static_cast<std::uint8_t>(Type::MSG) && t <= static_cast<std::uint8_t>(kLastType);
+        }
+    };
+
+    using HeaderCodec = Codec<Header,
+                              Field<&Header::type>,
+                              Field<&Header::msg_id>,
+                              Field<&Header::seq>,
+                              Field<&Header::total>,
+                              Field<&Header::payload_len>>;
+    static_assert(HeaderCodec::size == sizeof(Header), "wire header and struct must match");
+    static_assert(HeaderCodec::offset_of<&Header::payload_len>() == 13, "payload_len closes the header");
     
     size_t serialize_header(const Header & h, std::uint8_t * buf, std::size_t buf_size)noexcept;
 
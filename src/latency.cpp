@@ -0,0 +1,80 @@
+#include "latency.hpp"
+
+using namespace std;
+
+namespace linkchat
+{
+    const char *latency_metric_name(LatencyMetric m) noexcept
+    {
+        switch (m)
+        {
+        case LatencyMetric::FirstTx:
+            return "send->first tx";
+        case LatencyMetric::Acked:
+            return "send->acked";
+        case LatencyMetric::Delivery:
+            return "first frame->delivery";
+        case LatencyMetric::AckRtt:
+            return "frame ack rtt";
+        }
+        return "?";
+    }
+
+    LatencyBook::PeerSlot &LatencyBook::peer_slot(const Mac &peer) noexcept
+    {
+        const uint64_t key = mac_to_u64(peer) + 1;
+        for (size_t i = 0; i < kLatencyPeers; i++)
+        {
+            uint64_t seen = peers_[i].key.load(memory_order_acquire);
+            if (seen == 0 && peers_[i].key.compare_exchange_strong(seen, key, memory_order_acq_rel))
+                return peers_[i];
+            if (seen == key)
+                return peers_[i];
+        }
+        return peers_[kLatencyPeers];
+    }
+
+    void LatencyBook::record(LatencyMetric m, Type type, const Mac &peer, uint64_t us) noexcept
+    {
+        const size_t t = static_cast<size_t>(type);
+        all_[index(m)].record(us);
+        if (t < kTypeSlots)
+            by_type_[index(m)][t].record(us);
+        peer_slot(peer).h[index(m)].record(us);
+    }
+
+    LatencyBreakdown LatencyBook::breakdown(LatencyMetric m) const
+    {
+        LatencyBreakdown out{};
+        out.all = all_[index(m)].summary();
+        for (size_t t = 0; t < kTypeSlots; t++)
+            if (by_type_[index(m)][t].count() > 0)
+                out.by_type.emplace_back(static_cast<Type>(t), by_type_[index(m)][t].summary());
+        for (size_t i = 0; i < kLatencyPeers; i++)
+        {
+            const uint64_t key = peers_[i].key.load(memory_order_acquire);
+            if (key == 0 || peers_[i].h[index(m)].count() == 0)
+                continue;
+            Mac mac{};
+            for (size_t b = 0; b < kMacSize; b++)
+                mac.bytes[b] = static_cast<uint8_t>((key - 1) >> (8 * (kMacSize - 1 - b)));
+            out.by_peer.emplace_back(mac, peers_[i].h[index(m)].summary());
+        }
+        out.other_peers = peers_[kLatencyPeers].h[index(m)].count();
+        return out;
+    }
+
+    void LatencyBook::reset() noexcept
+    {
+        for (size_t m = 0; m < kLatencyMetrics; m++)
+        {
+            all_[m].reset();
+            for (auto &h : by_type_[m])
+                h.reset();
+        }
+        // peers keep their slots, only the samples go
+        for (auto &p : peers_)
+            for (auto &h : p.h)
+                h.reset();
+    }
+}
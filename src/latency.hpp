@@ -0,0 +1,62 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include "header.hpp" // kTypeSlots
+#include "util/histogram.hpp"
+#include "util/structs.hpp" // Type
+#include "util/mac.hpp"     // Mac
+
+namespace linkchat
+{
+    // all in microseconds, on the steady clock
+    enum class LatencyMetric : std::uint8_t
+    {
+        FirstTx = 0,  // send() -> first frame handed to the link
+        Acked,        // send() -> last frame ACKed
+        Delivery,     // first frame received -> message handed to on_deliver
+        AckRtt,       // frame sent once -> its ACK (Karn: resent frames give no sample)
+    };
+    inline constexpr std::size_t kLatencyMetrics = 4;
+
+    [[nodiscard]] const char *latency_metric_name(LatencyMetric m) noexcept;
+
+    struct LatencyBreakdown
+    {
+        LatencyPercentiles all;
+        std::vector<std::pair<Type, LatencyPercentiles>> by_type; // types with samples
+        std::vector<std::pair<Mac, LatencyPercentiles>> by_peer;  // peers with samples
+        std::uint64_t other_peers;                                // samples of peers past kLatencyPeers
+    };
+
+    // Histograms of one metric per message Type and per peer, next to the overall one.
+    // Recording is a few relaxed atomic increments; a new peer takes a slot with one CAS and
+    // the first kLatencyPeers peers keep their own, later ones share the overflow slot.
+    class LatencyBook
+    {
+    public:
+        static constexpr std::size_t kLatencyPeers = 16;
+
+        void record(LatencyMetric m, Type type, const Mac &peer, std::uint64_t us) noexcept;
+        LatencyBreakdown breakdown(LatencyMetric m) const;
+        LatencyPercentiles summary(LatencyMetric m) const noexcept { return all_[index(m)].summary(); }
+        void reset() noexcept;
+
+    private:
+        static constexpr std::size_t index(LatencyMetric m) noexcept { return static_cast<std::size_t>(m); }
+
+        struct PeerSlot
+        {
+            std::atomic<std::uint64_t> key{0}; // mac_to_u64 + 1, 0 = free
+            LatencyHistogram h[kLatencyMetrics];
+        };
+
+        PeerSlot &peer_slot(const Mac &peer) noexcept;
+
+        LatencyHistogram all_[kLatencyMetrics];
+        LatencyHistogram by_type_[kLatencyMetrics][kTypeSlots];
+        PeerSlot peers_[kLatencyPeers + 1]; // the last one takes every peer without a slot
+    };
+}
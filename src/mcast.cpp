@@ -0,0 +1,327 @@
+#include "mcast.hpp"
+#include "fec.hpp"
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+namespace linkchat
+{
+    static constexpr uint64_t kNakForgetMs = 30000;
+    static constexpr uint32_t kNakMaxBackoff = 3; // 8 * holdoff stays under the sender's linger
+
+    McastSender::McastSender(EmitFrameFn emit_tx, SenderConfig cfg, McastConfig mcfg)
+    {
+        emit_tx_ = emit_tx;
+        if(emit_tx_ == nullptr)
+            emit_tx_ = [](const FrameRef&, FrameNote){};
+
+        cfg_ = cfg;
+        if(cfg_.now == nullptr)
+            cfg_.now = [](){ return 0u; };
+        if(cfg_.mtu < kHeaderSize + kCrcSize + 1)
+            cfg_.mtu = kHeaderSize + kCrcSize + 1;
+
+        mcfg_ = mcfg;
+        if(mcfg_.burst == 0)
+            mcfg_.burst = 1;
+
+        random_device rd;
+        next_msg_id_ = rd();
+    }
+
+    uint32_t McastSender::send(const vector<uint8_t>& data, Type type)
+    {
+        lock_guard<mutex> lk(mu_);
+        uint32_t msg_id = (next_msg_id_++) | kMcastIdBit;
+
+        uint16_t chunk_mtu = cfg_.mtu;
+        if(cfg_.fec.k > 0 && chunk_mtu > kHeaderSize + kCrcSize + kRepairHdrSize)
+            chunk_mtu = static_cast<uint16_t>(chunk_mtu - kRepairHdrSize);
+
+        vector<FrameRef> pdus = chunkify_from_vector(data, msg_id, type, chunk_mtu);
+        if(pdus.empty())
+            return 0;
+
+        McTxMsg msg;
+        msg.msg_id = msg_id;
+        msg.type = type;
+        msg.pdus = move(pdus);
+        msg.repaired_at.resize(msg.pdus.size(), 0);
+        msgs_[msg_id] = move(msg);
+
+        McTxMsg &st = msgs_[msg_id];
+        uint64_t now = cfg_.now();
+        uint32_t end = min<uint32_t>(mcfg_.burst, static_cast<uint32_t>(st.pdus.size()));
+        for(; st.next < end; st.next++)
+        {
+            emit_tx_(st.pdus[st.next], FrameNote::None);
+            sample_loss(false);
+        }
+        st.last_tx_ms = now;
+        st.last_nak_ms = now;
+        emit_repairs(st);
+        return msg_id;
+    }
+
+    void McastSender::on_nak(uint32_t msg_id, const vector<NakRange>& ranges) noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+        auto it = msgs_.find(msg_id);
+        if(it == msgs_.end())
+            return;
+
+        McTxMsg &st = it->second;
+        const uint32_t k = cfg_.fec.k;
+        unordered_map<uint32_t, uint32_t> lacks;
+        for(const NakRange &r : ranges)
+        {
+            for(uint32_t seq = r.from; seq <= r.to && seq < st.next; seq++)
+            {
+                st.pending.push_back(seq);
+                if(k > 0)
+                    lacks[seq / k]++;
+            }
+        }
+        for(const auto &[block, n] : lacks)
+            st.block_need[block] = max(st.block_need[block], n);
+
+        st.last_nak_ms = cfg_.now();
+    }
+
+    void McastSender::on_tick() noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+        uint64_t now = cfg_.now();
+        vector<uint32_t> to_erase;
+        for(auto &[msg_id, st] : msgs_)
+        {
+            // repairs first: receivers that fell behind catch up before more new data arrives.
+            // The budget shrinks with the NAKed fraction so the slowest receiver sets the pace.
+            uint32_t burst = static_cast<uint32_t>(mcfg_.burst * (1.0 - min(0.9, 4.0 * loss_)));
+            burst = max<uint32_t>(burst, 1);
+            uint32_t budget = burst - flush_naks(st, now, burst);
+
+            uint32_t total = static_cast<uint32_t>(st.pdus.size());
+            if(st.next < total)
+            {
+                uint32_t end = min<uint32_t>(st.next + budget, total);
+                for(; st.next < end; st.next++)
+                {
+                    emit_tx_(st.pdus[st.next], FrameNote::None);
+                    sample_loss(false);
+                }
+                st.last_tx_ms = now;
+                st.last_nak_ms = now;
+                emit_repairs(st);
+                continue;
+            }
+
+            if(st.pending.empty() && now - st.last_nak_ms >= mcfg_.linger_ms)
+            {
+                to_erase.push_back(msg_id);
+                continue;
+            }
+            if(now - st.last_tx_ms >= mcfg_.heartbeat_ms)
+            {
+                emit_tx_(st.pdus.back(), FrameNote::Resend);
+                st.last_tx_ms = now;
+            }
+        }
+        for(size_t i = 0; i < to_erase.size(); i++)
+            msgs_.erase(to_erase[i]);
+    }
+
+    // NAKs gathered since the last tick, within the tick's frame budget: each lost seq goes out
+    // once for every receiver, and a block where no receiver lacks more than one frame gets a
+    // single parity frame instead of one copy per distinct loss. Returns the frames sent.
+    uint32_t McastSender::flush_naks(McTxMsg &st, uint64_t now, uint32_t budget) noexcept
+    {
+        if(st.pending.empty() || budget == 0)
+            return 0;
+
+        sort(st.pending.begin(), st.pending.end());
+        st.pending.erase(unique(st.pending.begin(), st.pending.end()), st.pending.end());
+
+        const uint32_t k = cfg_.fec.k;
+        const uint32_t total = static_cast<uint32_t>(st.pdus.size());
+        uint32_t sent = 0;
+        size_t i = 0;
+        while(i < st.pending.size() && sent < budget)
+        {
+            uint32_t block = (k > 0) ? st.pending[i] / k : st.pending[i];
+            vector<uint32_t> &seqs = seqs_;
+            seqs.clear();
+            for(; i < st.pending.size() && ((k > 0) ? st.pending[i] / k : st.pending[i]) == block; i++)
+            {
+                uint32_t seq = st.pending[i];
+                if(st.repaired_at[seq] != 0 && now - st.repaired_at[seq] < mcfg_.holdoff_ms)
+                    continue;
+                seqs.push_back(seq);
+            }
+            if(seqs.empty())
+                continue;
+
+            for(size_t n = 0; n < seqs.size(); n++)
+            {
+                st.repaired_at[seqs[n]] = now;
+                sample_loss(true);
+            }
+
+            uint32_t block_start = block * k;
+            bool block_sent = k > 0 && st.next >= min<uint32_t>(block_start + k, total);
+            if(block_sent && seqs.size() > 1 && st.block_need[block] == 1)
+            {
+                repairs_.clear();
+                build_repair_pdus(st.pdus, st.msg_id, st.type, block_start, cfg_.fec.k, 1, repairs_);
+                for(size_t n = 0; n < repairs_.size(); n++)
+                    emit_tx_(repairs_[n], FrameNote::None);
+                sent += static_cast<uint32_t>(repairs_.size());
+                repairs_.clear();
+                continue;
+            }
+
+            for(size_t n = 0; n < seqs.size(); n++)
+                emit_tx_(st.pdus[seqs[n]], FrameNote::Resend);
+            sent += static_cast<uint32_t>(seqs.size());
+        }
+
+        st.pending.erase(st.pending.begin(), st.pending.begin() + i);
+        if(st.pending.empty())
+            st.block_need.clear();
+        if(sent > 0)
+            st.last_tx_ms = now;
+        repair_frames_ += sent;
+        return sent;
+    }
+
+    void McastSender::emit_repairs(McTxMsg &msg) noexcept
+    {
+        if(cfg_.fec.k == 0)
+            return;
+
+        const uint32_t k = cfg_.fec.k;
+        while(static_cast<uint64_t>(msg.fec_block) * k < msg.pdus.size())
+        {
+            uint32_t block_start = msg.fec_block * k;
+            uint32_t block_end = min<uint32_t>(block_start + k, static_cast<uint32_t>(msg.pdus.size()));
+            if(msg.next < block_end)
+                return;
+
+            uint8_t groups = fec_groups_for_loss(loss_, cfg_.fec);
+            repairs_.clear();
+            build_repair_pdus(msg.pdus, msg.msg_id, msg.type, block_start, cfg_.fec.k, groups, repairs_);
+            for(size_t i = 0; i < repairs_.size(); i++)
+                emit_tx_(repairs_[i], FrameNote::None);
+            repairs_.clear();
+            msg.fec_block++;
+        }
+    }
+
+    void McastSender::sample_loss(bool lost) noexcept
+    {
+        const double alpha = 1.0 / 64.0;
+        loss_ += alpha * ((lost ? 1.0 : 0.0) - loss_);
+    }
+
+    bool McastSender::owns(uint32_t msg_id) const noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+        return msgs_.find(msg_id) != msgs_.end();
+    }
+
+    bool McastSender::is_done(uint32_t msg_id) const noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+        return msgs_.find(msg_id) == msgs_.end();
+    }
+
+    uint64_t McastSender::repair_frames() const noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+        return repair_frames_;
+    }
+
+    NakScheduler::NakScheduler(McastConfig cfg, NowFn now)
+        : cfg_(cfg), now_(move(now)), rng_(random_device{}())
+    {
+        if(now_ == nullptr)
+            now_ = [](){ return 0u; };
+    }
+
+    uint64_t NakScheduler::jitter(uint32_t max_ms) noexcept
+    {
+        if(max_ms == 0)
+            return 0;
+        return uniform_int_distribution<uint32_t>(0, max_ms)(rng_);
+    }
+
+    void NakScheduler::on_data(uint32_t msg_id, uint32_t total, bool progress) noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+        uint64_t now = now_();
+        auto it = msgs_.find(msg_id);
+        if(it == msgs_.end())
+        {
+            msgs_[msg_id] = Entry{total, now + jitter(cfg_.nak_delay_ms), now, 0};
+            return;
+        }
+        it->second.last_seen = now;
+        if(progress)
+            it->second.backoff = 0;
+    }
+
+    void NakScheduler::suppress(uint32_t msg_id) noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+        auto it = msgs_.find(msg_id);
+        if(it == msgs_.end())
+            return;
+        uint64_t later = now_() + cfg_.holdoff_ms + jitter(cfg_.nak_delay_ms);
+        it->second.next_at = max(it->second.next_at, later);
+    }
+
+    void NakScheduler::forget(uint32_t msg_id) noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+        msgs_.erase(msg_id);
+    }
+
+    vector<NakScheduler::Due> NakScheduler::due() noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+        uint64_t now = now_();
+        vector<Due> out;
+        for(auto it = msgs_.begin(); it != msgs_.end();)
+        {
+            if(now - it->second.last_seen > kNakForgetMs)
+            {
+                it = msgs_.erase(it);
+                continue;
+            }
+            if(now >= it->second.next_at)
+                out.push_back(Due{it->first, it->second.total});
+            ++it;
+        }
+        return out;
+    }
+
+    void NakScheduler::reschedule(uint32_t msg_id, bool sent) noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+        auto it = msgs_.find(msg_id);
+        if(it == msgs_.end())
+            return;
+
+        Entry &e = it->second;
+        uint64_t now = now_();
+        if(!sent)
+        {
+            e.next_at = now + jitter(cfg_.nak_delay_ms);
+            return;
+        }
+        uint64_t wait = static_cast<uint64_t>(cfg_.holdoff_ms) << min(e.backoff, kNakMaxBackoff);
+        e.next_at = now + wait + jitter(cfg_.nak_delay_ms);
+        e.backoff++;
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <random>
+#include "sender.hpp"
+#include "util/mac.hpp"
+
+namespace linkchat
+{
+    // Multicast messages carry this bit in msg_id. Receivers never ACK them; they NAK the
+    // seq ranges they miss and the sender repairs every receiver with one group transmission.
+    inline constexpr std::uint32_t kMcastIdBit = 0x80000000u;
+
+    [[nodiscard]] inline constexpr bool is_mcast_id(std::uint32_t msg_id) noexcept
+    {
+        return (msg_id & kMcastIdBit) != 0;
+    }
+
+    // locally administered group address joined by every LinkChat peer
+    inline constexpr Mac kMcastGroup{{0x03, 0x4c, 0x43, 0x00, 0x00, 0x01}};
+
+    struct McastConfig
+    {
+        Mac group = kMcastGroup;
+        std::uint32_t burst = 64;         // frames (new data and repairs) per tick
+        std::uint32_t nak_delay_ms = 20;  // random wait before a NAK so one receiver's NAK covers the rest
+        std::uint32_t holdoff_ms = 40;    // a repaired seq is not resent again within this window
+        std::uint32_t heartbeat_ms = 100; // last frame is repeated so receivers that lost the tail notice
+        std::uint32_t linger_ms = 1000;   // message is done after this long without NAKs
+    };
+
+    class McastSender
+    {
+    public:
+        McastSender(EmitFrameFn emit_tx, SenderConfig cfg, McastConfig mcfg);
+
+        std::uint32_t send(const std::vector<std::uint8_t> &data, Type type);
+
+        void on_nak(std::uint32_t msg_id, const std::vector<NakRange> &ranges) noexcept;
+
+        void on_tick() noexcept;
+
+        bool owns(std::uint32_t msg_id) const noexcept;
+        bool is_done(std::uint32_t msg_id) const noexcept;
+
+        // data frames resent plus parity frames sent in answer to NAKs
+        std::uint64_t repair_frames() const noexcept;
+
+    private:
+        struct McTxMsg
+        {
+            std::uint32_t msg_id{};
+            Type type{};
+            std::vector<FrameRef> pdus;
+            std::uint32_t next{0};                     // first frame never sent
+            std::uint32_t fec_block{0};                // first block whose proactive repair frames are unsent
+            std::vector<std::uint64_t> repaired_at;    // last NAK repair of each seq
+            std::vector<std::uint32_t> pending;        // NAKed seqs waiting for the next tick
+            std::unordered_map<std::uint32_t, std::uint32_t> block_need; // FEC block -> most frames one NAK lacks
+            std::uint64_t last_tx_ms{0};
+            std::uint64_t last_nak_ms{0};
+        };
+
+        void emit_repairs(McTxMsg &msg) noexcept;
+        std::uint32_t flush_naks(McTxMsg &msg, std::uint64_t now, std::uint32_t budget) noexcept;
+        void sample_loss(bool lost) noexcept;
+
+        EmitFrameFn emit_tx_;
+        SenderConfig cfg_;
+        McastConfig mcfg_;
+        std::unordered_map<std::uint32_t, McTxMsg> msgs_;
+        std::uint32_t next_msg_id_{1};
+        double loss_{0.0};                  // EWMA of NAKed / transmitted frames, sizes proactive FEC
+        std::uint64_t repair_frames_{0};
+        std::vector<FrameRef> repairs_;     // scratch for parity frames, reused across blocks
+        std::vector<std::uint32_t> seqs_;   // scratch for flush_naks
+        mutable std::mutex mu_;
+    };
+
+    // Receiver side: decides when each incomplete multicast message should NAK.
+    // The first NAK waits a random delay; hearing another receiver NAK the same gaps
+    // pushes ours back, and repeated NAKs without progress back off exponentially.
+    class NakScheduler
+    {
+    public:
+        NakScheduler(McastConfig cfg, NowFn now);
+
+        void on_data(std::uint32_t msg_id, std::uint32_t total, bool progress) noexcept;
+        void suppress(std::uint32_t msg_id) noexcept;
+        void forget(std::uint32_t msg_id) noexcept;
+
+        struct Due
+        {
+            std::uint32_t msg_id;
+            std::uint32_t total;
+        };
+        std::vector<Due> due() noexcept;
+
+        // after due(): sent = a NAK went out, otherwise there was nothing to ask for yet
+        void reschedule(std::uint32_t msg_id, bool sent) noexcept;
+
+    private:
+        struct Entry
+        {
+            std::uint32_t total;
+            std::uint64_t next_at;
+            std::uint64_t last_seen;
+            std::uint32_t backoff;
+        };
+
+        std::uint64_t jitter(std::uint32_t max_ms) noexcept;
+
+        McastConfig cfg_;
+        NowFn now_;
+        std::unordered_map<std::uint32_t, Entry> msgs_;
+        std::mt19937 rng_;
+        std::mutex mu_;
+    };
+}
@@ -9,33 +9,78 @@ using namespace std;
 
 namespace linkchat
 {
-    bool bind_app_to_eth(LinkchatApp &app, const EthConfig &cfg, AppEthHandle &out) noexcept
+    bool bind_app_to_transport(LinkchatApp &app, unique_ptr<Transport> transport, AppEthHandle &out) noexcept
     {
-        if (!eth_init(cfg))
+        if (!transport || out.rx_thread.joinable())
             return false;
+        out.transport = move(transport);
+        out.app = &app;
+        Transport *t = out.transport.get();
+
+        app.set_emit_pdu([t](const FrameRef &pdu)
+                         { t->send(pdu); });
+
+        app.set_emit_echo([t](const Mac &dst, const FrameRef &pdu, FrameStamp *tx)
+                          { return tx ? t->send_stamped(dst, pdu.data(), pdu.size(), *tx) : t->send_to(dst, pdu); });
+
+        const Mac group = app.mcast_config().group;
+        if (t->join_group(group))
+            app.set_emit_group_pdu([t, group](const FrameRef &pdu)
+                                   { t->send_to(group, pdu); });
+
+        PacketCapture *cap = app.capture();
+        if (cap)
+            cap->set_local_mac(t->local_mac());
 
-        app.set_emit_pdu([](const vector<uint8_t> &pdu)
-                         { eth_send_pdu(pdu); });
+        out.peers = app.peer_directory();
+        if (out.peers)
+            out.peers->attach([t, cap](const Mac &dst, const FrameRef &pdu)
+                              {
+                                  if (cap)
+                                      cap->record(CaptureDir::Tx, dst, pdu.data(), pdu.size());
+                                  t->send_to(dst, pdu); });
 
         out.running = true;
-        out.rx_thread = thread([&app, &out]
-                               { eth_rx_loop([&](const Mac &src_mac, const uint8_t *pdu, size_t pdu_size)
-                                             {if(out.running) app.on_rx_pdu(src_mac, pdu, pdu_size); }); });
+        out.rx_thread = thread([&app, &out, t]
+                               { t->run_rx_batch([&](const RxFrame *frames, size_t n)
+                                                 {if(out.running) app.on_rx_batch(frames, n); }); });
 
         return true;
     }
 
+    bool bind_app_to_eth(LinkchatApp &app, const EthConfig &cfg, AppEthHandle &out) noexcept
+    {
+        auto eth = make_unique<EthTransport>();
+        if (!eth->open(cfg))
+            return false;
+        return bind_app_to_transport(app, move(eth), out);
+    }
+
     void unbind_app_from_eth(AppEthHandle &h) noexcept
     {
         h.running = false;
-        eth_shutdown();
+        if (h.peers)
+            h.peers->attach(nullptr);
+        h.peers = nullptr;
+        if (h.transport)
+            h.transport->stop();
         if (h.rx_thread.joinable())
             h.rx_thread.join();
+        if (h.app)
+        {
+            // nothing new arrives now; let the workers hand over what already did
+            h.app->flush_deliveries();
+            h.app->set_emit_pdu(nullptr);
+            h.app->set_emit_group_pdu(nullptr);
+            h.app->set_emit_echo(nullptr);
+        }
+        h.app = nullptr;
+        h.transport.reset();
     }
 
-    bool app_eth_send_to(const Mac &dst, const vector<uint8_t> &pdu) noexcept
+    bool app_eth_send_to(AppEthHandle &h, const Mac &dst, const vector<uint8_t> &pdu) noexcept
     {
-        return eth_send_pdu_to(dst, pdu);
+        return h.transport && h.transport->send_to(dst, pdu.data(), pdu.size());
     }
 
 }
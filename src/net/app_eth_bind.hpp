@@ -1,24 +1,35 @@
 #pragma once
 #include <thread>
 #include <functional>
+#include <memory>
 #include <vector>
 #include <atomic>
 #include "../app.hpp"
+#include "transport.hpp"
 #include "eth_adapter.hpp"
 
 namespace linkchat
 {
 
+    // One app on one transport, with its own RX thread. Handles are independent, so a
+    // process can bind several apps to several segments at once.
     struct AppEthHandle
     {
+        std::unique_ptr<Transport> transport;
         std::thread rx_thread;
         std::atomic<bool> running{false};
+        LinkchatApp *app = nullptr;
+        PeerDirectory *peers = nullptr;   // detached again on unbind
     };
 
+    bool bind_app_to_transport(LinkchatApp &app, std::unique_ptr<Transport> transport, AppEthHandle &out) noexcept;
+
+    // opens an EthTransport on cfg and binds the app to it
     bool bind_app_to_eth(LinkchatApp &app, const EthConfig &cfg, AppEthHandle &out) noexcept;
 
+    // stops the RX thread, detaches the app's emitters and closes the transport
     void unbind_app_from_eth(AppEthHandle &h) noexcept;
 
-    bool app_eth_send_to(const Mac& dst, const std::vector<std::uint8_t>& pdu) noexcept;
+    bool app_eth_send_to(AppEthHandle &h, const Mac& dst, const std::vector<std::uint8_t>& pdu) noexcept;
 
 }
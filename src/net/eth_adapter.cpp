@@ -1,32 +1,88 @@
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <linux/if_packet.h>
 #include <net/ethernet.h>
 #include <unistd.h>
 #include <poll.h>
 #include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 #include <atomic>
 #include <vector>
 #include <string>
 #include <cstring>
 #include <fstream>
+#include <climits>
+#include <chrono>
+#include <thread>
 
 #include "eth_adapter.hpp"
+#include "xdp_socket.hpp"
 #include "../util/mac.hpp"
+#include "../util/structs.hpp"
 
 using namespace std;
 
 namespace linkchat
 {
-    static int g_rx_fd = -1;
-    static int g_tx_fd = -1;
-    static atomic<bool> g_running{false};
-    static int g_ifindex = -1;
-    static EthConfig g_cfg;
-    static bool is_open() noexcept
+    struct EthTransport::Link
     {
-
-        return (g_rx_fd >= 0 && g_tx_fd >= 0);
+        string ifname;
+        int rx_fd = -1;
+        int tx_fd = -1;
+        int ts_fd = -1;  // send-only socket for frames whose TX time is wanted
+        int ifindex = -1;
+        bool hw_stamps = false; // the NIC stamps frames in hardware
+        bool hw_restore = false; // we switched the NIC's stamping on: hw_prev goes back on close
+        hwtstamp_config hw_prev{};
+        Mac src_mac{};
+        Mac dst_mac{};
+        XdpSocket xsk;   // open only in XDP mode; the AF_PACKET sockets stay as fallback
+        atomic<uint64_t> tx_frames{0};
+        atomic<uint64_t> rx_frames{0};
+    };
+    using Link = EthTransport::Link;
+
+    static constexpr int kRxBufBytes = 4 << 20;
+    static constexpr int kTxBufBytes = 4 << 20;       // low-latency mode: sends never block on a full socket
+    static constexpr int kBusyPollUs = 50;            // SO_BUSY_POLL: the driver is polled this long per receive
+    static constexpr uint64_t kSpinIdleNs = 2000000;  // spinning RX falls back to poll() after this long without a frame
+    static constexpr size_t kXdpRxBurst = 64;         // frames taken off an AF_XDP RX ring per wakeup
+    static constexpr int kTxStampWaitMs = 5;          // send_stamped gives up on the TX stamp after this long
+    static constexpr size_t kTxSampleFrames = 64;     // striped sends between two looks at the socket queues
+    static constexpr int kTxQueueSlack = 64 << 10;    // links queued this close to the emptiest one share the frames
+
+    static void restore_hw_stamps(int fd, const string &ifname, hwtstamp_config prev) noexcept;
+
+    static void close_link(Link &link) noexcept
+    {
+        if (link.hw_restore && link.rx_fd >= 0)
+            restore_hw_stamps(link.rx_fd, link.ifname, link.hw_prev);
+        link.hw_restore = false;
+        link.xsk.close();
+        if (link.tx_fd >= 0)
+            ::close(link.tx_fd);
+        if (link.rx_fd >= 0)
+            ::close(link.rx_fd);
+        if (link.ts_fd >= 0)
+            ::close(link.ts_fd);
+        link.tx_fd = -1;
+        link.rx_fd = -1;
+        link.ts_fd = -1;
+        link.hw_stamps = false;
+        link.ifindex = -1;
+        link.ifname.clear();
+        link.src_mac = {};
+        link.dst_mac = {};
+        link.tx_frames = 0;
+        link.rx_frames = 0;
     }
 
     static bool read_sysfs_ifindex(const string &ifname, int &out_ifindex) noexcept
@@ -96,28 +152,85 @@ namespace linkchat
         return 14;
     }
 
-    bool eth_init(const EthConfig &cfg) noexcept
+    static void set_low_latency_opts(int rxfd, int txfd) noexcept
     {
-        if (cfg.ifname.empty() || cfg.ether_type == 0)
-            return false;
-        if (g_running.load() || g_rx_fd >= 0 || g_tx_fd >= 0)
+        int busy = kBusyPollUs;
+        ::setsockopt(rxfd, SOL_SOCKET, SO_BUSY_POLL, &busy, sizeof(busy));
+
+        // straight to the driver queue, no qdisc in the way
+        int one = 1;
+        ::setsockopt(txfd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+
+        int sndbuf = kTxBufBytes;
+        if (::setsockopt(txfd, SOL_SOCKET, SO_SNDBUFFORCE, &sndbuf, sizeof(sndbuf)) < 0)
+            ::setsockopt(txfd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    }
+
+    // NIC timestamping for every frame in and out; changes the device's setting, so it is only
+    // switched on where nothing has configured it yet, and left alone where it is already on.
+    // changed tells the caller to put prev back (restore_hw_stamps) once it is done
+    static bool enable_hw_stamps(int fd, const string &ifname, hwtstamp_config &prev, bool &changed) noexcept
+    {
+        changed = false;
+        ifreq ifr{};
+        hwtstamp_config hc{};
+        strncpy(ifr.ifr_name, ifname.c_str(), IFNAMSIZ - 1);
+        ifr.ifr_data = reinterpret_cast<char *>(&hc);
+        if (::ioctl(fd, SIOCGHWTSTAMP, &ifr) == 0)
+        {
+            if (hc.tx_type == HWTSTAMP_TX_ON && hc.rx_filter == HWTSTAMP_FILTER_ALL)
+                return true;
+            if (hc.tx_type != HWTSTAMP_TX_OFF || hc.rx_filter != HWTSTAMP_FILTER_NONE)
+                return false; // someone else's configuration (PTP)
+        }
+        prev = hc;
+        hc = hwtstamp_config{};
+        hc.tx_type = HWTSTAMP_TX_ON;
+        hc.rx_filter = HWTSTAMP_FILTER_ALL;
+        if (::ioctl(fd, SIOCSHWTSTAMP, &ifr) != 0)
             return false;
+        changed = true;
+        return hc.rx_filter == HWTSTAMP_FILTER_ALL;
+    }
+
+    static void restore_hw_stamps(int fd, const string &ifname, hwtstamp_config prev) noexcept
+    {
+        ifreq ifr{};
+        strncpy(ifr.ifr_name, ifname.c_str(), IFNAMSIZ - 1);
+        ifr.ifr_data = reinterpret_cast<char *>(&prev);
+        ::ioctl(fd, SIOCSHWTSTAMP, &ifr);
+    }
+
+    // kernel (and NIC, with hw) arrival time of every frame read from the packet socket, or none
+    static void set_rx_stamping(int fd, bool on, bool hw) noexcept
+    {
+        int ts_flags = 0;
+        if (on)
+            ts_flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+                       (hw ? SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE : 0);
+        if (::setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &ts_flags, sizeof(ts_flags)) < 0)
+        {
+            int ts = on ? 1 : 0;
+            ::setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &ts, sizeof(ts));
+        }
+    }
 
+    static bool open_link(const EthConfig &cfg, const string &ifname, const Mac &cfg_src, const Mac &dst, Link &out, size_t &out_mtu) noexcept
+    {
         int ifindex = -1;
-        if (!read_sysfs_ifindex(cfg.ifname, ifindex) || ifindex <= 0)
+        if (!read_sysfs_ifindex(ifname, ifindex) || ifindex <= 0)
             return false;
 
-        Mac src = cfg.src_mac;
+        Mac src = cfg_src;
         if (is_zero(src))
         {
-            if (!read_sysfs_mac(cfg.ifname, src))
+            if (!read_sysfs_mac(ifname, src))
                 return false;
         }
 
         size_t mtu_sys = 0;
-        if (!read_sysfs_mtu(cfg.ifname, mtu_sys) || mtu_sys < 64)
+        if (!read_sysfs_mtu(ifname, mtu_sys) || mtu_sys < 64)
             return false;
-        size_t frame_mtu = (cfg.frame_mtu == 0) ? mtu_sys : min(cfg.frame_mtu, mtu_sys);
 
         int rxfd = ::socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
         if (rxfd < 0)
@@ -134,191 +247,673 @@ namespace linkchat
             return false;
         }
 
+        // room for a full burst from the sender (multicast sends have no window)
+        int rcvbuf = kRxBufBytes;
+        if (::setsockopt(rxfd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0)
+            ::setsockopt(rxfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+        // kernel arrival time of every frame, for the RX latency histogram and echo turnaround;
+        // rx_one only reads it where it is wanted. The NIC's only when asked for (ping), since it
+        // reconfigures the device for everyone using it
+        hwtstamp_config hw_prev{};
+        bool hw_restore = false;
+        const bool hw = cfg.hw_stamps && enable_hw_stamps(rxfd, ifname, hw_prev, hw_restore);
+        set_rx_stamping(rxfd, true, hw);
+
+        // protocol 0: receives nothing, so its error queue (where TX stamps come back) never
+        // competes with received frames for buffer space. Stamps are asked for per frame
+        int tsfd = ::socket(AF_PACKET, SOCK_RAW, 0);
+        if (tsfd >= 0)
+        {
+            sockaddr_ll tsll = sll;
+            tsll.sll_protocol = 0;
+            int report = SOF_TIMESTAMPING_SOFTWARE | (hw ? SOF_TIMESTAMPING_RAW_HARDWARE : 0);
+            if (::bind(tsfd, reinterpret_cast<sockaddr *>(&tsll), sizeof(tsll)) < 0 ||
+                ::setsockopt(tsfd, SOL_SOCKET, SO_TIMESTAMPING, &report, sizeof(report)) < 0)
+            {
+                ::close(tsfd);
+                tsfd = -1;
+            }
+        }
+
         int txfd = ::socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
-        if (txfd < 0)
+        if (txfd < 0 || ::bind(txfd, reinterpret_cast<sockaddr *>(&sll), sizeof(sll)) < 0)
         {
+            if (hw_restore)
+                restore_hw_stamps(rxfd, ifname, hw_prev);
             ::close(rxfd);
+            if (txfd >= 0)
+                ::close(txfd);
+            if (tsfd >= 0)
+                ::close(tsfd);
             return false;
         }
-        if (::bind(txfd, reinterpret_cast<sockaddr *>(&sll), sizeof(sll)) < 0)
+
+        if (cfg.low_latency)
+            set_low_latency_opts(rxfd, txfd);
+
+        // frames of our EtherType are redirected to the AF_XDP socket before the stack sees
+        // them; if it cannot be set up (no driver hook, another XDP program) the link stays AF_PACKET
+        if (cfg.use_xdp)
+            out.xsk.open(ifindex, cfg.xdp_queue, cfg.ether_type, mtu_sys, cfg.low_latency);
+
+        out.ifname = ifname;
+        out.rx_fd = rxfd;
+        out.tx_fd = txfd;
+        out.ts_fd = tsfd;
+        out.hw_stamps = hw && tsfd >= 0;
+        out.hw_restore = hw_restore;
+        out.hw_prev = hw_prev;
+        out.ifindex = ifindex;
+        out.src_mac = src;
+        out.dst_mac = dst;
+        out.tx_frames = 0;
+        out.rx_frames = 0;
+        out_mtu = mtu_sys;
+        return true;
+    }
+
+    // header + pdu + zero padding up to the 60-byte minimum, in one sendmsg
+    static bool send_frame(int fd, const sockaddr_ll *to, const uint8_t *hdr, const uint8_t *pdu, size_t len) noexcept
+    {
+        static const uint8_t kPad[60] = {};
+        const size_t frame_len = kEthHdr + len;
+
+        iovec iov[3];
+        iov[0].iov_base = const_cast<uint8_t *>(hdr);
+        iov[0].iov_len = kEthHdr;
+        iov[1].iov_base = const_cast<uint8_t *>(pdu);
+        iov[1].iov_len = len;
+        size_t niov = 2;
+        if (frame_len < sizeof(kPad))
         {
-            ::close(rxfd);
-            ::close(txfd);
+            iov[2].iov_base = const_cast<uint8_t *>(kPad);
+            iov[2].iov_len = sizeof(kPad) - frame_len;
+            niov = 3;
+        }
+
+        msghdr msg{};
+        msg.msg_name = const_cast<sockaddr_ll *>(to);
+        msg.msg_namelen = to == nullptr ? 0 : static_cast<socklen_t>(sizeof(*to));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = niov;
+
+        const ssize_t sent = ::sendmsg(fd, &msg, 0);
+        return sent == static_cast<ssize_t>(max(frame_len, sizeof(kPad)));
+    }
+
+    // AF_XDP when the link has it, AF_PACKET otherwise or while every UMEM TX frame is in flight
+    static bool link_send(Link &link, const sockaddr_ll *to, const uint8_t *hdr, const uint8_t *pdu, size_t len) noexcept
+    {
+        if (link.xsk.is_open() && link.xsk.send(hdr, kEthHdr, pdu, len))
+            return true;
+        return send_frame(link.tx_fd, to, hdr, pdu, len);
+    }
+
+    static uint64_t clock_ns(clockid_t clk) noexcept
+    {
+        timespec ts{};
+        ::clock_gettime(clk, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    static void pin_current_thread(int cpu) noexcept
+    {
+        if (cpu < 0 || cpu >= CPU_SETSIZE)
+            return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+    }
+
+    EthTransport::EthTransport() noexcept : links_(new (nothrow) Link[kMaxLinks])
+    {
+    }
+
+    EthTransport::~EthTransport()
+    {
+        close();
+    }
+
+    bool EthTransport::is_open() const noexcept
+    {
+        return (nlinks_ > 0 && links_[0].rx_fd >= 0 && links_[0].tx_fd >= 0);
+    }
+
+    bool EthTransport::is_local_mac(const Mac &mac) const noexcept
+    {
+        for (size_t i = 0; i < nlinks_; i++)
+        {
+            if (links_[i].src_mac == mac)
+                return true;
+        }
+        return false;
+    }
+
+    bool EthTransport::is_joined_group(const Mac &mac) const noexcept
+    {
+        const size_t n = ngroups_.load();
+        for (size_t i = 0; i < n; i++)
+        {
+            if (groups_[i] == mac)
+                return true;
+        }
+        return false;
+    }
+
+    bool EthTransport::open(const EthConfig &cfg) noexcept
+    {
+        if (!links_ || cfg.ifname.empty() || cfg.ether_type == 0)
             return false;
+        if (running_.load() || nlinks_ > 0)
+            return false;
+        if (cfg.extra_links.size() + 1 > kMaxLinks)
+            return false;
+
+        size_t mtu_sys = 0;
+        if (!open_link(cfg, cfg.ifname, cfg.src_mac, cfg.dst_mac, links_[0], mtu_sys))
+            return false;
+        nlinks_ = 1;
+
+        for (const EthLink &extra : cfg.extra_links)
+        {
+            size_t link_mtu = 0;
+            if (extra.ifname.empty() || !open_link(cfg, extra.ifname, Mac{}, extra.dst_mac, links_[nlinks_], link_mtu))
+            {
+                for (size_t i = 0; i < nlinks_; i++)
+                    close_link(links_[i]);
+                nlinks_ = 0;
+                return false;
+            }
+            mtu_sys = min(mtu_sys, link_mtu);
+            nlinks_++;
         }
 
-        g_rx_fd = rxfd;
-        g_tx_fd = txfd;
-        g_ifindex = ifindex;
-        g_cfg = cfg;
-        g_cfg.src_mac = src;
-        g_cfg.frame_mtu = frame_mtu;
+        size_t frame_mtu = (cfg.frame_mtu == 0) ? mtu_sys : min(cfg.frame_mtu, mtu_sys);
+
+        cfg_ = cfg;
+        cfg_.src_mac = links_[0].src_mac;
+        cfg_.frame_mtu = frame_mtu;
+        rr_ = 0;
+        tx_links_ = ~0u;
+        ngroups_ = 0;
+        rx_latency_.reset();
+        rx_stamps_ = cfg.rx_stamps;
 
-        g_running = true;
+        running_ = true;
         return true;
     }
 
-    bool eth_send_pdu(const vector<uint8_t> &pdu) noexcept
+    void EthTransport::set_rx_stamps(bool on) noexcept
+    {
+        if (is_open())
+            rx_stamps_ = on;
+    }
+
+    void EthTransport::stop() noexcept
+    {
+        running_ = false;
+    }
+
+    void EthTransport::close() noexcept
+    {
+        running_ = false;
+        // the RX thread notices within one poll() timeout; the UMEM and rings cannot go away under it
+        while (rx_active_.load())
+            this_thread::sleep_for(chrono::milliseconds(1));
+        for (size_t i = 0; i < nlinks_; i++)
+            close_link(links_[i]);
+        nlinks_ = 0;
+        ngroups_ = 0;
+        cfg_ = {};
+    }
+
+    // round-robin over the links whose sockets had the fewest bytes queued when last looked at;
+    // the queues (one ioctl per link) are only sampled every kTxSampleFrames sends
+    size_t EthTransport::pick_tx_link() noexcept
+    {
+        if (nlinks_ <= 1)
+            return 0;
+
+        const size_t n = rr_.fetch_add(1);
+        if (n % kTxSampleFrames == 0)
+        {
+            int queued[kMaxLinks];
+            int least = INT_MAX;
+            for (size_t i = 0; i < nlinks_; i++)
+            {
+                if (::ioctl(links_[i].tx_fd, SIOCOUTQ, &queued[i]) < 0)
+                    queued[i] = 0;
+                least = min(least, queued[i]);
+            }
+            uint32_t mask = 0;
+            for (size_t i = 0; i < nlinks_; i++)
+            {
+                if (queued[i] - least <= kTxQueueSlack)
+                    mask |= 1u << i;
+            }
+            tx_links_.store(mask, memory_order_relaxed);
+        }
+
+        const uint32_t mask = tx_links_.load(memory_order_relaxed);
+        for (size_t k = 0; k < nlinks_; k++)
+        {
+            const size_t i = (n + k) % nlinks_;
+            if (mask & (1u << i))
+                return i;
+        }
+        return n % nlinks_;
+    }
+
+    bool EthTransport::send(const uint8_t *pdu, size_t len) noexcept
     {
-        if (!g_running.load() || g_tx_fd < 0)
+        if (!running_.load() || !is_open())
             return false;
 
-        if (pdu.empty())
+        if (pdu == nullptr || len == 0)
             return false;
 
-        if (pdu.size() > g_cfg.frame_mtu)
+        if (len > cfg_.frame_mtu)
             return false;
 
-        size_t frame_len = kEthHdr + pdu.size();
-        if (frame_len < 60)
-            frame_len = 60;
+        Link &link = links_[pick_tx_link()];
 
-        vector<uint8_t> frame(frame_len, 0);
-        build_eth_header(frame.data(), g_cfg.dst_mac, g_cfg.src_mac, g_cfg.ether_type);
-        if (!pdu.empty())
-        {
-            for (int i = 0; i < pdu.size(); i++)
-                frame[kEthHdr + i] = pdu[i];
-        }
+        uint8_t hdr[kEthHdr];
+        build_eth_header(hdr, link.dst_mac, link.src_mac, cfg_.ether_type);
 
         sockaddr_ll to{};
         to.sll_family = AF_PACKET;
         to.sll_protocol = htons(ETH_P_ALL);
-        to.sll_ifindex = g_ifindex;
+        to.sll_ifindex = link.ifindex;
         to.sll_halen = 6;
         for (int i = 0; i < 6; i++)
-            to.sll_addr[i] = g_cfg.dst_mac.bytes[i];
+            to.sll_addr[i] = link.dst_mac.bytes[i];
 
-        const ssize_t sent = ::sendto(g_tx_fd,
-                                      frame.data(),
-                                      static_cast<int>(frame.size()),
-                                      0,
-                                      reinterpret_cast<sockaddr *>(&to),
-                                      static_cast<socklen_t>(sizeof(to)));
-
-        return (sent == static_cast<ssize_t>(frame.size()));
+        if (!link_send(link, &to, hdr, pdu, len))
+            return false;
+        link.tx_frames.fetch_add(1, memory_order_relaxed);
+        return true;
     }
 
-    void eth_rx_loop(function<void(const Mac &, const uint8_t *, size_t)> on_pdu) noexcept
+    bool EthTransport::send_to(const Mac &dst, const uint8_t *pdu, size_t len) noexcept
     {
-        if (g_rx_fd < 0)
-            return;
-        if (!on_pdu)
-        {
-            on_pdu = [](const Mac &, const uint8_t *, size_t) {};
-        }
+        if (!is_open())
+            return false;
 
-        const size_t bufcap = max<size_t>(g_cfg.frame_mtu + 64, 2048);
-        vector<uint8_t> buf(bufcap);
+        if (pdu == nullptr || len == 0)
+            return false;
+
+        uint8_t hdr[kEthHdr];
+        build_eth_header(hdr, dst, cfg_.src_mac, cfg_.ether_type);
+
+        if (!link_send(links_[0], nullptr, hdr, pdu, len))
+            return false;
+        links_[0].tx_frames.fetch_add(1, memory_order_relaxed);
+        return true;
+    }
 
-        pollfd pfd;
-        pfd.fd = g_rx_fd;
-        pfd.events = POLLIN;
-        pfd.revents = 0;
+    static uint64_t timespec_ns(const timespec &ts) noexcept
+    {
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+    }
 
-        while (g_running.load())
+    // always over the first link's AF_PACKET path (AF_XDP frames are not stamped), with the
+    // stamps requested for this frame only; the kernel hands them back on the error queue with
+    // a copy of the frame, which tells them apart from late stamps of earlier frames
+    bool EthTransport::send_stamped(const Mac &dst, const uint8_t *pdu, size_t len, FrameStamp &tx) noexcept
+    {
+        tx = FrameStamp{};
+        if (!is_open() || pdu == nullptr || len == 0 || len > cfg_.frame_mtu)
+            return false;
+        Link &link = links_[0];
+        if (link.ts_fd < 0)
+            return send_to(dst, pdu, len);
+
+        static const uint8_t kPad[60] = {};
+        uint8_t hdr[kEthHdr];
+        build_eth_header(hdr, dst, cfg_.src_mac, cfg_.ether_type);
+        const size_t frame_len = kEthHdr + len;
+        iovec iov[3] = {{hdr, kEthHdr}, {const_cast<uint8_t *>(pdu), len}, {const_cast<uint8_t *>(kPad), 0}};
+        if (frame_len < sizeof(kPad))
+            iov[2].iov_len = sizeof(kPad) - frame_len;
+
+        alignas(cmsghdr) char ctrl[CMSG_SPACE(sizeof(uint32_t))] = {};
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 3;
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+        cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SO_TIMESTAMPING;
+        c->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+        const uint32_t want = SOF_TIMESTAMPING_TX_SOFTWARE | (link.hw_stamps ? SOF_TIMESTAMPING_TX_HARDWARE : 0);
+        memcpy(CMSG_DATA(c), &want, sizeof(want));
+
+        if (::sendmsg(link.ts_fd, &msg, 0) != static_cast<ssize_t>(max(frame_len, sizeof(kPad))))
+            return false;
+        link.tx_frames.fetch_add(1, memory_order_relaxed);
+
+        // the software stamp is taken as the driver queues the frame, the hardware one once it left
+        uint8_t echo[2048];
+        const uint64_t deadline = clock_ns(CLOCK_MONOTONIC) + uint64_t(kTxStampWaitMs) * 1000000ull;
+        while ((tx.sw_ns == 0 || (link.hw_stamps && tx.hw_ns == 0)))
         {
-            pfd.revents = 0;
-            int pr = ::poll(&pfd, 1, 250);
-            if (pr < 0)
+            alignas(cmsghdr) char ectrl[512];
+            iovec eiov{echo, sizeof(echo)};
+            msghdr em{};
+            em.msg_iov = &eiov;
+            em.msg_iovlen = 1;
+            em.msg_control = ectrl;
+            em.msg_controllen = sizeof(ectrl);
+            const ssize_t n = ::recvmsg(link.ts_fd, &em, MSG_ERRQUEUE | MSG_DONTWAIT);
+            if (n < 0)
             {
-                if (errno == EINTR)
-                    continue;
-                break;
-            }
-            if (pr == 0)
+                const uint64_t now = clock_ns(CLOCK_MONOTONIC);
+                if (now >= deadline)
+                    break;
+                pollfd p{link.ts_fd, 0, 0};
+                ::poll(&p, 1, static_cast<int>((deadline - now + 999999) / 1000000));
                 continue;
-            if ((pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) != 0)
-                break;
-            if ((pfd.revents & POLLIN) == 0)
+            }
+            if (static_cast<size_t>(n) < frame_len || memcmp(echo + kEthHdr, pdu, len) != 0)
                 continue;
-
-            sockaddr_ll saddr{};
-            socklen_t alen = sizeof(saddr);
-            const ssize_t rcv = ::recvfrom(g_rx_fd,
-                                           buf.data(),
-                                           static_cast<int>(buf.size()),
-                                           0,
-                                           reinterpret_cast<sockaddr *>(&saddr),
-                                           &alen);
-            if (rcv <= 0)
+            for (cmsghdr *e = CMSG_FIRSTHDR(&em); e != nullptr; e = CMSG_NXTHDR(&em, e))
             {
-                if (rcv < 0 && errno == EINTR)
+                if (e->cmsg_level != SOL_SOCKET || e->cmsg_type != SCM_TIMESTAMPING)
                     continue;
-                break;
+                scm_timestamping st{};
+                memcpy(&st, CMSG_DATA(e), sizeof(st));
+                if (tx.sw_ns == 0)
+                    tx.sw_ns = timespec_ns(st.ts[0]);
+                if (tx.hw_ns == 0)
+                    tx.hw_ns = timespec_ns(st.ts[2]);
             }
+        }
+        return true;
+    }
 
-            size_t len = static_cast<size_t>(rcv);
-            if (len < kEthHdr)
-                continue;
+    // fills out with a received frame (Ethernet header included) if it is addressed to us
+    bool EthTransport::accept_frame(Link &link, const uint8_t *frame, size_t len, RxFrame &out) noexcept
+    {
+        if (len < kEthHdr)
+            return false;
 
-            const uint16_t et = (static_cast<uint16_t>(buf[12]) << 8) | (static_cast<uint16_t>(buf[13]));
-            const int pkttype = saddr.sll_pkttype;
+        const uint16_t et = (static_cast<uint16_t>(frame[12]) << 8) | (static_cast<uint16_t>(frame[13]));
+        if (et != cfg_.ether_type)
+            return false;
 
-            if (et != g_cfg.ether_type)
-                continue;
+        Mac dst{};
+        for (int i = 0; i < 6; ++i)
+            dst.bytes[i] = frame[0 + i];
+
+        if (!(dst == link.src_mac) && !is_broadcast(dst) && !is_joined_group(dst) /*&& pkttype != PACKET_OUTGOING*/)
+            return false;
+
+        Mac src_mac{};
+        for (int i = 0; i < 6; ++i)
+            src_mac.bytes[i] = frame[6 + i];
+
+        if (is_local_mac(src_mac))
+            return false;
 
-            if (pkttype != PACKET_HOST && pkttype != PACKET_BROADCAST && pkttype != PACKET_MULTICAST)
+        link.rx_frames.fetch_add(1, memory_order_relaxed);
+        out = RxFrame{src_mac, frame + kEthHdr, len - kEthHdr};
+        return true;
+    }
+
+    // reads one frame from the link's AF_PACKET socket and hands it on if it is ours;
+    // 1 = a frame was read, 0 = nothing queued, -1 = the socket failed
+    int EthTransport::rx_one(Link &link, vector<uint8_t> &buf, const RxBatchFn &on_batch) noexcept
+    {
+        sockaddr_ll saddr{};
+        alignas(cmsghdr) char ctrl[CMSG_SPACE(sizeof(scm_timestamping))];
+        iovec iov{buf.data(), buf.size()};
+        msghdr msg{};
+        msg.msg_name = &saddr;
+        msg.msg_namelen = sizeof(saddr);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+
+        const ssize_t rcv = ::recvmsg(link.rx_fd, &msg, MSG_DONTWAIT);
+        if (rcv < 0)
+            return (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        if (rcv == 0)
+            return -1;
+
+        const int pkttype = saddr.sll_pkttype;
+        if (pkttype != PACKET_HOST && pkttype != PACKET_BROADCAST && pkttype != PACKET_MULTICAST)
+            return 1;
+
+        RxFrame f;
+        if (!accept_frame(link, buf.data(), static_cast<size_t>(rcv), f))
+            return 1;
+        // echo requests always carry their stamp, the responder's turnaround starts from it;
+        // other frames only while the histogram is on
+        const bool stamps = rx_stamps_.load(memory_order_relaxed);
+        const bool echo = f.len > 0 && f.pdu[0] == static_cast<uint8_t>(Type::ECHO);
+        if (!stamps && !echo)
+        {
+            on_batch(&f, 1);
+            return 1;
+        }
+
+        // arrival time is read before the frame is handed on, so it only covers the receive path
+        FrameStamp stamp{};
+        for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c != nullptr; c = CMSG_NXTHDR(&msg, c))
+        {
+            if (c->cmsg_level != SOL_SOCKET)
                 continue;
+            if (c->cmsg_type == SCM_TIMESTAMPING)
+            {
+                scm_timestamping st{};
+                memcpy(&st, CMSG_DATA(c), sizeof(st));
+                stamp.sw_ns = timespec_ns(st.ts[0]);
+                stamp.hw_ns = timespec_ns(st.ts[2]);
+            }
+            else if (c->cmsg_type == SCM_TIMESTAMPNS)
+            {
+                timespec arrival{};
+                memcpy(&arrival, CMSG_DATA(c), sizeof(arrival));
+                stamp.sw_ns = timespec_ns(arrival);
+            }
+        }
+        uint64_t latency = 0;
+        bool stamped = false;
+        if (stamps)
+        {
+            const uint64_t now = clock_ns(CLOCK_REALTIME);
+            stamped = stamp.sw_ns != 0 && now >= stamp.sw_ns;
+            if (stamped)
+                latency = now - stamp.sw_ns;
+        }
+
+        f.stamp = stamp;
+        on_batch(&f, 1);
+        if (stamped)
+            rx_latency_.record(latency);
+        return 1;
+    }
 
-            Mac dst{};
-            for (int i = 0; i < 6; ++i)
-                dst.bytes[i] = buf[0 + i];
+    void EthTransport::run_rx(RxPduFn on_pdu) noexcept
+    {
+        run_rx_batch([&on_pdu](const RxFrame *frames, size_t n)
+                     {
+                         for (size_t i = 0; i < n; i++)
+                             if (on_pdu)
+                                 on_pdu(frames[i].src, frames[i].pdu, frames[i].len); });
+    }
 
-            if (!(dst == g_cfg.src_mac) && !is_broadcast(dst) /*&& pkttype != PACKET_OUTGOING*/)
+    void EthTransport::run_rx_batch(RxBatchFn on_batch) noexcept
+    {
+        // raised before running_ is read: close() either waits for us or we see it stopping
+        rx_active_ = true;
+        if (!running_.load() || !is_open())
+        {
+            rx_active_ = false;
+            return;
+        }
+        if (!on_batch)
+        {
+            on_batch = [](const RxFrame *, size_t) {};
+        }
+
+        const size_t bufcap = max<size_t>(cfg_.frame_mtu + 64, 2048);
+        vector<uint8_t> buf(bufcap);
+
+        // one pollfd per AF_PACKET socket, then one per AF_XDP socket; frames the XDP program
+        // could not redirect (no socket on their queue) still arrive on the packet socket
+        const size_t nlinks = nlinks_;
+        pollfd pfds[2 * kMaxLinks];
+        size_t owner[2 * kMaxLinks];
+        vector<function<void(const uint8_t *, size_t)>> xsk_rx(nlinks);
+        // an AF_XDP burst is handed over whole, before its frames go back to the fill ring
+        RxFrame burst[kRxBatchMax];
+        size_t nburst = 0;
+        const function<void()> flush_burst = [&]
+        {
+            if (nburst > 0)
+                on_batch(burst, nburst);
+            nburst = 0;
+        };
+        size_t nfds = 0;
+        for (size_t i = 0; i < nlinks; i++)
+        {
+            pfds[nfds] = {links_[i].rx_fd, POLLIN, 0};
+            owner[nfds++] = i;
+        }
+        const size_t first_xsk = nfds;
+        for (size_t i = 0; i < nlinks; i++)
+        {
+            Link &link = links_[i];
+            if (!link.xsk.is_open())
                 continue;
+            xsk_rx[i] = [this, &link, &burst, &nburst, &flush_burst](const uint8_t *frame, size_t len)
+            {
+                if (nburst == kRxBatchMax)
+                    flush_burst();
+                if (accept_frame(link, frame, len, burst[nburst]))
+                    nburst++;
+            };
+            pfds[nfds] = {link.xsk.fd(), POLLIN, 0};
+            owner[nfds++] = i;
+        }
 
-            Mac src_mac{};
-            for (int i = 0; i < 6; ++i)
-                src_mac.bytes[i] = buf[6 + i];
+        // low-latency mode spins on non-blocking reads while frames keep coming and only
+        // sleeps in poll() once the link has been quiet for kSpinIdleNs
+        const bool spin = cfg_.low_latency;
+        if (spin)
+            pin_current_thread(cfg_.rx_cpu);
+        uint64_t last_frame = clock_ns(CLOCK_MONOTONIC);
 
-            if (src_mac == g_cfg.src_mac)
+        while (running_.load())
+        {
+            if (spin && clock_ns(CLOCK_MONOTONIC) - last_frame < kSpinIdleNs)
+            {
+                bool got = false;
+                bool failed = false;
+                for (size_t li = 0; li < nlinks; li++)
+                {
+                    int r = rx_one(links_[li], buf, on_batch);
+                    if (r < 0)
+                    {
+                        failed = true;
+                        break;
+                    }
+                    got = got || r > 0;
+                    if (xsk_rx[li])
+                        got = links_[li].xsk.recv(xsk_rx[li], kXdpRxBurst, flush_burst) > 0 || got;
+                }
+                if (failed)
+                    break;
+                if (got)
+                    last_frame = clock_ns(CLOCK_MONOTONIC);
                 continue;
+            }
 
-            const uint8_t *payload_ptr = buf.data() + kEthHdr;
-            const size_t payload_len = len - kEthHdr;
+            for (size_t i = 0; i < nfds; i++)
+                pfds[i].revents = 0;
+            int pr = ::poll(pfds, nfds, 250);
+            if (pr < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            if (pr == 0)
+                continue;
+
+            bool failed = false;
+            for (size_t fi = 0; fi < nfds && !failed; fi++)
+            {
+                pollfd &pfd = pfds[fi];
+                if ((pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) != 0)
+                {
+                    failed = true;
+                    break;
+                }
+                if ((pfd.revents & POLLIN) == 0)
+                    continue;
 
-            on_pdu(src_mac, payload_ptr, payload_len);
+                const size_t li = owner[fi];
+                if (fi >= first_xsk)
+                    links_[li].xsk.recv(xsk_rx[li], kXdpRxBurst, flush_burst);
+                else if (rx_one(links_[li], buf, on_batch) < 0)
+                {
+                    failed = true;
+                    break;
+                }
+                last_frame = clock_ns(CLOCK_MONOTONIC);
+            }
+            if (failed)
+                break;
         }
+        rx_active_ = false;
     }
 
-    void eth_shutdown() noexcept
+    vector<LinkStats> EthTransport::link_stats() const
     {
-        g_running = false;
-        if (g_tx_fd >= 0 || g_rx_fd >= 0)
+        vector<LinkStats> out;
+        for (size_t i = 0; i < nlinks_; i++)
         {
-            ::close(g_tx_fd);
-            ::close(g_rx_fd);
-            g_tx_fd = -1;
-            g_rx_fd = -1;
+            LinkStats st;
+            st.name = links_[i].ifname;
+            st.backend = links_[i].xsk.is_open() ? "xdp" : "packet";
+            st.tx_frames = links_[i].tx_frames.load(memory_order_relaxed);
+            st.rx_frames = links_[i].rx_frames.load(memory_order_relaxed);
+            out.push_back(st);
         }
-        g_ifindex = -1;
-        g_cfg = {};
+        return out;
     }
 
-    bool eth_send_pdu_to(const Mac &dst, const vector<uint8_t> &pdu) noexcept
+    bool EthTransport::join_group(const Mac &group) noexcept
     {
-        if (g_tx_fd < 0)
+        if (!is_open() || (group.bytes[0] & 0x01) == 0)
+            return false;
+        if (is_joined_group(group))
+            return true;
+        if (ngroups_.load() >= kMaxGroups)
             return false;
-        
-        const size_t min_frame_no_crc = 60; 
-        vector<uint8_t> frame;
-        frame.reserve(max(min_frame_no_crc, kEthHdr + pdu.size()));
-
-        frame.insert(frame.end(), begin(dst.bytes), end(dst.bytes));
-        
-        frame.insert(frame.end(), begin(g_cfg.src_mac.bytes), end(g_cfg.src_mac.bytes));
-       
-        frame.push_back(static_cast<uint8_t>(g_cfg.ether_type >> 8));
-        frame.push_back(static_cast<uint8_t>(g_cfg.ether_type & 0xFF));
-        
-        frame.insert(frame.end(), pdu.begin(), pdu.end());
 
-        if (frame.size() < min_frame_no_crc)
-            frame.resize(min_frame_no_crc, 0);
+        for (size_t i = 0; i < nlinks_; i++)
+        {
+            packet_mreq mreq{};
+            mreq.mr_ifindex = links_[i].ifindex;
+            mreq.mr_type = PACKET_MR_MULTICAST;
+            mreq.mr_alen = 6;
+            for (int b = 0; b < 6; b++)
+                mreq.mr_address[b] = group.bytes[b];
+            if (::setsockopt(links_[i].rx_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+                return false;
+        }
 
-        ssize_t n = ::send(g_tx_fd, frame.data(), frame.size(), 0);
-        return (n == static_cast<ssize_t>(frame.size()));
+        // publish the address before the count so the RX thread never reads a half-written slot
+        groups_[ngroups_.load()] = group;
+        ngroups_.fetch_add(1);
+        return true;
     }
 
 }
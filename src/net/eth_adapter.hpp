@@ -3,29 +3,100 @@
 #include <vector>
 #include <functional>
 #include <string>
-#include "../util/mac.hpp"  
+#include <memory>
+#include <atomic>
+#include "transport.hpp"
+#include "../util/mac.hpp"
+#include "../util/frame_pool.hpp"
+#include "../util/histogram.hpp"
 
 namespace linkchat{
 
+    struct EthLink {
+        std::string   ifname;       // extra interface on the same L2 segment
+        Mac           dst_mac;      // peer MAC reachable through that interface
+    };
+
     struct EthConfig {
         std::string   ifname;       // "eth0", "wlan0"
-        Mac           src_mac;      // local MAC 
+        Mac           src_mac;      // local MAC
         Mac           dst_mac;      // destiny MAC
-        std::uint16_t ether_type;   // own EtherType 0x88B5 
-        std::size_t   frame_mtu;    // interface MTU 
+        std::uint16_t ether_type;   // own EtherType 0x88B5
+        std::size_t   frame_mtu;    // interface MTU
+        std::vector<EthLink> extra_links; // frames are striped over ifname + these
+        bool          low_latency = false; // RX thread spins on the sockets (busy poll) instead of sleeping in poll()
+        int           rx_cpu = -1;         // low-latency mode pins the RX thread here, -1 = no pinning
+        bool          use_xdp = false;     // AF_XDP socket per link, AF_PACKET where it cannot be set up
+        std::uint32_t xdp_queue = 0;       // RX queue the AF_XDP socket binds to
+        bool          rx_stamps = false;   // arrival stamps on every frame from the start (set_rx_stamps): RX latency histogram
+        bool          hw_stamps = false;   // NIC timestamping too (ping); changes the device's setting until close()
     };
 
-    inline constexpr std::size_t kEthHdr = 14;
+    // Raw-socket transport over one or more interfaces of the same segment (AF_PACKET,
+    // AF_XDP per link when asked for). Every instance has its own sockets and counters.
+    class EthTransport final : public Transport {
+    public:
+        EthTransport() noexcept;
+        ~EthTransport() override;
+        EthTransport(const EthTransport&) = delete;
+        EthTransport& operator=(const EthTransport&) = delete;
+
+        bool open(const EthConfig& cfg) noexcept;
+        // stops run_rx, waits for it to leave and closes every socket
+        void close() noexcept;
+
+        // the Ethernet header is gathered in front of the pdu by the kernel, the pdu is not copied
+        using Transport::send;
+        using Transport::send_to;
+        bool send(const std::uint8_t* pdu, std::size_t len) noexcept override;
+        bool send_to(const Mac& dst, const std::uint8_t* pdu, std::size_t len) noexcept override;
+        // SO_TIMESTAMPING: software stamp always, hardware where EthConfig::hw_stamps got the NIC to stamp frames
+        bool send_stamped(const Mac& dst, const std::uint8_t* pdu, std::size_t len, FrameStamp& tx) noexcept override;
 
-    bool eth_init(const EthConfig& cfg) noexcept;
+        // subscribes every link to the group
+        bool join_group(const Mac& group) noexcept override;
 
-    bool eth_send_pdu(const std::vector<std::uint8_t>& pdu) noexcept;
+        void run_rx(RxPduFn on_pdu) noexcept override;
+        void run_rx_batch(RxBatchFn on_batch) noexcept override;
+        void stop() noexcept override;
 
-    void eth_rx_loop(std::function<void(const Mac& ,const std::uint8_t*, std::size_t)> on_pdu) noexcept;
+        std::size_t frame_mtu() const noexcept override { return cfg_.frame_mtu; }
+        Mac local_mac() const noexcept override { return cfg_.src_mac; }
+        std::vector<LinkStats> link_stats() const override;
 
-    void eth_shutdown() noexcept;
+        // kernel arrival (SO_TIMESTAMPING software stamp) -> handed to the app, since open(),
+        // for the frames that came in while stamps were on
+        LatencyPercentiles rx_latency() const noexcept override { return rx_latency_.summary(); }
 
-    bool eth_send_pdu_to(const Mac& dst, const std::vector<std::uint8_t>& pdu) noexcept;
+        // SO_TIMESTAMPING stays on; this switches whether rx_one reads it for frames other than
+        // echo requests. Callable while run_rx runs
+        void set_rx_stamps(bool on) noexcept override;
+        bool rx_stamps() const noexcept override { return rx_stamps_.load(std::memory_order_relaxed); }
 
+        struct Link;
+
+    private:
+        static constexpr std::size_t kMaxLinks = 8;
+        static constexpr std::size_t kMaxGroups = 4;
+
+        bool is_open() const noexcept;
+        bool is_local_mac(const Mac& mac) const noexcept;
+        bool is_joined_group(const Mac& mac) const noexcept;
+        std::size_t pick_tx_link() noexcept;
+        bool accept_frame(Link& link, const std::uint8_t* frame, std::size_t len, RxFrame& out) noexcept;
+        int rx_one(Link& link, std::vector<std::uint8_t>& buf, const RxBatchFn& on_batch) noexcept;
+
+        EthConfig cfg_{};
+        std::unique_ptr<Link[]> links_;
+        std::size_t nlinks_{0};
+        std::atomic<std::size_t> rr_{0};
+        std::atomic<std::uint32_t> tx_links_{~0u};  // links pick_tx_link stripes over, from the last queue sample
+        std::atomic<bool> running_{false};
+        std::atomic<bool> rx_active_{false}; // run_rx is inside the sockets / XDP rings
+        std::atomic<bool> rx_stamps_{false}; // rx_one reads arrival stamps of every frame, not just ECHOs
+        Mac groups_[kMaxGroups]{};
+        std::atomic<std::size_t> ngroups_{0};
+        LatencyHistogram rx_latency_;
+    };
 
-} 
+}
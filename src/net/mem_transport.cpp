@@ -0,0 +1,172 @@
+#include "mem_transport.hpp"
+#include <chrono>
+
+using namespace std;
+
+namespace linkchat
+{
+    void MemSegment::attach(MemTransport *end)
+    {
+        lock_guard<mutex> lk(mu_);
+        ends_.push_back(end);
+    }
+
+    void MemSegment::detach(MemTransport *end) noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+        for (size_t i = 0; i < ends_.size(); i++)
+        {
+            if (ends_[i] == end)
+            {
+                ends_.erase(ends_.begin() + static_cast<ptrdiff_t>(i));
+                break;
+            }
+        }
+    }
+
+    size_t MemSegment::deliver(const MemTransport *from, const Mac &dst, const uint8_t *pdu, size_t len) noexcept
+    {
+        // held while copying, so an endpoint cannot detach (and go away) under us
+        lock_guard<mutex> lk(mu_);
+        const Mac src = from->local_mac();
+        size_t n = 0;
+        for (MemTransport *end : ends_)
+        {
+            if (end != from && end->wants(dst) && end->enqueue(src, pdu, len))
+                n++;
+        }
+        return n;
+    }
+
+    MemTransport::MemTransport(shared_ptr<MemSegment> segment, const Mac &mac, const Mac &peer, size_t frame_mtu, string name)
+        : segment_(move(segment)), mac_(mac), peer_(peer), mtu_(frame_mtu), name_(move(name))
+    {
+        if (segment_)
+            segment_->attach(this);
+    }
+
+    MemTransport::~MemTransport()
+    {
+        stop();
+        if (segment_)
+            segment_->detach(this);
+    }
+
+    bool MemTransport::send(const uint8_t *pdu, size_t len) noexcept
+    {
+        if (len > mtu_)
+            return false;
+        return send_to(peer_, pdu, len);
+    }
+
+    bool MemTransport::send_to(const Mac &dst, const uint8_t *pdu, size_t len) noexcept
+    {
+        if (!segment_ || pdu == nullptr || len == 0)
+            return false;
+        segment_->deliver(this, dst, pdu, len);
+        // like a NIC, a frame nobody picks up still counts as sent
+        tx_frames_.fetch_add(1, memory_order_relaxed);
+        return true;
+    }
+
+    bool MemTransport::join_group(const Mac &group) noexcept
+    {
+        if ((group.bytes[0] & 0x01) == 0)
+            return false;
+        if (wants(group))
+            return true;
+        const size_t n = ngroups_.load();
+        if (n >= kMaxGroups)
+            return false;
+        groups_[n] = group;
+        ngroups_.fetch_add(1);
+        return true;
+    }
+
+    bool MemTransport::wants(const Mac &dst) const noexcept
+    {
+        if (dst == mac_ || is_broadcast(dst))
+            return true;
+        const size_t n = ngroups_.load();
+        for (size_t i = 0; i < n; i++)
+        {
+            if (groups_[i] == dst)
+                return true;
+        }
+        return false;
+    }
+
+    bool MemTransport::enqueue(const Mac &src, const uint8_t *pdu, size_t len) noexcept
+    {
+        FrameRef copy = FrameRef::copy_of(pdu, len);
+        if (copy.empty())
+            return false;
+        {
+            lock_guard<mutex> lk(mu_);
+            if (inbox_.size() >= kInboxMax)
+                return false;
+            inbox_.emplace_back(src, move(copy));
+        }
+        cv_.notify_one();
+        return true;
+    }
+
+    void MemTransport::run_rx(RxPduFn on_pdu) noexcept
+    {
+        run_rx_batch([&on_pdu](const RxFrame *frames, size_t n)
+                     {
+                         for (size_t i = 0; i < n; i++)
+                             if (on_pdu)
+                                 on_pdu(frames[i].src, frames[i].pdu, frames[i].len); });
+    }
+
+    void MemTransport::run_rx_batch(RxBatchFn on_batch) noexcept
+    {
+        deque<pair<Mac, FrameRef>> batch;
+        RxFrame frames[kRxBatchMax];
+        while (running_.load())
+        {
+            {
+                unique_lock<mutex> lk(mu_);
+                cv_.wait_for(lk, chrono::milliseconds(250), [this]
+                             { return !inbox_.empty() || !running_.load(); });
+                batch.swap(inbox_);
+            }
+            // the callback may send, which takes other endpoints' locks: never call it holding ours
+            size_t n = 0;
+            for (auto &[src, pdu] : batch)
+            {
+                rx_frames_.fetch_add(1, memory_order_relaxed);
+                frames[n++] = RxFrame{src, pdu.data(), pdu.size()};
+                if (n == kRxBatchMax)
+                {
+                    if (on_batch)
+                        on_batch(frames, n);
+                    n = 0;
+                }
+            }
+            if (n > 0 && on_batch)
+                on_batch(frames, n);
+            batch.clear();
+        }
+    }
+
+    void MemTransport::stop() noexcept
+    {
+        {
+            lock_guard<mutex> lk(mu_);
+            running_ = false;
+        }
+        cv_.notify_all();
+    }
+
+    vector<LinkStats> MemTransport::link_stats() const
+    {
+        LinkStats st;
+        st.name = name_;
+        st.backend = "mem";
+        st.tx_frames = tx_frames_.load(memory_order_relaxed);
+        st.rx_frames = rx_frames_.load(memory_order_relaxed);
+        return {st};
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "transport.hpp"
+
+namespace linkchat{
+
+    class MemTransport;
+
+    // In-process L2 segment: every frame an attached endpoint sends is copied into the
+    // inbox of each other endpoint it is addressed to (unicast, broadcast or joined group).
+    class MemSegment {
+    public:
+        void attach(MemTransport* end);
+        void detach(MemTransport* end) noexcept;
+
+        // returns how many endpoints took a copy
+        std::size_t deliver(const MemTransport* from, const Mac& dst, const std::uint8_t* pdu, std::size_t len) noexcept;
+
+    private:
+        std::mutex mu_;
+        std::vector<MemTransport*> ends_;
+    };
+
+    // Transport endpoint on a MemSegment, for running several apps in one process
+    // without touching a NIC. Frames are queued, so run_rx still needs its own thread.
+    class MemTransport final : public Transport {
+    public:
+        MemTransport(std::shared_ptr<MemSegment> segment, const Mac& mac, const Mac& peer,
+                     std::size_t frame_mtu = 1500, std::string name = "mem");
+        ~MemTransport() override;
+        MemTransport(const MemTransport&) = delete;
+        MemTransport& operator=(const MemTransport&) = delete;
+
+        using Transport::send;
+        using Transport::send_to;
+        bool send(const std::uint8_t* pdu, std::size_t len) noexcept override;
+        bool send_to(const Mac& dst, const std::uint8_t* pdu, std::size_t len) noexcept override;
+        bool join_group(const Mac& group) noexcept override;
+
+        void run_rx(RxPduFn on_pdu) noexcept override;
+        void run_rx_batch(RxBatchFn on_batch) noexcept override;
+        void stop() noexcept override;
+
+        std::size_t frame_mtu() const noexcept override { return mtu_; }
+        Mac local_mac() const noexcept override { return mac_; }
+        std::vector<LinkStats> link_stats() const override;
+
+        // segment side: is this frame for us, and queue it if so
+        bool wants(const Mac& dst) const noexcept;
+        bool enqueue(const Mac& src, const std::uint8_t* pdu, std::size_t len) noexcept;
+
+    private:
+        static constexpr std::size_t kInboxMax = 8192; // frames; beyond this they drop like a full socket
+        static constexpr std::size_t kMaxGroups = 4;
+
+        std::shared_ptr<MemSegment> segment_;
+        Mac mac_;
+        Mac peer_;
+        std::size_t mtu_;
+        std::string name_;
+
+        Mac groups_[kMaxGroups]{};
+        std::atomic<std::size_t> ngroups_{0};
+
+        std::mutex mu_;
+        std::condition_variable cv_;
+        std::deque<std::pair<Mac, FrameRef>> inbox_;
+        std::atomic<bool> running_{true};
+        std::atomic<std::uint64_t> tx_frames_{0};
+        std::atomic<std::uint64_t> rx_frames_{0};
+    };
+
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+#include "../util/mac.hpp"
+#include "../util/frame_pool.hpp"
+#include "../util/histogram.hpp"
+
+namespace linkchat{
+
+    inline constexpr std::size_t kEthHdr = 14;
+
+    struct LinkStats {
+        std::string   name;         // interface, or endpoint name for in-memory links
+        std::string   backend;      // "packet", "xdp", "mem"
+        std::uint64_t tx_frames;
+        std::uint64_t rx_frames;
+    };
+
+    // src MAC, PDU (Ethernet header stripped)
+    using RxPduFn = std::function<void(const Mac& src, const std::uint8_t* pdu, std::size_t len)>;
+
+    // when a frame crossed the kernel (software, CLOCK_REALTIME) and the NIC (hardware, the
+    // NIC's own clock), in nanoseconds; 0 where the link does not stamp frames
+    struct FrameStamp {
+        std::uint64_t sw_ns = 0;
+        std::uint64_t hw_ns = 0;
+    };
+
+    struct RxFrame {
+        Mac                 src;
+        const std::uint8_t* pdu;    // Ethernet header stripped, valid until the callback returns
+        std::size_t         len;
+        FrameStamp          stamp{};
+    };
+    inline constexpr std::size_t kRxBatchMax = 64;
+
+    // frames taken from the link in one go (one ring pass, one inbox swap), in arrival order
+    using RxBatchFn = std::function<void(const RxFrame* frames, std::size_t n)>;
+
+    // One attachment to an L2 segment. Each instance owns its sockets (or queues), its
+    // configuration and its counters, so several can run side by side in one process.
+    // send/send_to may be called from any thread, run_rx from exactly one.
+    class Transport {
+    public:
+        virtual ~Transport() = default;
+
+        // to the configured peer (striped over the links when there are several)
+        virtual bool send(const std::uint8_t* pdu, std::size_t len) noexcept = 0;
+        bool send(const FrameRef& pdu) noexcept { return send(pdu.data(), pdu.size()); }
+
+        // to an explicit destination (broadcast, group, directory peer) on the first link
+        virtual bool send_to(const Mac& dst, const std::uint8_t* pdu, std::size_t len) noexcept = 0;
+        bool send_to(const Mac& dst, const FrameRef& pdu) noexcept { return send_to(dst, pdu.data(), pdu.size()); }
+
+        // send_to for a frame whose transmit time is wanted (ping): tx gets the kernel/NIC stamps,
+        // or stays empty on links without them. Slower than send_to, not for the data path
+        virtual bool send_stamped(const Mac& dst, const std::uint8_t* pdu, std::size_t len, FrameStamp& tx) noexcept {
+            tx = FrameStamp{};
+            return send_to(dst, pdu, len);
+        }
+
+        // frames to this Ethernet multicast group are delivered from now on
+        virtual bool join_group(const Mac& group) noexcept = 0;
+
+        // receives until stop(); the callback runs on the calling thread
+        virtual void run_rx(RxPduFn on_pdu) noexcept = 0;
+        // same, handing over whatever one read of the link brought (at most kRxBatchMax frames);
+        // backends that read frame by frame deliver batches of one
+        virtual void run_rx_batch(RxBatchFn on_batch) noexcept {
+            run_rx([&on_batch](const Mac& src, const std::uint8_t* pdu, std::size_t len) {
+                const RxFrame f{src, pdu, len};
+                on_batch(&f, 1);
+            });
+        }
+        // makes run_rx return soon, callable from any thread
+        virtual void stop() noexcept = 0;
+
+        virtual std::size_t frame_mtu() const noexcept = 0;
+        virtual Mac local_mac() const noexcept = 0;
+        virtual std::vector<LinkStats> link_stats() const = 0;
+
+        // kernel arrival -> handed to the app, in nanoseconds; empty where the backend has no timestamps
+        // or they are off
+        virtual LatencyPercentiles rx_latency() const noexcept { return LatencyPercentiles{}; }
+
+        // arrival stamps on received frames (RxFrame::stamp, rx_latency()); they cost a control
+        // message and a clock read per frame, so backends that have them start with them off.
+        // ECHO frames get theirs either way
+        virtual void set_rx_stamps(bool on) noexcept { (void)on; }
+        virtual bool rx_stamps() const noexcept { return false; }
+    };
+
+}
@@ -0,0 +1,365 @@
+#include "xdp_socket.hpp"
+
+#if __has_include(<linux/if_xdp.h>) && __has_include(<linux/bpf.h>) && __has_include(<linux/if_link.h>)
+#define LINKCHAT_HAVE_XDP 1
+#include <linux/if_xdp.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <atomic>
+#endif
+
+#include <algorithm>
+
+using namespace std;
+
+namespace linkchat
+{
+#ifdef LINKCHAT_HAVE_XDP
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+    static constexpr uint32_t kRingSize = 1024;                // every ring, power of two
+    static constexpr uint32_t kRxFrames = kRingSize;           // lent to the fill ring
+    static constexpr uint32_t kTxFrames = kRingSize;           // never more in flight than the TX ring holds
+    static constexpr uint32_t kMaxQueues = 64;                 // XSKMAP slots, indexed by RX queue
+    static constexpr size_t kMinFrameLen = 60;
+    static constexpr int kBusyPollUs = 50;
+
+    bool xdp_supported() noexcept { return true; }
+
+    static uint32_t load_acquire(const uint32_t *p) noexcept
+    {
+        return atomic_ref<uint32_t>(*const_cast<uint32_t *>(p)).load(memory_order_acquire);
+    }
+
+    static void store_release(uint32_t *p, uint32_t v) noexcept
+    {
+        atomic_ref<uint32_t>(*p).store(v, memory_order_release);
+    }
+
+    static long bpf_call(int cmd, bpf_attr &attr) noexcept
+    {
+        return ::syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+    }
+
+    static constexpr bpf_insn insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) noexcept
+    {
+        return bpf_insn{code, dst, src, off, imm};
+    }
+
+    // if (eth.type == ether_type) return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+    // return XDP_PASS;
+    static int load_redirect_prog(int map_fd, uint16_t ether_type) noexcept
+    {
+        const int32_t et_wire = static_cast<int32_t>(htons(ether_type)); // the u16 load below reads wire order
+        const bpf_insn prog[] = {
+            insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0),
+            insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_6, offsetof(xdp_md, data), 0),
+            insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_3, BPF_REG_6, offsetof(xdp_md, data_end), 0),
+            insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0),
+            insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 14),
+            insn(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 8, 0),           // short frame -> pass
+            insn(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_4, BPF_REG_2, 12, 0),
+            insn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, 6, et_wire),             // not ours -> pass
+            insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_6, offsetof(xdp_md, rx_queue_index), 0),
+            insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd),
+            insn(0, 0, 0, 0, 0),
+            insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS),            // no socket on this queue
+            insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+            insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+            insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS),
+            insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        };
+        static const char kLicense[] = "Dual MIT/GPL";
+
+        bpf_attr attr{};
+        attr.prog_type = BPF_PROG_TYPE_XDP;
+        attr.insns = reinterpret_cast<uintptr_t>(prog);
+        attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+        attr.license = reinterpret_cast<uintptr_t>(kLicense);
+        attr.expected_attach_type = BPF_XDP;
+        return static_cast<int>(bpf_call(BPF_PROG_LOAD, attr));
+    }
+
+    static bool map_ring(int fd, XdpSocket::Ring &ring, const xdp_ring_offset &off, off_t pgoff, size_t desc_size) noexcept
+    {
+        const size_t len = off.desc + kRingSize * desc_size;
+        void *map = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+        if (map == MAP_FAILED)
+            return false;
+        uint8_t *base = static_cast<uint8_t *>(map);
+        ring.producer = reinterpret_cast<uint32_t *>(base + off.producer);
+        ring.consumer = reinterpret_cast<uint32_t *>(base + off.consumer);
+        ring.descs = base + off.desc;
+        ring.mask = kRingSize - 1;
+        ring.map = map;
+        ring.map_len = len;
+        return true;
+    }
+
+    static void unmap_ring(XdpSocket::Ring &ring) noexcept
+    {
+        if (ring.map != nullptr)
+            ::munmap(ring.map, ring.map_len);
+        ring = {};
+    }
+
+    XdpSocket::~XdpSocket()
+    {
+        close();
+    }
+
+    bool XdpSocket::open(int ifindex, uint32_t queue, uint16_t ether_type, size_t frame_mtu, bool busy_poll) noexcept
+    {
+        if (is_open() || ifindex <= 0 || queue >= kMaxQueues)
+            return false;
+
+        // aligned UMEM chunks are a power of two between 2 KiB and a page
+        const size_t need = 14 + max(frame_mtu, kMinFrameLen);
+        frame_bytes_ = need <= 2048 ? 2048 : 4096;
+        if (need > frame_bytes_ || frame_bytes_ > static_cast<size_t>(::sysconf(_SC_PAGESIZE)))
+            return false;
+
+        umem_len_ = static_cast<size_t>(kRxFrames + kTxFrames) * frame_bytes_;
+        void *mem = ::mmap(nullptr, umem_len_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+        {
+            umem_len_ = 0;
+            return false;
+        }
+        umem_ = static_cast<uint8_t *>(mem);
+
+        fd_ = ::socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+        if (fd_ < 0)
+        {
+            close();
+            return false;
+        }
+
+        xdp_umem_reg reg{};
+        reg.addr = reinterpret_cast<uintptr_t>(umem_);
+        reg.len = umem_len_;
+        reg.chunk_size = static_cast<uint32_t>(frame_bytes_);
+        reg.headroom = 0;
+        const int ring_size = kRingSize;
+        xdp_mmap_offsets off{};
+        socklen_t off_len = sizeof(off);
+        if (::setsockopt(fd_, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0 ||
+            ::setsockopt(fd_, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) < 0 ||
+            ::setsockopt(fd_, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) < 0 ||
+            ::setsockopt(fd_, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) < 0 ||
+            ::setsockopt(fd_, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)) < 0 ||
+            ::getsockopt(fd_, SOL_XDP, XDP_MMAP_OFFSETS, &off, &off_len) < 0)
+        {
+            close();
+            return false;
+        }
+
+        if (!map_ring(fd_, rx_, off.rx, XDP_PGOFF_RX_RING, sizeof(xdp_desc)) ||
+            !map_ring(fd_, tx_, off.tx, XDP_PGOFF_TX_RING, sizeof(xdp_desc)) ||
+            !map_ring(fd_, fill_, off.fr, XDP_UMEM_PGOFF_FILL_RING, sizeof(uint64_t)) ||
+            !map_ring(fd_, comp_, off.cr, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof(uint64_t)))
+        {
+            close();
+            return false;
+        }
+
+        // first half of the UMEM waits in the fill ring for RX, the rest is the TX free list
+        uint64_t *fill = static_cast<uint64_t *>(fill_.descs);
+        for (uint32_t i = 0; i < kRxFrames; i++)
+            fill[i & fill_.mask] = static_cast<uint64_t>(i) * frame_bytes_;
+        store_release(fill_.producer, kRxFrames);
+
+        tx_free_.clear();
+        tx_free_.reserve(kTxFrames);
+        for (uint32_t i = 0; i < kTxFrames; i++)
+            tx_free_.push_back(static_cast<uint64_t>(kRxFrames + i) * frame_bytes_);
+
+        sockaddr_xdp sxdp{};
+        sxdp.sxdp_family = AF_XDP;
+        sxdp.sxdp_ifindex = static_cast<uint32_t>(ifindex);
+        sxdp.sxdp_queue_id = queue;
+        sxdp.sxdp_flags = XDP_COPY; // generic XDP never does zero-copy
+        if (::bind(fd_, reinterpret_cast<sockaddr *>(&sxdp), sizeof(sxdp)) < 0)
+        {
+            close();
+            return false;
+        }
+
+        if (busy_poll)
+        {
+            int busy = kBusyPollUs;
+            ::setsockopt(fd_, SOL_SOCKET, SO_BUSY_POLL, &busy, sizeof(busy));
+        }
+
+        bpf_attr attr{};
+        attr.map_type = BPF_MAP_TYPE_XSKMAP;
+        attr.key_size = sizeof(uint32_t);
+        attr.value_size = sizeof(uint32_t);
+        attr.max_entries = kMaxQueues;
+        map_fd_ = static_cast<int>(bpf_call(BPF_MAP_CREATE, attr));
+        if (map_fd_ < 0)
+        {
+            close();
+            return false;
+        }
+
+        const uint32_t key = queue;
+        const uint32_t value = static_cast<uint32_t>(fd_);
+        attr = {};
+        attr.map_fd = static_cast<uint32_t>(map_fd_);
+        attr.key = reinterpret_cast<uintptr_t>(&key);
+        attr.value = reinterpret_cast<uintptr_t>(&value);
+        attr.flags = BPF_ANY;
+        if (bpf_call(BPF_MAP_UPDATE_ELEM, attr) < 0)
+        {
+            close();
+            return false;
+        }
+
+        prog_fd_ = load_redirect_prog(map_fd_, ether_type);
+        if (prog_fd_ < 0)
+        {
+            close();
+            return false;
+        }
+
+        // a BPF link detaches the program by itself when the last fd goes away, even on a crash
+        attr = {};
+        attr.link_create.prog_fd = static_cast<uint32_t>(prog_fd_);
+        attr.link_create.target_ifindex = static_cast<uint32_t>(ifindex);
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+        link_fd_ = static_cast<int>(bpf_call(BPF_LINK_CREATE, attr));
+        if (link_fd_ < 0)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void XdpSocket::close() noexcept
+    {
+        if (link_fd_ >= 0)
+            ::close(link_fd_);
+        if (prog_fd_ >= 0)
+            ::close(prog_fd_);
+        if (map_fd_ >= 0)
+            ::close(map_fd_);
+        unmap_ring(rx_);
+        unmap_ring(tx_);
+        unmap_ring(fill_);
+        unmap_ring(comp_);
+        if (fd_ >= 0)
+            ::close(fd_);
+        if (umem_ != nullptr)
+            ::munmap(umem_, umem_len_);
+        link_fd_ = prog_fd_ = map_fd_ = fd_ = -1;
+        umem_ = nullptr;
+        umem_len_ = 0;
+        tx_free_.clear();
+    }
+
+    void XdpSocket::reclaim_tx() noexcept
+    {
+        const uint32_t cons = *comp_.consumer;
+        const uint32_t prod = load_acquire(comp_.producer);
+        const uint64_t *addrs = static_cast<const uint64_t *>(comp_.descs);
+        for (uint32_t i = cons; i != prod; i++)
+            tx_free_.push_back(addrs[i & comp_.mask]);
+        store_release(comp_.consumer, prod);
+    }
+
+    bool XdpSocket::send(const uint8_t *hdr, size_t hdr_len, const uint8_t *pdu, size_t len) noexcept
+    {
+        const size_t frame_len = max(hdr_len + len, kMinFrameLen);
+        if (!is_open() || frame_len > frame_bytes_)
+            return false;
+
+        lock_guard<mutex> lk(tx_mu_);
+        if (tx_free_.empty())
+            reclaim_tx();
+        if (tx_free_.empty())
+            return false;
+
+        const uint64_t addr = tx_free_.back();
+        tx_free_.pop_back();
+        uint8_t *frame = umem_ + addr;
+        memcpy(frame, hdr, hdr_len);
+        memcpy(frame + hdr_len, pdu, len);
+        if (hdr_len + len < frame_len)
+            memset(frame + hdr_len + len, 0, frame_len - hdr_len - len);
+
+        const uint32_t prod = *tx_.producer;
+        xdp_desc &d = static_cast<xdp_desc *>(tx_.descs)[prod & tx_.mask];
+        d.addr = addr;
+        d.len = static_cast<uint32_t>(frame_len);
+        d.options = 0;
+        store_release(tx_.producer, prod + 1);
+
+        // copy mode only transmits from inside this call; a busy ring keeps the frame for the next kick
+        if (::sendto(fd_, nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0 &&
+            errno != EAGAIN && errno != EBUSY && errno != ENOBUFS && errno != ENETDOWN)
+            return false;
+        reclaim_tx();
+        return true;
+    }
+
+    size_t XdpSocket::recv(const function<void(const uint8_t *, size_t)> &on_frame, size_t max_frames,
+                           const function<void()> &on_burst_end) noexcept
+    {
+        if (!is_open())
+            return 0;
+
+        const uint32_t cons = *rx_.consumer;
+        const uint32_t prod = load_acquire(rx_.producer);
+        const uint32_t n = static_cast<uint32_t>(min<size_t>(prod - cons, max_frames));
+        if (n == 0)
+            return 0;
+
+        // the fill ring holds every RX frame, so there is always room to hand these back
+        const xdp_desc *descs = static_cast<const xdp_desc *>(rx_.descs);
+        uint64_t *fill = static_cast<uint64_t *>(fill_.descs);
+        const uint32_t fprod = *fill_.producer;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            const xdp_desc &d = descs[(cons + i) & rx_.mask];
+            on_frame(umem_ + d.addr, d.len);
+            fill[(fprod + i) & fill_.mask] = d.addr & ~static_cast<uint64_t>(frame_bytes_ - 1);
+        }
+        // the frames stay ours until the fill ring gets them back
+        if (on_burst_end)
+            on_burst_end();
+        store_release(fill_.producer, fprod + n);
+        store_release(rx_.consumer, cons + n);
+        return n;
+    }
+
+#else
+
+    bool xdp_supported() noexcept { return false; }
+
+    XdpSocket::~XdpSocket() = default;
+
+    bool XdpSocket::open(int, uint32_t, uint16_t, size_t, bool) noexcept { return false; }
+    void XdpSocket::close() noexcept {}
+    void XdpSocket::reclaim_tx() noexcept {}
+    bool XdpSocket::send(const uint8_t *, size_t, const uint8_t *, size_t) noexcept { return false; }
+    size_t XdpSocket::recv(const function<void(const uint8_t *, size_t)> &, size_t, const function<void()> &) noexcept { return 0; }
+
+#endif
+}
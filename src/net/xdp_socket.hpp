@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace linkchat{
+
+    // true when the tree was built against the AF_XDP / BPF kernel headers
+    bool xdp_supported() noexcept;
+
+    // AF_XDP socket bound to one queue of one interface, in copy mode so generic (SKB) XDP
+    // works on any driver, veth included. A small XDP program attached to the interface
+    // redirects frames of our EtherType into the socket and passes everything else to the
+    // stack. Frames live in a UMEM area shared with the kernel: half of it is lent to the
+    // fill ring for RX, half is a free list for TX.
+    class XdpSocket {
+    public:
+        XdpSocket() = default;
+        ~XdpSocket();
+        XdpSocket(const XdpSocket&) = delete;
+        XdpSocket& operator=(const XdpSocket&) = delete;
+
+        // false when AF_XDP is missing or the interface already has an XDP program
+        bool open(int ifindex, std::uint32_t queue, std::uint16_t ether_type, std::size_t frame_mtu, bool busy_poll) noexcept;
+        void close() noexcept;
+        bool is_open() const noexcept { return fd_ >= 0; }
+        int fd() const noexcept { return fd_; }
+
+        // copies header + pdu (+ padding to 60 bytes) into a UMEM frame and kicks the kernel;
+        // false when every TX frame is still in flight. Safe from several threads.
+        bool send(const std::uint8_t* hdr, std::size_t hdr_len, const std::uint8_t* pdu, std::size_t len) noexcept;
+
+        // hands up to max_frames received frames (Ethernet header included) to on_frame and
+        // recycles their buffers; on_burst_end runs after the last one, while every buffer of
+        // the burst is still valid. One reader thread only
+        std::size_t recv(const std::function<void(const std::uint8_t*, std::size_t)>& on_frame, std::size_t max_frames,
+                         const std::function<void()>& on_burst_end = nullptr) noexcept;
+
+        struct Ring {
+            std::uint32_t* producer = nullptr;
+            std::uint32_t* consumer = nullptr;
+            void*          descs = nullptr;
+            std::uint32_t  mask = 0;
+            void*          map = nullptr;
+            std::size_t    map_len = 0;
+        };
+
+    private:
+        void reclaim_tx() noexcept;
+
+        int fd_{-1};
+        int map_fd_{-1};
+        int prog_fd_{-1};
+        int link_fd_{-1};
+        std::uint8_t* umem_{nullptr};
+        std::size_t umem_len_{0};
+        std::size_t frame_bytes_{0};
+        Ring rx_, tx_, fill_, comp_;
+        std::vector<std::uint64_t> tx_free_;
+        std::mutex tx_mu_;
+    };
+
+}
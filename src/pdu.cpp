@@ -1,8 +1,10 @@
 #include "pdu.hpp"
 #include "util/crc32.hpp"
 #include "util/helpers.hpp"
+#include "util/task_pool.hpp"
 #include <cstring>     // memcpy
 #include <vector>
+#include <atomic>
 #include <iostream>
 using namespace std;
 
@@ -32,129 +34,223 @@ namespace linkchat
 
     }
 
-    bool parse_pdu(const uint8_t * buf, size_t buf_size,
-                   Header & out_h,
-                   vector<uint8_t> & out_payload) noexcept
+    size_t seal_pdu(const Header& h, uint8_t* out, size_t out_cap, bool with_crc) noexcept
+    {
+        const size_t payload_len = h.payload_len;
+        if(out == nullptr || out_cap < kHeaderSize + payload_len + kCrcSize)
+            return 0;
+
+        if(serialize_header(h, out, out_cap) != kHeaderSize)
+            return 0;
+
+        uint32_t crc = with_crc ? crc32(out + kHeaderSize, payload_len) : 0;
+        uint32_to_BE(crc, out, static_cast<int>(kHeaderSize + payload_len));
+
+        return kHeaderSize + payload_len + kCrcSize;
+    }
+
+    bool pdu_crc_ok(const uint8_t * buf, size_t buf_size) noexcept
+    {
+        if(buf == nullptr || buf_size < kHeaderSize+kCrcSize)
+            return false;
+        const size_t paylen = buf_size - (kHeaderSize + kCrcSize);
+        return BE_to_uint32(buf + kHeaderSize + paylen, 0) == crc32(buf + kHeaderSize, paylen);
+    }
+
+    PduView PduView::parse(const uint8_t * buf, size_t buf_size) noexcept
+    {
+        PduView v;
+        if(buf == nullptr || buf_size < kHeaderSize + kCrcSize || !HeaderCodec::valid_at(buf))
+            return v;
+        v.p_ = buf;
+        v.n_ = buf_size;
+        return v;
+    }
+
+    bool PduView::crc_ok() const noexcept
+    {
+        if(crc_ < 0)
+            crc_ = !truncated() && load_be32(payload() + payload_len()) == crc32(payload(), payload_len());
+        return crc_ == 1;
+    }
+
+    bool verify_pdu(const uint8_t * buf, size_t buf_size,
+                    Header & out_h,
+                    const uint8_t *& out_payload, size_t & out_len,
+                    bool crc_checked) noexcept
     {
         if(buf == nullptr || buf_size < kHeaderSize+kCrcSize)
             return false;
 
         if(!parse_header(buf, buf_size, out_h)) return false;
 
-        if(buf_size < kHeaderSize + kCrcSize) return false;
-
         const size_t real_paylen = buf_size - (kHeaderSize + kCrcSize);
         
         const uint8_t * payload_ptr = buf + kHeaderSize;
-        const uint8_t * crc_ptr = payload_ptr + real_paylen;
-        uint32_t received_crc = BE_to_uint32(crc_ptr, 0);
-        uint32_t computed_crc = crc32(payload_ptr, real_paylen);
+        if(!crc_checked)
+        {
+            const uint8_t * crc_ptr = payload_ptr + real_paylen;
+            uint32_t received_crc = BE_to_uint32(crc_ptr, 0);
+            uint32_t computed_crc = crc32(payload_ptr, real_paylen);
 
-        if(received_crc != computed_crc)
+            if(received_crc != computed_crc)
+                return false;
+        }
+
+        out_payload = payload_ptr;
+        out_len = real_paylen;
+        return true;
+    }
+
+    bool parse_pdu(const uint8_t * buf, size_t buf_size,
+                   Header & out_h,
+                   vector<uint8_t> & out_payload) noexcept
+    {
+        const uint8_t * payload_ptr = nullptr;
+        size_t payload_len = 0;
+        if(!verify_pdu(buf, buf_size, out_h, payload_ptr, payload_len))
             return false;
 
         //copy payload to out_payload vector      
-        out_payload.resize(real_paylen);                                                 
-        for(size_t i=kHeaderSize ;i<kHeaderSize+real_paylen;i++)
-            out_payload[i-kHeaderSize] = buf[i] ;
-
+        out_payload.assign(payload_ptr, payload_ptr + payload_len);
         return true;
     }
 
     bool is_ack_header(const Header& h)noexcept
     {
-        if((h.type == Type::ACK) && (h.seq == 0) && (h.total == 0) && (h.payload_len == kAckPayloadSize))
+        if((h.type == Type::ACK) && (h.seq == 0) && (h.total == 0) &&
+           (h.payload_len == kAckPayloadSize || h.payload_len == kAckRwndPayloadSize))
             return true;
 
         return false;
     }
 
-    vector<uint8_t> create_ack(const AckFields& ack)noexcept
+    FrameRef create_ack(const AckFields& ack)noexcept
     {
-        int total_pdu_size = kHeaderSize + kAckPayloadSize + kCrcSize;//total_size = 27
-        vector<uint8_t> pdu_out(total_pdu_size);
+        if(ack.rwnd == kNoRwnd)
+            return make_control_pdu<AckCodec>(Type::ACK, ack.msg_id, 0, 0, ack);
+        return make_control_pdu<AckRwndCodec>(Type::ACK, ack.msg_id, 0, 0, ack);
+    }
+
+    bool try_parse_ack(const PduView& pdu, AckFields& out)noexcept
+    {
+        if(!pdu || !is_ack_header(pdu.header()))
+            return false;
+
+        out.rwnd = kNoRwnd;
+        const bool ok = pdu.payload_len() == kAckRwndPayloadSize ? read_control_pdu<AckRwndCodec>(pdu, Type::ACK, out)
+                                                                 : read_control_pdu<AckCodec>(pdu, Type::ACK, out);
+
+        //check that msg_id from ack payload structure matches the msg_id field from header
+        return ok && out.msg_id == pdu.msg_id();
+    }
+
+    FrameRef create_nak(uint32_t msg_id, uint32_t total, const vector<NakRange>& ranges)noexcept
+    {
+        size_t count = min(ranges.size(), kNakMaxRanges);
+        if(count == 0)
+            return {};
+
+        const size_t payload_len = 2 + count * NakRangeCodec::size;
+        FrameRef pdu_out = FrameRef::make(kHeaderSize + payload_len + kCrcSize);
+        if(pdu_out.empty())
+            return {};
+
+        uint8_t * payload = pdu_out.data() + kHeaderSize;
+        store_be<uint16_t>(payload, static_cast<uint16_t>(count));
+        for(size_t i = 0; i < count; i++)
+            NakRangeCodec::encode(ranges[i], payload + 2 + i * NakRangeCodec::size);
 
         Header h;
-        h.type = Type::ACK;
-        h.msg_id = ack.msg_id;
+        h.type = Type::NAK;
+        h.msg_id = msg_id;
         h.seq = 0;
-        h.total = 0;
-        h.payload_len = kAckPayloadSize;
-
-        //Fill Header 
-        uint8_t * header_ptr = pdu_out.data();
-        if(serialize_header(h,header_ptr,kHeaderSize)!=kHeaderSize)return {};//return empty vector on failure
-        
-        //Fill Payload
-        uint8_t * payload_ptr = pdu_out.data() + kHeaderSize;
-        uint32_to_BE(ack.msg_id,payload_ptr,0);
-        uint32_to_BE(ack.highest_seq_ok,payload_ptr,4);
-        
-        //Fill CRC
-        uint8_t * crc_ptr = pdu_out.data() + kHeaderSize + kAckPayloadSize;
-        uint32_t crc = crc32(payload_ptr,kAckPayloadSize);
-        uint32_to_BE(crc,crc_ptr,0);
+        h.total = total;
+        h.payload_len = static_cast<uint16_t>(payload_len);
 
+        if(seal_pdu(h, pdu_out.data(), pdu_out.size()) != pdu_out.size())
+            return {};
         return pdu_out;
     }
 
-    bool try_parse_ack(const uint8_t * pdu,size_t pdu_size,AckFields& out)noexcept
+    bool try_parse_nak(const PduView& pdu,
+                       uint32_t& msg_id, uint32_t& total,
+                       vector<NakRange>& out)noexcept
     {
-        if( pdu == nullptr || pdu_size < kHeaderSize + kAckPayloadSize + kCrcSize)
-            return false;
-        
-        Header h;
-        
-        if(!parse_header(pdu,pdu_size,h))
-            return false;
-        
-        if(!is_ack_header(h))
+        if(!pdu || pdu.truncated() || pdu.type() != Type::NAK || pdu.payload_len() < 2 || !pdu.crc_ok())
             return false;
 
-        //check crc
-        int crc_index = kHeaderSize+kAckPayloadSize;
-        uint32_t crc_rcv = BE_to_uint32(pdu,crc_index);
-        const uint8_t * payload_ptr = pdu + kHeaderSize;
-        uint32_t crc_calc = crc32(payload_ptr,kAckPayloadSize);
-        if(crc_rcv != crc_calc)
+        const uint8_t * payload = pdu.payload();
+        const size_t count = load_be16(payload);
+        if(count == 0 || count > kNakMaxRanges || pdu.payload_len() != 2 + count * NakRangeCodec::size)
             return false;
 
-        //fill out with msg_id and highest_seq_ok info from parsed pdu
-        out.msg_id = BE_to_uint32(pdu,kHeaderSize);
-        out.highest_seq_ok = BE_to_uint32(pdu,kHeaderSize + 4);
+        const uint32_t msg_total = pdu.total();
+        out.clear();
+        out.reserve(count);
+        for(size_t i = 0; i < count; i++)
+        {
+            NakRange r;
+            NakRangeCodec::decode(payload + 2 + i * NakRangeCodec::size, r);
+            if(r.from > r.to || r.to >= msg_total)
+                return false;
+            out.push_back(r);
+        }
 
-        //check that msg_id from ack payload structure matches the msg_id field from header
-        if(out.msg_id != h.msg_id)return false;
-        
+        msg_id = pdu.msg_id();
+        total = msg_total;
         return true;
     }
 
-    [[nodiscard]] vector<vector<uint8_t>> chunkify_from_buffer(const uint8_t *data,
-                                                               size_t data_size, 
-                                                               uint32_t msg_id,
-                                                               Type msg_type, 
-                                                               uint16_t mtu)
+    FrameRef create_echo(const EchoFields& echo)noexcept
     {
-        if(data_size == 0 || data==nullptr)
-            return {};
+        return make_control_pdu<EchoCodec>(Type::ECHO, 0, echo.seq, 0, echo);
+    }
 
-        size_t cap = mtu_payload(mtu);
+    bool try_parse_echo(const PduView& pdu, EchoFields& out)noexcept
+    {
+        if(!read_control_pdu<EchoCodec>(pdu, Type::ECHO, out))
+            return false;
+        out.seq = pdu.seq();
+        return out.kind == kEchoRequest || out.kind == kEchoReply;
+    }
 
-        if(cap==0)
-            return {};
+    FrameRef create_reject(const RejectFields& reject)noexcept
+    {
+        return make_control_pdu<RejectCodec>(Type::REJECT, reject.msg_id, 0, 0, reject);
+    }
 
-        vector<vector<uint8_t>> out;
+    bool try_parse_reject(const PduView& pdu, RejectFields& out)noexcept
+    {
+        if(!read_control_pdu<RejectCodec>(pdu, Type::REJECT, out))
+            return false;
+        out.msg_id = pdu.msg_id();
+        return true;
+    }
 
-        uint32_t total = (data_size)/cap;
-        if(data_size%cap != 0)
-            total++;
+    uint32_t chunk_count(size_t n, uint16_t mtu) noexcept
+    {
+        size_t cap = mtu_payload(mtu);
+        if(n == 0 || cap == 0 || (n + cap - 1) / cap > UINT32_MAX)
+            return 0;
+        return static_cast<uint32_t>((n + cap - 1) / cap);
+    }
 
-        out.reserve(total);
+    bool chunk_range(const uint8_t *data, size_t data_size,
+                     uint32_t msg_id, Type msg_type, uint16_t mtu,
+                     uint32_t from, uint32_t to, FrameRef *out,
+                     const ChunkOptions &opt) noexcept
+    {
+        size_t cap = mtu_payload(mtu);
+        const size_t msg_size = data_size + opt.tail_len;
+        uint32_t total = chunk_count(msg_size, mtu);
+        if(data == nullptr || total == 0 || to > total || (opt.tail_len > 0 && opt.tail == nullptr))
+            return false;
 
-        for(uint32_t seq=0;seq<total;seq++)
+        for(uint32_t seq=from;seq<to;seq++)
         {
             size_t offset = static_cast<size_t>(seq)*cap;
-            size_t chunk_len = min(cap,data_size-offset);
+            size_t chunk_len = min(cap,msg_size-offset);
             Header h;
             h.type = msg_type;
             h.msg_id = msg_id;
@@ -162,23 +258,56 @@ namespace linkchat
             h.total = total;
             h.payload_len = static_cast<uint16_t>(chunk_len);
         
-            vector<uint8_t> pdu(kHeaderSize+chunk_len+kCrcSize);
-            const uint8_t * payload = data + offset;
-            size_t built_pdu = build_pdu(h,payload,chunk_len,pdu.data(),pdu.size());
-            
-            if(built_pdu != kHeaderSize + chunk_len + kCrcSize)
-                return {};
-
-            out.push_back(move(pdu));
+            FrameRef pdu = FrameRef::make(kHeaderSize+chunk_len+kCrcSize);
+            if(pdu.empty())
+                return false;
+
+            // the tail may start inside this frame or the one before
+            uint8_t *payload = pdu.data() + kHeaderSize;
+            const size_t from_data = offset < data_size ? min(chunk_len, data_size - offset) : 0;
+            if(from_data > 0)
+                memcpy(payload, data + offset, from_data);
+            if(from_data < chunk_len)
+                memcpy(payload + from_data, opt.tail + (offset + from_data - data_size), chunk_len - from_data);
+
+            if(seal_pdu(h, pdu.data(), pdu.size(), opt.crc) != kHeaderSize + chunk_len + kCrcSize)
+                return false;
+
+            out[seq] = move(pdu);
         }
+        return true;
+    }
 
+    [[nodiscard]] vector<FrameRef> chunkify_from_buffer(const uint8_t *data,
+                                                        size_t data_size, 
+                                                        uint32_t msg_id,
+                                                        Type msg_type, 
+                                                        uint16_t mtu)
+    {
+        if(data_size == 0 || data==nullptr)
+            return {};
+
+        uint32_t total = chunk_count(data_size, mtu);
+        if(total == 0)
+            return {};
+
+        vector<FrameRef> out(total);
+        atomic<bool> ok{true};
+        shared_pool().parallel_for(total, kChunkBlock, [&](size_t begin, size_t end)
+        {
+            if(ok.load(memory_order_relaxed) &&
+               !chunk_range(data, data_size, msg_id, msg_type, mtu, static_cast<uint32_t>(begin), static_cast<uint32_t>(end), out.data()))
+                ok.store(false, memory_order_relaxed);
+        });
+        if(!ok.load())
+            return {};
         return out;
     }
 
-    [[nodiscard]] vector<vector<uint8_t>> chunkify_from_vector( const vector<uint8_t> &msg,
-                                                                uint32_t msg_id,
-                                                                Type msg_type,
-                                                                uint16_t mtu)
+    [[nodiscard]] vector<FrameRef> chunkify_from_vector( const vector<uint8_t> &msg,
+                                                         uint32_t msg_id,
+                                                         Type msg_type,
+                                                         uint16_t mtu)
     {
         if(msg.empty())
             return {};
@@ -4,13 +4,62 @@
 #include <vector>
 #include "header.hpp"
 #include "util/structs.hpp"
+#include "util/frame_pool.hpp"
 
 namespace linkchat
 {
 
-    inline constexpr std::size_t kHeaderSize = 15;
+    inline constexpr std::size_t kHeaderSize = HeaderCodec::size;
     inline constexpr std::size_t kCrcSize = 4;
-    inline constexpr std::size_t kAckPayloadSize = 8;
+    inline constexpr std::uint32_t kNoRwnd = 0xFFFFFFFFu;      // no window advertised
+
+    // msg_id bit of unicast messages: the message ends in an XXH64 of everything before it
+    // (8 bytes, BE), checked once it is reassembled. Only sent to peers whose HELLO carries kCapDigest
+    inline constexpr std::uint32_t kDigestIdBit = 0x40000000u;
+    inline constexpr std::size_t kDigestSize = 8;
+
+    [[nodiscard]] inline constexpr bool has_digest(std::uint32_t msg_id) noexcept
+    {
+        // multicast ids (top bit) use the rest of their bits freely
+        return (msg_id & (0x80000000u | kDigestIdBit)) == kDigestIdBit;
+    }
+
+    // A received PDU, read in place. PduView::parse checks the header once per frame; the fields
+    // are loaded straight from the frame, the payload is never copied and the CRC is computed
+    // at most once, the first time crc_ok() asks. Valid while the frame buffer is
+    class PduView
+    {
+    public:
+        PduView() = default;
+
+        // empty view when the header is malformed. The link may pad short frames, so n may
+        // exceed size(); a frame cut short of its header's payload_len is truncated()
+        static PduView parse(const std::uint8_t *buf, std::size_t n) noexcept;
+
+        explicit operator bool() const noexcept { return p_ != nullptr; }
+        bool truncated() const noexcept { return n_ < size(); }
+
+        Type type() const noexcept { return HeaderCodec::read<&Header::type>(p_); }
+        std::uint32_t msg_id() const noexcept { return HeaderCodec::read<&Header::msg_id>(p_); }
+        std::uint32_t seq() const noexcept { return HeaderCodec::read<&Header::seq>(p_); }
+        std::uint32_t total() const noexcept { return HeaderCodec::read<&Header::total>(p_); }
+        std::uint16_t payload_len() const noexcept { return HeaderCodec::read<&Header::payload_len>(p_); }
+        Header header() const noexcept { return Header{type(), msg_id(), seq(), total(), payload_len()}; }
+
+        const std::uint8_t *data() const noexcept { return p_; }
+        const std::uint8_t *payload() const noexcept { return p_ + kHeaderSize; }
+        std::size_t size() const noexcept { return kHeaderSize + payload_len() + kCrcSize; } // link padding left out
+        std::size_t frame_len() const noexcept { return n_; }                                // as received
+
+        bool crc_ok() const noexcept;
+        // the CRC was checked elsewhere (a parallel batch), or need not be (a trusted link FCS)
+        void assume_crc(bool ok) noexcept { crc_ = ok ? 1 : 0; }
+
+    private:
+        const std::uint8_t *p_{nullptr};
+        std::size_t n_{0};
+        mutable std::int8_t crc_{-1}; // -1 until checked
+    };
 
     // [Header(15)] [Payload(P)] [CRC32(4, BE)]
     size_t build_pdu(const Header &h,
@@ -21,19 +70,137 @@ namespace linkchat
                    Header &out_h,
                    std::vector<uint8_t> &out_payload) noexcept;
 
+    // parse_pdu without the copy: out_payload points into buf. crc_checked skips the CRC
+    // for a frame whose checksum was already verified (pdu_crc_ok, PduView::crc_ok)
+    bool verify_pdu(const std::uint8_t *buf, std::size_t n,
+                    Header &out_h,
+                    const std::uint8_t *&out_payload, std::size_t &out_len,
+                    bool crc_checked = false) noexcept;
+
+    // true if the CRC trailer matches the payload; buf holds exactly one PDU
+    bool pdu_crc_ok(const std::uint8_t *buf, std::size_t n) noexcept;
+
+    // header and CRC around a payload already written at out + kHeaderSize;
+    // with_crc = false leaves the CRC field zero
+    size_t seal_pdu(const Header &h, std::uint8_t *out, std::size_t out_cap, bool with_crc = true) noexcept;
+
+    // A single-frame control PDU whose payload is exactly one C layout (ACK, ECHO, ...): the
+    // frame is sized, encoded and sealed from the codec, nothing written by hand
+    template <typename C>
+    FrameRef make_control_pdu(Type type, std::uint32_t msg_id, std::uint32_t seq, std::uint32_t total,
+                              const typename C::Struct &fields) noexcept
+    {
+        FrameRef pdu = FrameRef::make(kHeaderSize + C::size + kCrcSize);
+        if (pdu.empty())
+            return {};
+        C::encode(fields, pdu.data() + kHeaderSize);
+        const Header h{type, msg_id, seq, total, static_cast<std::uint16_t>(C::size)};
+        if (seal_pdu(h, pdu.data(), pdu.size()) != pdu.size())
+            return {};
+        return pdu;
+    }
+
+    // the payload of a control PDU of this type, decoded as C once its length and CRC check out
+    template <typename C>
+    bool read_control_pdu(const PduView &pdu, Type type, typename C::Struct &out) noexcept
+    {
+        return pdu && !pdu.truncated() && pdu.type() == type && pdu.payload_len() == C::size &&
+               pdu.crc_ok() && C::decode(pdu.payload(), out);
+    }
+
     struct AckFields
     {
-        // Ack structure: type=ACK, seq=0, total=0, payload_len=8 (BE), CRC32(payload)
+        // Ack structure: type=ACK, seq=0, total=0, payload_len=8 or 12 (BE), CRC32(payload)
         // Payload body
         std::uint32_t msg_id;         // id from message that is being acknowledged
         std::uint32_t highest_seq_ok; // biggest seq of consecutive PDU's received
+        std::uint32_t rwnd = kNoRwnd; // bytes the receiver can still take; only sent to peers with kCapRwnd
     };
 
+    using AckCodec = Codec<AckFields, Field<&AckFields::msg_id>, Field<&AckFields::highest_seq_ok>>;
+    using AckRwndCodec = Codec<AckFields, Field<&AckFields::msg_id>, Field<&AckFields::highest_seq_ok>, Field<&AckFields::rwnd>>;
+    inline constexpr std::size_t kAckPayloadSize = AckCodec::size;
+    inline constexpr std::size_t kAckRwndPayloadSize = AckRwndCodec::size; // ACK that also carries a receive window
+    static_assert(kAckPayloadSize == 8 && kAckRwndPayloadSize == 12, "ACK payloads are part of the wire format");
+
     bool is_ack_header(const Header &h) noexcept;
 
-    std::vector<uint8_t> create_ack(const AckFields &ack) noexcept;
+    FrameRef create_ack(const AckFields &ack) noexcept;
+
+    bool try_parse_ack(const PduView &pdu, AckFields &out) noexcept;
+
+    // Nak structure: type=NAK, msg_id, seq=0, total=total of the message, CRC32(payload)
+    // Payload: [count(2, BE)] {[from(4, BE)] [to(4, BE)]} inclusive seq ranges the receiver is missing
+    inline constexpr std::size_t kNakMaxRanges = 64;
+
+    struct NakRange
+    {
+        std::uint32_t from;
+        std::uint32_t to;
+    };
 
-    bool try_parse_ack(const std::uint8_t *pdu, std::size_t pdu_size, AckFields &out) noexcept;
+    using NakRangeCodec = Codec<NakRange, Field<&NakRange::from>, Field<&NakRange::to>>;
+
+    FrameRef create_nak(std::uint32_t msg_id, std::uint32_t total, const std::vector<NakRange> &ranges) noexcept;
+
+    bool try_parse_nak(const PduView &pdu,
+                       std::uint32_t &msg_id, std::uint32_t &total,
+                       std::vector<NakRange> &out) noexcept;
+
+    // Echo structure: type=ECHO, msg_id=0, seq=probe number, total=0, CRC32(payload)
+    // Payload: [kind(1)] [ident(2, BE)] [turnaround_ns(8, BE)]; single unreliable frames, never ACKed.
+    // A reply carries how long the request sat in the responder (kernel arrival -> reply sent)
+    inline constexpr std::uint8_t kEchoRequest = 0;
+    inline constexpr std::uint8_t kEchoReply = 1;
+
+    struct EchoFields
+    {
+        std::uint8_t kind;
+        std::uint16_t ident;          // one ping run; replies to earlier runs are told apart by it
+        std::uint32_t seq;
+        std::uint64_t turnaround_ns;  // replies only
+    };
+
+    // seq rides in the header
+    using EchoCodec = Codec<EchoFields, Field<&EchoFields::kind>, Field<&EchoFields::ident>, Field<&EchoFields::turnaround_ns>>;
+    inline constexpr std::size_t kEchoPayloadSize = EchoCodec::size;
+    static_assert(kEchoPayloadSize == 11, "ECHO payload is part of the wire format");
+
+    FrameRef create_echo(const EchoFields &echo) noexcept;
+
+    bool try_parse_echo(const PduView &pdu, EchoFields &out) noexcept;
+
+    // Reject structure: type=REJECT, msg_id=refused message, seq=0, total=0, CRC32(payload)
+    // Payload: [reason(1)]; a single unreliable frame, repeated if the sender keeps sending.
+    // Only sent to peers whose HELLO carries kCapReject
+    enum class RejectReason : std::uint8_t
+    {
+        TooLarge = 1, // would never fit the receive memory: the sender gives the message up
+        Resend = 2,   // reassembled, but its digest did not match: the sender sends it all again
+    };
+
+    template <>
+    struct WireEnum<RejectReason>
+    {
+        static constexpr bool valid(std::uint8_t r) noexcept
+        {
+            return r >= static_cast<std::uint8_t>(RejectReason::TooLarge) && r <= static_cast<std::uint8_t>(RejectReason::Resend);
+        }
+    };
+
+    struct RejectFields
+    {
+        std::uint32_t msg_id;   // rides in the header
+        RejectReason reason;
+    };
+
+    using RejectCodec = Codec<RejectFields, Field<&RejectFields::reason>>;
+    inline constexpr std::size_t kRejectPayloadSize = RejectCodec::size;
+    static_assert(kRejectPayloadSize == 1, "REJECT payload is part of the wire format");
+
+    FrameRef create_reject(const RejectFields &reject) noexcept;
+
+    bool try_parse_reject(const PduView &pdu, RejectFields &out) noexcept;
 
     [[nodiscard]] inline constexpr std::size_t mtu_payload(std::uint16_t mtu) noexcept
     {
@@ -43,15 +210,36 @@ namespace linkchat
             return 0;
     }
 
-    //create pdu from message stored in buffer
-    [[nodiscard]] std::vector<std::vector<std::uint8_t>> chunkify_from_buffer(const std::uint8_t *data,
-                                                                                std::size_t n,
-                                                                                std::uint32_t msg_id,
-                                                                                Type msg_type,
-                                                                                std::uint16_t mtu = 1500);
+    // frames a message of n bytes takes at this MTU, 0 if it cannot be sent
+    [[nodiscard]] std::uint32_t chunk_count(std::size_t n, std::uint16_t mtu) noexcept;
+
+    struct ChunkOptions
+    {
+        const std::uint8_t *tail = nullptr; // bytes sent after the data, as part of the message (the digest)
+        std::size_t tail_len = 0;
+        bool crc = true;                    // false: CRC fields left zero, for a peer that trusts its link FCS
+    };
+
+    // builds frames [from, to) of the message into out[from..to); false if a frame cannot be allocated.
+    // Disjoint ranges may be built from different threads at once. With a tail, frames are counted
+    // with chunk_count(n + tail_len, mtu)
+    bool chunk_range(const std::uint8_t *data, std::size_t n,
+                     std::uint32_t msg_id, Type msg_type, std::uint16_t mtu,
+                     std::uint32_t from, std::uint32_t to, FrameRef *out,
+                     const ChunkOptions &opt = {}) noexcept;
+
+    inline constexpr std::uint32_t kChunkBlock = 64; // frames built (and checksummed) per pool task
+
+    //create pdu from message stored in buffer, one pooled frame per pdu; big messages are built
+    //in blocks on the shared task pool
+    [[nodiscard]] std::vector<FrameRef> chunkify_from_buffer(const std::uint8_t *data,
+                                                             std::size_t n,
+                                                             std::uint32_t msg_id,
+                                                             Type msg_type,
+                                                             std::uint16_t mtu = 1500);
 
     //create pdu from message stored in vector 
-    [[nodiscard]] std::vector<std::vector<std::uint8_t>>
+    [[nodiscard]] std::vector<FrameRef>
     chunkify_from_vector(const std::vector<std::uint8_t> &msg,
                             std::uint32_t msg_id,
                             Type msg_type,
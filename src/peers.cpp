@@ -0,0 +1,253 @@
+#include "peers.hpp"
+#include "pdu.hpp"
+#include "util/helpers.hpp"
+#include "util/time.hpp"
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+namespace linkchat
+{
+    static constexpr size_t kMacAsciiLen = 17;
+
+    [[nodiscard]] vector<uint8_t> encode_hello(const HelloInfo &hello)
+    {
+        string nick = hello.alias;
+        if(nick.size() > 255)
+            nick.resize(255);
+        string mac = hello.mac_ascii;
+        if(mac.size() != kMacAsciiLen)
+            mac = "??:??:??:??:??:??";
+
+        vector<uint8_t> out;
+        out.reserve(1 + nick.size() + kMacAsciiLen + 5);
+        out.push_back(static_cast<uint8_t>(nick.size()));
+        out.insert(out.end(), nick.begin(), nick.end());
+        out.insert(out.end(), mac.begin(), mac.end());
+        out.resize(out.size() + 4);
+        uint32_to_BE(hello.caps, out.data(), static_cast<int>(out.size() - 4));
+        out.push_back(hello.flags);
+        return out;
+    }
+
+    bool decode_hello(const uint8_t *data, size_t len, HelloInfo &out) noexcept
+    {
+        if(data == nullptr || len < 1)
+            return false;
+        size_t nlen = data[0];
+        if(len < 1 + nlen)
+            return false;
+
+        out = HelloInfo{};
+        out.alias.assign(reinterpret_cast<const char *>(data + 1), nlen);
+        size_t pos = 1 + nlen;
+        if(len >= pos + kMacAsciiLen)
+        {
+            out.mac_ascii.assign(reinterpret_cast<const char *>(data + pos), kMacAsciiLen);
+            pos += kMacAsciiLen;
+        }
+        if(len >= pos + 5)
+        {
+            out.caps = BE_to_uint32(data, static_cast<int>(pos));
+            out.flags = data[pos + 4];
+        }
+        return true;
+    }
+
+    [[nodiscard]] FrameRef create_hello_pdu(const HelloInfo &hello)
+    {
+        vector<uint8_t> payload = encode_hello(hello);
+
+        Header h;
+        h.type = Type::HELLO;
+        h.msg_id = kHelloMsgId;
+        h.seq = 0;
+        h.total = 1;
+        h.payload_len = static_cast<uint16_t>(payload.size());
+
+        FrameRef pdu = FrameRef::make(kHeaderSize + payload.size() + kCrcSize);
+        if(pdu.empty() || build_pdu(h, payload.data(), payload.size(), pdu.data(), pdu.size()) != pdu.size())
+            return {};
+        return pdu;
+    }
+
+    PeerDirectory::PeerDirectory(PeerDirectoryConfig cfg, NowFn now)
+        : cfg_(cfg), now_(move(now)), rng_(random_device{}())
+    {
+        if(now_ == nullptr)
+            now_ = steady_millis;
+        if(cfg_.announce_min_ms == 0)
+            cfg_.announce_min_ms = 1;
+        cfg_.announce_max_ms = max(cfg_.announce_max_ms, cfg_.announce_min_ms);
+        interval_ = cfg_.announce_min_ms;
+    }
+
+    uint64_t PeerDirectory::jitter(uint32_t max_ms) noexcept
+    {
+        if(max_ms == 0)
+            return 0;
+        return uniform_int_distribution<uint32_t>(0, max_ms)(rng_);
+    }
+
+    void PeerDirectory::reset_backoff(uint64_t now) noexcept
+    {
+        interval_ = cfg_.announce_min_ms;
+        next_announce_ = min(next_announce_, now + cfg_.announce_min_ms + jitter(cfg_.announce_min_ms / 4));
+    }
+
+    void PeerDirectory::set_identity(const string &alias, const string &mac_ascii, uint32_t caps)
+    {
+        lock_guard<mutex> lk(mu_);
+        const bool changed = self_.alias != alias || self_.mac_ascii != mac_ascii || self_.caps != caps;
+        self_.alias = alias;
+        self_.mac_ascii = mac_ascii;
+        self_.caps = caps;
+        // only our own change restarts the backoff; peers coming and going never do, or every
+        // station on a busy segment would re-announce at once each time one of them joins
+        if(changed && emit_)
+            reset_backoff(now_());
+    }
+
+    void PeerDirectory::attach(EmitToFn emit) noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+        emit_ = move(emit);
+        replies_.clear();
+        if(emit_)
+        {
+            probe_pending_ = true;
+            interval_ = cfg_.announce_min_ms;
+            next_announce_ = 0;
+        }
+    }
+
+    void PeerDirectory::probe() noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+        probe_pending_ = true;
+        next_announce_ = 0;
+    }
+
+    void PeerDirectory::on_hello(const Mac &src, const uint8_t *payload, size_t len) noexcept
+    {
+        HelloInfo hello;
+        if(!decode_hello(payload, len, hello))
+            return;
+
+        lock_guard<mutex> lk(mu_);
+        uint64_t now = now_();
+        uint64_t key = mac_to_u64(src);
+
+        auto it = peers_.find(key);
+        const bool newcomer = it == peers_.end();
+        if(newcomer)
+        {
+            peers_[key] = PeerInfo{src, hello.alias, hello.caps, now};
+        }
+        else
+        {
+            it->second.alias = hello.alias;
+            it->second.caps = hello.caps;
+            it->second.last_seen_ms = now;
+        }
+
+        // a newcomer learns about us from a jittered unicast answer, like a probe gets, without
+        // waiting out the backoff and without a broadcast from everyone
+        if(((hello.flags & kHelloProbe) != 0 || newcomer) && replies_.find(key) == replies_.end())
+            replies_[key] = now + jitter(cfg_.reply_jitter_ms);
+    }
+
+    void PeerDirectory::tick() noexcept
+    {
+        vector<pair<Mac, FrameRef>> out;
+        EmitToFn emit;
+        {
+            lock_guard<mutex> lk(mu_);
+            if(!emit_)
+                return;
+            emit = emit_;
+            uint64_t now = now_();
+
+            for(auto it = peers_.begin(); it != peers_.end();)
+            {
+                if(now - it->second.last_seen_ms > cfg_.ttl_ms)
+                {
+                    it = peers_.erase(it);
+                    continue;
+                }
+                ++it;
+            }
+
+            HelloInfo reply = self_;
+            reply.flags = 0;
+            for(auto it = replies_.begin(); it != replies_.end();)
+            {
+                if(now < it->second)
+                {
+                    ++it;
+                    continue;
+                }
+                auto peer = peers_.find(it->first);
+                if(peer != peers_.end())
+                    out.emplace_back(peer->second.mac, create_hello_pdu(reply));
+                it = replies_.erase(it);
+            }
+
+            if(now >= next_announce_)
+            {
+                HelloInfo announce = self_;
+                announce.flags = probe_pending_ ? kHelloProbe : 0;
+                Mac bcast;
+                fill(begin(bcast.bytes), end(bcast.bytes), 0xFF);
+                out.emplace_back(bcast, create_hello_pdu(announce));
+
+                probe_pending_ = false;
+                // +-25% so periodic announcements from many peers drift apart
+                uint64_t spread = interval_ / 2;
+                next_announce_ = now + interval_ - interval_ / 4 + jitter(static_cast<uint32_t>(spread));
+                interval_ = static_cast<uint32_t>(min<uint64_t>(uint64_t(interval_) * 2, cfg_.announce_max_ms));
+            }
+        }
+
+        for(const auto &[dst, pdu] : out)
+        {
+            if(!pdu.empty())
+                emit(dst, pdu);
+        }
+    }
+
+    vector<PeerInfo> PeerDirectory::snapshot() const
+    {
+        lock_guard<mutex> lk(mu_);
+        vector<PeerInfo> out;
+        out.reserve(peers_.size());
+        for(const auto &[key, peer] : peers_)
+            out.push_back(peer);
+        sort(out.begin(), out.end(), [](const PeerInfo &a, const PeerInfo &b)
+             { return a.last_seen_ms > b.last_seen_ms; });
+        return out;
+    }
+
+    bool PeerDirectory::lookup(const string &alias, Mac &out) const
+    {
+        lock_guard<mutex> lk(mu_);
+        const PeerInfo *best = nullptr;
+        for(const auto &[key, peer] : peers_)
+        {
+            if(peer.alias == alias && (best == nullptr || peer.last_seen_ms > best->last_seen_ms))
+                best = &peer;
+        }
+        if(best == nullptr)
+            return false;
+        out = best->mac;
+        return true;
+    }
+
+    uint32_t PeerDirectory::caps_of(const Mac &mac) const
+    {
+        lock_guard<mutex> lk(mu_);
+        auto it = peers_.find(mac_to_u64(mac));
+        return it == peers_.end() ? 0 : it->second.caps;
+    }
+}
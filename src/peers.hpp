@@ -0,0 +1,110 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <random>
+#include "sender.hpp"   // NowFn
+#include "util/mac.hpp"
+#include "util/frame_pool.hpp"
+
+namespace linkchat
+{
+    // HELLO payload: [nick_len(1)] [nick] [mac_ascii(17)] [caps(4, BE)] [flags(1)]
+    // caps and flags are optional so HELLOs from older peers still parse.
+    // Directory HELLOs are single unreliable frames with msg_id 0: never ACKed, never retransmitted.
+    inline constexpr std::uint32_t kHelloMsgId = 0;
+    inline constexpr std::uint8_t kHelloProbe = 0x01; // sender wants every peer to answer
+
+    enum PeerCaps : std::uint32_t
+    {
+        kCapFec   = 1u << 0,
+        kCapXfer  = 1u << 1,  // resumable transfers
+        kCapDelta = 1u << 2,  // content-defined delta transfers
+        kCapMcast = 1u << 3,  // NAK-based multicast
+        kCapRwnd  = 1u << 4,  // understands ACKs carrying a receive window
+        kCapDigest = 1u << 5, // checks whole-message digests (kDigestIdBit)
+        kCapFcsTrust = 1u << 6, // trusts its link FCS: skips the CRC32 of digest frames, so senders need not compute it
+        kCapEcho  = 1u << 7,  // answers ECHO requests (ping)
+        kCapReject = 1u << 8, // refuses messages it cannot take with a REJECT, instead of dropping their frames
+        kCapFileStream = 1u << 9, // writes FILE messages to disk as they arrive: their size is not bound by its receive memory
+    };
+    inline constexpr std::uint32_t kLocalCaps = kCapFec | kCapXfer | kCapDelta | kCapMcast | kCapRwnd | kCapDigest | kCapEcho |
+                                                kCapReject | kCapFileStream;
+
+    struct HelloInfo
+    {
+        std::string alias;
+        std::string mac_ascii;
+        std::uint32_t caps = 0;
+        std::uint8_t flags = 0;
+    };
+
+    [[nodiscard]] std::vector<std::uint8_t> encode_hello(const HelloInfo &hello);
+    bool decode_hello(const std::uint8_t *data, std::size_t len, HelloInfo &out) noexcept;
+
+    // single-frame HELLO PDU outside the reliable Sender
+    [[nodiscard]] FrameRef create_hello_pdu(const HelloInfo &hello);
+
+    struct PeerInfo
+    {
+        Mac mac;
+        std::string alias;
+        std::uint32_t caps;
+        std::uint64_t last_seen_ms;
+    };
+
+    struct PeerDirectoryConfig
+    {
+        std::uint32_t announce_min_ms = 1000;  // first re-announce after a change
+        std::uint32_t announce_max_ms = 60000; // backoff ceiling on a quiet segment
+        std::uint32_t ttl_ms = 180000;         // peer dropped after this long unheard
+        std::uint32_t reply_jitter_ms = 500;   // answers to a probe are spread over this window
+    };
+
+    using EmitToFn = std::function<void(const Mac &dst, const FrameRef &pdu)>;
+
+    // MAC -> alias, capabilities and last-seen time, kept fresh by periodic HELLOs.
+    // Outlives any single chat/send session; whichever app is bound feeds and drives it.
+    class PeerDirectory
+    {
+    public:
+        explicit PeerDirectory(PeerDirectoryConfig cfg = {}, NowFn now = nullptr);
+
+        void set_identity(const std::string &alias, const std::string &mac_ascii, std::uint32_t caps);
+
+        // link to send HELLOs on; attaching probes the segment, nullptr detaches
+        void attach(EmitToFn emit) noexcept;
+
+        void on_hello(const Mac &src, const std::uint8_t *payload, std::size_t len) noexcept;
+
+        // announcements, probe replies and TTL expiry
+        void tick() noexcept;
+
+        // announce now and ask every peer to answer
+        void probe() noexcept;
+
+        std::vector<PeerInfo> snapshot() const;
+        bool lookup(const std::string &alias, Mac &out) const;
+        std::uint32_t caps_of(const Mac &mac) const; // 0 for a peer never heard
+
+    private:
+        std::uint64_t jitter(std::uint32_t max_ms) noexcept;
+        void reset_backoff(std::uint64_t now) noexcept;
+
+        PeerDirectoryConfig cfg_;
+        NowFn now_;
+        HelloInfo self_;
+        EmitToFn emit_;
+        std::unordered_map<std::uint64_t, PeerInfo> peers_;
+        std::unordered_map<std::uint64_t, std::uint64_t> replies_; // peer -> when our answer goes out
+        std::uint64_t next_announce_{0};
+        std::uint32_t interval_;
+        bool probe_pending_{false};
+        std::mt19937 rng_;
+        mutable std::mutex mu_;
+    };
+}
@@ -1,5 +1,7 @@
 #include "reassembly.hpp"
 #include "util/helpers.hpp"
+#include "util/time.hpp"
+#include "util/hash.hpp"
 #include <cstdint>
 #include <cstddef>
 #include <vector>
@@ -8,34 +10,55 @@
 #include <cstring> 
 #include <algorithm> 
 #include <utility>
+#include <limits>
 using namespace std;
 
 namespace linkchat
 {
-    Reassembly::Reassembly(EmitAckFn emit_ack): msgs_(), emit_ack_(move(emit_ack))
+    static constexpr size_t kDoneHistory = 4096;
+    // bookkeeping per announced frame, charged before any payload arrives
+    static constexpr size_t kSlotBytes = sizeof(FrameRef) + 1;
+    // a FEC block spans at most this many frames, so a streamed chunk this far below the
+    // first missing frame can no longer be part of a repair
+    static constexpr uint32_t kFecBlockMax = numeric_limits<uint8_t>::max();
+    // frames of a refused message repeat its REJECT at most this often
+    static constexpr uint64_t kRejectRepeatMs = 50;
+
+    Reassembly::Reassembly(EmitAckFn emit_ack, ReassemblyConfig cfg): msgs_(), emit_ack_(move(emit_ack)), cfg_(move(cfg))
     {
         if(!emit_ack_) emit_ack_ = [](const AckFields &){};
+        emit_reject_ = [](const RejectFields &){ return false; };
+        if(!cfg_.now) cfg_.now = steady_millis;
     }
 
-    RxChunkEvent Reassembly::feed_pdu(const std::uint8_t *pdu, std::size_t pdu_size) noexcept
+    void Reassembly::set_stream(StreamCallbacks cb) noexcept
     {
-        RxChunkEvent event;
+        stream_ = move(cb);
+        if(!stream_.on_complete) stream_.on_complete = [](uint32_t, uint64_t, bool){};
+    }
 
-        if(pdu == nullptr || pdu_size < kHeaderSize + kCrcSize)
-        {
-            event.accepted = false;
-            return event;
-        }
+    void Reassembly::set_on_reject(EmitRejectFn fn) noexcept
+    {
+        if(fn)
+            emit_reject_ = move(fn);
+        else
+            emit_reject_ = [](const RejectFields &){ return false; };
+    }
+
+    RxChunkEvent Reassembly::feed_pdu(const PduView &pdu, std::uint64_t peer) noexcept
+    {
+        RxChunkEvent event{};
 
-        Header h;
-        if(!parse_header(pdu, pdu_size, h)) 
+        if(!pdu || pdu.truncated())
         {
             event.accepted = false;
             return event;
         }
+
+        const Header h = pdu.header();
         const uint32_t msg_id = static_cast<uint32_t>(h.msg_id) ;
 
-        //fill event fields  after parsing header
+        //fill event fields from the header
         event.type = h.type;
         event.msg_id = h.msg_id;
         event.seq = h.seq;
@@ -49,33 +72,62 @@ namespace linkchat
             return event;
         }
 
-        //parse pdu to get payload and validate crc
-        vector<uint8_t> out_payload;
-        if(!parse_pdu(pdu, pdu_size, h, out_payload)) 
+        //validate crc; the payload is only copied out once it is known to be new
+        if(!pdu.crc_ok())
         {
             event.accepted = false;
+            event.bad_crc = true;
             return event;
         }
+        const uint8_t *payload = pdu.payload();
+        const size_t payload_len = h.payload_len;
+
+        if(h.type == Type::REPAIR)
+            return feed_repair(h, payload, payload_len, event, peer);
 
         //validate header fields and payload length
-        if(h.total == 0 || h.seq >= h.total || h.payload_len != out_payload.size())
+        if(h.total == 0 || h.seq >= h.total)
+        {
+            event.accepted = false;
+            return event;
+        }
+
+        auto refused = refused_.find(msg_id);
+        if(refused != refused_.end() && refused->second.reason == RejectReason::Resend && h.seq == 0)
+            refused_.erase(refused); // the sender heard it and starts over
+        else if(refused != refused_.end())
         {
+            const uint64_t now = cfg_.now();
+            if(now - refused->second.sent_ms >= kRejectRepeatMs)
+            {
+                refused->second.sent_ms = now;
+                emit_reject_(RejectFields{msg_id, refused->second.reason});
+            }
             event.accepted = false;
             return event;
         }
         
+        auto done = done_.find(msg_id);
+        if(done != done_.end() && done->second == h.total && msgs_.find(msg_id) == msgs_.end())
+        {
+            event.duplicate = true;
+            event.accepted = false;
+            event.highest_seq_ok = h.total - 1;
+            AckFields ack = {.msg_id = msg_id, .highest_seq_ok = h.total - 1};
+            emit_ack_(ack);
+            return event;
+        }
+
         //check if message state exists, if not create it
         if(msgs_.find(msg_id) == msgs_.end())
         {
-            MsgState new_msg;
-            new_msg.type = h.type;
-            new_msg.total = h.total;
-            new_msg.chunks.resize(h.total);
-            new_msg.received.resize(h.total, 0);
-            new_msg.prefix = -1;
-            new_msg.bytes_accum = 0;
-
-            msgs_[msg_id] = move(new_msg);
+            // every frame but the last is full, so it tells the size of the whole message
+            const size_t frame_bytes = h.seq + 1 < h.total ? payload_len : 0;
+            if(create_state(msg_id, h.type, h.total, peer, frame_bytes) == nullptr)
+            {
+                event.accepted = false;
+                return event;
+            }
             event.duplicate = false;
         }
         else 
@@ -88,12 +140,16 @@ namespace linkchat
 
             if(msgs_[msg_id].received[h.seq] == 1)
             {
+                touch(msgs_[msg_id]);
                 event.duplicate = true;
                 event.accepted = false;
                 if(msgs_[msg_id].prefix < 0)
+                {
+                    // nothing in order yet: an ACK of -1 would read as "all received"
                     event.highest_seq_ok = 0u;
-                else
-                    event.highest_seq_ok = msgs_[msg_id].prefix;
+                    return event;
+                }
+                event.highest_seq_ok = msgs_[msg_id].prefix;
                 AckFields ack = {.msg_id = msg_id, .highest_seq_ok = static_cast<uint32_t>(msgs_[msg_id].prefix)};
                 emit_ack_(ack); 
                 return event;
@@ -101,22 +157,205 @@ namespace linkchat
         }
         
         //Save Chunk 
-        msgs_[msg_id].chunks[h.seq] = move(out_payload);
-        msgs_[msg_id].received[h.seq] = 1;
-        msgs_[msg_id].bytes_accum += h.payload_len;
+        MsgState &st = msgs_[msg_id];
+        if(!make_room(st.peer, payload_len, msg_id))
+        {
+            rejected_++;
+            // nothing else is left to evict: held whole, this message can never fit
+            if(!st.streamed)
+            {
+                release(msg_id);
+                refuse(msg_id, RejectReason::TooLarge);
+            }
+            event.accepted = false;
+            return event;
+        }
+        FrameRef chunk = FrameRef::copy_of(payload, payload_len);
+        if(payload_len > 0 && chunk.empty())
+        {
+            rejected_++;
+            event.accepted = false;
+            return event;
+        }
+        touch(st);
+        store_chunk(st, h.seq, move(chunk));
+        try_repair(st, h.seq);
 
-        
-        int current_prefix = msgs_[msg_id].prefix;
-        while(msgs_[msg_id].prefix + 1 < static_cast<int>(h.total) && msgs_[msg_id].received[msgs_[msg_id].prefix + 1] == 1)
+        advance_prefix(msg_id, st, event);
+        event.duplicate = false;
+        event.accepted = true;
+        return event;
+    }
+
+    RxChunkEvent Reassembly::feed_repair(const Header &h, const uint8_t *payload, size_t payload_len, RxChunkEvent event, uint64_t peer) noexcept
+    {
+        RepairFields rf;
+        const uint8_t *parity = nullptr;
+        size_t parity_len = 0;
+        if(!parse_repair(payload, payload_len, rf, parity, parity_len))
+        {
+            event.accepted = false;
+            return event;
+        }
+        if(h.total == 0 || rf.block_start >= h.total)
         {
-            msgs_[msg_id].prefix++;
+            event.accepted = false;
+            return event;
         }
 
-        if(current_prefix != msgs_[msg_id].prefix)
+        const uint32_t msg_id = h.msg_id;
+        auto done = done_.find(msg_id);
+        if((done != done_.end() && done->second == h.total && msgs_.find(msg_id) == msgs_.end()) ||
+           refused_.count(msg_id) != 0)
         {
-            event.highest_seq_ok = static_cast<uint32_t>(msgs_[msg_id].prefix);
-            AckFields ack = {.msg_id = msg_id, .highest_seq_ok = static_cast<uint32_t>(msgs_[msg_id].prefix)};
-            emit_ack_(ack);
+            event.duplicate = true;
+            event.accepted = false;
+            return event;
+        }
+
+        // parity is as long as the longest frame of its group
+        if(msgs_.find(msg_id) == msgs_.end() && create_state(msg_id, rf.orig_type, h.total, peer, parity_len) == nullptr)
+        {
+            event.accepted = false;
+            return event;
+        }
+
+        MsgState &st = msgs_[msg_id];
+        event.type = st.type;
+        if(st.type != rf.orig_type || st.total != h.total)
+        {
+            event.accepted = false;
+            return event;
+        }
+
+        for(size_t i = 0; i < st.repairs.size(); i++)
+        {
+            const RepairFields &o = st.repairs[i].fields;
+            if(o.block_start == rf.block_start && o.group == rf.group && o.groups == rf.groups)
+            {
+                event.duplicate = true;
+                event.accepted = false;
+                return event;
+            }
+        }
+
+        RepairGroup rg;
+        rg.fields = rf;
+        rg.parity = FrameRef::copy_of(parity, parity_len);
+        if(parity_len > 0 && rg.parity.empty())
+        {
+            event.accepted = false;
+            return event;
+        }
+
+        event.duplicate = false;
+        touch(st);
+        if(!repair_group(st, rg))
+        {
+            if(make_room(st.peer, rg.parity.size(), msg_id))
+            {
+                account(st, static_cast<ptrdiff_t>(rg.parity.size()));
+                st.repairs.push_back(move(rg));
+            }
+            else
+                rejected_++;
+            event.accepted = false;
+            return event;
+        }
+
+        advance_prefix(msg_id, st, event);
+        event.accepted = true;
+        return event;
+    }
+
+    void Reassembly::store_chunk(MsgState &st, uint32_t seq, FrameRef &&payload) noexcept
+    {
+        account(st, static_cast<ptrdiff_t>(payload.size()));
+        st.bytes_accum += payload.size();
+        st.chunks[seq] = move(payload);
+        st.received[seq] = 1;
+    }
+
+    void Reassembly::try_repair(MsgState &st, uint32_t seq) noexcept
+    {
+        for(size_t i = 0; i < st.repairs.size(); i++)
+        {
+            const RepairFields &rf = st.repairs[i].fields;
+            if(seq < rf.block_start || seq >= rf.block_start + rf.k)
+                continue;
+            if((seq - rf.block_start) % rf.groups != rf.group)
+                continue;
+
+            RepairGroup rg = move(st.repairs[i]);
+            st.repairs.erase(st.repairs.begin() + i);
+            if(!repair_group(st, rg))
+                st.repairs.push_back(move(rg));
+            else
+                account(st, -static_cast<ptrdiff_t>(rg.parity.size()));
+            return;
+        }
+    }
+
+    // true once the group is fully covered, either already or by rebuilding its single missing frame
+    bool Reassembly::repair_group(MsgState &st, const RepairGroup &rg) noexcept
+    {
+        const RepairFields &rf = rg.fields;
+        const uint32_t block_end = min<uint32_t>(rf.block_start + rf.k, st.total);
+
+        int64_t missing = -1;
+        uint16_t len = rf.len_xor;
+        for(uint32_t seq = rf.block_start + rf.group; seq < block_end; seq += rf.groups)
+        {
+            if(st.received[seq] == 1)
+            {
+                len ^= static_cast<uint16_t>(st.chunks[seq].size());
+                continue;
+            }
+            if(missing >= 0)
+                return false;
+            missing = seq;
+        }
+
+        if(missing < 0)
+            return true;
+        if(len > rg.parity.size())
+            return true;
+
+        FrameRef rebuilt = FrameRef::copy_of(rg.parity.data(), len);
+        if(len > 0 && rebuilt.empty())
+            return false;
+        for(uint32_t seq = rf.block_start + rf.group; seq < block_end; seq += rf.groups)
+        {
+            if(seq == static_cast<uint32_t>(missing))
+                continue;
+            const FrameRef &chunk = st.chunks[seq];
+            size_t n = min(chunk.size(), rebuilt.size());
+            for(size_t i = 0; i < n; i++)
+                rebuilt.data()[i] ^= chunk.data()[i];
+        }
+
+        store_chunk(st, static_cast<uint32_t>(missing), move(rebuilt));
+        return true;
+    }
+
+    void Reassembly::advance_prefix(uint32_t msg_id, MsgState &st, RxChunkEvent &event) noexcept
+    {
+        int current_prefix = st.prefix;
+        while(st.prefix + 1 < static_cast<int>(st.total) && st.received[st.prefix + 1] == 1)
+        {
+            st.prefix++;
+        }
+
+        // the last frame of a digest message is ACKed by digest_checked, once it is known good
+        const int acked = has_digest(msg_id) && st.prefix + 1 == static_cast<int>(st.total) ? st.prefix - 1 : st.prefix;
+        if(current_prefix != st.prefix)
+        {
+            event.highest_seq_ok = static_cast<uint32_t>(st.prefix);
+            if(acked > current_prefix)
+            {
+                AckFields ack = {.msg_id = msg_id, .highest_seq_ok = static_cast<uint32_t>(acked)};
+                emit_ack_(ack);
+            }
         }
         else    
         {
@@ -126,9 +365,82 @@ namespace linkchat
                 event.highest_seq_ok = static_cast<uint32_t>(current_prefix);
         }
         
-        event.completed = (msgs_[msg_id].prefix == static_cast<int>(h.total) - 1);
-        event.accepted = true;
-        return event;
+        event.completed = (st.prefix == static_cast<int>(st.total) - 1);
+        event.streamed = st.streamed;
+        if(st.streamed && current_prefix != st.prefix)
+            stream_prefix(msg_id, st, event); // last: a completed message is released
+    }
+
+    // hands out what the prefix added. A digest's bytes sit at the end of the last frames, so
+    // kDigestSize bytes are always held back and checked once the whole message is in
+    void Reassembly::stream_prefix(uint32_t msg_id, MsgState &st, RxChunkEvent &event) noexcept
+    {
+        const bool digest = has_digest(msg_id);
+        const size_t hold = digest ? kDigestSize : 0;
+        const uint32_t end = static_cast<uint32_t>(st.prefix + 1);
+
+        size_t avail = 0;
+        for(uint32_t seq = st.stream_seq; seq < end; seq++)
+            avail += st.chunks[seq].size();
+        avail -= st.stream_off;
+
+        size_t give = avail > hold ? avail - hold : 0;
+        while(give > 0)
+        {
+            const FrameRef &chunk = st.chunks[st.stream_seq];
+            const size_t n = min(give, chunk.size() - st.stream_off);
+            if(n > 0)
+            {
+                span<const uint8_t> piece(chunk.data() + st.stream_off, n);
+                if(digest)
+                    st.hash.update(piece.data(), piece.size());
+                stream_.on_data(msg_id, st.stream_bytes, chunk, piece);
+            }
+            st.stream_bytes += n;
+            st.stream_off += n;
+            give -= n;
+            if(st.stream_off == chunk.size())
+            {
+                st.stream_seq++;
+                st.stream_off = 0;
+            }
+        }
+        while(st.stream_seq < end && st.chunks[st.stream_seq].size() == 0)
+            st.stream_seq++;
+
+        while(st.kept_from < st.stream_seq && st.kept_from + kFecBlockMax <= end)
+        {
+            FrameRef &chunk = st.chunks[st.kept_from++];
+            account(st, -static_cast<ptrdiff_t>(chunk.size()));
+            chunk = FrameRef{};
+        }
+
+        if(end != st.total)
+            return;
+
+        bool ok = true;
+        if(digest)
+        {
+            // what is left is exactly the digest, maybe split over the last frames
+            uint8_t trailer[kDigestSize];
+            size_t got = 0;
+            for(uint32_t seq = st.stream_seq; seq < end; seq++)
+            {
+                const FrameRef &chunk = st.chunks[seq];
+                const size_t from = seq == st.stream_seq ? st.stream_off : 0;
+                const size_t n = min(chunk.size() - from, kDigestSize - got);
+                memcpy(trailer + got, chunk.data() + from, n);
+                got += n;
+            }
+            ok = got == kDigestSize && BE_to_uint64(trailer, 0) == st.hash.digest();
+            event.digest_failed = !ok;
+        }
+        stream_.on_complete(msg_id, st.stream_bytes, ok);
+        if(digest)
+            digest_checked(msg_id, st.total, ok);
+        else
+            remember_done(msg_id, st.total);
+        release(msg_id);
     }
 
     bool Reassembly::is_complete(uint32_t msg_id) const noexcept
@@ -137,17 +449,17 @@ namespace linkchat
         if(ptr == msgs_.end()) 
             return false;
 
-        MsgState msg_state = ptr->second; 
+        const MsgState &msg_state = ptr->second;
         return (static_cast<uint32_t>(msg_state.prefix + 1) == msg_state.total);
     }
 
-    bool Reassembly::extract_message(uint32_t msg_id, vector<uint8_t> &out) noexcept
+    bool Reassembly::extract_message(uint32_t msg_id, vector<uint8_t> &out, uint64_t *first_us) noexcept
     {
         if(!is_complete(msg_id))
             return false;
         
         size_t total_bytes = 0;
-        for (uint8_t chunk = 0; chunk < msgs_[msg_id].total; chunk++)
+        for (uint32_t chunk = 0; chunk < msgs_[msg_id].total; chunk++)
         {
             total_bytes += msgs_[msg_id].chunks[chunk].size();
         }
@@ -162,17 +474,268 @@ namespace linkchat
         
         for (uint32_t i = 0; i < msgs_[msg_id].total; i++)
         {
-            vector<uint8_t> byte = msgs_[msg_id].chunks[i];
+            FrameRef &byte = msgs_[msg_id].chunks[i];
             out.insert(out.end(), byte.begin(), byte.end());
+            byte = FrameRef{};
+        }
+
+        if(first_us)
+            *first_us = msgs_[msg_id].first_us;
+        const uint32_t total = msgs_[msg_id].total;
+        release(msg_id);
+
+        if(!has_digest(msg_id))
+        {
+            remember_done(msg_id, total);
+            return true;
+        }
+
+        // every frame passed its CRC (or the link FCS); this catches what slips between them
+        const size_t body = out.size() - min(out.size(), kDigestSize);
+        const bool ok = out.size() >= kDigestSize &&
+                        BE_to_uint64(out.data(), static_cast<int>(body)) == xxh64(out.data(), body);
+        digest_checked(msg_id, total, ok);
+        if(!ok)
+        {
+            out.clear();
+            return false;
         }
+        out.resize(body);
+        return true;
+    }
+
+    Reassembly::MsgState *Reassembly::create_state(uint32_t msg_id, Type type, uint32_t total, uint64_t peer, size_t frame_bytes) noexcept
+    {
+        // a corrupt or hostile total must not turn into a huge allocation
+        const size_t slots = static_cast<size_t>(total) * kSlotBytes;
+        const size_t cap = min(cfg_.peer_cap_bytes, cfg_.mem_cap_bytes);
+        if(slots > cap)
+        {
+            rejected_++;
+            refuse(msg_id, RejectReason::TooLarge);
+            return nullptr;
+        }
+
+        // decided before the size check: a streamed message never holds all of its bytes
+        const bool streamed = stream_.want && stream_.on_data && stream_.want(msg_id, type, total, peer);
+        if(!streamed && slots + static_cast<size_t>(total) * frame_bytes > cap)
+        {
+            rejected_++;
+            refuse(msg_id, RejectReason::TooLarge);
+            return nullptr;
+        }
+        if(!make_room(peer, slots, msg_id))
+        {
+            rejected_++;
+            if(streamed)
+                stream_.on_complete(msg_id, 0, false);
+            return nullptr;
+        }
+
+        MsgState &st = msgs_[msg_id];
+        st.type = type;
+        st.total = total;
+        st.chunks.resize(total);
+        st.received.resize(total, 0);
+        st.prefix = -1;
+        st.bytes_accum = 0;
+        st.peer = peer;
+        st.mem = 0;
+        lru_.push_front(msg_id);
+        st.lru = lru_.begin();
+        st.last_ms = cfg_.now();
+        st.first_us = steady_micros();
+        st.streamed = streamed;
+        st.stream_seq = 0;
+        st.stream_off = 0;
+        st.stream_bytes = 0;
+        st.kept_from = 0;
+        st.hash.reset();
+        account(st, static_cast<ptrdiff_t>(slots));
+        return &st;
+    }
+
+    void Reassembly::account(MsgState &st, ptrdiff_t bytes) noexcept
+    {
+        st.mem += bytes;
+        bytes_held_ += bytes;
+        size_t &held = peer_bytes_[st.peer];
+        held += bytes;
+        if(held == 0)
+            peer_bytes_.erase(st.peer);
+    }
+
+    void Reassembly::touch(MsgState &st) noexcept
+    {
+        lru_.splice(lru_.begin(), lru_, st.lru);
+        st.last_ms = cfg_.now();
+    }
+
+    void Reassembly::release(uint32_t msg_id) noexcept
+    {
+        auto it = msgs_.find(msg_id);
+        if(it == msgs_.end())
+            return;
+        account(it->second, -static_cast<ptrdiff_t>(it->second.mem));
+        lru_.erase(it->second.lru);
+        msgs_.erase(it);
+    }
+
+    // a partial message dropped before completion; a stream learns it ended badly
+    void Reassembly::evict(uint32_t msg_id) noexcept
+    {
+        auto it = msgs_.find(msg_id);
+        if(it == msgs_.end())
+            return;
+        if(it->second.streamed)
+            stream_.on_complete(msg_id, it->second.stream_bytes, false);
+        release(msg_id);
+    }
+
+    // evicts the least recently active partial messages (never `keep`) until `bytes` more fit
+    bool Reassembly::make_room(uint64_t peer, size_t bytes, uint32_t keep) noexcept
+    {
+        auto peer_held = [&]() -> size_t
+        {
+            auto it = peer_bytes_.find(peer);
+            return it == peer_bytes_.end() ? 0 : it->second;
+        };
 
-        msgs_.erase(msg_id);
+        while(peer_held() + bytes > cfg_.peer_cap_bytes || bytes_held_ + bytes > cfg_.mem_cap_bytes)
+        {
+            const bool peer_full = peer_held() + bytes > cfg_.peer_cap_bytes;
+            bool evicted = false;
+            for(auto it = lru_.rbegin(); it != lru_.rend(); ++it)
+            {
+                uint32_t victim = *it;
+                if(victim == keep || (peer_full && msgs_[victim].peer != peer))
+                    continue;
+                evict(victim);
+                evicted_pressure_++;
+                evicted = true;
+                break;
+            }
+            if(!evicted)
+                return false;
+        }
         return true;
     }
 
+    void Reassembly::on_tick() noexcept
+    {
+        const uint64_t now = cfg_.now();
+        while(!lru_.empty())
+        {
+            uint32_t oldest = lru_.back();
+            if(now - msgs_[oldest].last_ms < cfg_.idle_timeout_ms)
+                break;
+            evict(oldest);
+            evicted_idle_++;
+        }
+    }
+
+    ReassemblyStats Reassembly::stats() const noexcept
+    {
+        ReassemblyStats st{};
+        st.bytes_held = bytes_held_;
+        st.msgs_held = msgs_.size();
+        st.evicted_idle = evicted_idle_;
+        st.evicted_pressure = evicted_pressure_;
+        st.rejected = rejected_;
+        st.refused = refused_msgs_;
+        st.digest_failed = digest_failed_;
+        return st;
+    }
+
+    bool Reassembly::missing_ranges(uint32_t msg_id, vector<NakRange> &out, size_t max_ranges) const noexcept
+    {
+        out.clear();
+        auto it = msgs_.find(msg_id);
+        if(it == msgs_.end())
+            return false;
+
+        const MsgState &st = it->second;
+        int64_t highest = static_cast<int64_t>(st.total) - 1;
+        while(highest >= 0 && st.received[highest] == 0)
+            highest--;
+
+        for(int64_t seq = st.prefix + 1; seq < highest && out.size() < max_ranges; seq++)
+        {
+            if(st.received[seq] == 1)
+                continue;
+            NakRange r{static_cast<uint32_t>(seq), static_cast<uint32_t>(seq)};
+            while(r.to + 1 < highest && st.received[r.to + 1] == 0)
+                r.to++;
+            out.push_back(r);
+            seq = r.to;
+        }
+        return !out.empty();
+    }
+
+    void Reassembly::remember_done(uint32_t msg_id, uint32_t total) noexcept
+    {
+        if(done_.find(msg_id) == done_.end())
+            done_order_.push_back(msg_id);
+        done_[msg_id] = total;
+
+        while(done_order_.size() > kDoneHistory)
+        {
+            done_.erase(done_order_.front());
+            done_order_.pop_front();
+        }
+    }
+
+    void Reassembly::remember_refused(uint32_t msg_id, RejectReason reason) noexcept
+    {
+        if(refused_.find(msg_id) == refused_.end())
+            refused_order_.push_back(msg_id);
+        refused_[msg_id] = Refusal{reason, cfg_.now()};
+        while(refused_order_.size() > kDoneHistory)
+        {
+            refused_.erase(refused_order_.front());
+            refused_order_.pop_front();
+        }
+    }
+
+    // the message is gone for good: its frames are dropped from now on, and the sender is told
+    void Reassembly::refuse(uint32_t msg_id, RejectReason reason) noexcept
+    {
+        refused_msgs_++;
+        remember_refused(msg_id, reason);
+        emit_reject_(RejectFields{msg_id, reason});
+    }
+
+    // a digest message is complete and released: ACK its last frame, or have it sent again
+    void Reassembly::digest_checked(uint32_t msg_id, uint32_t total, bool ok) noexcept
+    {
+        if(!ok)
+        {
+            digest_failed_++;
+            if(emit_reject_(RejectFields{msg_id, RejectReason::Resend}))
+            {
+                remember_refused(msg_id, RejectReason::Resend);
+                return;
+            }
+        }
+        // an older sender cannot resend it: as before, it learns the message arrived
+        AckFields ack = {.msg_id = msg_id, .highest_seq_ok = total - 1};
+        emit_ack_(ack);
+        remember_done(msg_id, total);
+    }
+
     void Reassembly::clear() noexcept
     {
+        for(auto &[msg_id, st] : msgs_)
+            if(st.streamed)
+                stream_.on_complete(msg_id, st.stream_bytes, false);
         msgs_.clear();
+        done_.clear();
+        done_order_.clear();
+        refused_.clear();
+        refused_order_.clear();
+        lru_.clear();
+        peer_bytes_.clear();
+        bytes_held_ = 0;
     }
 
 }
\ No newline at end of file
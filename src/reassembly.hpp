@@ -3,10 +3,16 @@
 #include <cstddef>
 #include <vector>
 #include <unordered_map>
+#include <deque>
+#include <list>
 #include <functional>
+#include <span>
 #include "header.hpp"
 #include "pdu.hpp"
+#include "fec.hpp"
 #include "util/structs.hpp"
+#include "util/frame_pool.hpp"
+#include "util/hash.hpp"
 
 namespace linkchat
 {
@@ -22,35 +28,169 @@ namespace linkchat
         bool duplicate;               
         bool completed;               
         std::uint32_t highest_seq_ok; 
+        bool bad_crc;                 // refused: payload CRC mismatch
+        bool streamed;                // handed out through StreamCallbacks, there is nothing to extract
+        bool digest_failed;           // a streamed message completed, but its digest did not match
     };
 
     using EmitAckFn = std::function<void(const AckFields &)>;
 
+    // tells the sender a message was refused; false when it cannot (an older peer, a multicast
+    // group), and the refusal stays silent
+    using EmitRejectFn = std::function<bool(const RejectFields &)>;
+
+    // Receive memory is charged per partial message: one slot per announced frame plus the
+    // payload and parity bytes stored. A message that would push a peer or the whole node past
+    // its cap first evicts the least recently active partial messages; one that can never fit is
+    // refused (RejectReason::TooLarge) before anything is allocated for it, or as soon as it
+    // outgrows the cap when its first frames did not tell its size. Streamed messages are not
+    // held whole, so their size is not limited.
+    struct ReassemblyConfig
+    {
+        std::size_t mem_cap_bytes = std::size_t(256) << 20;  // all partial messages together
+        std::size_t peer_cap_bytes = std::size_t(64) << 20;  // partial messages from one peer
+        std::uint32_t idle_timeout_ms = 30000;               // partial message dropped after this long without a new frame
+        std::function<std::uint64_t(void)> now;
+    };
+
+    // Progressive delivery. A message want() picks (when its first frame arrives) is handed to
+    // on_data in order, a piece each time its contiguous prefix grows, and closed by one
+    // on_complete. ok = false when its digest did not match or it was evicted: what on_data
+    // gave out must be thrown away. A digest's own bytes are never handed out. Such a message
+    // never reaches extract_message, and its frames are let go once no FEC block can need them.
+    // data lies inside frame: keeping a copy of the handle keeps the bytes, nothing is copied.
+    using StreamWantFn = std::function<bool(std::uint32_t msg_id, Type type, std::uint32_t total, std::uint64_t peer)>;
+    using StreamDataFn = std::function<void(std::uint32_t msg_id, std::uint64_t offset, const FrameRef &frame,
+                                            std::span<const std::uint8_t> data)>;
+    using StreamDoneFn = std::function<void(std::uint32_t msg_id, std::uint64_t bytes, bool ok)>;
+
+    struct StreamCallbacks
+    {
+        StreamWantFn want;         // unset = nothing is streamed
+        StreamDataFn on_data;
+        StreamDoneFn on_complete;
+    };
+
+    struct ReassemblyStats
+    {
+        std::size_t bytes_held;
+        std::size_t msgs_held;
+        std::uint64_t evicted_idle;
+        std::uint64_t evicted_pressure;
+        std::uint64_t rejected;       // frames refused because their message could not be made to fit
+        std::uint64_t refused;        // messages refused as a whole (REJECT), too large to ever fit
+        std::uint64_t digest_failed;  // complete messages dropped because their digest did not match (and asked again)
+    };
+
     class Reassembly
     {
     public:
-        explicit Reassembly(EmitAckFn emit_ack);
+        explicit Reassembly(EmitAckFn emit_ack, ReassemblyConfig cfg = {});
+
+        // the callbacks run inside feed_pdu (and on_tick for evictions); messages already
+        // partly received keep the mode they started with
+        void set_stream(StreamCallbacks cb) noexcept;
+
+        // runs inside feed_pdu, like the ACK callback
+        void set_on_reject(EmitRejectFn fn) noexcept;
        
-        RxChunkEvent feed_pdu(const std::uint8_t *pdu, std::size_t pdu_size) noexcept;
+        // peer: key of the sending station (mac_to_u64), used for the per-peer memory cap.
+        // The CRC is the view's: one the caller already checked (or assumed) is not computed again
+        RxChunkEvent feed_pdu(const PduView &pdu, std::uint64_t peer = 0) noexcept;
+
+        // drops partial messages idle past the timeout
+        void on_tick() noexcept;
+
+        ReassemblyStats stats() const noexcept;
 
         bool is_complete(std::uint32_t msg_id) const noexcept;
 
-        bool extract_message(std::uint32_t msg_id, std::vector<std::uint8_t> &out) noexcept;
+        // a message with kDigestIdBit comes out without its digest, or not at all when it does not
+        // match. Its last frame is only ACKed once the digest checks out; on a mismatch the sender
+        // is asked to send it all again (RejectReason::Resend), and one that cannot be asked gets
+        // the ACK and the message is lost. first_us gets the steady_micros() of the message's first frame
+        bool extract_message(std::uint32_t msg_id, std::vector<std::uint8_t> &out, std::uint64_t *first_us = nullptr) noexcept;
+
+        // gaps below the highest seq received so far (multicast NAKs), at most max_ranges of them
+        bool missing_ranges(std::uint32_t msg_id, std::vector<NakRange> &out, std::size_t max_ranges) const noexcept;
 
         void clear() noexcept;
 
     private:
+        struct RepairGroup
+        {
+            RepairFields fields;
+            FrameRef parity;
+        };
+
         struct MsgState
         {
             Type type;
             std::uint32_t total;                           
-            std::vector<std::vector<std::uint8_t>> chunks; 
+            std::vector<FrameRef> chunks;                  // payloads, in pooled frames
             std::vector<std::uint8_t> received;            
             std::int32_t prefix;                           
             std::size_t bytes_accum;                       
+            std::vector<RepairGroup> repairs;              // parity groups still waiting for a loss
+            std::uint64_t peer;
+            std::size_t mem;                               // bytes charged to this message
+            std::uint64_t last_ms;
+            std::uint64_t first_us;                        // first frame, for the delivery latency
+            std::list<std::uint32_t>::iterator lru;
+            bool streamed;                                 // goes out through stream_ as the prefix grows
+            std::uint32_t stream_seq;                      // next chunk to hand out (maybe partly)
+            std::size_t stream_off;                        // bytes of it already handed out
+            std::uint64_t stream_bytes;                    // handed out so far: the next offset
+            std::uint32_t kept_from;                       // first handed-out chunk still held for FEC
+            Xxh64State hash;                               // of what was handed out, for the digest
         };
 
+        void store_chunk(MsgState &st, std::uint32_t seq, FrameRef &&payload) noexcept;
+        void try_repair(MsgState &st, std::uint32_t seq) noexcept;
+        bool repair_group(MsgState &st, const RepairGroup &rg) noexcept;
+        void advance_prefix(std::uint32_t msg_id, MsgState &st, RxChunkEvent &event) noexcept;
+        RxChunkEvent feed_repair(const Header &h, const std::uint8_t *payload, std::size_t payload_len, RxChunkEvent event, std::uint64_t peer) noexcept;
+
+        void stream_prefix(std::uint32_t msg_id, MsgState &st, RxChunkEvent &event) noexcept;
+        void evict(std::uint32_t msg_id) noexcept;
+
+        void remember_done(std::uint32_t msg_id, std::uint32_t total) noexcept;
+        void remember_refused(std::uint32_t msg_id, RejectReason reason) noexcept;
+        void refuse(std::uint32_t msg_id, RejectReason reason) noexcept;
+        void digest_checked(std::uint32_t msg_id, std::uint32_t total, bool ok) noexcept;
+
+        // frame_bytes: payload of a full frame when the frame tells it (0 when not), to size the whole message
+        MsgState *create_state(std::uint32_t msg_id, Type type, std::uint32_t total, std::uint64_t peer, std::size_t frame_bytes) noexcept;
+        void account(MsgState &st, std::ptrdiff_t bytes) noexcept;
+        void release(std::uint32_t msg_id) noexcept;
+        bool make_room(std::uint64_t peer, std::size_t bytes, std::uint32_t keep) noexcept;
+        void touch(MsgState &st) noexcept;
+
         std::unordered_map<std::uint32_t, MsgState> msgs_; 
+        // recently delivered messages (msg_id -> total): late retransmits are re-ACKed, not delivered twice
+        std::unordered_map<std::uint32_t, std::uint32_t> done_;
+        std::deque<std::uint32_t> done_order_;
+        // recently refused messages: their frames are dropped and now and then answered with the
+        // REJECT again, in case it was lost. A Resend one starts over with its first frame
+        struct Refusal
+        {
+            RejectReason reason;
+            std::uint64_t sent_ms;
+        };
+        std::unordered_map<std::uint32_t, Refusal> refused_;
+        std::deque<std::uint32_t> refused_order_;
         EmitAckFn emit_ack_;
+        EmitRejectFn emit_reject_;
+        StreamCallbacks stream_;
+
+        ReassemblyConfig cfg_;
+        std::list<std::uint32_t> lru_;                          // front = most recently active
+        std::unordered_map<std::uint64_t, std::size_t> peer_bytes_;
+        std::size_t bytes_held_{0};
+        std::uint64_t evicted_idle_{0};
+        std::uint64_t evicted_pressure_{0};
+        std::uint64_t rejected_{0};
+        std::uint64_t refused_msgs_{0};
+        std::uint64_t digest_failed_{0};
     };
 }
@@ -1,23 +1,59 @@
 #include "sender.hpp"
+#include "mcast.hpp"
+#include "util/time.hpp"
+#include "util/task_pool.hpp"
+#include "util/hash.hpp"
+#include "util/helpers.hpp"
 #include <algorithm>
 #include <utility>
+#include <random>
+#include <climits>
+#include <atomic>
+#include <memory>
 
 using namespace std;
 
 namespace linkchat {
 
-    Sender::Sender(EmitTxFn emit_tx, SenderConfig cfg)
+    static constexpr uint64_t kInitialRttUs = 1000;  // LAN guess until the first ACK is timed
+    static constexpr uint64_t kPaceSliceUs = 250;    // a message may burst this much of its rate at once
+    static constexpr double kPaceGain = 1.25;        // pace a little above window/RTT so the window, not the pacer, limits
+    static constexpr uint32_t kMaxResends = 3;       // whole-message resends a digest mismatch may ask for
+
+    TxClass tx_class_for(Type type, size_t frames) noexcept
+    {
+        switch(type)
+        {
+            case Type::MSG:
+                return TxClass::Interactive;
+            case Type::XFER:
+                // offers, queries and state replies fit one frame; segments are bulk data
+                return frames <= 1 ? TxClass::Interactive : TxClass::Bulk;
+            case Type::FILE:
+                return TxClass::Bulk;
+            default:
+                return TxClass::Control;
+        }
+    }
+
+    Sender::Sender(EmitFrameFn emit_tx, SenderConfig cfg)
     {
         emit_tx_ = emit_tx;
         if(emit_tx_ == nullptr)
-            emit_tx_ = [](const vector<uint8_t>&){};
+            emit_tx_ = [](const FrameRef&, FrameNote){};
         
         cfg_ = cfg;
         if(cfg_.now == nullptr)
             cfg_.now = [](){ return 0u; };
+        if(cfg_.now_us == nullptr)
+            cfg_.now_us = steady_micros;
     
         if(cfg_.window == 0)
             cfg_.window = 1;
+        // a loss holds the window at the lost frame; the rest of its FEC block must still fit in
+        // it, or the block never finishes going out and its repair frames are never sent
+        if(cfg_.fec.k > 0 && cfg_.window < cfg_.fec.k)
+            cfg_.window = cfg_.fec.k;
     
         if(cfg_.mtu < kHeaderSize + kCrcSize + 1)
             cfg_.mtu = kHeaderSize + kCrcSize + 1;
@@ -25,90 +61,261 @@ namespace linkchat {
         if(cfg_.rto_ms == 0)
             cfg_.rto_ms = 1;
         
-        next_msg_id_ = 1;
+        // random start so a restarted peer does not reuse ids the receiver still remembers
+        random_device rd;
+        next_msg_id_ = rd() | 1u;
     }
 
-    uint32_t Sender::send(const vector<uint8_t>& data, Type type)
+    // Frames are built in blocks of kChunkBlock on the shared pool, outside the lock, and each
+    // block is handed to the window as soon as it and the ones before it exist: the first frame
+    // leaves after one block instead of after the whole message, and ACKs are not held up meanwhile.
+    uint32_t Sender::send(const vector<uint8_t>& data, Type type, SendOptions opt)
     {
-        uint32_t msg_id = next_msg_id_++;
+        // leave room for the repair header so parity frames fit the same MTU
+        uint16_t chunk_mtu = cfg_.mtu;
+        if(cfg_.fec.k > 0 && chunk_mtu > kHeaderSize + kCrcSize + kRepairHdrSize)
+            chunk_mtu = static_cast<uint16_t>(chunk_mtu - kRepairHdrSize);
 
-        vector<vector<uint8_t>> pdus = chunkify_from_vector(data,msg_id,type,cfg_.mtu);
+        // the digest travels as the last bytes of the message, so it lands in the final frame
+        uint8_t digest[kDigestSize];
+        ChunkOptions chunk_opt;
+        if(opt.digest)
+        {
+            uint64_to_BE(xxh64(data.data(), data.size()), digest, 0);
+            chunk_opt.tail = digest;
+            chunk_opt.tail_len = kDigestSize;
+            chunk_opt.crc = opt.frame_crc;
+        }
 
-        if(pdus.empty())
+        const uint32_t total = chunk_count(data.size() + chunk_opt.tail_len, chunk_mtu);
+        if(total == 0)
             return 0;
 
         TxMsg txmsg;
-        txmsg.msg_id = msg_id;
         txmsg.type = type;
-        txmsg.pdus = move(pdus);
+        txmsg.pdus.resize(total);
         txmsg.base = 0;
         txmsg.next = 0;
-        txmsg.sent_at_ms.resize(txmsg.pdus.size(),0);
+        txmsg.sent_at_ms.resize(total,0);
         txmsg.done = false;
+        txmsg.sent_us.resize(total,0);
+        txmsg.cls = tx_class_for(type, total);
+        txmsg.dst = opt.dst;
 
-        msgs_[msg_id] = move(txmsg);
-        auto msg = msgs_.find(msg_id);
-        TxMsg& msg_st = msg->second;
-
-        uint32_t window_limit = min(cfg_.window, static_cast<uint32_t>(msg_st.pdus.size()));
-        vector<vector<uint8_t>> to_send;
-        to_send.reserve(window_limit);
-        for(uint32_t i = 0; i < window_limit; i++)
+        uint32_t msg_id;
+        TxMsg *msg;
         {
-            to_send.push_back(msg_st.pdus[i]);
-            msg_st.sent_at_ms[i] = cfg_.now();
+            lock_guard<mutex> lk(mu_);
+            msg_id = (next_msg_id_++) & ~(kMcastIdBit | kDigestIdBit);
+            if(msg_id == 0)
+                msg_id = (next_msg_id_++) & ~(kMcastIdBit | kDigestIdBit);
+            if(opt.digest)
+                msg_id |= kDigestIdBit;
+            txmsg.msg_id = msg_id;
+            txmsg.pace.last_us = cfg_.now_us();
+            txmsg.queued_us = txmsg.pace.last_us;
+            txmsg.pace.tokens = max<double>(2.0 * cfg_.mtu, pace_rate() * kPaceSliceUs / 1e6);
+            // not schedulable until built > 0; map nodes stay put, so the pointer is safe
+            // until the message is done, and on_ack cannot finish it before every frame exists
+            msg = &(msgs_[msg_id] = move(txmsg));
         }
-        msg_st.next = window_limit;
 
-        for(uint32_t i = 0; i < to_send.size(); i++)
+        const uint32_t nblocks = (total + kChunkBlock - 1) / kChunkBlock;
+        unique_ptr<atomic<uint8_t>[]> ready(new atomic<uint8_t>[nblocks]); // 0 = pending, 1 = built, 2 = failed
+        for(uint32_t b = 0; b < nblocks; b++)
+            ready[b].store(0, memory_order_relaxed);
+        FrameRef *out = msg->pdus.data();
+        auto build = [&, out, msg_id](uint32_t b)
+        {
+            const uint32_t from = b * kChunkBlock;
+            const uint32_t to = min(total, from + kChunkBlock);
+            const bool ok = chunk_range(data.data(), data.size(), msg_id, type, chunk_mtu, from, to, out, chunk_opt);
+            ready[b].store(ok ? 1 : 2, memory_order_release);
+        };
+
+        TaskPool &pool = shared_pool();
+        TaskGroup group;
+        for(uint32_t b = 1; b < nblocks; b++)
+            pool.submit(group, [&build, b]{ build(b); });
+        build(0);
+
+        // with no workers the caller builds every block itself; handing them out one by one
+        // would only make it share the core with the transfer it started, so it hands out all at once
+        const bool stream = pool.workers() > 0;
+        bool failed = false;
+        for(uint32_t b = 0; b < nblocks && !failed; b++)
         {
-            emit_tx_(to_send[i]);
+            pool.help_until([&]{ return ready[b].load(memory_order_acquire) != 0; });
+            if(ready[b].load(memory_order_acquire) == 2)
+            {
+                failed = true;
+                break;
+            }
+            if(!stream && b + 1 < nblocks)
+                continue;
+            lock_guard<mutex> lk(mu_);
+            msg->built = min(total, (b + 1) * kChunkBlock);
+            activate(*msg);
+            pump();
         }
+        pool.wait(group);
 
+        if(failed)
+        {
+            // out of frame buffers: whatever went out is abandoned like a message that never got ACKed
+            lock_guard<mutex> lk(mu_);
+            uncommit(*msg, static_cast<uint32_t>(msg->pdus.size()) - msg->base);
+            msgs_.erase(msg_id);
+            return 0;
+        }
+        {
+            // refused while its frames were still being built: on_reject left it to us
+            lock_guard<mutex> lk(mu_);
+            auto it = msgs_.find(msg_id);
+            if(it != msgs_.end() && it->second.refused)
+            {
+                uncommit(it->second, static_cast<uint32_t>(it->second.pdus.size()) - it->second.base);
+                msgs_.erase(it);
+            }
+        }
         return msg_id;
     }
 
-    void Sender::on_ack(const AckFields& ack)noexcept
+    void Sender::seed_rtt_us(uint64_t us) noexcept
     {
+        lock_guard<mutex> lk(mu_);
+        if (srtt_us_ == 0)
+            srtt_us_ = max<uint64_t>(us, 1);
+    }
+
+    void Sender::on_ack(const AckFields& ack, uint64_t from)noexcept
+    {
+        lock_guard<mutex> lk(mu_);
         auto msg_id = ack.msg_id;
+        // the window is the receiver's, not the message's: a window update may name a message
+        // that is already done here, or repeat an ACK we had
+        const bool window_update = ack.rwnd != kNoRwnd;
+        if(window_update)
+        {
+            auto [rw, fresh] = rwnd_.try_emplace(from);
+            rw->second.frames = static_cast<uint32_t>(ack.rwnd / max<size_t>(1, mtu_payload(cfg_.mtu)));
+            // the first window from a receiver: count what is already going out to it
+            if(fresh)
+            {
+                for(const auto &[id, msg] : msgs_)
+                {
+                    if(msg.sent_hw > 0 && msg.dst == from)
+                        rw->second.committed += static_cast<uint32_t>(msg.pdus.size()) - msg.base;
+                }
+            }
+        }
+
         if(msgs_.find(msg_id) == msgs_.end())
+        {
+            if(window_update)
+                pump();
             return;
+        }
     
         TxMsg& msg_st = msgs_[msg_id];
         
         if(msg_st.done)
             return;
+        stats_.acks++;
 
-        if(msg_st.pdus.empty())
+        // only frames that exist can have been received: the pool may still be writing the rest,
+        // and an ACK past them (forged, or for an old message with the same id) must not finish
+        // the message and free them under the builders
+        if(msg_st.built == 0)
+        {
+            if(window_update)
+                pump();
             return;
+        }
         
-        uint32_t max_index = static_cast<uint32_t>(msg_st.pdus.size()) - 1;
+        uint32_t max_index = msg_st.built - 1;
 
         uint32_t index = min(ack.highest_seq_ok, max_index);
 
         if(index + 1 <= msg_st.base)
+        {
+            if(window_update)
+                pump();
             return;
+        }
 
+        // Karn: only frames sent exactly once give an RTT sample
+        if(msg_st.sent_us[index] != 0)
+        {
+            uint64_t sample = cfg_.now_us() - msg_st.sent_us[index];
+            srtt_us_ = srtt_us_ == 0 ? sample : (7 * srtt_us_ + sample) / 8;
+            srtt_us_ = max<uint64_t>(srtt_us_, 1);
+            if(on_latency_)
+                on_latency_(LatencyMetric::AckRtt, msg_st.type, sample);
+        }
+
+        uncommit(msg_st, index + 1 - msg_st.base);
         msg_st.base = index + 1;
 
         if(msg_st.base>=msg_st.pdus.size())
         {
             msg_st.done = true; 
+            if(on_latency_)
+                on_latency_(LatencyMetric::Acked, msg_st.type, cfg_.now_us() - msg_st.queued_us);
             msgs_.erase(msg_id);
+            pump();
+            return;
+        }
+
+        // an ACK can overtake a go-back-N rewind still waiting in the queue
+        if(msg_st.next < msg_st.base)
+            msg_st.next = msg_st.base;
+
+        activate(msg_st);
+        pump();
+    }
+
+    void Sender::on_reject(const RejectFields& reject)noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+        auto it = msgs_.find(reject.msg_id);
+        if(it == msgs_.end() || it->second.done || it->second.refused)
+            return;
+        TxMsg &msg = it->second;
+
+        // a Resend repeated while the message is already going out again is stale
+        if(reject.reason == RejectReason::Resend && msg.next < msg.pdus.size())
+            return;
+        if(reject.reason == RejectReason::Resend && msg.resends < kMaxResends)
+        {
+            // the receiver dropped it all: start over, it ACKs from the first frame again
+            msg.resends++;
+            commit(msg, msg.base);
+            msg.base = 0;
+            msg.next = 0;
+            msg.fec_block = 0;
+            fill(msg.sent_at_ms.begin(), msg.sent_at_ms.end(), 0);
+            fill(msg.sent_us.begin(), msg.sent_us.end(), 0);
+            activate(msg);
+            pump();
             return;
         }
 
-        while(msg_st.next < msg_st.pdus.size() && msg_st.next < msg_st.base + cfg_.window)
+        if(on_refused_)
+            on_refused_(msg.msg_id, msg.type, reject.reason);
+        // the builders may still be writing its frames; send() erases it when they are done
+        msg.refused = true;
+        if(msg.built == msg.pdus.size())
         {
-            emit_tx_(msg_st.pdus[msg_st.next]);
-            msg_st.sent_at_ms[msg_st.next] = cfg_.now();
-            msg_st.next++;
+            uncommit(msg, static_cast<uint32_t>(msg.pdus.size()) - msg.base);
+            msgs_.erase(it);
         }
-    
+        pump();
     }
 
     void Sender::on_tick()noexcept
     {
+        lock_guard<mutex> lk(mu_);
         auto now = cfg_.now();
         vector<uint32_t> to_erase;
         for(auto& [msg_id,msg_st] : msgs_)
@@ -129,25 +336,274 @@ namespace linkchat {
             if(now - msg_st.sent_at_ms[curr_ind] < cfg_.rto_ms)
                 continue;
             
+            // go-back-N: rewind, the scheduler resends base..next in its turn
             for(uint32_t j = msg_st.base;j<msg_st.next;j++)
-            {
-                emit_tx_(msg_st.pdus[j]);
-                msg_st.sent_at_ms[j] = now;
-            }
+                sample_loss(true);
+            msg_st.next = msg_st.base;
+            activate(msg_st);
         }
         for(size_t i = 0;i<to_erase.size();i++)
         {
             msgs_.erase(to_erase[i]);
         }
+        pump();
+    }
+
+    bool Sender::can_send(const TxMsg &msg) const noexcept
+    {
+        return !msg.done && !msg.refused && msg.next < msg.built && msg.next < msg.base + cfg_.window;
+    }
+
+    // only receivers that advertise a window are counted; the rest are never held back
+    void Sender::commit(const TxMsg &msg, uint32_t frames) noexcept
+    {
+        if(msg.sent_hw == 0 || frames == 0)
+            return;
+        auto rw = rwnd_.find(msg.dst);
+        if(rw != rwnd_.end())
+            rw->second.committed += frames;
+    }
+
+    void Sender::uncommit(const TxMsg &msg, uint32_t frames) noexcept
+    {
+        if(msg.sent_hw == 0 || frames == 0)
+            return;
+        auto rw = rwnd_.find(msg.dst);
+        if(rw != rwnd_.end())
+            rw->second.committed -= min(rw->second.committed, frames);
+    }
+
+    // The receiver's window is room in its delivery queue, which takes whole messages, so it
+    // gates when a message may start; once started it runs on its own window. A message bigger
+    // than the window still starts when nothing else is committed, and a closed window lets one
+    // start per RTO in case the receiver's window update was lost. Each receiver has its own
+    // window, filled only by the messages going to it.
+    bool Sender::rwnd_open(const TxMsg &msg) const noexcept
+    {
+        if(msg.sent_hw > 0)
+            return true;
+        auto rw = rwnd_.find(msg.dst);
+        if(rw == rwnd_.end())
+            return true;
+        const uint32_t window = rw->second.frames;
+        const uint32_t used = rw->second.committed;
+        const uint32_t frames = static_cast<uint32_t>(msg.pdus.size());
+        if(used == 0)
+            return window > 0 || cfg_.now() - rw->second.probe_ms >= cfg_.rto_ms;
+        return window > used && frames <= window - used;
+    }
+
+    void IdRing::push_back(uint32_t id)
+    {
+        if(count_ == buf_.size())
+        {
+            vector<uint32_t> grown(max<size_t>(8, 2 * buf_.size()));
+            for(size_t i = 0; i < count_; i++)
+                grown[i] = (*this)[i];
+            buf_ = move(grown);
+            head_ = 0;
+        }
+        buf_[(head_ + count_) & (buf_.size() - 1)] = id;
+        count_++;
+    }
+
+    void Sender::activate(TxMsg &msg) noexcept
+    {
+        if(msg.queued || !can_send(msg))
+            return;
+        msg.queued = true;
+        active_[static_cast<size_t>(msg.cls)].push_back(msg.msg_id);
+    }
+
+    void TokenBucket::refill(double rate, double depth, uint64_t now_us) noexcept
+    {
+        if(now_us > last_us)
+            tokens = min(depth, tokens + rate * static_cast<double>(now_us - last_us) / 1e6);
+        last_us = now_us;
+    }
+
+    uint64_t TokenBucket::wait_us(double rate, double want, uint64_t now_us) const noexcept
+    {
+        double have = tokens + rate * static_cast<double>(now_us - min(now_us, last_us)) / 1e6;
+        if(have >= want)
+            return 0;
+        return static_cast<uint64_t>((want - have) * 1e6 / rate) + 1;
+    }
+
+    // bytes/s one message may send: its window per smoothed RTT
+    double Sender::pace_rate() const noexcept
+    {
+        const uint64_t rtt = srtt_us_ == 0 ? kInitialRttUs : srtt_us_;
+        return kPaceGain * cfg_.window * cfg_.mtu * 1e6 / static_cast<double>(rtt);
+    }
+
+    static double pace_depth(double rate, uint16_t mtu) noexcept
+    {
+        return max<double>(2.0 * mtu, rate * kPaceSliceUs / 1e6);
+    }
+
+    bool Sender::pace_ready(const TxMsg &msg) const noexcept
+    {
+        if(!msg.pace.ready())
+            return false;
+        return msg.cls != TxClass::Bulk || cfg_.rate_cap == 0 || bulk_cap_.ready();
+    }
+
+    // Hands window-allowed frames to the link: higher classes first, and within a class one
+    // quantum (an MTU's worth of bytes) per message per round, so concurrent transfers share
+    // the link evenly and a short message never waits for a bulk window to drain. Each message
+    // is also paced by its token bucket; one that is out of tokens keeps its place and waits.
+    void Sender::pump() noexcept
+    {
+        uint32_t budget = cfg_.burst == 0 ? UINT32_MAX : cfg_.burst;
+        const uint32_t quantum = cfg_.mtu;
+        const uint64_t now_us = cfg_.now_us();
+        const double rate = pace_rate();
+        const double depth = pace_depth(rate, cfg_.mtu);
+        if(cfg_.rate_cap > 0)
+            bulk_cap_.refill(static_cast<double>(cfg_.rate_cap), pace_depth(static_cast<double>(cfg_.rate_cap), cfg_.mtu), now_us);
+        for(size_t c = 0; c < kTxClasses && budget > 0; c++)
+        {
+            IdRing &q = active_[c];
+            size_t stalled = 0;   // messages in a row that were out of tokens or receive window
+            while(!q.empty() && budget > 0 && stalled < q.size())
+            {
+                uint32_t msg_id = q.front();
+                q.pop_front();
+                auto it = msgs_.find(msg_id);
+                if(it == msgs_.end())
+                    continue;
+
+                TxMsg &msg = it->second;
+                msg.pace.refill(rate, depth, now_us);
+                if(!pace_ready(msg) || !rwnd_open(msg))
+                {
+                    q.push_back(msg_id);
+                    stalled++;
+                    continue;
+                }
+                stalled = 0;
+
+                msg.deficit += quantum;
+                while(budget > 0 && can_send(msg) && pace_ready(msg) && msg.deficit >= msg.pdus[msg.next].size())
+                {
+                    const size_t len = msg.pdus[msg.next].size();
+                    msg.deficit -= static_cast<uint32_t>(len);
+                    msg.pace.tokens -= static_cast<double>(len);
+                    if(msg.cls == TxClass::Bulk)
+                        bulk_cap_.tokens -= static_cast<double>(len);
+                    emit_tx_(msg.pdus[msg.next], msg.next < msg.sent_hw ? FrameNote::Resend : FrameNote::None);
+                    stats_.frames++;
+                    if(msg.next < msg.sent_hw)
+                        stats_.resent++;
+                    msg.sent_at_ms[msg.next] = cfg_.now();
+                    // resends were already counted as losses when the window was rewound
+                    if(msg.next >= msg.sent_hw)
+                    {
+                        if(msg.sent_hw == 0)
+                        {
+                            if(on_latency_)
+                                on_latency_(LatencyMetric::FirstTx, msg.type, now_us - msg.queued_us);
+                            auto rw = rwnd_.find(msg.dst);
+                            if(rw != rwnd_.end())
+                            {
+                                rw->second.committed += static_cast<uint32_t>(msg.pdus.size()) - msg.base;
+                                if(rw->second.frames == 0)
+                                    rw->second.probe_ms = cfg_.now();
+                            }
+                        }
+                        msg.sent_us[msg.next] = now_us;
+                        msg.sent_hw = msg.next + 1;
+                        sample_loss(false);
+                    }
+                    else
+                        msg.sent_us[msg.next] = 0;
+                    msg.next++;
+                    budget--;
+                }
+                emit_repairs(msg);
+
+                if(can_send(msg))
+                    q.push_back(msg_id);
+                else
+                {
+                    msg.queued = false;
+                    msg.deficit = 0;
+                }
+            }
+        }
+    }
+
+    uint64_t Sender::pace_wait_us() const noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+        const uint64_t now_us = cfg_.now_us();
+        const double rate = pace_rate();
+        const double cap = static_cast<double>(cfg_.rate_cap);
+        // wake once half a slice has built up rather than for every frame
+        const double want = max<double>(cfg_.mtu, rate * kPaceSliceUs / 2e6);
+        const double cap_want = max<double>(cfg_.mtu, cap * kPaceSliceUs / 2e6);
+
+        uint64_t wait = UINT64_MAX;
+        for(size_t c = 0; c < kTxClasses; c++)
+        {
+            for(size_t i = 0; i < active_[c].size(); i++)
+            {
+                const uint32_t msg_id = active_[c][i];
+                auto it = msgs_.find(msg_id);
+                // one held back by the receive window waits for an ACK, not the clock
+                if(it == msgs_.end() || !can_send(it->second) || !rwnd_open(it->second))
+                    continue;
+                const TxMsg &msg = it->second;
+                uint64_t w = msg.pace.wait_us(rate, want, now_us);
+                if(msg.cls == TxClass::Bulk && cfg_.rate_cap > 0)
+                    w = max(w, bulk_cap_.wait_us(cap, cap_want, now_us));
+                wait = min(wait, w);
+            }
+        }
+        return wait;
+    }
+
+    void Sender::emit_repairs(TxMsg &msg) noexcept
+    {
+        if(cfg_.fec.k == 0)
+            return;
+
+        // repair frames for a block go out once, right after its last data frame is first sent
+        const uint32_t k = cfg_.fec.k;
+        while(static_cast<uint64_t>(msg.fec_block) * k < msg.pdus.size())
+        {
+            uint32_t block_start = msg.fec_block * k;
+            uint32_t block_end = min<uint32_t>(block_start + k, static_cast<uint32_t>(msg.pdus.size()));
+            if(msg.next < block_end)
+                return;
+
+            uint8_t groups = fec_groups_for_loss(loss_, cfg_.fec);
+            repairs_.clear();
+            build_repair_pdus(msg.pdus, msg.msg_id, msg.type, block_start, cfg_.fec.k, groups, repairs_);
+            for(size_t i = 0; i < repairs_.size(); i++)
+                emit_tx_(repairs_[i], FrameNote::None);
+            stats_.repairs += repairs_.size();
+            repairs_.clear();
+            msg.fec_block++;
+        }
+    }
+
+    void Sender::sample_loss(bool lost) noexcept
+    {
+        const double alpha = 1.0 / 64.0;
+        loss_ += alpha * ((lost ? 1.0 : 0.0) - loss_);
     }
 
     bool Sender::is_done(uint32_t msg_id)const noexcept
     {
+        lock_guard<mutex> lk(mu_);
         return (msgs_.find(msg_id) == msgs_.end());
     }
 
     size_t Sender::in_flight(uint32_t msg_id)const noexcept
     {
+        lock_guard<mutex> lk(mu_);
         if(msgs_.find(msg_id) == msgs_.end())
             return 0;
         else 
@@ -3,51 +3,184 @@
 #include <vector>
 #include <unordered_map>
 #include <functional>
+#include <mutex>
 #include "pdu.hpp"      
 #include "header.hpp"   
+#include "fec.hpp"
+#include "capture.hpp"  // FrameNote
+#include "latency.hpp"  // LatencyMetric
 
 namespace linkchat {
 
-    using EmitTxFn = std::function<void(const std::vector<std::uint8_t>&)>;
+    using EmitTxFn = std::function<void(const FrameRef&)>;
+
+    // what the senders hand their frames to; the note says why the frame goes out (packet capture)
+    using EmitFrameFn = std::function<void(const FrameRef&, FrameNote)>;
 
     using NowFn = std::function<std::uint64_t(void)>;
 
+    // one latency sample in microseconds, for the message type it belongs to
+    using LatencySampleFn = std::function<void(LatencyMetric, Type, std::uint64_t us)>;
+
+    // a message the receiver refused (REJECT) and the sender gave up on
+    using RefusedFn = std::function<void(std::uint32_t msg_id, Type type, RejectReason reason)>;
+
+    // Transmit priority. ACKs and directory HELLOs never queue here: they leave straight from
+    // the receive path. Within a class, messages share the link by deficit round-robin.
+    enum class TxClass : std::uint8_t {
+        Control     = 0,   // reliable HELLO
+        Interactive = 1,   // chat text, single-frame transfer control
+        Bulk        = 2    // files, transfer segments
+    };
+    inline constexpr std::size_t kTxClasses = 3;
+
+    [[nodiscard]] TxClass tx_class_for(Type type, std::size_t frames) noexcept;
+
     struct SenderConfig {
         std::uint16_t mtu = 1500;       
         std::uint32_t window = 4;       
         std::uint32_t rto_ms = 300;     
+        FecConfig fec{};                // repair frames per block, off by default; with it on the window is at least k
+        std::uint32_t burst = 64;       // frames handed to the link per scheduling pass, 0 = no limit;
+                                        // what is left waits in the sender, where a chat message can overtake it
+        std::uint64_t rate_cap = 0;     // bytes/s shared by all bulk messages, on top of window/RTT pacing; 0 = no cap
         NowFn now;                      
+        NowFn now_us;                   // pacing clock, steady_micros when unset
+    };
+
+    // per message, picked from what the peer announced in its HELLO
+    struct SendOptions {
+        bool digest = false;    // append an XXH64 the peer checks after reassembly (kDigestIdBit)
+        bool frame_crc = true;  // false: skip the per-frame CRC32, the peer trusts its link FCS; digest only
+        std::uint64_t dst = 0;  // mac_to_u64 of the receiver: its ACK windows gate this message
+    };
+
+    // running totals since the sender was made
+    struct SenderStats {
+        std::uint64_t frames;   // data frames handed to the link, resends included
+        std::uint64_t resent;   // of those, frames sent again after a timeout
+        std::uint64_t repairs;  // FEC parity frames
+        std::uint64_t acks;     // ACKs that named a message still in flight
+    };
+
+    // Byte bucket refilled at a rate up to a depth. A frame may overdraw it; the debt holds back
+    // the next one, so the long-run rate holds whatever the frame sizes.
+    struct TokenBucket {
+        double        tokens{0};
+        std::uint64_t last_us{0};
+
+        void refill(double rate, double depth, std::uint64_t now_us) noexcept;
+        bool ready() const noexcept { return tokens > 0; }
+        // microseconds until at least `want` bytes are in, 0 if they already are
+        std::uint64_t wait_us(double rate, double want, std::uint64_t now_us) const noexcept;
     };
 
     struct TxMsg {
         std::uint32_t                 msg_id{};
         Type                           type{};
-        std::vector<std::vector<std::uint8_t>> pdus;   
+        std::vector<FrameRef>         pdus;           
+        std::uint32_t                 built{0};        // pdus below this exist; the rest are still being built
         std::uint32_t                 base{0};         
         std::uint32_t                 next{0};         
         std::vector<std::uint64_t>    sent_at_ms;      
+        std::uint64_t                 queued_us{0};    // when send() took it, for the FirstTx/Acked samples
+        std::vector<std::uint64_t>    sent_us;         // first transmission time for RTT samples, 0 once resent
+        std::uint32_t                 fec_block{0};    // first block whose repair frames are still unsent
         bool                           done{false};
+        TxClass                        cls{TxClass::Bulk};
+        std::uint32_t                 deficit{0};      // DRR credit in bytes
+        std::uint32_t                 sent_hw{0};      // frames below this were sent at least once
+        bool                           queued{false};   // listed in its class's active queue
+        TokenBucket                    pace;            // window/RTT pacing
+        std::uint64_t                 dst{0};          // receiver key (SendOptions::dst)
+        bool                           refused{false};  // REJECTed while still being built: send() drops it once done
+        std::uint32_t                 resends{0};      // times the receiver asked for all of it again (digest mismatch)
+    };
+
+    // FIFO of message ids on a ring that only grows: the scheduler pops and pushes one per
+    // message per pass, and a deque would free and allocate a block every few hundred of those
+    class IdRing {
+    public:
+        bool empty() const noexcept { return count_ == 0; }
+        std::size_t size() const noexcept { return count_; }
+        std::uint32_t front() const noexcept { return buf_[head_]; }
+        std::uint32_t operator[](std::size_t i) const noexcept { return buf_[(head_ + i) & (buf_.size() - 1)]; }
+        void pop_front() noexcept { head_ = (head_ + 1) & (buf_.size() - 1); count_--; }
+        void push_back(std::uint32_t id);
+
+    private:
+        std::vector<std::uint32_t> buf_;   // power-of-two size
+        std::size_t head_{0};
+        std::size_t count_{0};
     };
 
     class Sender {
     public:
-        explicit Sender(EmitTxFn emit_tx, SenderConfig cfg);
+        explicit Sender(EmitFrameFn emit_tx, SenderConfig cfg);
+
+        std::uint32_t send(const std::vector<std::uint8_t>& data, Type type, SendOptions opt = {});
 
-        std::uint32_t send(const std::vector<std::uint8_t>& data, Type type);
+        // from: mac_to_u64 of the station that sent the ACK; its window only gates messages to it
+        void on_ack(const AckFields& ack, std::uint64_t from = 0) noexcept;
 
-        void on_ack(const AckFields& ack) noexcept;
+        // the receiver will not take the message: it is given up and reported to set_on_refused.
+        // RejectReason::Resend sends it all again instead, up to a few times
+        void on_reject(const RejectFields& reject) noexcept;
 
         void on_tick() noexcept;
 
+        // FirstTx, Acked and AckRtt samples; called with the sender's lock held, set before sending
+        void set_on_latency(LatencySampleFn fn) noexcept { on_latency_ = std::move(fn); }
+
+        // called with the sender's lock held, set before sending
+        void set_on_refused(RefusedFn fn) noexcept { on_refused_ = std::move(fn); }
+
         bool is_done(std::uint32_t msg_id) const noexcept;
         std::size_t in_flight(std::uint32_t msg_id) const noexcept;
 
+        double loss_estimate() const noexcept { std::lock_guard<std::mutex> lk(mu_); return loss_; }
+        std::uint64_t srtt_us() const noexcept { std::lock_guard<std::mutex> lk(mu_); return srtt_us_; }
+
+        SenderStats stats() const noexcept { std::lock_guard<std::mutex> lk(mu_); return stats_; }
+
+        // RTT measured outside the data path (ping); only taken while no ACK has been sampled yet
+        void seed_rtt_us(std::uint64_t us) noexcept;
+
+        // microseconds until the pacer lets the next queued frame out, UINT64_MAX when nothing waits
+        std::uint64_t pace_wait_us() const noexcept;
 
     private:
-        EmitTxFn emit_tx_;
+        bool can_send(const TxMsg &msg) const noexcept;
+        void activate(TxMsg &msg) noexcept;
+        void pump() noexcept;
+        double pace_rate() const noexcept;
+        bool pace_ready(const TxMsg &msg) const noexcept;
+        bool rwnd_open(const TxMsg &msg) const noexcept;
+        // moves a started message's unACKed frames in or out of its receiver's committed count
+        void commit(const TxMsg &msg, std::uint32_t frames) noexcept;
+        void uncommit(const TxMsg &msg, std::uint32_t frames) noexcept;
+        void emit_repairs(TxMsg &msg) noexcept;
+        void sample_loss(bool lost) noexcept;
+
+        EmitFrameFn emit_tx_;
         SenderConfig cfg_;
+        LatencySampleFn on_latency_;
+        RefusedFn on_refused_;
         std::unordered_map<std::uint32_t, TxMsg> msgs_;  
         std::uint32_t next_msg_id_{1};                   
+        std::vector<FrameRef> repairs_;                  // scratch for emit_repairs, reused across blocks
+        IdRing active_[kTxClasses];                      // messages with frames the window allows out
+        double loss_{0.0};                               // EWMA of retransmitted / transmitted frames
+        std::uint64_t srtt_us_{0};                       // smoothed frame -> ACK time, 0 until sampled
+        TokenBucket bulk_cap_;                           // rate_cap, shared by every bulk message
+        struct Rwnd {
+            std::uint32_t frames{UINT32_MAX};            // receiver's last advertised room, across its messages
+            std::uint64_t probe_ms{0};                   // last message started into its closed window
+            std::uint32_t committed{0};                  // unACKed frames of its messages already started
+        };
+        std::unordered_map<std::uint64_t, Rwnd> rwnd_;   // by receiver, once it has advertised a window
+        SenderStats stats_{};
+        mutable std::mutex mu_;                          // send() may run on the RX thread (replies) next to on_tick()
     };
 
 } 
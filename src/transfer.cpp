@@ -0,0 +1,795 @@
+#include "transfer.hpp"
+#include "util/hash.hpp"
+#include "util/helpers.hpp"
+#include "util/cdc.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <utility>
+using namespace std;
+namespace fs = filesystem;
+
+namespace linkchat
+{
+    static const char kMetaMagic[4] = {'L', 'C', 'X', 'F'};
+    static const char kChunkedMagic[4] = {'L', 'C', 'X', 'S'}; // LCXC tables had FNV-1a chunk ids
+    // chunk table entry, in MANIFESTs and .meta files: [len(4)] [sha256(32)]
+    static constexpr size_t kChunkEntrySize = 4 + sizeof(Sha256Digest);
+
+    static void put_chunk_entry(const CdcChunk &c, uint8_t *out) noexcept
+    {
+        uint32_to_BE(c.len, out, 0);
+        copy(c.hash.begin(), c.hash.end(), out + 4);
+    }
+
+    static void get_chunk_entry(const uint8_t *in, CdcChunk &c) noexcept
+    {
+        c.len = BE_to_uint32(in, 0);
+        copy(in + 4, in + kChunkEntrySize, c.hash.begin());
+    }
+
+    [[nodiscard]] uint32_t xfer_seg_count(uint64_t file_size, uint32_t seg_size) noexcept
+    {
+        if(seg_size == 0)
+            return 0;
+        uint64_t n = file_size / seg_size;
+        if(file_size % seg_size != 0)
+            n++;
+        if(n > UINT32_MAX)
+            return 0;
+        return static_cast<uint32_t>(n);
+    }
+
+    bool bitmap_test(const vector<uint8_t> &bitmap, uint32_t i) noexcept
+    {
+        if(i / 8 >= bitmap.size())
+            return false;
+        return (bitmap[i / 8] >> (i % 8)) & 1u;
+    }
+
+    void bitmap_set(vector<uint8_t> &bitmap, uint32_t i) noexcept
+    {
+        if(i / 8 >= bitmap.size())
+            return;
+        bitmap[i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+    }
+
+    [[nodiscard]] vector<uint8_t> encode_offer(const XferOffer &offer)
+    {
+        string name = offer.name;
+        if(name.size() > 65535)
+            name.resize(65535);
+
+        vector<uint8_t> out(23 + name.size());
+        out[0] = static_cast<uint8_t>(XferOp::OFFER);
+        uint64_to_BE(offer.xfer_id, out.data(), 1);
+        uint64_to_BE(offer.file_size, out.data(), 9);
+        uint32_to_BE(offer.seg_size, out.data(), 17);
+        uint16_to_BE(static_cast<uint16_t>(name.size()), out.data(), 21);
+        for(size_t i = 0; i < name.size(); i++)
+            out[23 + i] = static_cast<uint8_t>(name[i]);
+        return out;
+    }
+
+    [[nodiscard]] vector<uint8_t> encode_state(const XferState &state)
+    {
+        vector<uint8_t> out(13);
+        out[0] = static_cast<uint8_t>(XferOp::STATE);
+        uint64_to_BE(state.xfer_id, out.data(), 1);
+        uint32_to_BE(state.seg_count, out.data(), 9);
+        out.insert(out.end(), state.bitmap.begin(), state.bitmap.end());
+        return out;
+    }
+
+    [[nodiscard]] vector<uint8_t> encode_seg(uint64_t xfer_id, uint32_t index, uint64_t offset,
+                                             const uint8_t *data, size_t len)
+    {
+        vector<uint8_t> out(kXferSegHdrSize + len);
+        out[0] = static_cast<uint8_t>(XferOp::SEG);
+        uint64_to_BE(xfer_id, out.data(), 1);
+        uint32_to_BE(index, out.data(), 9);
+        uint64_to_BE(offset, out.data(), 13);
+        if(len > 0 && data != nullptr)
+            copy(data, data + len, out.begin() + kXferSegHdrSize);
+        return out;
+    }
+
+    bool xfer_op_of(const vector<uint8_t> &msg, XferOp &out) noexcept
+    {
+        if(msg.empty())
+            return false;
+        if(msg[0] < static_cast<uint8_t>(XferOp::OFFER) || msg[0] > static_cast<uint8_t>(XferOp::MANIFEST))
+            return false;
+        out = static_cast<XferOp>(msg[0]);
+        return true;
+    }
+
+    bool decode_offer(const vector<uint8_t> &msg, XferOffer &out) noexcept
+    {
+        if(msg.size() < 23 || msg[0] != static_cast<uint8_t>(XferOp::OFFER))
+            return false;
+        out.xfer_id = BE_to_uint64(msg.data(), 1);
+        out.file_size = BE_to_uint64(msg.data(), 9);
+        out.seg_size = BE_to_uint32(msg.data(), 17);
+        uint16_t nlen = BE_to_uint16(msg.data(), 21);
+        if(msg.size() < 23u + nlen || out.seg_size < kXferSegMin || out.seg_size > kXferSegMax)
+            return false;
+        out.name.assign(reinterpret_cast<const char *>(msg.data() + 23), nlen);
+        out.name = fs::path(out.name).filename().string();
+        const uint32_t segs = xfer_seg_count(out.file_size, out.seg_size);
+        return !out.name.empty() && segs > 0 && segs <= kXferMaxSegs;
+    }
+
+    bool decode_state(const vector<uint8_t> &msg, XferState &out) noexcept
+    {
+        if(msg.size() < 13 || msg[0] != static_cast<uint8_t>(XferOp::STATE))
+            return false;
+        out.xfer_id = BE_to_uint64(msg.data(), 1);
+        out.seg_count = BE_to_uint32(msg.data(), 9);
+        if(msg.size() - 13 != (static_cast<size_t>(out.seg_count) + 7) / 8)
+            return false;
+        out.bitmap.assign(msg.begin() + 13, msg.end());
+        return true;
+    }
+
+    bool decode_seg(const vector<uint8_t> &msg, XferSeg &out) noexcept
+    {
+        if(msg.size() < kXferSegHdrSize || msg[0] != static_cast<uint8_t>(XferOp::SEG))
+            return false;
+        out.xfer_id = BE_to_uint64(msg.data(), 1);
+        out.index = BE_to_uint32(msg.data(), 9);
+        out.offset = BE_to_uint64(msg.data(), 13);
+        out.data = msg.data() + kXferSegHdrSize;
+        out.len = msg.size() - kXferSegHdrSize;
+        return true;
+    }
+
+    [[nodiscard]] vector<uint8_t> encode_manifest(const XferManifest &m)
+    {
+        string name = m.name;
+        if(name.size() > 65535)
+            name.resize(65535);
+
+        vector<uint8_t> out(23 + name.size() + kChunkEntrySize * m.chunks.size());
+        out[0] = static_cast<uint8_t>(XferOp::MANIFEST);
+        uint64_to_BE(m.xfer_id, out.data(), 1);
+        uint64_to_BE(m.file_size, out.data(), 9);
+        uint16_to_BE(static_cast<uint16_t>(name.size()), out.data(), 17);
+        copy(name.begin(), name.end(), out.begin() + 19);
+        size_t pos = 19 + name.size();
+        uint32_to_BE(static_cast<uint32_t>(m.chunks.size()), out.data(), static_cast<int>(pos));
+        pos += 4;
+        for(const CdcChunk &c : m.chunks)
+        {
+            put_chunk_entry(c, out.data() + pos);
+            pos += kChunkEntrySize;
+        }
+        return out;
+    }
+
+    bool decode_manifest(const vector<uint8_t> &msg, XferManifest &out) noexcept
+    {
+        if(msg.size() < 23 || msg[0] != static_cast<uint8_t>(XferOp::MANIFEST))
+            return false;
+        out.xfer_id = BE_to_uint64(msg.data(), 1);
+        out.file_size = BE_to_uint64(msg.data(), 9);
+        uint16_t nlen = BE_to_uint16(msg.data(), 17);
+        if(msg.size() < 23u + nlen)
+            return false;
+        out.name.assign(reinterpret_cast<const char *>(msg.data() + 19), nlen);
+        out.name = fs::path(out.name).filename().string();
+
+        size_t pos = 19 + nlen;
+        uint32_t count = BE_to_uint32(msg.data(), static_cast<int>(pos));
+        pos += 4;
+        if(count == 0 || count > kXferMaxSegs || (msg.size() - pos) != static_cast<size_t>(count) * kChunkEntrySize)
+            return false;
+
+        out.chunks.resize(count);
+        uint64_t offset = 0;
+        for(uint32_t i = 0; i < count; i++, pos += kChunkEntrySize)
+        {
+            out.chunks[i].offset = offset;
+            get_chunk_entry(msg.data() + pos, out.chunks[i]);
+            if(out.chunks[i].len == 0 || out.chunks[i].len > kCdcMaxSize)
+                return false;
+            offset += out.chunks[i].len;
+        }
+        return !out.name.empty() && offset == out.file_size;
+    }
+
+    [[nodiscard]] uint64_t manifest_xfer_id(const vector<CdcChunk> &chunks, const string &name) noexcept
+    {
+        uint64_t h = kFnv64Offset;
+        uint8_t entry[kChunkEntrySize];
+        for(const CdcChunk &c : chunks)
+        {
+            put_chunk_entry(c, entry);
+            h = fnv1a64(entry, sizeof(entry), h);
+        }
+        return fnv1a64(reinterpret_cast<const uint8_t *>(name.data()), name.size(), h);
+    }
+
+    bool file_xfer_id(const string &path, uint64_t &out_id, uint64_t &out_size) noexcept
+    {
+        ifstream f(path, ios::binary);
+        if(!f)
+            return false;
+
+        vector<uint8_t> buf(1u << 16);
+        uint64_t h = kFnv64Offset;
+        uint64_t size = 0;
+        while(f)
+        {
+            f.read(reinterpret_cast<char *>(buf.data()), buf.size());
+            streamsize got = f.gcount();
+            if(got <= 0)
+                break;
+            h = fnv1a64(buf.data(), static_cast<size_t>(got), h);
+            size += static_cast<uint64_t>(got);
+        }
+        if(f.bad() || size == 0)
+            return false;
+
+        string name = fs::path(path).filename().string();
+        out_id = fnv1a64(reinterpret_cast<const uint8_t *>(name.data()), name.size(), h);
+        out_size = size;
+        return true;
+    }
+
+    TransferStore::TransferStore(string dir, uint64_t cache_cap): dir_(move(dir)), open_(), cache_cap_(cache_cap), mu_()
+    {
+        if(dir_.empty())
+            dir_ = ".";
+    }
+
+    TransferStore::~TransferStore()
+    {
+        {
+            lock_guard<mutex> lk(mu_);
+            stop_ = true;
+        }
+        prefill_cv_.notify_all();
+        if(prefill_thr_.joinable())
+            prefill_thr_.join();
+    }
+
+    string TransferStore::part_path(uint64_t xfer_id) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.part", static_cast<unsigned long long>(xfer_id));
+        return (fs::path(dir_) / ".partial" / name).string();
+    }
+
+    string TransferStore::meta_path(uint64_t xfer_id) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.meta", static_cast<unsigned long long>(xfer_id));
+        return (fs::path(dir_) / ".partial" / name).string();
+    }
+
+    string TransferStore::chunk_path(const Sha256Digest &hash) const
+    {
+        char name[2 * sizeof(Sha256Digest) + 1];
+        for(size_t i = 0; i < hash.size(); i++)
+            snprintf(name + 2 * i, 3, "%02x", hash[i]);
+        return (fs::path(dir_) / ".chunks" / name).string();
+    }
+
+    bool TransferStore::seg_span(const Partial &p, uint32_t index, uint64_t &offset, uint64_t &len) noexcept
+    {
+        if(index >= p.seg_count)
+            return false;
+        if(!p.chunks.empty())
+        {
+            offset = p.chunks[index].offset;
+            len = p.chunks[index].len;
+            return true;
+        }
+        offset = static_cast<uint64_t>(index) * p.offer.seg_size;
+        len = min<uint64_t>(p.offer.seg_size, p.offer.file_size - offset);
+        return true;
+    }
+
+    // [magic(4)] [xfer_id(8)] [file_size(8)] [seg_size(4)] [name_len(2)] [name] ([count(4)] [chunk table]) [bitmap]
+    // magic LCXF = fixed segments, LCXS = content-defined chunks with their table
+    bool TransferStore::load_meta(uint64_t xfer_id, Partial &out) const noexcept
+    {
+        ifstream f(meta_path(xfer_id), ios::binary);
+        if(!f)
+            return false;
+        vector<uint8_t> raw((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+        if(raw.size() < 26)
+            return false;
+        bool chunked = equal(kChunkedMagic, kChunkedMagic + 4, raw.begin());
+        if(!chunked && !equal(kMetaMagic, kMetaMagic + 4, raw.begin()))
+            return false;
+
+        out.offer.xfer_id = BE_to_uint64(raw.data(), 4);
+        out.offer.file_size = BE_to_uint64(raw.data(), 12);
+        out.offer.seg_size = BE_to_uint32(raw.data(), 20);
+        uint16_t nlen = BE_to_uint16(raw.data(), 24);
+        if(out.offer.xfer_id != xfer_id || raw.size() < 26u + nlen)
+            return false;
+        out.offer.name.assign(reinterpret_cast<const char *>(raw.data() + 26), nlen);
+
+        size_t pos = 26 + nlen;
+        out.chunks.clear();
+        if(chunked)
+        {
+            if(raw.size() < pos + 4)
+                return false;
+            uint32_t count = BE_to_uint32(raw.data(), static_cast<int>(pos));
+            pos += 4;
+            if(count == 0 || (raw.size() - pos) / kChunkEntrySize < count)
+                return false;
+            uint64_t offset = 0;
+            out.chunks.resize(count);
+            for(uint32_t i = 0; i < count; i++, pos += kChunkEntrySize)
+            {
+                out.chunks[i].offset = offset;
+                get_chunk_entry(raw.data() + pos, out.chunks[i]);
+                offset += out.chunks[i].len;
+            }
+            if(offset != out.offer.file_size)
+                return false;
+            out.seg_count = count;
+        }
+        else
+        {
+            out.seg_count = xfer_seg_count(out.offer.file_size, out.offer.seg_size);
+        }
+
+        if(out.seg_count == 0 || raw.size() - pos != (static_cast<size_t>(out.seg_count) + 7) / 8)
+            return false;
+        out.bitmap.assign(raw.begin() + pos, raw.end());
+
+        out.have = 0;
+        for(uint32_t i = 0; i < out.seg_count; i++)
+            out.have += bitmap_test(out.bitmap, i) ? 1 : 0;
+
+        error_code ec;
+        if(fs::exists(part_path(xfer_id), ec))
+            return true;
+
+        // finished earlier: keep answering with a full bitmap while the file is still in place
+        uintmax_t final_size = fs::file_size(fs::path(dir_) / out.offer.name, ec);
+        return !ec && out.have == out.seg_count && final_size == out.offer.file_size;
+    }
+
+    bool TransferStore::save_meta(const Partial &p) const noexcept
+    {
+        const bool chunked = !p.chunks.empty();
+        vector<uint8_t> raw(26 + p.offer.name.size());
+        if(chunked)
+            copy(kChunkedMagic, kChunkedMagic + 4, raw.begin());
+        else
+            copy(kMetaMagic, kMetaMagic + 4, raw.begin());
+        uint64_to_BE(p.offer.xfer_id, raw.data(), 4);
+        uint64_to_BE(p.offer.file_size, raw.data(), 12);
+        uint32_to_BE(p.offer.seg_size, raw.data(), 20);
+        uint16_to_BE(static_cast<uint16_t>(p.offer.name.size()), raw.data(), 24);
+        copy(p.offer.name.begin(), p.offer.name.end(), raw.begin() + 26);
+        if(chunked)
+        {
+            size_t pos = raw.size();
+            raw.resize(pos + 4 + kChunkEntrySize * p.chunks.size());
+            uint32_to_BE(static_cast<uint32_t>(p.chunks.size()), raw.data(), static_cast<int>(pos));
+            pos += 4;
+            for(const CdcChunk &c : p.chunks)
+            {
+                put_chunk_entry(c, raw.data() + pos);
+                pos += kChunkEntrySize;
+            }
+        }
+        raw.insert(raw.end(), p.bitmap.begin(), p.bitmap.end());
+
+        // write-then-rename so a crash never leaves a torn bitmap behind
+        string path = meta_path(p.offer.xfer_id);
+        string tmp = path + ".tmp";
+        {
+            ofstream f(tmp, ios::binary | ios::trunc);
+            if(!f)
+                return false;
+            f.write(reinterpret_cast<const char *>(raw.data()), raw.size());
+            if(!f.good())
+                return false;
+        }
+        error_code ec;
+        fs::rename(tmp, path, ec);
+        return !ec;
+    }
+
+    // The header and chunk table never change once written and the bitmap sits right after
+    // them, so a new segment rewrites only its own bitmap byte, in place. One byte cannot tear.
+    bool TransferStore::save_meta_bit(const Partial &p, uint32_t index) const noexcept
+    {
+        if(index / 8 >= p.bitmap.size())
+            return false;
+        size_t pos = 26 + p.offer.name.size();
+        if(!p.chunks.empty())
+            pos += 4 + kChunkEntrySize * p.chunks.size();
+        pos += index / 8;
+
+        fstream f(meta_path(p.offer.xfer_id), ios::binary | ios::in | ios::out);
+        if(!f)
+            return false;
+        f.seekp(static_cast<streamoff>(pos));
+        f.put(static_cast<char>(p.bitmap[index / 8]));
+        f.flush();
+        return f.good();
+    }
+
+    TransferStore::Partial *TransferStore::find_or_load(uint64_t xfer_id) noexcept
+    {
+        auto it = open_.find(xfer_id);
+        if(it != open_.end())
+            return &it->second;
+
+        Partial p;
+        if(!load_meta(xfer_id, p))
+            return nullptr;
+        return &(open_[xfer_id] = move(p));
+    }
+
+    bool TransferStore::fits_disk(uint64_t file_size) const noexcept
+    {
+        error_code ec;
+        const fs::space_info sp = fs::space(dir_, ec);
+        return !ec && file_size <= sp.available;
+    }
+
+    TransferStore::Partial *TransferStore::create_partial(Partial &&np) noexcept
+    {
+        error_code ec;
+        fs::create_directories(fs::path(dir_) / ".partial", ec);
+        if(ec || np.seg_count == 0)
+            return nullptr;
+
+        const uint64_t xfer_id = np.offer.xfer_id;
+        {
+            ofstream f(part_path(xfer_id), ios::binary | ios::trunc);
+            if(!f)
+                return nullptr;
+        }
+        fs::resize_file(part_path(xfer_id), np.offer.file_size, ec);
+        if(ec || !save_meta(np))
+            return nullptr;
+        return &(open_[xfer_id] = move(np));
+    }
+
+    bool TransferStore::finish_if_complete(Partial &p, string &done_path) noexcept
+    {
+        if(p.have != p.seg_count)
+            return false;
+
+        const uint64_t xfer_id = p.offer.xfer_id;
+        error_code ec;
+        if(!fs::exists(part_path(xfer_id), ec))
+            return false;
+        string final_path = (fs::path(dir_) / p.offer.name).string();
+        fs::rename(part_path(xfer_id), final_path, ec);
+        if(ec)
+            return false;
+        open_.erase(xfer_id);
+        done_path = final_path;
+        return true;
+    }
+
+    bool TransferStore::on_offer(const XferOffer &offer, XferState &out) noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+
+        Partial *p = find_or_load(offer.xfer_id);
+        if(p != nullptr && (p->offer.file_size != offer.file_size || p->offer.seg_size != offer.seg_size || !p->chunks.empty()))
+        {
+            open_.erase(offer.xfer_id);
+            p = nullptr;
+        }
+
+        if(p == nullptr)
+        {
+            if(!fits_disk(offer.file_size))
+                return false;
+            Partial np;
+            np.offer = offer;
+            np.seg_count = xfer_seg_count(offer.file_size, offer.seg_size);
+            np.have = 0;
+            np.bitmap.assign((static_cast<size_t>(np.seg_count) + 7) / 8, 0);
+            p = create_partial(move(np));
+            if(p == nullptr)
+                return false;
+        }
+
+        out.xfer_id = offer.xfer_id;
+        out.seg_count = p->seg_count;
+        out.bitmap = p->bitmap;
+        return true;
+    }
+
+    bool TransferStore::on_manifest(const XferManifest &m, XferState &out, string &done_path) noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+        done_path.clear();
+
+        Partial *p = find_or_load(m.xfer_id);
+        if(p != nullptr && (p->offer.file_size != m.file_size || p->chunks.size() != m.chunks.size()))
+        {
+            open_.erase(m.xfer_id);
+            p = nullptr;
+        }
+
+        if(p == nullptr)
+        {
+            if(!fits_disk(m.file_size))
+                return false;
+            Partial np;
+            np.offer.xfer_id = m.xfer_id;
+            np.offer.file_size = m.file_size;
+            np.offer.seg_size = 0;
+            np.offer.name = m.name;
+            np.chunks = m.chunks;
+            np.seg_count = static_cast<uint32_t>(m.chunks.size());
+            np.have = 0;
+            np.bitmap.assign((static_cast<size_t>(np.seg_count) + 7) / 8, 0);
+            p = create_partial(move(np));
+            if(p == nullptr)
+                return false;
+            p->preparing = true;
+            prefill_queue_.push_back(m.xfer_id);
+            if(!prefill_thr_.joinable())
+                prefill_thr_ = thread(&TransferStore::prefill_loop, this);
+            prefill_cv_.notify_one();
+        }
+
+        out.xfer_id = m.xfer_id;
+        if(p->preparing)
+        {
+            out.seg_count = 0;
+            out.bitmap.clear();
+            return true;
+        }
+        out.seg_count = p->seg_count;
+        out.bitmap = p->bitmap;
+        finish_if_complete(*p, done_path);
+        return true;
+    }
+
+    void TransferStore::prefill_loop()
+    {
+        unique_lock<mutex> lk(mu_);
+        for(;;)
+        {
+            prefill_cv_.wait(lk, [this] { return stop_ || !prefill_queue_.empty(); });
+            if(stop_)
+                return;
+            const uint64_t xfer_id = prefill_queue_.front();
+            prefill_queue_.pop_front();
+            lk.unlock();
+            prefill(xfer_id);
+            lk.lock();
+        }
+    }
+
+    // copies chunks the receiver already has (previous version in the inbox, chunk cache) into the
+    // partial file. Runs on the store's thread: the file IO and hashing happen unlocked, on a copy
+    // of the chunk table, and the bitmap is only updated at the end
+    void TransferStore::prefill(uint64_t xfer_id) noexcept
+    {
+        string name;
+        vector<CdcChunk> chunks;
+        vector<uint8_t> had;
+        {
+            lock_guard<mutex> lk(mu_);
+            auto it = open_.find(xfer_id);
+            if(it == open_.end() || !it->second.preparing)
+                return;
+            name = it->second.offer.name;
+            chunks = it->second.chunks;
+            had = it->second.bitmap;
+        }
+
+        vector<uint32_t> filled;
+        fstream part(part_path(xfer_id), ios::binary | ios::in | ios::out);
+        if(part)
+        {
+            map<Sha256Digest, CdcChunk> old_chunks;
+            string old_path = (fs::path(dir_) / name).string();
+            ifstream old(old_path, ios::binary);
+            if(old)
+            {
+                vector<CdcChunk> list;
+                if(cdc_chunk_file(old_path, list))
+                {
+                    for(const CdcChunk &c : list)
+                        old_chunks.emplace(c.hash, c);
+                }
+            }
+
+            vector<uint8_t> buf;
+            for(uint32_t i = 0; i < chunks.size(); i++)
+            {
+                if(bitmap_test(had, i))
+                    continue;
+                const CdcChunk &want = chunks[i];
+                buf.resize(want.len);
+
+                bool found = false;
+                auto it = old_chunks.find(want.hash);
+                if(it != old_chunks.end() && it->second.len == want.len)
+                {
+                    old.clear();
+                    old.seekg(static_cast<streamoff>(it->second.offset));
+                    old.read(reinterpret_cast<char *>(buf.data()), want.len);
+                    found = static_cast<size_t>(old.gcount()) == want.len;
+                }
+                if(!found)
+                {
+                    string path = chunk_path(want.hash);
+                    ifstream cached(path, ios::binary);
+                    if(cached)
+                    {
+                        cached.read(reinterpret_cast<char *>(buf.data()), want.len);
+                        found = static_cast<size_t>(cached.gcount()) == want.len && cached.peek() == EOF;
+                        error_code ec;
+                        if(found)
+                            fs::last_write_time(path, fs::file_time_type::clock::now(), ec); // recently used
+                    }
+                }
+                if(!found || sha256(buf.data(), buf.size()) != want.hash)
+                    continue;
+
+                part.seekp(static_cast<streamoff>(want.offset));
+                part.write(reinterpret_cast<const char *>(buf.data()), want.len);
+                if(!part.good())
+                    break;
+                filled.push_back(i);
+            }
+            part.flush();
+            if(!part.good())
+                filled.clear();
+        }
+
+        XferState state;
+        string done_path;
+        {
+            lock_guard<mutex> lk(mu_);
+            auto it = open_.find(xfer_id);
+            if(it == open_.end() || !it->second.preparing)
+                return;
+            Partial &p = it->second;
+            p.preparing = false;
+            for(uint32_t i : filled)
+            {
+                if(bitmap_test(p.bitmap, i))
+                    continue;
+                bitmap_set(p.bitmap, i);
+                p.have++;
+            }
+            save_meta(p);
+            state.xfer_id = xfer_id;
+            state.seg_count = p.seg_count;
+            state.bitmap = p.bitmap;
+            finish_if_complete(p, done_path);
+        }
+        if(on_ready_)
+            on_ready_(name, state, done_path);
+    }
+
+    void TransferStore::cache_put(const Sha256Digest &hash, const uint8_t *data, size_t len) noexcept
+    {
+        if(len > cache_cap_)
+            return;
+        error_code ec;
+        fs::create_directories(fs::path(dir_) / ".chunks", ec);
+        string path = chunk_path(hash);
+        if(ec || fs::exists(path, ec))
+            return;
+        cache_trim(len);
+
+        string tmp = path + ".tmp";
+        {
+            ofstream f(tmp, ios::binary | ios::trunc);
+            if(!f)
+                return;
+            f.write(reinterpret_cast<const char *>(data), len);
+            if(!f.good())
+                return;
+        }
+        fs::rename(tmp, path, ec);
+        if(!ec)
+            cache_bytes_ += len;
+    }
+
+    // makes room for incoming bytes: past the cap, the oldest chunks (by mtime, which prefill
+    // refreshes on a hit) go until the cache is back under 3/4 of it
+    void TransferStore::cache_trim(uint64_t incoming) noexcept
+    {
+        const fs::path dir = fs::path(dir_) / ".chunks";
+        error_code ec;
+        if(!cache_counted_)
+        {
+            cache_bytes_ = 0;
+            for(const fs::directory_entry &e : fs::directory_iterator(dir, ec))
+                cache_bytes_ += e.is_regular_file(ec) ? e.file_size(ec) : 0;
+            cache_counted_ = true;
+        }
+        if(cache_bytes_ + incoming <= cache_cap_)
+            return;
+
+        struct Entry
+        {
+            fs::file_time_type mtime;
+            fs::path path;
+            uint64_t size;
+        };
+        vector<Entry> entries;
+        uint64_t total = 0;
+        for(const fs::directory_entry &e : fs::directory_iterator(dir, ec))
+        {
+            error_code eec;
+            if(!e.is_regular_file(eec))
+                continue;
+            Entry en{e.last_write_time(eec), e.path(), e.file_size(eec)};
+            if(eec)
+                continue;
+            total += en.size;
+            entries.push_back(move(en));
+        }
+        sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.mtime < b.mtime; });
+
+        const uint64_t target = cache_cap_ / 4 * 3;
+        for(const Entry &e : entries)
+        {
+            if(total + incoming <= target)
+                break;
+            if(fs::remove(e.path, ec))
+                total -= e.size;
+        }
+        cache_bytes_ = total;
+    }
+
+    bool TransferStore::on_segment(const XferSeg &seg, string &done_path) noexcept
+    {
+        lock_guard<mutex> lk(mu_);
+        done_path.clear();
+
+        Partial *p = find_or_load(seg.xfer_id);
+        if(p == nullptr)
+            return false;
+
+        uint64_t offset = 0;
+        uint64_t expect = 0;
+        if(!seg_span(*p, seg.index, offset, expect))
+            return false;
+        if(seg.offset != offset || seg.len != expect)
+            return false;
+        if(p->preparing || bitmap_test(p->bitmap, seg.index))
+            return false;
+        if(!p->chunks.empty() && sha256(seg.data, seg.len) != p->chunks[seg.index].hash)
+            return false;
+
+        {
+            fstream f(part_path(seg.xfer_id), ios::binary | ios::in | ios::out);
+            if(!f)
+                return false;
+            f.seekp(static_cast<streamoff>(offset));
+            f.write(reinterpret_cast<const char *>(seg.data), seg.len);
+            f.flush();
+            if(!f.good())
+                return false;
+        }
+        if(!p->chunks.empty())
+            cache_put(p->chunks[seg.index].hash, seg.data, seg.len);
+
+        bitmap_set(p->bitmap, seg.index);
+        p->have++;
+        if(!save_meta_bit(*p, seg.index))
+            return false;
+
+        finish_if_complete(*p, done_path);
+        return true;
+    }
+}
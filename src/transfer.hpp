@@ -0,0 +1,165 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+#include "util/cdc.hpp"
+
+namespace linkchat
+{
+    // Resumable file transfer carried in Type::XFER messages.
+    // OFFER: [op(1)] [xfer_id(8)] [file_size(8)] [seg_size(4)] [name_len(2)] [name]
+    // STATE: [op(1)] [xfer_id(8)] [seg_count(4)] [bitmap]
+    //   seg_count 0: the receiver is still looking for chunks it has; it sends the STATE when done
+    // SEG:   [op(1)] [xfer_id(8)] [index(4)] [offset(8)] [data]
+    // MANIFEST: [op(1)] [xfer_id(8)] [file_size(8)] [name_len(2)] [name] [count(4)] {[len(4)] [sha256(32)]}
+    //   delta mode: segments are content-defined chunks, the receiver fills the ones it already
+    //   has from its inbox or chunk cache and answers STATE like for an OFFER
+    inline constexpr std::uint32_t kXferSegSize = 1u << 20;
+    // what a receiver accepts from an OFFER or MANIFEST: the bitmap, the STATE reply and the
+    // partial file are sized from them before any data arrives. A SEG is one message, held whole
+    inline constexpr std::uint32_t kXferSegMin = 1u << 10;
+    inline constexpr std::uint32_t kXferSegMax = 16u << 20;
+    inline constexpr std::uint32_t kXferMaxSegs = 1u << 20; // bitmap of 128 KiB
+    inline constexpr std::uint64_t kXferChunkCacheCap = 256ull << 20; // <dir>/.chunks, least recently used go first
+    inline constexpr std::size_t kXferSegHdrSize = 21;
+
+    enum class XferOp : std::uint8_t
+    {
+        OFFER = 1,
+        STATE = 2,
+        SEG   = 3,
+        MANIFEST = 4
+    };
+
+    struct XferOffer
+    {
+        std::uint64_t xfer_id;   // content hash of the file, stable across restarts
+        std::uint64_t file_size;
+        std::uint32_t seg_size;
+        std::string name;
+    };
+
+    struct XferState
+    {
+        std::uint64_t xfer_id;
+        std::uint32_t seg_count;
+        std::vector<std::uint8_t> bitmap; // bit i set = segment i already on the receiver's disk
+    };
+
+    struct XferManifest
+    {
+        std::uint64_t xfer_id;
+        std::uint64_t file_size;
+        std::string name;
+        std::vector<CdcChunk> chunks;
+    };
+
+    struct XferSeg
+    {
+        std::uint64_t xfer_id;
+        std::uint32_t index;
+        std::uint64_t offset;
+        const std::uint8_t *data;
+        std::size_t len;
+    };
+
+    [[nodiscard]] std::uint32_t xfer_seg_count(std::uint64_t file_size, std::uint32_t seg_size) noexcept;
+    bool bitmap_test(const std::vector<std::uint8_t> &bitmap, std::uint32_t i) noexcept;
+    void bitmap_set(std::vector<std::uint8_t> &bitmap, std::uint32_t i) noexcept;
+
+    [[nodiscard]] std::vector<std::uint8_t> encode_offer(const XferOffer &offer);
+    [[nodiscard]] std::vector<std::uint8_t> encode_state(const XferState &state);
+    [[nodiscard]] std::vector<std::uint8_t> encode_seg(std::uint64_t xfer_id, std::uint32_t index, std::uint64_t offset,
+                                                       const std::uint8_t *data, std::size_t len);
+
+    [[nodiscard]] std::vector<std::uint8_t> encode_manifest(const XferManifest &m);
+    // id of a delta transfer: hash of the chunk table and the name
+    [[nodiscard]] std::uint64_t manifest_xfer_id(const std::vector<CdcChunk> &chunks, const std::string &name) noexcept;
+
+    bool xfer_op_of(const std::vector<std::uint8_t> &msg, XferOp &out) noexcept;
+    bool decode_offer(const std::vector<std::uint8_t> &msg, XferOffer &out) noexcept;
+    bool decode_state(const std::vector<std::uint8_t> &msg, XferState &out) noexcept;
+    bool decode_manifest(const std::vector<std::uint8_t> &msg, XferManifest &out) noexcept;
+    bool decode_seg(const std::vector<std::uint8_t> &msg, XferSeg &out) noexcept;
+
+    // streams the file once: id = hash(content, name)
+    bool file_xfer_id(const std::string &path, std::uint64_t &out_id, std::uint64_t &out_size) noexcept;
+
+    // the STATE of a MANIFEST that was answered with seg_count 0, for the file `name`; done_path
+    // is set when every chunk was already available locally
+    using XferReadyFn = std::function<void(const std::string &name, const XferState &state, const std::string &done_path)>;
+
+    // Receiver side: partial files and their bitmaps live under <dir>/.partial so an
+    // interrupted transfer survives restarts and resumes from the segments already written.
+    // Delta chunks are also kept in <dir>/.chunks, keyed by hash, for later transfers; the cache
+    // is bounded by cache_cap (0 = no cache) and drops the least recently used chunks first.
+    class TransferStore
+    {
+    public:
+        explicit TransferStore(std::string dir, std::uint64_t cache_cap = kXferChunkCacheCap);
+        ~TransferStore();
+
+        TransferStore(const TransferStore &) = delete;
+        TransferStore &operator=(const TransferStore &) = delete;
+
+        // runs on the store's own thread; set before the first MANIFEST
+        void set_on_ready(XferReadyFn fn) { on_ready_ = std::move(fn); }
+
+        // both refuse a file larger than the free space in dir
+        bool on_offer(const XferOffer &offer, XferState &out) noexcept;
+
+        // a new delta transfer is answered with seg_count 0 at once: looking through the old file
+        // and the chunk cache may take long, so it happens on the store's thread and its STATE goes
+        // to set_on_ready. Asked again meanwhile, it answers seg_count 0 again
+        bool on_manifest(const XferManifest &m, XferState &out, std::string &done_path) noexcept;
+
+        // true when the segment was new; done_path is set once the file is complete
+        bool on_segment(const XferSeg &seg, std::string &done_path) noexcept;
+
+    private:
+        struct Partial
+        {
+            XferOffer offer;
+            std::uint32_t seg_count;
+            std::uint32_t have;
+            std::vector<std::uint8_t> bitmap;
+            std::vector<CdcChunk> chunks; // empty = fixed seg_size segments
+            bool preparing{false};        // prefill still running, the STATE is not known yet
+        };
+
+        std::string part_path(std::uint64_t xfer_id) const;
+        std::string meta_path(std::uint64_t xfer_id) const;
+        std::string chunk_path(const Sha256Digest &hash) const;
+        static bool seg_span(const Partial &p, std::uint32_t index, std::uint64_t &offset, std::uint64_t &len) noexcept;
+        bool load_meta(std::uint64_t xfer_id, Partial &out) const noexcept;
+        bool save_meta(const Partial &p) const noexcept;
+        bool save_meta_bit(const Partial &p, std::uint32_t index) const noexcept;
+        Partial *find_or_load(std::uint64_t xfer_id) noexcept;
+        bool fits_disk(std::uint64_t file_size) const noexcept;
+        Partial *create_partial(Partial &&np) noexcept;
+        bool finish_if_complete(Partial &p, std::string &done_path) noexcept;
+        void prefill_loop();
+        void prefill(std::uint64_t xfer_id) noexcept;
+        void cache_put(const Sha256Digest &hash, const std::uint8_t *data, std::size_t len) noexcept;
+        void cache_trim(std::uint64_t incoming) noexcept;
+
+        std::string dir_;
+        std::unordered_map<std::uint64_t, Partial> open_;
+        std::uint64_t cache_cap_;
+        std::uint64_t cache_bytes_{0};      // size of <dir>/.chunks, counted on first use
+        bool cache_counted_{false};
+        XferReadyFn on_ready_;
+        std::mutex mu_;
+        std::deque<std::uint64_t> prefill_queue_; // guarded by mu_
+        std::condition_variable prefill_cv_;
+        bool stop_{false};
+        std::thread prefill_thr_;           // started with the first MANIFEST
+    };
+}
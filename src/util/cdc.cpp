@@ -0,0 +1,86 @@
+#include "cdc.hpp"
+#include "hash.hpp"
+#include <array>
+#include <fstream>
+using namespace std;
+
+namespace linkchat
+{
+    static constexpr array<uint64_t, 256> make_gear_table() noexcept
+    {
+        // splitmix64, fixed seed: both ends must cut at the same places
+        array<uint64_t, 256> t{};
+        uint64_t x = 0x9e3779b97f4a7c15ull;
+        for(size_t i = 0; i < t.size(); i++)
+        {
+            x += 0x9e3779b97f4a7c15ull;
+            uint64_t z = x;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            t[i] = z ^ (z >> 31);
+        }
+        return t;
+    }
+
+    static constexpr array<uint64_t, 256> kGear = make_gear_table();
+    // 16 high bits set: a cut every ~64 KiB past the minimum size
+    static constexpr uint64_t kCdcMask = 0xffff000000000000ull;
+
+    // the gear hash looks for cuts byte by byte; the bytes between cuts are hashed a run at a time
+    void CdcChunker::feed(const uint8_t *data, size_t n, vector<CdcChunk> &out)
+    {
+        size_t run = 0;
+        for(size_t i = 0; i < n; i++)
+        {
+            gear_ = (gear_ << 1) + kGear[data[i]];
+            len_++;
+
+            bool cut = (len_ >= kCdcMinSize && (gear_ & kCdcMask) == 0) || len_ >= kCdcMaxSize;
+            if(!cut)
+                continue;
+
+            hash_.update(data + run, i + 1 - run);
+            run = i + 1;
+            out.push_back({offset_, len_, hash_.digest()});
+            offset_ += len_;
+            len_ = 0;
+            gear_ = 0;
+            hash_.reset();
+        }
+        hash_.update(data + run, n - run);
+    }
+
+    void CdcChunker::finish(vector<CdcChunk> &out)
+    {
+        if(len_ == 0)
+            return;
+        out.push_back({offset_, len_, hash_.digest()});
+        offset_ += len_;
+        len_ = 0;
+        gear_ = 0;
+        hash_.reset();
+    }
+
+    bool cdc_chunk_file(const string &path, vector<CdcChunk> &out) noexcept
+    {
+        ifstream f(path, ios::binary);
+        if(!f)
+            return false;
+
+        out.clear();
+        CdcChunker chunker;
+        vector<uint8_t> buf(1u << 20);
+        while(f)
+        {
+            f.read(reinterpret_cast<char *>(buf.data()), buf.size());
+            streamsize got = f.gcount();
+            if(got <= 0)
+                break;
+            chunker.feed(buf.data(), static_cast<size_t>(got), out);
+        }
+        if(f.bad())
+            return false;
+        chunker.finish(out);
+        return true;
+    }
+}
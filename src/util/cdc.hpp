@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "hash.hpp"
+
+namespace linkchat
+{
+    // Gear-hash content-defined chunking: cut points depend on the bytes around them,
+    // so an edit only changes the chunks it touches and the rest keep their hashes.
+    inline constexpr std::uint32_t kCdcMinSize = 16u * 1024;
+    inline constexpr std::uint32_t kCdcAvgSize = 64u * 1024;
+    inline constexpr std::uint32_t kCdcMaxSize = 256u * 1024;
+
+    struct CdcChunk
+    {
+        std::uint64_t offset;
+        std::uint32_t len;
+        Sha256Digest hash;  // of the chunk bytes: two chunks with the same hash are taken to be the same
+    };
+
+    class CdcChunker
+    {
+    public:
+        // feeds bytes and appends every chunk completed by them
+        void feed(const std::uint8_t *data, std::size_t n, std::vector<CdcChunk> &out);
+        // flushes the trailing partial chunk
+        void finish(std::vector<CdcChunk> &out);
+
+    private:
+        std::uint64_t gear_{0};
+        Sha256State hash_;
+        std::uint64_t offset_{0};
+        std::uint32_t len_{0};
+    };
+
+    bool cdc_chunk_file(const std::string &path, std::vector<CdcChunk> &out) noexcept;
+}
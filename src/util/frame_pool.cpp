@@ -0,0 +1,277 @@
+#include "frame_pool.hpp"
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <new>
+using namespace std;
+
+namespace linkchat
+{
+    static constexpr size_t kClasses = sizeof(kFrameClassBytes) / sizeof(kFrameClassBytes[0]);
+    static constexpr uint8_t kUnpooled = 0xFF;
+    static constexpr size_t kCacheMax = 256;                 // frames per class kept by one thread
+    static constexpr size_t kSharedIdleBytes = size_t(64) << 20; // idle bytes per class kept process-wide
+
+    struct FrameRef::Block
+    {
+        atomic<uint32_t> refs;
+        uint32_t len;
+        uint8_t cls;
+        Block *next;
+
+        uint8_t *bytes() noexcept { return reinterpret_cast<uint8_t *>(this + 1); }
+    };
+    using Block = FrameRef::Block;
+
+    struct SharedList
+    {
+        mutex mu;
+        Block *head = nullptr;
+        size_t count = 0;
+    };
+
+    // never destroyed: frames may be released by static destructors after main returns
+    static SharedList *shared_lists()
+    {
+        static SharedList *lists = new SharedList[kClasses];
+        return lists;
+    }
+
+    static atomic<uint64_t> g_heap_allocs{0};
+    static atomic<uint64_t> g_heap_frees{0};
+    static atomic<uint64_t> g_reused{0};
+
+    static void free_block(Block *b) noexcept
+    {
+        b->~Block();
+        ::operator delete(b);
+        g_heap_frees.fetch_add(1, memory_order_relaxed);
+    }
+
+    // hands a chain of up to n blocks back to the shared list, freeing what it has no room for
+    static void give_back(size_t cls, Block *chain, size_t n) noexcept
+    {
+        SharedList &sl = shared_lists()[cls];
+        const size_t max_idle = kSharedIdleBytes / kFrameClassBytes[cls];
+        Block *excess = nullptr;
+        {
+            lock_guard<mutex> lk(sl.mu);
+            while(chain != nullptr && n > 0)
+            {
+                Block *b = chain;
+                chain = b->next;
+                n--;
+                if(sl.count < max_idle)
+                {
+                    b->next = sl.head;
+                    sl.head = b;
+                    sl.count++;
+                }
+                else
+                {
+                    b->next = excess;
+                    excess = b;
+                }
+            }
+        }
+        while(excess != nullptr)
+        {
+            Block *b = excess;
+            excess = b->next;
+            free_block(b);
+        }
+    }
+
+    struct ThreadCache
+    {
+        Block *head[kClasses]{};
+        size_t count[kClasses]{};
+
+        ~ThreadCache();
+    };
+
+    static thread_local ThreadCache t_cache;
+    static thread_local bool t_cache_alive = true;
+
+    ThreadCache::~ThreadCache()
+    {
+        t_cache_alive = false;
+        for(size_t cls = 0; cls < kClasses; cls++)
+            give_back(cls, head[cls], count[cls]);
+    }
+
+    static Block *acquire(size_t len) noexcept
+    {
+        size_t cls = 0;
+        while(cls < kClasses && kFrameClassBytes[cls] < len)
+            cls++;
+
+        if(cls < kClasses && t_cache_alive)
+        {
+            ThreadCache &tc = t_cache;
+            if(tc.head[cls] == nullptr)
+            {
+                // refill half a cache in one lock round trip
+                SharedList &sl = shared_lists()[cls];
+                lock_guard<mutex> lk(sl.mu);
+                for(size_t n = 0; n < kCacheMax / 2 && sl.head != nullptr; n++)
+                {
+                    Block *b = sl.head;
+                    sl.head = b->next;
+                    sl.count--;
+                    b->next = tc.head[cls];
+                    tc.head[cls] = b;
+                    tc.count[cls]++;
+                }
+            }
+            if(tc.head[cls] != nullptr)
+            {
+                Block *b = tc.head[cls];
+                tc.head[cls] = b->next;
+                tc.count[cls]--;
+                b->refs.store(1, memory_order_relaxed);
+                b->len = static_cast<uint32_t>(len);
+                g_reused.fetch_add(1, memory_order_relaxed);
+                return b;
+            }
+        }
+
+        const size_t cap = cls < kClasses ? kFrameClassBytes[cls] : len;
+        void *mem = ::operator new(sizeof(Block) + cap, nothrow);
+        if(mem == nullptr)
+            return nullptr;
+        Block *b = new (mem) Block{};
+        b->refs.store(1, memory_order_relaxed);
+        b->len = static_cast<uint32_t>(len);
+        b->cls = cls < kClasses ? static_cast<uint8_t>(cls) : kUnpooled;
+        b->next = nullptr;
+        g_heap_allocs.fetch_add(1, memory_order_relaxed);
+        return b;
+    }
+
+    static void recycle(Block *b) noexcept
+    {
+        if(b->cls == kUnpooled)
+        {
+            free_block(b);
+            return;
+        }
+        if(!t_cache_alive)
+        {
+            b->next = nullptr;
+            give_back(b->cls, b, 1);
+            return;
+        }
+
+        ThreadCache &tc = t_cache;
+        b->next = tc.head[b->cls];
+        tc.head[b->cls] = b;
+        if(++tc.count[b->cls] <= kCacheMax)
+            return;
+
+        // frames freed on another thread than the one that took them (ACKed on the RX
+        // thread, sent from the tick thread) drift back through the shared list
+        Block *chain = tc.head[b->cls];
+        const size_t n = kCacheMax / 2;
+        Block *last = chain;
+        for(size_t i = 1; i < n; i++)
+            last = last->next;
+        tc.head[b->cls] = last->next;
+        tc.count[b->cls] -= n;
+        last->next = nullptr;
+        give_back(b->cls, chain, n);
+    }
+
+    FramePoolStats frame_pool_stats() noexcept
+    {
+        FramePoolStats st{};
+        st.heap_allocs = g_heap_allocs.load(memory_order_relaxed);
+        st.heap_frees = g_heap_frees.load(memory_order_relaxed);
+        st.reused = g_reused.load(memory_order_relaxed);
+        return st;
+    }
+
+    FrameRef FrameRef::make(size_t len) noexcept
+    {
+        if(len == 0 || len > UINT32_MAX)
+            return FrameRef{};
+        return FrameRef(acquire(len));
+    }
+
+    FrameRef FrameRef::copy_of(const uint8_t *data, size_t len) noexcept
+    {
+        if(data == nullptr)
+            return FrameRef{};
+        FrameRef f = make(len);
+        if(!f.empty())
+            memcpy(f.data(), data, len);
+        return f;
+    }
+
+    FrameRef::FrameRef(const FrameRef &o) noexcept : b_(o.b_)
+    {
+        if(b_ != nullptr)
+            b_->refs.fetch_add(1, memory_order_relaxed);
+    }
+
+    FrameRef::FrameRef(FrameRef &&o) noexcept : b_(o.b_)
+    {
+        o.b_ = nullptr;
+    }
+
+    FrameRef &FrameRef::operator=(const FrameRef &o) noexcept
+    {
+        if(this != &o)
+        {
+            if(o.b_ != nullptr)
+                o.b_->refs.fetch_add(1, memory_order_relaxed);
+            reset();
+            b_ = o.b_;
+        }
+        return *this;
+    }
+
+    FrameRef &FrameRef::operator=(FrameRef &&o) noexcept
+    {
+        if(this != &o)
+        {
+            reset();
+            b_ = o.b_;
+            o.b_ = nullptr;
+        }
+        return *this;
+    }
+
+    FrameRef::~FrameRef()
+    {
+        reset();
+    }
+
+    void FrameRef::reset() noexcept
+    {
+        if(b_ != nullptr && b_->refs.fetch_sub(1, memory_order_acq_rel) == 1)
+            recycle(b_);
+        b_ = nullptr;
+    }
+
+    uint8_t *FrameRef::data() noexcept
+    {
+        return b_ == nullptr ? nullptr : b_->bytes();
+    }
+
+    const uint8_t *FrameRef::data() const noexcept
+    {
+        return b_ == nullptr ? nullptr : b_->bytes();
+    }
+
+    size_t FrameRef::size() const noexcept
+    {
+        return b_ == nullptr ? 0 : b_->len;
+    }
+
+    void FrameRef::shrink(size_t len) noexcept
+    {
+        if(b_ != nullptr && len < b_->len)
+            b_->len = static_cast<uint32_t>(len);
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+namespace linkchat
+{
+    // Frames come in fixed size classes; anything bigger than the largest class is a plain
+    // heap block. Freed frames go to a per-thread cache first and spill to a shared free
+    // list, so a steady transfer recycles the same buffers instead of hitting the allocator.
+    inline constexpr std::size_t kFrameClassBytes[] = {256, 2048, 9216};
+
+    struct FramePoolStats
+    {
+        std::uint64_t heap_allocs;  // blocks taken from the allocator
+        std::uint64_t heap_frees;   // blocks given back to it
+        std::uint64_t reused;       // frames served from a free list
+    };
+
+    FramePoolStats frame_pool_stats() noexcept;
+
+    // Refcounted handle to one frame buffer. Copies share the buffer; the last one
+    // to go returns it to the pool. The bytes are not synchronized: fill before sharing.
+    class FrameRef
+    {
+    public:
+        FrameRef() noexcept = default;
+
+        // uninitialized buffer of len bytes, empty handle if it cannot be allocated
+        static FrameRef make(std::size_t len) noexcept;
+        static FrameRef copy_of(const std::uint8_t *data, std::size_t len) noexcept;
+
+        FrameRef(const FrameRef &o) noexcept;
+        FrameRef(FrameRef &&o) noexcept;
+        FrameRef &operator=(const FrameRef &o) noexcept;
+        FrameRef &operator=(FrameRef &&o) noexcept;
+        ~FrameRef();
+
+        std::uint8_t *data() noexcept;
+        const std::uint8_t *data() const noexcept;
+        std::size_t size() const noexcept;
+        bool empty() const noexcept { return size() == 0; }
+
+        const std::uint8_t *begin() const noexcept { return data(); }
+        const std::uint8_t *end() const noexcept { return data() + size(); }
+
+        // drops trailing bytes, never grows
+        void shrink(std::size_t len) noexcept;
+
+        struct Block;
+
+    private:
+        explicit FrameRef(Block *b) noexcept : b_(b) {}
+        void reset() noexcept;
+
+        Block *b_{nullptr};
+    };
+}
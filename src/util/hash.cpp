@@ -0,0 +1,295 @@
+#include "hash.hpp"
+#include <cstring>
+#include <algorithm>
+using namespace std;
+
+namespace linkchat
+{
+    uint64_t fnv1a64(const uint8_t *data, size_t len, uint64_t seed) noexcept
+    {
+        const uint64_t prime = 0x100000001b3ull;
+        uint64_t h = seed;
+        for(size_t i = 0; i < len; i++)
+        {
+            h ^= data[i];
+            h *= prime;
+        }
+        return h;
+    }
+
+    static constexpr uint64_t kP1 = 0x9E3779B185EBCA87ull;
+    static constexpr uint64_t kP2 = 0xC2B2AE3D27D4EB4Full;
+    static constexpr uint64_t kP3 = 0x165667B19E3779F9ull;
+    static constexpr uint64_t kP4 = 0x85EBCA77C2B2AE63ull;
+    static constexpr uint64_t kP5 = 0x27D4EB2F165667C5ull;
+
+    static inline uint64_t rotl64(uint64_t x, int r) noexcept
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    // xxHash is defined over little-endian words
+    static inline uint64_t read64(const uint8_t *p) noexcept
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        v = __builtin_bswap64(v);
+#endif
+        return v;
+    }
+
+    static inline uint32_t read32(const uint8_t *p) noexcept
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        v = __builtin_bswap32(v);
+#endif
+        return v;
+    }
+
+    static inline uint64_t round64(uint64_t acc, uint64_t input) noexcept
+    {
+        acc += input * kP2;
+        acc = rotl64(acc, 31);
+        return acc * kP1;
+    }
+
+    static inline uint64_t merge64(uint64_t acc, uint64_t lane) noexcept
+    {
+        acc ^= round64(0, lane);
+        return acc * kP1 + kP4;
+    }
+
+    static inline void stripe(uint64_t v[4], const uint8_t *p) noexcept
+    {
+        v[0] = round64(v[0], read64(p));
+        v[1] = round64(v[1], read64(p + 8));
+        v[2] = round64(v[2], read64(p + 16));
+        v[3] = round64(v[3], read64(p + 24));
+    }
+
+    static inline uint64_t converge(const uint64_t v[4]) noexcept
+    {
+        uint64_t h = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + rotl64(v[3], 18);
+        h = merge64(h, v[0]);
+        h = merge64(h, v[1]);
+        h = merge64(h, v[2]);
+        h = merge64(h, v[3]);
+        return h;
+    }
+
+    static inline void init_lanes(uint64_t v[4], uint64_t seed) noexcept
+    {
+        v[0] = seed + kP1 + kP2;
+        v[1] = seed + kP2;
+        v[2] = seed;
+        v[3] = seed - kP1;
+    }
+
+    // the last (< 32) bytes and the avalanche
+    static uint64_t finish(uint64_t h, const uint8_t *p, const uint8_t *end) noexcept
+    {
+        for(; p + 8 <= end; p += 8)
+        {
+            h ^= round64(0, read64(p));
+            h = rotl64(h, 27) * kP1 + kP4;
+        }
+        if(p + 4 <= end)
+        {
+            h ^= static_cast<uint64_t>(read32(p)) * kP1;
+            h = rotl64(h, 23) * kP2 + kP3;
+            p += 4;
+        }
+        for(; p < end; p++)
+        {
+            h ^= static_cast<uint64_t>(*p) * kP5;
+            h = rotl64(h, 11) * kP1;
+        }
+
+        h ^= h >> 33;
+        h *= kP2;
+        h ^= h >> 29;
+        h *= kP3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    uint64_t xxh64(const uint8_t *data, size_t len, uint64_t seed) noexcept
+    {
+        const uint8_t *p = data;
+        const uint8_t *const end = data + len;
+        uint64_t h;
+
+        if(len >= 32)
+        {
+            uint64_t v[4];
+            init_lanes(v, seed);
+            const uint8_t *const limit = end - 32;
+            do
+            {
+                stripe(v, p);
+                p += 32;
+            } while(p <= limit);
+            h = converge(v);
+        }
+        else
+            h = seed + kP5;
+
+        h += static_cast<uint64_t>(len);
+        return finish(h, p, end);
+    }
+
+    void Xxh64State::reset(uint64_t seed) noexcept
+    {
+        init_lanes(v_, seed);
+        seed_ = seed;
+        total_ = 0;
+        buffered_ = 0;
+    }
+
+    void Xxh64State::update(const uint8_t *data, size_t len) noexcept
+    {
+        total_ += len;
+        if(buffered_ > 0)
+        {
+            const size_t take = min(len, sizeof(buf_) - buffered_);
+            memcpy(buf_ + buffered_, data, take);
+            buffered_ += take;
+            data += take;
+            len -= take;
+            if(buffered_ < sizeof(buf_))
+                return;
+            stripe(v_, buf_);
+            buffered_ = 0;
+        }
+        for(; len >= 32; data += 32, len -= 32)
+            stripe(v_, data);
+        if(len > 0)
+        {
+            memcpy(buf_, data, len);
+            buffered_ = len;
+        }
+    }
+
+    uint64_t Xxh64State::digest() const noexcept
+    {
+        uint64_t h = total_ >= 32 ? converge(v_) : seed_ + kP5;
+        h += total_;
+        return finish(h, buf_, buf_ + buffered_);
+    }
+
+    static constexpr uint32_t kSha256K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+    static inline uint32_t rotr32(uint32_t x, int r) noexcept
+    {
+        return (x >> r) | (x << (32 - r));
+    }
+
+    // SHA-256 is defined over big-endian words
+    static void sha256_block(uint32_t h[8], const uint8_t *p) noexcept
+    {
+        uint32_t w[64];
+        for(int i = 0; i < 16; i++)
+            w[i] = (uint32_t(p[4 * i]) << 24) | (uint32_t(p[4 * i + 1]) << 16) | (uint32_t(p[4 * i + 2]) << 8) | p[4 * i + 3];
+        for(int i = 16; i < 64; i++)
+        {
+            const uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+        for(int i = 0; i < 64; i++)
+        {
+            const uint32_t t1 = k + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) + ((e & f) ^ (~e & g)) + kSha256K[i] + w[i];
+            const uint32_t t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            k = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+        h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+    }
+
+    void Sha256State::reset() noexcept
+    {
+        static constexpr uint32_t kInit[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                              0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        memcpy(h_, kInit, sizeof(h_));
+        total_ = 0;
+        buffered_ = 0;
+    }
+
+    void Sha256State::update(const uint8_t *data, size_t len) noexcept
+    {
+        total_ += len;
+        if(buffered_ > 0)
+        {
+            const size_t take = min(len, sizeof(buf_) - buffered_);
+            memcpy(buf_ + buffered_, data, take);
+            buffered_ += take;
+            data += take;
+            len -= take;
+            if(buffered_ < sizeof(buf_))
+                return;
+            sha256_block(h_, buf_);
+            buffered_ = 0;
+        }
+        for(; len >= 64; data += 64, len -= 64)
+            sha256_block(h_, data);
+        if(len > 0)
+        {
+            memcpy(buf_, data, len);
+            buffered_ = len;
+        }
+    }
+
+    Sha256Digest Sha256State::digest() const noexcept
+    {
+        // padding: 0x80, zeros, then the length in bits (64-bit BE) closing the last block
+        uint32_t h[8];
+        memcpy(h, h_, sizeof(h));
+        uint8_t tail[128] = {};
+        memcpy(tail, buf_, buffered_);
+        tail[buffered_] = 0x80;
+        const size_t n = buffered_ + 9 <= 64 ? 64 : 128;
+        const uint64_t bits = total_ * 8;
+        for(int i = 0; i < 8; i++)
+            tail[n - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+        sha256_block(h, tail);
+        if(n == 128)
+            sha256_block(h, tail + 64);
+
+        Sha256Digest out;
+        for(int i = 0; i < 8; i++)
+        {
+            out[4 * i] = static_cast<uint8_t>(h[i] >> 24);
+            out[4 * i + 1] = static_cast<uint8_t>(h[i] >> 16);
+            out[4 * i + 2] = static_cast<uint8_t>(h[i] >> 8);
+            out[4 * i + 3] = static_cast<uint8_t>(h[i]);
+        }
+        return out;
+    }
+
+    Sha256Digest sha256(const uint8_t *data, size_t len) noexcept
+    {
+        Sha256State st;
+        st.update(data, len);
+        return st.digest();
+    }
+}
@@ -13,23 +13,10 @@ namespace linkchat
 
     bool uint8_to_type(uint8_t t, Type &out) noexcept
     {
-        switch (t)
-        {
-        case 1:
-            out = Type::MSG;
-            return true;
-        case 2:
-            out = Type::FILE;
-            return true;
-        case 3:
-            out = Type::ACK;
-            return true;
-        case 4:
-            out = Type::HELLO;
-            return true;
-        default:
+        if (!WireEnum<Type>::valid(t))
             return false;
-        }
+        out = static_cast<Type>(t);
+        return true;
     }
 
     void uint16_to_BE(uint16_t val, uint8_t *buf, int index = 0) noexcept
@@ -46,6 +33,12 @@ namespace linkchat
         buf[index + 3] = (val);
     }
 
+    void uint64_to_BE(uint64_t val, uint8_t *buf, int index = 0) noexcept
+    {
+        uint32_to_BE(static_cast<uint32_t>(val >> 32), buf, index);
+        uint32_to_BE(static_cast<uint32_t>(val), buf, index + 4);
+    }
+
     uint32_t BE_to_uint32(const uint8_t *buf, int index = 0) noexcept
     {
         return (static_cast<uint32_t>(buf[index]) << 24) |
@@ -54,6 +47,12 @@ namespace linkchat
                (static_cast<uint32_t>(buf[index + 3]));
     }
 
+    uint64_t BE_to_uint64(const uint8_t *buf, int index = 0) noexcept
+    {
+        return (static_cast<uint64_t>(BE_to_uint32(buf, index)) << 32) |
+               static_cast<uint64_t>(BE_to_uint32(buf, index + 4));
+    }
+
     uint16_t BE_to_uint16(const uint8_t *buf, int index = 0) noexcept
     {
         return (static_cast<uint16_t>(buf[index]) << 8) |
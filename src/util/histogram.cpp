@@ -0,0 +1,84 @@
+#include "histogram.hpp"
+#include <algorithm>
+using namespace std;
+
+namespace linkchat
+{
+    static constexpr size_t kSubBits = LatencyHistogram::kSubBits;
+    static constexpr size_t kSub = size_t(1) << kSubBits;
+    static constexpr size_t kLinear = kSub * 2; // values below this get a bucket each
+
+    static size_t bucket_of(uint64_t v) noexcept
+    {
+        if(v < kLinear)
+            return static_cast<size_t>(v);
+        const size_t e = 63 - static_cast<size_t>(__builtin_clzll(v));
+        const size_t sub = static_cast<size_t>(v >> (e - kSubBits)) & (kSub - 1);
+        return kLinear + (e - (kSubBits + 1)) * kSub + sub;
+    }
+
+    static uint64_t bucket_top(size_t idx) noexcept
+    {
+        if(idx < kLinear)
+            return idx;
+        const size_t e = (idx - kLinear) / kSub + kSubBits + 1;
+        const size_t sub = (idx - kLinear) % kSub;
+        const uint64_t lower = static_cast<uint64_t>(kSub + sub) << (e - kSubBits);
+        return lower + (uint64_t(1) << (e - kSubBits)) - 1;
+    }
+
+    void LatencyHistogram::record(uint64_t v) noexcept
+    {
+        buckets_[bucket_of(v)].fetch_add(1, memory_order_relaxed);
+        uint64_t seen = max_.load(memory_order_relaxed);
+        while(v > seen && !max_.compare_exchange_weak(seen, v, memory_order_relaxed))
+        {
+        }
+    }
+
+    void LatencyHistogram::reset() noexcept
+    {
+        for(auto &b : buckets_)
+            b.store(0, memory_order_relaxed);
+        max_.store(0, memory_order_relaxed);
+    }
+
+    uint64_t LatencyHistogram::count() const noexcept
+    {
+        uint64_t n = 0;
+        for(const auto &b : buckets_)
+            n += b.load(memory_order_relaxed);
+        return n;
+    }
+
+    uint64_t LatencyHistogram::percentile(double p) const noexcept
+    {
+        const uint64_t n = count();
+        if(n == 0)
+            return 0;
+        p = min(100.0, max(0.0, p));
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(n) + 0.5);
+        rank = max<uint64_t>(rank, 1);
+
+        uint64_t seen = 0;
+        for(size_t i = 0; i < kBuckets; i++)
+        {
+            seen += buckets_[i].load(memory_order_relaxed);
+            if(seen >= rank)
+                return min(bucket_top(i), max_.load(memory_order_relaxed));
+        }
+        return max_.load(memory_order_relaxed);
+    }
+
+    LatencyPercentiles LatencyHistogram::summary() const noexcept
+    {
+        LatencyPercentiles out{};
+        out.count = count();
+        out.p50 = percentile(50.0);
+        out.p90 = percentile(90.0);
+        out.p99 = percentile(99.0);
+        out.p999 = percentile(99.9);
+        out.max = max_.load(memory_order_relaxed);
+        return out;
+    }
+}
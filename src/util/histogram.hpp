@@ -0,0 +1,38 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace linkchat
+{
+    struct LatencyPercentiles
+    {
+        std::uint64_t count;
+        std::uint64_t p50;
+        std::uint64_t p90;
+        std::uint64_t p99;
+        std::uint64_t p999;
+        std::uint64_t max;
+    };
+
+    // Log-linear histogram: 8 sub-buckets per power of two, so any value is off by at most
+    // 12.5%. Recording is a relaxed atomic increment, safe from one thread while another reads.
+    class LatencyHistogram
+    {
+    public:
+        void record(std::uint64_t v) noexcept;
+        void reset() noexcept;
+
+        std::uint64_t count() const noexcept;
+        // upper bound of the bucket holding the p-th percentile (p in 0..100)
+        std::uint64_t percentile(double p) const noexcept;
+        LatencyPercentiles summary() const noexcept;
+
+        static constexpr std::size_t kSubBits = 3;
+        static constexpr std::size_t kBuckets = (64 - kSubBits) * (std::size_t(1) << kSubBits) + (std::size_t(1) << (kSubBits + 1));
+
+    private:
+        std::atomic<std::uint64_t> buckets_[kBuckets]{};
+        std::atomic<std::uint64_t> max_{0};
+    };
+}
@@ -21,6 +21,14 @@ namespace linkchat
         return !operator==(a, b);
     }
 
+    uint64_t mac_to_u64(const Mac &mac) noexcept
+    {
+        uint64_t key = 0;
+        for (size_t i = 0; i < kMacSize; i++)
+            key = (key << 8) | mac.bytes[i];
+        return key;
+    }
+
     bool is_hexVal(char c) noexcept
     {
         set<char> hexVal;
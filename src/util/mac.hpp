@@ -18,6 +18,9 @@ namespace linkchat {
 
     bool is_zero(const Mac& mac) noexcept;
 
+    // 48-bit MAC as an integer key for maps
+    std::uint64_t mac_to_u64(const Mac& mac) noexcept;
+
     bool parse_mac(const std::string& text, Mac& out) noexcept;
 
     std::string mac_to_string(const Mac& mac) noexcept;
@@ -7,10 +7,12 @@ enum class Type : std::uint8_t {
     MSG   = 1,
     FILE  = 2,
     ACK   = 3,
-    HELLO = 4
+    HELLO = 4,
+    REPAIR = 5,
+    XFER  = 6,
+    NAK   = 7,
+    ECHO  = 8,
+    REJECT = 9
 };
 
-enum class Off 
-    { T=0, MID=1, SEQ=5, TOT=9, LEN=13 };
-
 }
@@ -0,0 +1,151 @@
+#include "task_pool.hpp"
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+namespace linkchat
+{
+    // queue of the worker running on this thread, SIZE_MAX elsewhere
+    static thread_local size_t t_worker_queue = SIZE_MAX;
+    static thread_local const void *t_worker_pool = nullptr;
+
+    TaskPool::TaskPool(unsigned workers)
+    {
+        const size_t nq = max(1u, workers);
+        for (size_t i = 0; i < nq; i++)
+            queues_.push_back(make_unique<Queue>());
+        for (unsigned i = 0; i < workers; i++)
+            threads_.emplace_back([this, i]
+                                  { worker(i); });
+    }
+
+    TaskPool::~TaskPool()
+    {
+        help_until([this]
+                   { return queued_.load() == 0; });
+        {
+            lock_guard<mutex> lk(mu_);
+            stopping_ = true;
+        }
+        cv_work_.notify_all();
+        for (auto &t : threads_)
+            t.join();
+    }
+
+    void TaskPool::submit(TaskGroup &group, function<void()> fn)
+    {
+        group.pending_.fetch_add(1);
+        // a worker feeds its own deque; anyone else spreads tasks round-robin
+        const size_t q = (t_worker_pool == this) ? t_worker_queue : next_queue_.fetch_add(1) % queues_.size();
+        {
+            lock_guard<mutex> lk(queues_[q]->mu);
+            queues_[q]->tasks.push_back(Task{move(fn), &group});
+        }
+        queued_.fetch_add(1);
+        {
+            // a worker checks queued_ under mu_ before it sleeps, so it cannot miss this one
+            lock_guard<mutex> lk(mu_);
+        }
+        cv_work_.notify_one();
+    }
+
+    // takes one task, from home first, and runs it; false when every deque is empty
+    bool TaskPool::try_run(size_t home, bool newest_first) noexcept
+    {
+        const size_t nq = queues_.size();
+        for (size_t k = 0; k < nq; k++)
+        {
+            Queue &q = *queues_[(home + k) % nq];
+            Task task;
+            {
+                lock_guard<mutex> lk(q.mu);
+                if (q.tasks.empty())
+                    continue;
+                // own work LIFO while it is cache-warm, stolen work FIFO
+                if (k == 0 && newest_first)
+                {
+                    task = move(q.tasks.back());
+                    q.tasks.pop_back();
+                }
+                else
+                {
+                    task = move(q.tasks.front());
+                    q.tasks.pop_front();
+                }
+            }
+            queued_.fetch_sub(1);
+            task.fn();
+            task.group->pending_.fetch_sub(1, memory_order_acq_rel);
+            {
+                // waiters may be watching something the task set, not just its group
+                lock_guard<mutex> lk(mu_);
+            }
+            cv_done_.notify_all();
+            return true;
+        }
+        return false;
+    }
+
+    void TaskPool::worker(size_t index) noexcept
+    {
+        t_worker_queue = index;
+        t_worker_pool = this;
+        for (;;)
+        {
+            if (try_run(index, true))
+                continue;
+            unique_lock<mutex> lk(mu_);
+            cv_work_.wait(lk, [this]
+                          { return stopping_ || queued_.load() > 0; });
+            if (stopping_ && queued_.load() == 0)
+                return;
+        }
+    }
+
+    void TaskPool::help_until(const function<bool()> &done)
+    {
+        const size_t home = (t_worker_pool == this) ? t_worker_queue : 0;
+        while (!done())
+        {
+            if (try_run(home, false))
+                continue;
+            // what is left is running on workers; they wake us as each task finishes
+            unique_lock<mutex> lk(mu_);
+            cv_done_.wait_for(lk, chrono::milliseconds(1), [&]
+                              { return queued_.load() > 0 || done(); });
+        }
+    }
+
+    void TaskPool::wait(TaskGroup &group)
+    {
+        help_until([&group]
+                   { return group.done(); });
+    }
+
+    void TaskPool::parallel_for(size_t n, size_t grain, const function<void(size_t, size_t)> &fn)
+    {
+        if (n == 0)
+            return;
+        grain = max<size_t>(1, grain);
+        if (threads_.empty() || n <= grain)
+        {
+            fn(0, n);
+            return;
+        }
+        TaskGroup group;
+        for (size_t begin = 0; begin < n; begin += grain)
+        {
+            const size_t end = min(n, begin + grain);
+            submit(group, [&fn, begin, end]
+                   { fn(begin, end); });
+        }
+        wait(group);
+    }
+
+    TaskPool &shared_pool()
+    {
+        static TaskPool pool(max(1u, thread::hardware_concurrency()) - 1);
+        return pool;
+    }
+}
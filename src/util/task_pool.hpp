@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace linkchat
+{
+    // Tasks submitted together; wait() returns once every one of them has run.
+    class TaskGroup
+    {
+    public:
+        TaskGroup() = default;
+        TaskGroup(const TaskGroup &) = delete;
+        TaskGroup &operator=(const TaskGroup &) = delete;
+
+        bool done() const noexcept { return pending_.load(std::memory_order_acquire) == 0; }
+
+    private:
+        friend class TaskPool;
+        std::atomic<std::size_t> pending_{0};
+    };
+
+    // Fixed set of workers, each with its own deque. A worker runs its newest task and, when
+    // it runs dry, steals the oldest one from another worker. Threads that wait on a group run
+    // queued tasks (oldest first) instead of sleeping, so a pool with no workers still makes
+    // progress: everything then runs on the waiting thread, in submission order.
+    class TaskPool
+    {
+    public:
+        explicit TaskPool(unsigned workers);
+        ~TaskPool(); // runs what is still queued, then stops
+        TaskPool(const TaskPool &) = delete;
+        TaskPool &operator=(const TaskPool &) = delete;
+
+        unsigned workers() const noexcept { return static_cast<unsigned>(threads_.size()); }
+
+        void submit(TaskGroup &group, std::function<void()> fn);
+
+        // runs queued tasks on the calling thread until done() says so
+        void help_until(const std::function<bool()> &done);
+        void wait(TaskGroup &group);
+
+        // fn(begin, end) over [0, n) in slices of grain items, the calling thread included
+        void parallel_for(std::size_t n, std::size_t grain, const std::function<void(std::size_t, std::size_t)> &fn);
+
+    private:
+        struct Task
+        {
+            std::function<void()> fn;
+            TaskGroup *group;
+        };
+
+        struct Queue
+        {
+            std::mutex mu;
+            std::deque<Task> tasks;
+        };
+
+        bool try_run(std::size_t home, bool newest_first) noexcept;
+        void worker(std::size_t index) noexcept;
+
+        std::vector<std::unique_ptr<Queue>> queues_; // one per worker, at least one
+        std::vector<std::thread> threads_;
+        std::atomic<std::size_t> queued_{0};
+        std::atomic<std::size_t> next_queue_{0};
+        std::mutex mu_;                   // sleeping workers and waiters
+        std::condition_variable cv_work_;
+        std::condition_variable cv_done_;
+        bool stopping_{false};
+    };
+
+    // process-wide pool with one worker per core besides the caller's, created on first use
+    TaskPool &shared_pool();
+}
@@ -1,5 +1,6 @@
 #include "time.hpp"
 #include <chrono>
+#include <ctime>
 using namespace std;
 
 namespace linkchat {
@@ -9,4 +10,33 @@ namespace linkchat {
         auto now_ms = chrono::duration_cast<chrono::milliseconds>(now.time_since_epoch());
         return static_cast<uint64_t>(now_ms.count());
     }
+
+    uint64_t steady_micros() noexcept
+    {
+        auto now = chrono::steady_clock::now();
+        auto now_us = chrono::duration_cast<chrono::microseconds>(now.time_since_epoch());
+        return static_cast<uint64_t>(now_us.count());
+    }
+
+    uint64_t steady_nanos() noexcept
+    {
+        auto now = chrono::steady_clock::now();
+        auto now_ns = chrono::duration_cast<chrono::nanoseconds>(now.time_since_epoch());
+        return static_cast<uint64_t>(now_ns.count());
+    }
+
+    uint64_t realtime_nanos() noexcept
+    {
+        auto now = chrono::system_clock::now();
+        auto now_ns = chrono::duration_cast<chrono::nanoseconds>(now.time_since_epoch());
+        return static_cast<uint64_t>(now_ns.count());
+    }
+
+    uint64_t process_cpu_nanos() noexcept
+    {
+        timespec ts{};
+        if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0)
+            return 0;
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+    }
 }
@@ -3,4 +3,10 @@
 
 namespace linkchat {
     std::uint64_t steady_millis() noexcept;
+    std::uint64_t steady_micros() noexcept;
+    std::uint64_t steady_nanos() noexcept;
+    // CLOCK_REALTIME, the clock kernel software timestamps are taken on
+    std::uint64_t realtime_nanos() noexcept;
+    // CPU time of the whole process (every thread, user + system)
+    std::uint64_t process_cpu_nanos() noexcept;
 }
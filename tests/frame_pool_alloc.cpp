@@ -0,0 +1,184 @@
+// Steady-state frames must not touch the heap: the data frames of a message are built,
+// parsed, reassembled and ACKed (the ACK built and parsed again) while every operator new
+// in the process is counted. Only the start and the end of a message may allocate. The same
+// holds on the sending side, where each ACK carries a receive window and lets more frames out.
+#include "pdu.hpp"
+#include "reassembly.hpp"
+#include "sender.hpp"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+using namespace std;
+using namespace linkchat;
+
+static atomic<uint64_t> g_allocs{0};
+
+void *operator new(size_t n)
+{
+    g_allocs.fetch_add(1, memory_order_relaxed);
+    if (void *p = malloc(n ? n : 1))
+        return p;
+    throw bad_alloc();
+}
+
+void *operator new(size_t n, const nothrow_t &) noexcept
+{
+    g_allocs.fetch_add(1, memory_order_relaxed);
+    return malloc(n ? n : 1);
+}
+
+void *operator new[](size_t n) { return operator new(n); }
+void *operator new[](size_t n, const nothrow_t &t) noexcept { return operator new(n, t); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, const nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, const nothrow_t &) noexcept { free(p); }
+
+static constexpr uint16_t kMtu = 1500;
+static constexpr uint32_t kFrames = 2000;
+
+// one message, frame by frame; returns the allocations made by frames 1 .. total-2
+static uint64_t run_message(Reassembly &rx, uint32_t msg_id, const vector<uint8_t> &data,
+                            vector<FrameRef> &frames, vector<uint8_t> &out, uint64_t &acks)
+{
+    const uint32_t total = chunk_count(data.size(), kMtu);
+    if (total != kFrames || !chunk_range(data.data(), data.size(), msg_id, Type::MSG, kMtu, 0, 1, frames.data()))
+        return UINT64_MAX;
+    rx.feed_pdu(PduView::parse(frames[0].data(), frames[0].size()));
+    frames[0] = FrameRef{};
+
+    const uint64_t before = g_allocs.load();
+    for (uint32_t seq = 1; seq + 1 < total; seq++)
+    {
+        if (!chunk_range(data.data(), data.size(), msg_id, Type::MSG, kMtu, seq, seq + 1, frames.data()))
+            return UINT64_MAX;
+        const RxChunkEvent ev = rx.feed_pdu(PduView::parse(frames[seq].data(), frames[seq].size()));
+        if (!ev.accepted)
+            return UINT64_MAX;
+        frames[seq] = FrameRef{};
+    }
+    const uint64_t during = g_allocs.load() - before;
+
+    if (!chunk_range(data.data(), data.size(), msg_id, Type::MSG, kMtu, total - 1, total, frames.data()))
+        return UINT64_MAX;
+    rx.feed_pdu(PduView::parse(frames[total - 1].data(), frames[total - 1].size()));
+    frames[total - 1] = FrameRef{};
+    if (!rx.extract_message(msg_id, out) || out != data || acks < total)
+        return UINT64_MAX;
+    acks = 0;
+    return during;
+}
+
+// one message through a Sender, ACKed frame by frame with a window; returns the allocations
+// made while ACKing frames 1 .. total-2, or UINT64_MAX if it did not all go out and finish
+static uint64_t run_sender(Sender &tx, const vector<uint8_t> &data, uint64_t &emitted)
+{
+    static constexpr uint64_t kPeer = 0x0200000000b1ull;
+    const uint32_t total = chunk_count(data.size(), kMtu);
+    SendOptions opt;
+    opt.dst = kPeer;
+    emitted = 0;
+    const uint32_t msg_id = tx.send(data, Type::FILE, opt);
+    if (msg_id == 0)
+        return UINT64_MAX;
+
+    // the peer's side of every ACK: built into a pooled frame, parsed back, handed to the sender
+    auto ack = [&tx, msg_id](uint32_t seq)
+    {
+        FrameRef f = create_ack(AckFields{msg_id, seq, 64u * kMtu});
+        AckFields back{};
+        if (!try_parse_ack(PduView::parse(f.data(), f.size()), back))
+            return false;
+        tx.on_ack(back, kPeer);
+        tx.pace_wait_us();
+        return true;
+    };
+    if (!ack(0))
+        return UINT64_MAX;
+
+    const uint64_t before = g_allocs.load();
+    for (uint32_t seq = 1; seq + 1 < total; seq++)
+    {
+        if (!ack(seq))
+            return UINT64_MAX;
+    }
+    const uint64_t during = g_allocs.load() - before;
+
+    if (!ack(total - 1) || !tx.is_done(msg_id) || emitted != total)
+        return UINT64_MAX;
+    return during;
+}
+
+int main()
+{
+    vector<uint8_t> data(static_cast<size_t>(kFrames) * mtu_payload(kMtu));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<uint8_t>(i * 131 + 7);
+
+    uint64_t acks = 0;
+    // the sender's side of every ACK: built into a pooled frame, parsed back
+    Reassembly rx([&acks](const AckFields &ack)
+                  {
+                      FrameRef f = create_ack(ack);
+                      AckFields back{};
+                      if (try_parse_ack(PduView::parse(f.data(), f.size()), back) && back.msg_id == ack.msg_id)
+                          acks++;
+                  });
+
+    vector<FrameRef> frames(kFrames);
+    vector<uint8_t> out;
+    out.reserve(data.size());
+
+    // the first message fills the pool; the ones after it must only reuse frames
+    if (run_message(rx, 1, data, frames, out, acks) == UINT64_MAX)
+    {
+        fprintf(stderr, "warm-up message was not delivered\n");
+        return 1;
+    }
+    for (uint32_t msg_id = 2; msg_id < 6; msg_id++)
+    {
+        const uint64_t allocs = run_message(rx, msg_id, data, frames, out, acks);
+        if (allocs == UINT64_MAX)
+        {
+            fprintf(stderr, "message %u was not delivered\n", msg_id);
+            return 1;
+        }
+        if (allocs != 0)
+        {
+            fprintf(stderr, "message %u: %llu heap allocations over %u frames\n", msg_id,
+                    static_cast<unsigned long long>(allocs), kFrames - 2);
+            return 1;
+        }
+    }
+
+    // the frames go nowhere; a fake clock keeps the pacer out of the way
+    uint64_t emitted = 0, clock_us = 0;
+    SenderConfig cfg;
+    cfg.mtu = kMtu;
+    cfg.window = 64;
+    cfg.now = [] { return uint64_t{0}; };
+    cfg.now_us = [&clock_us] { return clock_us += 1000; };
+    Sender tx([&emitted](const FrameRef &, FrameNote) { emitted++; }, cfg);
+    for (uint32_t n = 0; n < 5; n++)
+    {
+        const uint64_t allocs = run_sender(tx, data, emitted);
+        if (allocs == UINT64_MAX)
+        {
+            fprintf(stderr, "sent message %u did not finish\n", n);
+            return 1;
+        }
+        // the first ACK with a window makes the receiver's entry
+        if (n > 0 && allocs != 0)
+        {
+            fprintf(stderr, "sent message %u: %llu heap allocations over %u ACKs\n", n,
+                    static_cast<unsigned long long>(allocs), kFrames - 2);
+            return 1;
+        }
+    }
+    printf("%u frames per message, no heap allocations in steady state\n", kFrames);
+    return 0;
+}
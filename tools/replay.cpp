@@ -0,0 +1,400 @@
+// linkchat_replay: feeds the LinkChat frames of a pcap/pcapng capture to LinkchatApp::on_rx_pdu,
+// as fast as possible or at the recorded pace, and reports throughput and where the receive
+// path spent its time. No sockets, no privileges.
+#include "app.hpp"  // LinkchatApp, RxStageStats
+#include "mac.hpp"  // Mac, parse_mac
+#include "time.hpp" // steady_nanos
+#include "transport.hpp" // kEthHdr
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace linkchat;
+
+namespace
+{
+    constexpr uint32_t kPcapMagicUs = 0xA1B2C3D4u;
+    constexpr uint32_t kPcapMagicNs = 0xA1B23C4Du;
+    constexpr uint32_t kPcapngShb = 0x0A0D0D0Au;
+    constexpr uint32_t kPcapngIdb = 1;
+    constexpr uint32_t kPcapngSpb = 3;
+    constexpr uint32_t kPcapngEpb = 6;
+    constexpr uint32_t kPcapngByteOrder = 0x1A2B3C4Du;
+    constexpr uint16_t kLinkEthernet = 1;
+    constexpr uint16_t kVlanTpid = 0x8100;
+
+    struct Options
+    {
+        string path;
+        double speed = 0;          // 0 = as fast as possible, 1 = recorded pace, 2 = twice as fast...
+        bool filter_src = false;
+        Mac src{};
+        uint16_t ethertype = 0x88B5;
+        unsigned delivery_workers = 0; // 0: on_deliver runs inline and counts as the delivery stage
+        bool trust_fcs = false;
+    };
+
+    struct Frame
+    {
+        uint64_t ts_ns;   // 0 when the capture has no timestamp for it
+        Mac src;
+        size_t off;       // PDU (Ethernet header stripped) in Capture::bytes
+        size_t len;
+    };
+
+    struct Capture
+    {
+        vector<uint8_t> bytes;
+        vector<Frame> frames;
+        uint64_t other = 0;     // another link type or EtherType
+        uint64_t truncated = 0; // cut by the capture's snaplen
+        uint64_t outbound = 0;  // pcapng frames flagged as sent by the capturing host
+        uint64_t foreign = 0;   // not from the --src station
+    };
+
+    // the capture file, read with the byte order its header announces
+    class Reader
+    {
+    public:
+        explicit Reader(const vector<uint8_t> &buf) : b_(buf) {}
+        bool has(size_t off, size_t n) const noexcept { return off <= b_.size() && n <= b_.size() - off; }
+        uint16_t u16(size_t off) const noexcept
+        {
+            uint16_t v;
+            memcpy(&v, b_.data() + off, 2);
+            return swap_ ? __builtin_bswap16(v) : v;
+        }
+        uint32_t u32(size_t off) const noexcept
+        {
+            uint32_t v;
+            memcpy(&v, b_.data() + off, 4);
+            return swap_ ? __builtin_bswap32(v) : v;
+        }
+        void set_swapped(bool s) noexcept { swap_ = s; }
+        const uint8_t *at(size_t off) const noexcept { return b_.data() + off; }
+        size_t size() const noexcept { return b_.size(); }
+
+    private:
+        const vector<uint8_t> &b_;
+        bool swap_{false};
+    };
+
+    // pcapng timestamp to nanoseconds; if_tsresol is a power of 10 (or of 2 with the top bit set)
+    uint64_t ts_ns(uint64_t ts, uint8_t tsresol) noexcept
+    {
+        const bool pow2 = (tsresol & 0x80) != 0;
+        const unsigned e = tsresol & 0x7F;
+        if (!pow2 && e <= 9)
+        {
+            uint64_t mul = 1;
+            for (unsigned i = e; i < 9; i++)
+                mul *= 10;
+            return ts * mul;
+        }
+        long double units = 1;
+        for (unsigned i = 0; i < e; i++)
+            units *= pow2 ? 2 : 10;
+        return static_cast<uint64_t>(static_cast<long double>(ts) * 1e9L / units);
+    }
+
+    // keeps an Ethernet frame if it carries our EtherType (optionally behind one VLAN tag)
+    void add_frame(Capture &cap, const Options &opt, uint16_t linktype, uint64_t ts,
+                   const uint8_t *data, size_t caplen, size_t origlen)
+    {
+        if (linktype != kLinkEthernet || caplen < kEthHdr)
+        {
+            cap.other++;
+            return;
+        }
+        size_t hdr = kEthHdr;
+        uint16_t type = static_cast<uint16_t>(data[12] << 8 | data[13]);
+        if (type == kVlanTpid && caplen >= kEthHdr + 4)
+        {
+            type = static_cast<uint16_t>(data[16] << 8 | data[17]);
+            hdr += 4;
+        }
+        if (type != opt.ethertype)
+        {
+            cap.other++;
+            return;
+        }
+        if (caplen < origlen)
+        {
+            cap.truncated++;
+            return;
+        }
+        Frame f{};
+        memcpy(f.src.bytes, data + kMacSize, kMacSize);
+        if (opt.filter_src && f.src != opt.src)
+        {
+            cap.foreign++;
+            return;
+        }
+        f.ts_ns = ts;
+        f.off = cap.bytes.size();
+        f.len = caplen - hdr;
+        cap.bytes.insert(cap.bytes.end(), data + hdr, data + caplen);
+        cap.frames.push_back(f);
+    }
+
+    bool load_pcap(Reader &r, Capture &cap, const Options &opt, bool nanos)
+    {
+        if (!r.has(0, 24))
+            return false;
+        const uint16_t linktype = static_cast<uint16_t>(r.u32(20));
+        size_t off = 24;
+        while (r.has(off, 16))
+        {
+            const uint64_t sec = r.u32(off), frac = r.u32(off + 4);
+            const size_t caplen = r.u32(off + 8), origlen = r.u32(off + 12);
+            off += 16;
+            if (!r.has(off, caplen))
+                return false;
+            add_frame(cap, opt, linktype, sec * 1000000000ull + (nanos ? frac : frac * 1000), r.at(off), caplen, origlen);
+            off += caplen;
+        }
+        return true;
+    }
+
+    bool load_pcapng(Reader &r, Capture &cap, const Options &opt)
+    {
+        struct Iface
+        {
+            uint16_t linktype;
+            uint8_t tsresol;
+        };
+        vector<Iface> ifaces;
+        size_t off = 0;
+        while (r.has(off, 12))
+        {
+            // the section header decides the byte order of everything up to the next one
+            if (r.u32(off) == kPcapngShb)
+            {
+                r.set_swapped(false);
+                r.set_swapped(r.u32(off + 8) != kPcapngByteOrder);
+                ifaces.clear();
+            }
+            const uint32_t type = r.u32(off);
+            const size_t len = r.u32(off + 4);
+            if (len < 12 || len % 4 != 0 || !r.has(off, len))
+                return false;
+
+            if (type == kPcapngIdb && len >= 20)
+            {
+                Iface ifc{r.u16(off + 8), 6};
+                for (size_t o = off + 16; o + 4 <= off + len - 4;)
+                {
+                    const uint16_t code = r.u16(o), olen = r.u16(o + 2);
+                    if (code == 0)
+                        break;
+                    if (code == 9 && olen >= 1)
+                        ifc.tsresol = *r.at(o + 4);
+                    o += 4 + ((olen + 3u) & ~3u);
+                }
+                ifaces.push_back(ifc);
+            }
+            else if (type == kPcapngEpb && len >= 32)
+            {
+                const uint32_t id = r.u32(off + 8);
+                const uint64_t ts = uint64_t(r.u32(off + 12)) << 32 | r.u32(off + 16);
+                const size_t caplen = r.u32(off + 20), origlen = r.u32(off + 24);
+                if (id >= ifaces.size() || 28 + caplen > len - 4)
+                    return false;
+                bool outbound = false;
+                for (size_t o = off + 28 + ((caplen + 3) & ~size_t(3)); o + 4 <= off + len - 4;)
+                {
+                    const uint16_t code = r.u16(o), olen = r.u16(o + 2);
+                    if (code == 0)
+                        break;
+                    if (code == 2 && olen == 4) // epb_flags: bits 0-1 are the direction
+                        outbound = (r.u32(o + 4) & 3u) == 2u;
+                    o += 4 + ((olen + 3u) & ~3u);
+                }
+                if (outbound)
+                    cap.outbound++;
+                else
+                    add_frame(cap, opt, ifaces[id].linktype, ts_ns(ts, ifaces[id].tsresol), r.at(off + 28), caplen, origlen);
+            }
+            else if (type == kPcapngSpb && len >= 16 && !ifaces.empty())
+            {
+                const size_t origlen = r.u32(off + 8);
+                add_frame(cap, opt, ifaces[0].linktype, 0, r.at(off + 12), min(origlen, len - 16), origlen);
+            }
+            off += len;
+        }
+        return true;
+    }
+
+    bool load_capture(const Options &opt, Capture &cap, vector<uint8_t> &file)
+    {
+        ifstream f(opt.path, ios::binary);
+        if (!f)
+            return false;
+        file.assign(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+        Reader r(file);
+        if (!r.has(0, 4))
+            return false;
+
+        const uint32_t magic = r.u32(0);
+        if (magic == kPcapngShb)
+            return load_pcapng(r, cap, opt);
+        if (magic == kPcapMagicUs || magic == kPcapMagicNs)
+            return load_pcap(r, cap, opt, magic == kPcapMagicNs);
+        r.set_swapped(true);
+        if (r.u32(0) == kPcapMagicUs || r.u32(0) == kPcapMagicNs)
+            return load_pcap(r, cap, opt, r.u32(0) == kPcapMagicNs);
+        return false;
+    }
+
+    void usage()
+    {
+        cerr << "usage: linkchat_replay [options] <capture.pcap|.pcapng>\n"
+                "  --speed F            replay pace: 0 = as fast as possible (default), 1 = as recorded\n"
+                "  --realtime           same as --speed 1\n"
+                "  --src MAC            only frames sent by this station\n"
+                "  --ethertype 0xNNNN   EtherType to pick out (default 0x88B5)\n"
+                "  --delivery-workers N on_deliver threads (default 0: inline, timed as delivery)\n"
+                "  --trust-fcs          skip frame CRCs of digest messages, like a receiver with fcs-trust\n";
+    }
+
+    bool parse_args(int argc, char **argv, Options &opt)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const string a = argv[i];
+            const bool more = i + 1 < argc;
+            if (a == "--speed" && more)
+                opt.speed = atof(argv[++i]);
+            else if (a == "--realtime")
+                opt.speed = 1;
+            else if (a == "--src" && more)
+            {
+                if (!parse_mac(argv[++i], opt.src))
+                    return false;
+                opt.filter_src = true;
+            }
+            else if (a == "--ethertype" && more)
+                opt.ethertype = static_cast<uint16_t>(strtoul(argv[++i], nullptr, 0));
+            else if (a == "--delivery-workers" && more)
+                opt.delivery_workers = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+            else if (a == "--trust-fcs")
+                opt.trust_fcs = true;
+            else if (!a.empty() && a[0] != '-' && opt.path.empty())
+                opt.path = a;
+            else
+                return false;
+        }
+        return !opt.path.empty() && opt.speed >= 0;
+    }
+
+    void print_stage(const char *name, uint64_t ns, const RxStageStats &st)
+    {
+        const uint64_t total = st.parse_ns + st.crc_ns + st.reassembly_ns + st.delivery_ns;
+        printf("  %-11s %10.1f ns/frame  %5.1f%%\n", name,
+               st.frames ? double(ns) / double(st.frames) : 0.0,
+               total ? 100.0 * double(ns) / double(total) : 0.0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    if (!parse_args(argc, argv, opt))
+    {
+        usage();
+        return 2;
+    }
+
+    Capture cap;
+    {
+        vector<uint8_t> file;
+        if (!load_capture(opt, cap, file))
+        {
+            cerr << "cannot read " << opt.path << " as pcap or pcapng\n";
+            return 1;
+        }
+    }
+    printf("%s: %zu LinkChat frames, %zu bytes of PDUs\n", opt.path.c_str(), cap.frames.size(), cap.bytes.size());
+    printf("  skipped: other=%llu truncated=%llu outbound=%llu other-src=%llu\n",
+           (unsigned long long)cap.other, (unsigned long long)cap.truncated,
+           (unsigned long long)cap.outbound, (unsigned long long)cap.foreign);
+    if (cap.truncated > 0)
+        printf("  (truncated frames need a capture taken without a snaplen limit)\n");
+    if (cap.frames.empty())
+        return 1;
+
+    DeliveryConfig dcfg;
+    dcfg.workers = opt.delivery_workers;
+    LinkchatApp app(SenderConfig{}, McastConfig{}, dcfg);
+    atomic<uint64_t> msgs{0}, msg_bytes{0};
+    uint64_t acks = 0, group_frames = 0;
+    app.set_emit_pdu([&](const FrameRef &)
+                     { acks++; });
+    app.set_emit_group_pdu([&](const FrameRef &)
+                           { group_frames++; });
+    app.set_on_deliver([&](uint32_t, Type, const vector<uint8_t> &data, const Mac &)
+                       {
+        msgs.fetch_add(1, memory_order_relaxed);
+        msg_bytes.fetch_add(data.size(), memory_order_relaxed); });
+    app.set_trust_fcs(opt.trust_fcs);
+    app.set_rx_profiling(true);
+
+    const uint64_t start = steady_nanos();
+    const uint64_t ts0 = cap.frames.front().ts_ns;
+    for (const Frame &f : cap.frames)
+    {
+        if (opt.speed > 0 && f.ts_ns >= ts0)
+        {
+            // the recorded gap, scaled; timers (NAKs, expiry) run while waiting as they would live
+            const uint64_t due = start + static_cast<uint64_t>(double(f.ts_ns - ts0) / opt.speed);
+            while (steady_nanos() < due)
+            {
+                app.tick();
+                const uint64_t now = steady_nanos();
+                if (now < due)
+                    this_thread::sleep_for(chrono::nanoseconds(min<uint64_t>(due - now, 1000000)));
+            }
+        }
+        app.on_rx_pdu(f.src, cap.bytes.data() + f.off, f.len);
+    }
+    app.flush_deliveries();
+    const uint64_t wall_ns = max<uint64_t>(steady_nanos() - start, 1);
+
+    const double secs = double(wall_ns) / 1e9;
+    printf("replayed %zu frames in %.3f s (%s): %.0f frames/s, %.1f MB/s\n",
+           cap.frames.size(), secs, opt.speed > 0 ? "paced" : "as fast as possible",
+           double(cap.frames.size()) / secs, double(cap.bytes.size()) / secs / 1e6);
+    printf("  delivered %llu messages, %llu bytes; %llu ACKs and %llu group frames emitted\n",
+           (unsigned long long)msgs.load(), (unsigned long long)msg_bytes.load(),
+           (unsigned long long)acks, (unsigned long long)group_frames);
+
+    const RxStageStats st = app.rx_stage_stats();
+    printf("receive path, %llu frames:\n", (unsigned long long)st.frames);
+    print_stage("parse", st.parse_ns, st);
+    print_stage("crc", st.crc_ns, st);
+    print_stage("reassembly", st.reassembly_ns, st);
+    print_stage("delivery", st.delivery_ns, st);
+
+    const LatencyPercentiles lat = app.latency().summary(LatencyMetric::Delivery);
+    if (lat.count > 0)
+        printf("first frame -> delivery (%llu msgs): p50=%llu p90=%llu p99=%llu p99.9=%llu max=%llu us\n",
+               (unsigned long long)lat.count, (unsigned long long)lat.p50, (unsigned long long)lat.p90,
+               (unsigned long long)lat.p99, (unsigned long long)lat.p999, (unsigned long long)lat.max);
+
+    const AppStats as = app.stats();
+    printf("reassembly: held=%zu msgs/%zu bytes rejected=%llu digest mismatches=%llu evicted idle=%llu pressure=%llu\n",
+           as.rx.msgs_held, as.rx.bytes_held, (unsigned long long)as.rx.rejected,
+           (unsigned long long)as.rx.digest_failed, (unsigned long long)as.rx.evicted_idle,
+           (unsigned long long)as.rx.evicted_pressure);
+    return 0;
+}